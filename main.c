@@ -10,18 +10,51 @@
 #endif
 
 #include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
 #define NAME_MAX_LEN 20
 
+// Built with -DPZDC_BENCH_ALLOC (make bench), every heap allocation made by this
+// file is counted so --bench-compose can report allocations per screen.
+// Allocations inside libyaml, SDL and libc are not seen. The counter is atomic
+// because the loader and simulation worker threads allocate too.
+#ifdef PZDC_BENCH_ALLOC
+static SDL_atomic_t bench_alloc_count;
+
+static void *bench_malloc(size_t n) {
+  SDL_AtomicAdd(&bench_alloc_count, 1);
+  return malloc(n);
+}
+
+static void *bench_calloc(size_t n, size_t size) {
+  SDL_AtomicAdd(&bench_alloc_count, 1);
+  return calloc(n, size);
+}
+
+static void *bench_realloc(void *p, size_t n) {
+  SDL_AtomicAdd(&bench_alloc_count, 1);
+  return realloc(p, n);
+}
+
+#define malloc(n) bench_malloc(n)
+#define calloc(n, size) bench_calloc(n, size)
+#define realloc(p, n) bench_realloc(p, n)
+#endif
+
 typedef struct {
   uint32_t codepoint;
   float u0, v0, u1, v1;
@@ -37,14 +70,30 @@ typedef struct {
   Line *lines;
   size_t line_count;
   size_t max_cols;
+  bool mapped; // line text and cells point into the view bundle
 } View;
 
+typedef enum {
+  METHOD_LOOKUP,
+  METHOD_ROUND
+} MethodOpType;
+
+typedef struct {
+  MethodOpType type;
+  uint32_t key_id;
+} MethodOp;
+
 typedef struct {
   int line_idx;
   char placeholder;
   char modifier;
   char **methods;
   size_t method_count;
+  // Bound by menu_bind_inserts once per cached template.
+  int col; // placeholder run in the line's cells; -1 if none
+  int width;
+  MethodOp *ops;
+  size_t op_count;
 } InsertOption;
 
 typedef struct {
@@ -64,6 +113,8 @@ typedef struct {
   size_t art_count;
   PartialSlot *partials;
   size_t partial_count;
+  bool inserts_shared; // copies borrow the cached template's inserts
+  bool mapped;         // method and partial names point into the view bundle
 } Menu;
 
 typedef struct {
@@ -74,16 +125,26 @@ typedef struct {
 typedef struct {
   Art *arts;
   size_t art_count;
+  bool mapped; // art names point into the view bundle
 } ArtFile;
 
 typedef struct {
-  char *key;
+  const char *key;
+  uint32_t key_id;
   char *value;
+  int int_value;
+  bool is_int;
 } KV;
 
+typedef struct ValueChunk ValueChunk;
+
 typedef struct {
   KV *items;
   size_t count;
+  size_t cap;
+  uint32_t *by_id; // key id -> item index + 1
+  size_t by_id_cap;
+  ValueChunk *chunks;
 } ValueMap;
 
 typedef struct {
@@ -91,14 +152,37 @@ typedef struct {
   char *path;
 } ArtArg;
 
+typedef struct {
+  float x, y;
+  float u, v;
+  uint8_t r, g, b, a;
+} QuadVertex;
+
 typedef struct {
   GLuint tex;
   Glyph *glyphs;
   size_t glyph_count;
-  uint32_t *glyph_list;
-  size_t glyph_list_count;
+  size_t glyph_cap;
+  uint32_t *glyph_slots;
+  size_t glyph_slot_cap;
+  uint8_t *pixels;
+  int atlas_cols;
+  int atlas_rows;
+  int atlas_max_rows;         // rows that fit in GL_MAX_TEXTURE_SIZE
+  uint32_t atlas_generation;  // bumped when a full atlas is emptied
+  bool atlas_overflow_logged;
+  TTF_Font *font;
+  int cell_w;
+  int cell_h;
   int grid_w;
   int grid_h;
+  QuadVertex *verts; // one quad per grid cell, row-major
+  size_t quad_count;
+  size_t quad_cap;
+  GLuint vbo;
+  size_t vbo_quads;
+  QuadVertex *overlay_verts;
+  size_t overlay_cap;
 } RenderState;
 
 typedef struct {
@@ -114,9 +198,11 @@ typedef enum {
 } NodeType;
 
 typedef struct Node Node;
+typedef struct NodeArena NodeArena;
 
 struct Node {
   NodeType type;
+  NodeArena *arena;
   char *scalar;
   Node **seq;
   size_t seq_len;
@@ -175,6 +261,24 @@ typedef struct {
   char enhance_name[64];
 } ShieldItem;
 
+typedef struct {
+  uint64_t s[4];
+  uint64_t draws;
+} Rng;
+
+// Independent random streams, so that e.g. browsing the shop never changes the next
+// fight. RNG_RUN covers hero creation, level-ups and which enemies show up.
+typedef enum {
+  RNG_RUN,
+  RNG_COMBAT,
+  RNG_LOOT,
+  RNG_EVENTS,
+  RNG_SHOP,
+  RNG_STREAMS
+} RngStream;
+
+static const char *const rng_stream_names[RNG_STREAMS] = {"run", "combat", "loot", "events", "shop"};
+
 typedef enum {
   SKILL_ACTIVE,
   SKILL_PASSIVE,
@@ -247,6 +351,16 @@ typedef struct {
   size_t enemy_count;
 } DungeonData;
 
+// Stats with equipment and skills applied; see character_stats.
+typedef struct {
+  int min_dmg;
+  int max_dmg;
+  int accuracy;
+  int armor;
+  int armor_penetration;
+  int block_chance;
+} CharacterStats;
+
 typedef struct {
   char code[32];
   char name[64];
@@ -284,6 +398,12 @@ typedef struct {
   Skill passive_skill;
   Skill camp_skill;
   ValueMap ingredients;
+  // Anything that changes a base stat, an equipped item or the passive skill
+  // calls character_touch. stats_gen is gen + 1 while stats is current, so a
+  // freshly zeroed Character starts stale.
+  uint32_t gen;
+  uint32_t stats_gen;
+  CharacterStats stats;
 } Character;
 
 typedef struct {
@@ -434,9 +554,39 @@ typedef enum {
   STATE_MESSAGE
 } GameState;
 
+// Outcome of one fight under the sim_run policy (active skill whenever affordable,
+// otherwise the base attack), see battle_odds.
+typedef struct {
+  double win;
+  double loss;
+  double open;    // still fighting at the round cap or the cutoff; win + open bounds win
+  double hp_lost; // per finished fight, a death counting as the whole starting HP
+  double rounds;  // per finished fight
+} BattleOdds;
+
+// Everything battle_round reads from the two fighters.
+typedef struct {
+  int hero[16];
+  int enemy[9];
+  int base_attack;
+  char active[32];
+  char passive[32];
+} BattleOddsKey;
+
+#define BATTLE_ODDS_CACHE 64
+
+typedef struct {
+  BattleOddsKey keys[BATTLE_ODDS_CACHE];
+  BattleOdds odds[BATTLE_ODDS_CACHE];
+  int count;
+  int next;
+} BattleOddsCache;
+
 typedef struct {
   GameState state;
   GameState next_state;
+  uint64_t seed;
+  Rng rng[RNG_STREAMS];
   char message_title[128];
   char message_art_name[32];
   char message_art_path[64];
@@ -528,9 +678,12 @@ typedef struct {
   GameState return_state;
   char ammo_show_type[16];
   char ammo_show_code[32];
+  BattleOddsCache odds;
 } Game;
 
-static int rand_range(int min, int max);
+static int rand_range(Rng *rng, int min, int max);
+static void game_seed(Game *g, uint64_t seed);
+static bool game_seek(Game *g, uint64_t seed, const Rng *saved, const bool *has_state);
 static void event_after_loot(Game *g);
 static void event_begin(Game *g, const EventDef *ev);
 static void event_handle_digit(Game *g, int digit);
@@ -625,7 +778,11 @@ static bool dir_exists(const char *path) {
   return S_ISDIR(st.st_mode);
 }
 
+// Set by --replay to a scratch copy of the saves a recording started from.
+static char saves_dir_override[512];
+
 static char *resolve_saves_dir(void) {
+  if (saves_dir_override[0]) return strdup_safe(saves_dir_override);
   const char *candidates[] = {
     "saves",
     "demo/pzdc_dungeon_2_gl/saves",
@@ -639,94 +796,32 @@ static char *resolve_saves_dir(void) {
   return NULL;
 }
 
-static char *resolve_data_path(const char *path) {
-  if (!path) return NULL;
-  if (file_exists(path)) return strdup_safe(path);
-  const char *candidates[] = { path, NULL, NULL, NULL, NULL, NULL, NULL };
-  char buf1[512];
-  char buf2[512];
-  char buf3[512];
-  char buf4[512];
-  char buf5[512];
-  char buf6[512];
-  snprintf(buf1, sizeof(buf1), "../%s", path);
-  snprintf(buf2, sizeof(buf2), "../../%s", path);
-  snprintf(buf3, sizeof(buf3), "../../../%s", path);
-  snprintf(buf4, sizeof(buf4), "demo/pzdc_dungeon_2_gl/%s", path);
-  snprintf(buf5, sizeof(buf5), "../demo/pzdc_dungeon_2_gl/%s", path);
-  snprintf(buf6, sizeof(buf6), "../../demo/pzdc_dungeon_2_gl/%s", path);
-  candidates[1] = buf1;
-  candidates[2] = buf2;
-  candidates[3] = buf3;
-  candidates[4] = buf4;
-  candidates[5] = buf5;
-  candidates[6] = buf6;
-  const char *found = find_existing_path(candidates, 7);
-  return found ? strdup_safe(found) : strdup_safe(path);
-}
-
-static char *resolve_menu_path(const char *path) {
-  if (!path) return NULL;
-  if (strstr(path, ".yml")) {
-    if (file_exists(path)) return strdup_safe(path);
-    const char *candidates[] = { path, NULL, NULL };
-    char buf1[512];
-    char buf2[512];
-    snprintf(buf1, sizeof(buf1), "../%s", path);
-    snprintf(buf2, sizeof(buf2), "../../%s", path);
-    candidates[1] = buf1;
-    candidates[2] = buf2;
-    const char *found = find_existing_path(candidates, 3);
-    return found ? strdup_safe(found) : strdup_safe(path);
+// The data/ root is probed once; later calls only concatenate. Loader
+// threads call resolve_data_path, so load_stage_start primes it first.
+static const char *data_root(void) {
+  static const char *root = NULL;
+  if (root) return root;
+  static const char *roots[] = {"", "../", "../../", "../../../", "demo/pzdc_dungeon_2_gl/",
+                                "../demo/pzdc_dungeon_2_gl/", "../../demo/pzdc_dungeon_2_gl/"};
+  for (size_t i = 0; i < sizeof(roots) / sizeof(roots[0]) && !root; ++i) {
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%sdata", roots[i]);
+    if (dir_exists(buf)) root = roots[i];
   }
-
-  char buf[512];
-  snprintf(buf, sizeof(buf), "views/menues/%s.yml", path);
-  if (file_exists(buf)) return strdup_safe(buf);
-  snprintf(buf, sizeof(buf), "demo/pzdc_dungeon_2_gl/views/menues/%s.yml", path);
-  if (file_exists(buf)) return strdup_safe(buf);
-  snprintf(buf, sizeof(buf), "../views/menues/%s.yml", path);
-  if (file_exists(buf)) return strdup_safe(buf);
-  snprintf(buf, sizeof(buf), "../demo/pzdc_dungeon_2_gl/views/menues/%s.yml", path);
-  if (file_exists(buf)) return strdup_safe(buf);
-  snprintf(buf, sizeof(buf), "../../views/menues/%s.yml", path);
-  if (file_exists(buf)) return strdup_safe(buf);
-  snprintf(buf, sizeof(buf), "../../demo/pzdc_dungeon_2_gl/views/menues/%s.yml", path);
-  if (file_exists(buf)) return strdup_safe(buf);
-  snprintf(buf, sizeof(buf), "views/menues/%s.yml", path);
-  return strdup_safe(buf);
+  if (!root) {
+    fprintf(stderr, "[pzdc_dungeon_2_gl] data/ not found\n");
+    root = "";
+  }
+  return root;
 }
 
-static char *resolve_art_path(const char *path) {
+static char *resolve_data_path(const char *path) {
   if (!path) return NULL;
-  if (strstr(path, ".yml")) {
-    if (file_exists(path)) return strdup_safe(path);
-    const char *candidates[] = { path, NULL, NULL };
-    char buf1[512];
-    char buf2[512];
-    snprintf(buf1, sizeof(buf1), "../%s", path);
-    snprintf(buf2, sizeof(buf2), "../../%s", path);
-    candidates[1] = buf1;
-    candidates[2] = buf2;
-    const char *found = find_existing_path(candidates, 3);
-    return found ? strdup_safe(found) : strdup_safe(path);
-  }
-
-  char buf[512];
-  snprintf(buf, sizeof(buf), "views/arts/%s.yml", path);
-  if (file_exists(buf)) return strdup_safe(buf);
-  snprintf(buf, sizeof(buf), "demo/pzdc_dungeon_2_gl/views/arts/%s.yml", path);
-  if (file_exists(buf)) return strdup_safe(buf);
-  snprintf(buf, sizeof(buf), "../views/arts/%s.yml", path);
-  if (file_exists(buf)) return strdup_safe(buf);
-  snprintf(buf, sizeof(buf), "../demo/pzdc_dungeon_2_gl/views/arts/%s.yml", path);
-  if (file_exists(buf)) return strdup_safe(buf);
-  snprintf(buf, sizeof(buf), "../../views/arts/%s.yml", path);
-  if (file_exists(buf)) return strdup_safe(buf);
-  snprintf(buf, sizeof(buf), "../../demo/pzdc_dungeon_2_gl/views/arts/%s.yml", path);
-  if (file_exists(buf)) return strdup_safe(buf);
-  snprintf(buf, sizeof(buf), "views/arts/%s.yml", path);
-  return strdup_safe(buf);
+  const char *root = data_root();
+  size_t n = strlen(root) + strlen(path) + 1;
+  char *out = (char *)malloc(n);
+  if (out) snprintf(out, n, "%s%s", root, path);
+  return out;
 }
 
 static size_t utf8_decode(const char *s, size_t len, size_t i, uint32_t *out) {
@@ -776,7 +871,7 @@ static size_t utf8_encode(uint32_t cp, char out[5]) {
 
 static void free_view(View *view) {
   if (!view) return;
-  for (size_t i = 0; i < view->line_count; ++i) {
+  for (size_t i = 0; i < view->line_count && !view->mapped; ++i) {
     free(view->lines[i].text);
     free(view->lines[i].cells);
   }
@@ -784,173 +879,409 @@ static void free_view(View *view) {
   view->lines = NULL;
   view->line_count = 0;
   view->max_cols = 0;
+  view->mapped = false;
 }
 
+// Decodes every line once into cells, then pads all lines to the widest.
 static void view_build_cells(View *view) {
   if (!view) return;
   size_t max_cols = 0;
   for (size_t i = 0; i < view->line_count; ++i) {
     Line *line = &view->lines[i];
     size_t len = strlen(line->text);
-    size_t count = 0;
+    free(line->cells);
+    line->cells = (uint32_t *)malloc((len > 0 ? len : 1) * sizeof(uint32_t));
+    line->len_cells = 0;
+    if (!line->cells) continue;
     for (size_t j = 0; j < len;) {
       uint32_t cp = 0;
-      size_t adv = utf8_decode(line->text, len, j, &cp);
-      (void)cp;
-      count++;
-      j += adv;
+      j += utf8_decode(line->text, len, j, &cp);
+      line->cells[line->len_cells++] = cp;
     }
-    if (count > max_cols) max_cols = count;
+    if (line->len_cells > max_cols) max_cols = line->len_cells;
   }
   view->max_cols = max_cols;
 
   for (size_t i = 0; i < view->line_count; ++i) {
     Line *line = &view->lines[i];
-    free(line->cells);
-    line->cells = (uint32_t *)malloc(max_cols * sizeof(uint32_t));
+    uint32_t *cells = (uint32_t *)realloc(line->cells, (max_cols > 0 ? max_cols : 1) * sizeof(uint32_t));
+    if (!cells) continue;
+    line->cells = cells;
+    for (size_t c = line->len_cells; c < max_cols; ++c) cells[c] = (uint32_t)' ';
     line->len_cells = max_cols;
-    for (size_t c = 0; c < max_cols; ++c) line->cells[c] = (uint32_t)' ';
-
-    size_t len = strlen(line->text);
-    size_t col = 0;
-    for (size_t j = 0; j < len && col < max_cols;) {
-      uint32_t cp = 0;
-      size_t adv = utf8_decode(line->text, len, j, &cp);
-      line->cells[col++] = cp;
-      j += adv;
-    }
   }
 }
 
+// Keys are interned once for the whole process and numbered densely from 1, so
+// a map finds a key by indexing with its id and a key costs no allocation
+// after its first use. Loader and simulation worker threads intern keys too
+// (ingredient names, loot), so every probe and insert holds key_intern.lock;
+// interned strings and ids never move, so they can be used after unlocking.
+typedef struct {
+  const char **keys;
+  uint32_t *hashes;
+  uint32_t *ids;
+  size_t count;
+  size_t cap;
+  char *block;
+  size_t block_used;
+  size_t block_cap;
+  SDL_SpinLock lock;
+} KeyIntern;
+
+static KeyIntern key_intern;
+
+struct ValueChunk {
+  ValueChunk *next;
+  size_t used;
+  size_t cap;
+  char data[];
+};
+
+static uint32_t hash_str(const char *s) {
+  uint32_t h = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)s; *p; ++p) {
+    h ^= *p;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static uint32_t key_hash(const char *s) {
+  uint32_t h = hash_str(s);
+  return h ? h : 1u;
+}
+
+static uint32_t key_intern_probe(const char *key, uint32_t hash, const char **out_key) {
+  if (key_intern.cap == 0) return 0;
+  size_t mask = key_intern.cap - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    if (!key_intern.keys[i]) return 0;
+    if (key_intern.hashes[i] == hash && strcmp(key_intern.keys[i], key) == 0) {
+      if (out_key) *out_key = key_intern.keys[i];
+      return key_intern.ids[i];
+    }
+  }
+}
+
+// Returns the key's id, or 0 if it was never interned.
+static uint32_t key_intern_find(const char *key, uint32_t hash, const char **out_key) {
+  SDL_AtomicLock(&key_intern.lock);
+  uint32_t id = key_intern_probe(key, hash, out_key);
+  SDL_AtomicUnlock(&key_intern.lock);
+  return id;
+}
+
+static uint32_t key_intern_insert(const char *key, uint32_t hash, const char **out_key) {
+  uint32_t found = key_intern_probe(key, hash, out_key);
+  if (found) return found;
+
+  if ((key_intern.count + 1) * 2 > key_intern.cap) {
+    size_t new_cap = key_intern.cap == 0 ? 512 : key_intern.cap * 2;
+    const char **keys = (const char **)calloc(new_cap, sizeof(char *));
+    uint32_t *hashes = (uint32_t *)calloc(new_cap, sizeof(uint32_t));
+    uint32_t *ids = (uint32_t *)calloc(new_cap, sizeof(uint32_t));
+    if (!keys || !hashes || !ids) {
+      free(keys);
+      free(hashes);
+      free(ids);
+      return 0;
+    }
+    for (size_t i = 0; i < key_intern.cap; ++i) {
+      if (!key_intern.keys[i]) continue;
+      size_t j = key_intern.hashes[i] & (new_cap - 1);
+      while (keys[j]) j = (j + 1) & (new_cap - 1);
+      keys[j] = key_intern.keys[i];
+      hashes[j] = key_intern.hashes[i];
+      ids[j] = key_intern.ids[i];
+    }
+    free(key_intern.keys);
+    free(key_intern.hashes);
+    free(key_intern.ids);
+    key_intern.keys = keys;
+    key_intern.hashes = hashes;
+    key_intern.ids = ids;
+    key_intern.cap = new_cap;
+  }
+
+  size_t n = strlen(key) + 1;
+  if (key_intern.block_used + n > key_intern.block_cap) {
+    size_t block_cap = n > 8192 ? n : 8192;
+    key_intern.block = (char *)malloc(block_cap);
+    if (!key_intern.block) return 0;
+    key_intern.block_used = 0;
+    key_intern.block_cap = block_cap;
+  }
+  char *copy = key_intern.block + key_intern.block_used;
+  memcpy(copy, key, n);
+  key_intern.block_used += n;
+
+  size_t mask = key_intern.cap - 1;
+  size_t i = hash & mask;
+  while (key_intern.keys[i]) i = (i + 1) & mask;
+  key_intern.keys[i] = copy;
+  key_intern.hashes[i] = hash;
+  key_intern.ids[i] = (uint32_t)++key_intern.count;
+  if (out_key) *out_key = copy;
+  return key_intern.ids[i];
+}
+
+static uint32_t key_intern_get(const char *key, const char **out_key) {
+  uint32_t hash = key_hash(key);
+  SDL_AtomicLock(&key_intern.lock);
+  uint32_t id = key_intern_insert(key, hash, out_key);
+  SDL_AtomicUnlock(&key_intern.lock);
+  return id;
+}
+
+static KV *value_map_find(const ValueMap *map, uint32_t key_id) {
+  if (!map || key_id >= map->by_id_cap) return NULL;
+  uint32_t slot = map->by_id[key_id];
+  return slot ? &map->items[slot - 1] : NULL;
+}
+
+static char *value_map_store(ValueMap *map, const char *value, size_t n) {
+  ValueChunk *c = map->chunks;
+  if (!c || c->used + n + 1 > c->cap) {
+    size_t cap = c ? c->cap * 2 : 4096;
+    if (cap < n + 1) cap = n + 1;
+    ValueChunk *chunk = (ValueChunk *)malloc(sizeof(ValueChunk) + cap);
+    if (!chunk) return NULL;
+    chunk->next = c;
+    chunk->used = 0;
+    chunk->cap = cap;
+    map->chunks = chunk;
+    c = chunk;
+  }
+  char *out = c->data + c->used;
+  memcpy(out, value, n);
+  out[n] = '\0';
+  c->used += n + 1;
+  return out;
+}
+
+static KV *value_map_slot(ValueMap *map, const char *key) {
+  const char *interned = NULL;
+  uint32_t id = key_intern_get(key, &interned);
+  if (!id) return NULL;
+  KV *kv = value_map_find(map, id);
+  if (kv) return kv;
+
+  if (id >= map->by_id_cap) {
+    size_t new_cap = map->by_id_cap == 0 ? 256 : map->by_id_cap;
+    while (new_cap <= id) new_cap *= 2;
+    uint32_t *by_id = (uint32_t *)realloc(map->by_id, new_cap * sizeof(uint32_t));
+    if (!by_id) return NULL;
+    memset(by_id + map->by_id_cap, 0, (new_cap - map->by_id_cap) * sizeof(uint32_t));
+    map->by_id = by_id;
+    map->by_id_cap = new_cap;
+  }
+  if (map->count + 1 > map->cap) {
+    size_t new_cap = map->cap == 0 ? 32 : map->cap * 2;
+    KV *items = (KV *)realloc(map->items, new_cap * sizeof(KV));
+    if (!items) return NULL;
+    map->items = items;
+    map->cap = new_cap;
+  }
+  kv = &map->items[map->count++];
+  memset(kv, 0, sizeof(*kv));
+  kv->key = interned;
+  kv->key_id = id;
+  map->by_id[id] = (uint32_t)map->count;
+  return kv;
+}
+
 static void value_map_clear(ValueMap *map) {
   if (!map) return;
-  for (size_t i = 0; i < map->count; ++i) {
-    free(map->items[i].key);
-    free(map->items[i].value);
+  for (size_t k = 0; k < map->count; ++k) map->by_id[map->items[k].key_id] = 0;
+  map->count = 0;
+  ValueChunk *c = map->chunks;
+  if (!c) return;
+  size_t total = 0;
+  for (ValueChunk *it = c; it; it = it->next) total += it->cap;
+  if (c->next) {
+    ValueChunk *it = c;
+    while (it) {
+      ValueChunk *next = it->next;
+      free(it);
+      it = next;
+    }
+    map->chunks = NULL;
+    c = (ValueChunk *)malloc(sizeof(ValueChunk) + total);
+    if (!c) return;
+    c->next = NULL;
+    c->cap = total;
+    map->chunks = c;
+  }
+  c->used = 0;
+}
+
+static void value_map_free(ValueMap *map) {
+  if (!map) return;
+  ValueChunk *c = map->chunks;
+  while (c) {
+    ValueChunk *next = c->next;
+    free(c);
+    c = next;
   }
   free(map->items);
-  map->items = NULL;
-  map->count = 0;
+  free(map->by_id);
+  memset(map, 0, sizeof(*map));
 }
 
 static void value_map_set(ValueMap *map, const char *key, const char *value) {
   if (!map || !key || !value) return;
-  for (size_t i = 0; i < map->count; ++i) {
-    if (strcmp(map->items[i].key, key) == 0) {
-      free(map->items[i].value);
-      map->items[i].value = strdup_safe(value);
-      return;
-    }
+  KV *kv = value_map_slot(map, key);
+  if (!kv) return;
+  size_t n = strlen(value);
+  if (kv->value && strlen(kv->value) >= n) {
+    memmove(kv->value, value, n + 1);
+  } else {
+    kv->value = value_map_store(map, value, n);
   }
-  KV *items = (KV *)realloc(map->items, (map->count + 1) * sizeof(KV));
-  if (!items) return;
-  map->items = items;
-  map->items[map->count].key = strdup_safe(key);
-  map->items[map->count].value = strdup_safe(value);
-  map->count++;
+  kv->is_int = false;
 }
 
 static void value_map_set_int(ValueMap *map, const char *key, int value) {
-  char buf[32];
-  snprintf(buf, sizeof(buf), "%d", value);
-  value_map_set(map, key, buf);
+  if (!map || !key) return;
+  KV *kv = value_map_slot(map, key);
+  if (!kv) return;
+  kv->int_value = value;
+  kv->is_int = true;
+  kv->value = NULL;
 }
 
-static const char *value_map_get(const ValueMap *map, const char *key) {
-  if (!map || !key) return NULL;
-  for (size_t i = 0; i < map->count; ++i) {
-    if (strcmp(map->items[i].key, key) == 0) return map->items[i].value;
-  }
-  return NULL;
+// Int values are formatted into buf on every read; reading never writes to the map.
+static const char *value_map_kv_text(const KV *kv, char *buf, size_t buf_size) {
+  if (!kv->is_int) return kv->value;
+  snprintf(buf, buf_size, "%d", kv->int_value);
+  return buf;
+}
+
+static const char *value_map_value_at(const ValueMap *map, size_t i, char *buf, size_t buf_size) {
+  if (!map || i >= map->count) return NULL;
+  return value_map_kv_text(&map->items[i], buf, buf_size);
 }
 
 static int value_map_get_int(const ValueMap *map, const char *key, int fallback) {
-  const char *s = value_map_get(map, key);
-  return s ? atoi(s) : fallback;
+  if (!map || !key || map->count == 0) return fallback;
+  KV *kv = value_map_find(map, key_intern_find(key, key_hash(key), NULL));
+  if (!kv) return fallback;
+  if (kv->is_int) return kv->int_value;
+  return kv->value ? atoi(kv->value) : fallback;
 }
 
 static void value_map_set_if_missing(ValueMap *map, const char *key, const char *value) {
-  if (!value_map_get(map, key)) value_map_set(map, key, value);
+  if (!map || !key) return;
+  if (map->count == 0 || !value_map_find(map, key_intern_find(key, key_hash(key), NULL))) value_map_set(map, key, value);
 }
 
-static void insert_option_free(InsertOption *opt) {
+static void insert_option_free(InsertOption *opt, bool mapped) {
   if (!opt) return;
-  for (size_t i = 0; i < opt->method_count; ++i) free(opt->methods[i]);
+  for (size_t i = 0; i < opt->method_count && !mapped; ++i) free(opt->methods[i]);
   free(opt->methods);
+  free(opt->ops);
   opt->methods = NULL;
   opt->method_count = 0;
+  opt->ops = NULL;
+  opt->op_count = 0;
 }
 
 static void free_menu(Menu *menu) {
   if (!menu) return;
   free_view(&menu->view);
-  for (size_t i = 0; i < menu->insert_count; ++i) insert_option_free(&menu->inserts[i]);
-  free(menu->inserts);
-  for (size_t i = 0; i < menu->partial_count; ++i) free(menu->partials[i].name);
+  if (!menu->inserts_shared) {
+    for (size_t i = 0; i < menu->insert_count; ++i) insert_option_free(&menu->inserts[i], menu->mapped);
+    free(menu->inserts);
+  }
+  for (size_t i = 0; i < menu->partial_count && !menu->mapped; ++i) free(menu->partials[i].name);
   free(menu->partials);
   free(menu->arts);
   menu->inserts = NULL;
   menu->insert_count = 0;
+  menu->inserts_shared = false;
   menu->partials = NULL;
   menu->partial_count = 0;
   menu->arts = NULL;
   menu->art_count = 0;
+  menu->mapped = false;
 }
 
 static void free_art_file(ArtFile *file) {
   if (!file) return;
   for (size_t i = 0; i < file->art_count; ++i) {
-    free(file->arts[i].name);
+    if (!file->mapped) free(file->arts[i].name);
     free_view(&file->arts[i].view);
   }
   free(file->arts);
   file->arts = NULL;
   file->art_count = 0;
+  file->mapped = false;
+}
+
+// Every Node of a document, its child arrays and its strings live in one
+// arena owned by the root, so a document is a few chunk allocations and
+// node_free(root) releases it in one go.
+typedef struct NodeArenaChunk NodeArenaChunk;
+
+struct NodeArenaChunk {
+  NodeArenaChunk *next;
+  size_t used;
+  size_t cap;
+  _Alignas(max_align_t) unsigned char data[];
+};
+
+struct NodeArena {
+  NodeArenaChunk *chunks;
+};
+
+static void *node_arena_alloc(NodeArena *a, size_t size) {
+  size = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+  NodeArenaChunk *c = a->chunks;
+  if (!c || c->cap - c->used < size) {
+    size_t cap = c ? c->cap * 2 : 16384;
+    if (cap < size) cap = size;
+    NodeArenaChunk *chunk = (NodeArenaChunk *)malloc(sizeof(NodeArenaChunk) + cap);
+    if (!chunk) return NULL;
+    chunk->next = c;
+    chunk->used = 0;
+    chunk->cap = cap;
+    a->chunks = chunk;
+    c = chunk;
+  }
+  void *p = c->data + c->used;
+  c->used += size;
+  return p;
+}
+
+static char *node_arena_strndup(NodeArena *a, const char *s, size_t len) {
+  char *out = (char *)node_arena_alloc(a, len + 1);
+  if (!out) return NULL;
+  memcpy(out, s, len);
+  out[len] = '\0';
+  return out;
+}
+
+static void node_arena_free(NodeArena *a) {
+  NodeArenaChunk *c = a->chunks;
+  while (c) {
+    NodeArenaChunk *next = c->next;
+    free(c);
+    c = next;
+  }
+  free(a);
 }
 
-static Node *node_new(NodeType type) {
-  Node *n = (Node *)calloc(1, sizeof(Node));
+static Node *node_new(NodeArena *a, NodeType type) {
+  Node *n = (Node *)node_arena_alloc(a, sizeof(Node));
   if (!n) return NULL;
+  memset(n, 0, sizeof(*n));
   n->type = type;
   return n;
 }
 
 static void node_free(Node *node) {
-  if (!node) return;
-  if (node->type == NODE_SCALAR) {
-    free(node->scalar);
-  } else if (node->type == NODE_SEQ) {
-    for (size_t i = 0; i < node->seq_len; ++i) node_free(node->seq[i]);
-    free(node->seq);
-  } else if (node->type == NODE_MAP) {
-    for (size_t i = 0; i < node->map.len; ++i) {
-      free(node->map.keys[i]);
-      node_free(node->map.values[i]);
-    }
-    free(node->map.keys);
-    free(node->map.values);
-  }
-  free(node);
-}
-
-static void node_seq_push(Node *seq, Node *item) {
-  if (!seq || seq->type != NODE_SEQ) return;
-  Node **arr = (Node **)realloc(seq->seq, (seq->seq_len + 1) * sizeof(Node *));
-  if (!arr) return;
-  seq->seq = arr;
-  seq->seq[seq->seq_len++] = item;
-}
-
-static void node_map_set(Node *map, char *key, Node *value) {
-  if (!map || map->type != NODE_MAP || !key) return;
-  char **keys = (char **)realloc(map->map.keys, (map->map.len + 1) * sizeof(char *));
-  Node **values = (Node **)realloc(map->map.values, (map->map.len + 1) * sizeof(Node *));
-  if (!keys || !values) return;
-  map->map.keys = keys;
-  map->map.values = values;
-  map->map.keys[map->map.len] = key;
-  map->map.values[map->map.len] = value;
-  map->map.len++;
+  if (node && node->arena) node_arena_free(node->arena);
 }
 
 static Node *node_map_get(Node *map, const char *key) {
@@ -972,48 +1303,77 @@ static int node_int(Node *node, int fallback) {
   return atoi(s);
 }
 
-static int node_map_int(Node *map, const char *key, int fallback) {
-  if (!map || map->type != NODE_MAP) return fallback;
-  return node_int(node_map_get(map, key), fallback);
+// Whole-string decimal or 0x-hex parse; signs, trailing junk and overflow are rejected.
+static bool parse_u64(const char *s, uint64_t *out) {
+  if (!s || !isdigit((unsigned char)s[0])) return false;
+  errno = 0;
+  char *end = NULL;
+  unsigned long long v = strtoull(s, &end, 0);
+  if (errno != 0 || *end != '\0') return false;
+  *out = (uint64_t)v;
+  return true;
 }
 
-static const char *node_map_str(Node *map, const char *key, const char *fallback) {
-  if (!map || map->type != NODE_MAP) return fallback;
-  Node *n = node_map_get(map, key);
-  const char *s = node_scalar(n);
-  return s ? s : fallback;
+static void free_string_list(char **list, size_t count) {
+  if (!list) return;
+  for (size_t i = 0; i < count; ++i) free(list[i]);
+  free(list);
 }
 
-static char **node_string_list(Node *node, size_t *out_count) {
-  if (out_count) *out_count = 0;
-  if (!node) return NULL;
-  char **list = NULL;
-  size_t count = 0;
+// Children are collected on a scratch stack shared by all open containers and
+// copied into the arena, sized exactly, when their container ends. On a parse
+// error the containers still open are closed the same way, so the partial tree
+// keeps everything read so far.
+typedef struct {
+  char *key;
+  Node *value;
+} NodeChild;
 
-  if (node->type == NODE_SCALAR) {
-    list = (char **)malloc(sizeof(char *));
-    if (!list) return NULL;
-    list[0] = strdup_safe(node->scalar ? node->scalar : "");
-    count = 1;
-  } else if (node->type == NODE_SEQ) {
-    for (size_t i = 0; i < node->seq_len; ++i) {
-      const char *s = node_scalar(node->seq[i]);
-      if (!s) continue;
-      char **arr = (char **)realloc(list, (count + 1) * sizeof(char *));
-      if (!arr) continue;
-      list = arr;
-      list[count++] = strdup_safe(s);
+typedef struct {
+  Node *node;
+  size_t first_child;
+  char *key;
+  bool expect_key;
+} NodeFrame;
+
+static void yaml_attach(NodeFrame *top, NodeChild **scratch, size_t *len, size_t *cap, Node *node) {
+  if (top->node->type == NODE_MAP && !top->key) return;
+  if (*len == *cap) {
+    size_t new_cap = *cap ? *cap * 2 : 256;
+    NodeChild *arr = (NodeChild *)realloc(*scratch, new_cap * sizeof(NodeChild));
+    if (!arr) return;
+    *scratch = arr;
+    *cap = new_cap;
+  }
+  (*scratch)[*len].key = top->key;
+  (*scratch)[*len].value = node;
+  (*len)++;
+  top->key = NULL;
+  top->expect_key = top->node->type == NODE_MAP;
+}
+
+static void yaml_close(NodeArena *arena, NodeFrame *top, NodeChild *scratch, size_t *len) {
+  Node *n = top->node;
+  size_t count = *len - top->first_child;
+  const NodeChild *children = scratch + top->first_child;
+  if (count > 0 && n->type == NODE_SEQ) {
+    n->seq = (Node **)node_arena_alloc(arena, count * sizeof(Node *));
+    if (n->seq) {
+      for (size_t i = 0; i < count; ++i) n->seq[i] = children[i].value;
+      n->seq_len = count;
+    }
+  } else if (count > 0 && n->type == NODE_MAP) {
+    n->map.keys = (char **)node_arena_alloc(arena, count * sizeof(char *));
+    n->map.values = (Node **)node_arena_alloc(arena, count * sizeof(Node *));
+    if (n->map.keys && n->map.values) {
+      for (size_t i = 0; i < count; ++i) {
+        n->map.keys[i] = children[i].key;
+        n->map.values[i] = children[i].value;
+      }
+      n->map.len = count;
     }
   }
-
-  if (out_count) *out_count = count;
-  return list;
-}
-
-static void free_string_list(char **list, size_t count) {
-  if (!list) return;
-  for (size_t i = 0; i < count; ++i) free(list[i]);
-  free(list);
+  *len = top->first_child;
 }
 
 static Node *yaml_load_file(const char *path) {
@@ -1029,93 +1389,71 @@ static Node *yaml_load_file(const char *path) {
   }
   yaml_parser_set_input_file(&parser, f);
 
+  NodeArena *arena = (NodeArena *)calloc(1, sizeof(NodeArena));
+  if (!arena) {
+    yaml_parser_delete(&parser);
+    fclose(f);
+    return NULL;
+  }
   Node *root = NULL;
-  Node *stack[128];
+  NodeFrame stack[128];
   size_t stack_len = 0;
-  char *map_key[128];
-  bool map_expect_key[128];
+  NodeChild *scratch = NULL;
+  size_t scratch_len = 0;
+  size_t scratch_cap = 0;
+  bool too_deep = false;
 
-  while (yaml_parser_parse(&parser, &event)) {
+  while (!too_deep && yaml_parser_parse(&parser, &event)) {
     bool done = false;
     switch (event.type) {
       case YAML_STREAM_END_EVENT:
         done = true;
         break;
-      case YAML_MAPPING_START_EVENT: {
-        Node *map = node_new(NODE_MAP);
-        if (!map) break;
-        if (stack_len == 0) {
-          if (!root) root = map;
-        } else {
-          Node *parent = stack[stack_len - 1];
-          if (parent->type == NODE_SEQ) {
-            node_seq_push(parent, map);
-          } else if (parent->type == NODE_MAP) {
-            if (!map_expect_key[stack_len - 1] && map_key[stack_len - 1]) {
-              node_map_set(parent, map_key[stack_len - 1], map);
-              map_key[stack_len - 1] = NULL;
-              map_expect_key[stack_len - 1] = true;
-            }
-          }
-        }
-        stack[stack_len] = map;
-        map_key[stack_len] = NULL;
-        map_expect_key[stack_len] = true;
-        stack_len++;
-        break;
-      }
+      case YAML_MAPPING_START_EVENT:
       case YAML_SEQUENCE_START_EVENT: {
-        Node *seq = node_new(NODE_SEQ);
-        if (!seq) break;
+        if (stack_len >= sizeof(stack) / sizeof(stack[0])) {
+          fprintf(stderr, "[pzdc_dungeon_2_gl] yaml: %s nests deeper than %zu levels\n", path, stack_len);
+          too_deep = true;
+          break;
+        }
+        Node *n = node_new(arena, event.type == YAML_MAPPING_START_EVENT ? NODE_MAP : NODE_SEQ);
+        if (!n) break;
         if (stack_len == 0) {
-          if (!root) root = seq;
+          if (!root) root = n;
         } else {
-          Node *parent = stack[stack_len - 1];
-          if (parent->type == NODE_SEQ) {
-            node_seq_push(parent, seq);
-          } else if (parent->type == NODE_MAP) {
-            if (!map_expect_key[stack_len - 1] && map_key[stack_len - 1]) {
-              node_map_set(parent, map_key[stack_len - 1], seq);
-              map_key[stack_len - 1] = NULL;
-              map_expect_key[stack_len - 1] = true;
-            }
-          }
+          yaml_attach(&stack[stack_len - 1], &scratch, &scratch_len, &scratch_cap, n);
         }
-        stack[stack_len] = seq;
-        map_key[stack_len] = NULL;
-        map_expect_key[stack_len] = false;
+        stack[stack_len].node = n;
+        stack[stack_len].first_child = scratch_len;
+        stack[stack_len].key = NULL;
+        stack[stack_len].expect_key = n->type == NODE_MAP;
         stack_len++;
         break;
       }
       case YAML_SCALAR_EVENT: {
-        Node *scalar = node_new(NODE_SCALAR);
+        char *text = node_arena_strndup(arena, (const char *)event.data.scalar.value, event.data.scalar.length);
+        if (!text) break;
+        if (stack_len > 0 && stack[stack_len - 1].expect_key) {
+          stack[stack_len - 1].key = text;
+          stack[stack_len - 1].expect_key = false;
+          break;
+        }
+        Node *scalar = node_new(arena, NODE_SCALAR);
         if (!scalar) break;
-        scalar->scalar = strdup_safe((const char *)event.data.scalar.value);
+        scalar->scalar = text;
         if (stack_len == 0) {
           if (!root) root = scalar;
-          else node_free(scalar);
         } else {
-          Node *parent = stack[stack_len - 1];
-          if (parent->type == NODE_SEQ) {
-            node_seq_push(parent, scalar);
-          } else if (parent->type == NODE_MAP) {
-            if (map_expect_key[stack_len - 1]) {
-              map_key[stack_len - 1] = scalar->scalar;
-              scalar->scalar = NULL;
-              node_free(scalar);
-              map_expect_key[stack_len - 1] = false;
-            } else if (map_key[stack_len - 1]) {
-              node_map_set(parent, map_key[stack_len - 1], scalar);
-              map_key[stack_len - 1] = NULL;
-              map_expect_key[stack_len - 1] = true;
-            }
-          }
+          yaml_attach(&stack[stack_len - 1], &scratch, &scratch_len, &scratch_cap, scalar);
         }
         break;
       }
       case YAML_MAPPING_END_EVENT:
       case YAML_SEQUENCE_END_EVENT:
-        if (stack_len > 0) stack_len--;
+        if (stack_len > 0) {
+          yaml_close(arena, &stack[stack_len - 1], scratch, &scratch_len);
+          stack_len--;
+        }
         break;
       default:
         break;
@@ -1123,9 +1461,16 @@ static Node *yaml_load_file(const char *path) {
     yaml_event_delete(&event);
     if (done) break;
   }
+  for (; stack_len > 0; --stack_len) yaml_close(arena, &stack[stack_len - 1], scratch, &scratch_len);
 
+  free(scratch);
   yaml_parser_delete(&parser);
   fclose(f);
+  if (!root || too_deep) {
+    node_arena_free(arena);
+    return NULL;
+  }
+  root->arena = arena;
   return root;
 }
 
@@ -1196,6 +1541,7 @@ static bool menu_load(const char *path, Menu *menu) {
         }
         menu->inserts = ins;
         InsertOption *opt = &menu->inserts[menu->insert_count++];
+        memset(opt, 0, sizeof(*opt));
         opt->line_idx = line_idx;
         opt->placeholder = placeholder;
         opt->modifier = modifier;
@@ -1307,1298 +1653,2896 @@ static Art *artfile_find(ArtFile *file, const char *name) {
   return NULL;
 }
 
-static char *read_version(const char *path) {
-  if (!path) return NULL;
-  FILE *f = fopen(path, "r");
-  if (!f) return NULL;
-  char *line = NULL;
-  size_t cap = 0;
-  char *version = NULL;
-  while (getline(&line, &cap, f) != -1) {
-    char *p = strstr(line, "VERSION");
-    if (p) {
-      char *q = strchr(p, '\'');
-      if (q) {
-        char *r = strchr(q + 1, '\'');
-        if (r && r > q + 1) {
-          size_t n = (size_t)(r - q - 1);
-          version = (char *)malloc(n + 4);
-          if (version) {
-            memcpy(version, "v ", 2);
-            memcpy(version + 2, q + 1, n);
-            version[2 + n] = '\0';
-          }
-          break;
-        }
+static void view_copy(View *dst, const View *src) {
+  memset(dst, 0, sizeof(*dst));
+  if (!src || src->line_count == 0) return;
+  dst->lines = (Line *)calloc(src->line_count, sizeof(Line));
+  if (!dst->lines) return;
+  dst->line_count = src->line_count;
+  dst->max_cols = src->max_cols;
+  for (size_t i = 0; i < src->line_count; ++i) {
+    const Line *s = &src->lines[i];
+    Line *d = &dst->lines[i];
+    // Composition works on cells only; the source text stays with the cached template.
+    d->text = NULL;
+    if (s->cells && s->len_cells > 0) {
+      d->cells = (uint32_t *)malloc(s->len_cells * sizeof(uint32_t));
+      if (d->cells) {
+        memcpy(d->cells, s->cells, s->len_cells * sizeof(uint32_t));
+        d->len_cells = s->len_cells;
       }
     }
   }
-  free(line);
-  fclose(f);
-  return version;
 }
 
-static void apply_insert(View *view, const InsertOption *opt, const char *value) {
-  if (!view || !opt || !value) return;
-  if (opt->line_idx < 0 || (size_t)opt->line_idx >= view->line_count) return;
-
-  char *line = view->lines[opt->line_idx].text;
-  char *p = line;
-  char ch = opt->placeholder;
-
-  while (*p) {
-    if (*p == ch) {
-      char *run_start = p;
-      while (*p == ch) p++;
-      size_t run_len = (size_t)(p - run_start);
-      if (run_len >= 3) {
-        size_t val_len = strlen(value);
-        size_t out_len = run_len;
-        char *insert = (char *)malloc(out_len + 1);
-        if (!insert) return;
-        if (val_len >= out_len) {
-          memcpy(insert, value, out_len);
-        } else {
-          size_t pad = out_len - val_len;
-          if (opt->modifier == 'm') {
-            size_t left = pad / 2;
-            size_t right = pad - left;
-            memset(insert, ' ', left);
-            memcpy(insert + left, value, val_len);
-            memset(insert + left + val_len, ' ', right);
-          } else if (opt->modifier == 'e') {
-            memset(insert, ' ', pad);
-            memcpy(insert + pad, value, val_len);
-          } else {
-            memcpy(insert, value, val_len);
-            memset(insert + val_len, ' ', pad);
-          }
-        }
-        insert[out_len] = '\0';
-
-        size_t prefix_len = (size_t)(run_start - line);
-        size_t suffix_len = strlen(p);
-        size_t new_len = prefix_len + out_len + suffix_len;
-        char *new_line = (char *)malloc(new_len + 1);
-        if (!new_line) {
-          free(insert);
-          return;
-        }
-        memcpy(new_line, line, prefix_len);
-        memcpy(new_line + prefix_len, insert, out_len);
-        memcpy(new_line + prefix_len + out_len, p, suffix_len + 1);
-        free(insert);
-        free(view->lines[opt->line_idx].text);
-        view->lines[opt->line_idx].text = new_line;
-        return;
-      }
-    } else {
-      p++;
+static void menu_copy(Menu *dst, const Menu *src) {
+  memset(dst, 0, sizeof(*dst));
+  view_copy(&dst->view, &src->view);
+  // Inserts never change after menu_bind_inserts, so a copy borrows them;
+  // it must not outlive src.
+  dst->inserts = src->inserts;
+  dst->insert_count = src->insert_count;
+  dst->inserts_shared = src->insert_count > 0;
+  if (src->art_count > 0) {
+    dst->arts = (ArtSlot *)malloc(src->art_count * sizeof(ArtSlot));
+    if (dst->arts) {
+      memcpy(dst->arts, src->arts, src->art_count * sizeof(ArtSlot));
+      dst->art_count = src->art_count;
     }
   }
-}
-
-static char *apply_method_chain(ValueMap *map, const InsertOption *opt) {
-  if (!opt || opt->method_count == 0) return strdup_safe("");
-  char key[128];
-  snprintf(key, sizeof(key), "%s", opt->methods[0]);
-  const char *base = value_map_get(map, key);
-  if (!base) base = "";
-  char *current = strdup_safe(base);
-
-  for (size_t i = 1; i < opt->method_count; ++i) {
-    if (strcmp(opt->methods[i], "round") == 0) {
-      double v = atof(current);
-      char buf[64];
-      snprintf(buf, sizeof(buf), "%.0f", round(v));
-      free(current);
-      current = strdup_safe(buf);
-    } else {
-      if (strlen(key) + strlen(opt->methods[i]) + 2 < sizeof(key)) {
-        strcat(key, ".");
-        strcat(key, opt->methods[i]);
-        const char *val = value_map_get(map, key);
-        if (val) {
-          free(current);
-          current = strdup_safe(val);
-        }
+  if (src->partial_count > 0) {
+    dst->partials = (PartialSlot *)calloc(src->partial_count, sizeof(PartialSlot));
+    if (dst->partials) {
+      dst->partial_count = src->partial_count;
+      for (size_t i = 0; i < src->partial_count; ++i) {
+        dst->partials[i] = src->partials[i];
+        dst->partials[i].name = src->partials[i].name ? strdup_safe(src->partials[i].name) : NULL;
       }
     }
   }
-  return current;
 }
 
-static void apply_inserts(Menu *menu, ValueMap *map) {
-  for (size_t i = 0; i < menu->insert_count; ++i) {
-    InsertOption *opt = &menu->inserts[i];
-    char *value = apply_method_chain(map, opt);
-    if (value) {
-      apply_insert(&menu->view, opt, value);
-      free(value);
-    }
-  }
-}
+// Compiled form of views/: every menu and art file with its cells already
+// decoded, produced by --build-bundle and mapped read-only at launch.
+#define VIEW_BUNDLE_FILE "views.bundle"
+#define VIEW_BUNDLE_MAGIC "PZDCVB01"
+#define VIEW_BUNDLE_VERSION 2u
 
-static void insert_view(View *dst, const View *src, int y0, int x0) {
-  if (!dst || !src) return;
-  for (int y = 0; y < (int)src->line_count; ++y) {
-    int dy = y0 + y;
-    if (dy < 0 || dy >= (int)dst->line_count) continue;
-    Line *dline = &dst->lines[dy];
-    Line *sline = (Line *)&src->lines[y];
-    for (int x = 0; x < (int)src->max_cols; ++x) {
-      int dx = x0 + x;
-      if (dx < 0 || dx >= (int)dst->max_cols) continue;
-      dline->cells[dx] = sline->cells[x];
-    }
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+  bool failed;
+} ByteBuf;
+
+typedef struct {
+  const uint8_t *p;
+  const uint8_t *end;
+  bool ok;
+} ByteReader;
+
+typedef struct {
+  const char *key;
+  uint32_t hash;
+  bool is_art;
+  const uint8_t *payload;
+  size_t payload_len;
+} BundleEntry;
+
+typedef struct {
+  void *map;
+  size_t size;
+  BundleEntry *entries;
+  size_t count;
+} ViewBundle;
+
+typedef struct {
+  char **paths;
+  size_t count;
+  size_t cap;
+} SourceList;
+
+static ViewBundle view_bundle;
+
+// A failed grow is sticky: later puts are dropped too, so a short buffer is never mistaken for a valid one.
+static void bb_reserve(ByteBuf *b, size_t extra) {
+  if (b->failed || b->len + extra <= b->cap) return;
+  size_t new_cap = b->cap == 0 ? 4096 : b->cap;
+  while (new_cap < b->len + extra) new_cap *= 2;
+  uint8_t *arr = (uint8_t *)realloc(b->data, new_cap);
+  if (!arr) {
+    b->failed = true;
+    return;
   }
+  b->data = arr;
+  b->cap = new_cap;
 }
 
-static void align_art_to_field(const ArtSlot *slot, int art_w, int art_h, int *out_x, int *out_y) {
-  int field_y_center = (slot->y0 + slot->y1) / 2;
-  int field_x_center = (slot->x0 + slot->x1) / 2;
-  int y_half_1 = art_h / 2 - ((art_h % 2 == 1) ? 0 : 1);
-  int y_min = field_y_center - y_half_1;
-  int x_half_1 = art_w / 2 - ((art_w % 2 == 1) ? 0 : 1);
-  int x_min = field_x_center - x_half_1;
-  *out_x = x_min;
-  *out_y = y_min;
+static void bb_put(ByteBuf *b, const void *src, size_t n) {
+  bb_reserve(b, n + 3);
+  if (b->failed) return;
+  memcpy(b->data + b->len, src, n);
+  b->len += n;
+  while (b->len % 4) b->data[b->len++] = 0;
 }
 
-static void compose_menu(Menu *menu, ValueMap *main_map, ValueMap **partial_maps, size_t partial_map_count, ArtArg *art_args, size_t art_arg_count) {
-  apply_inserts(menu, main_map);
-  view_build_cells(&menu->view);
+static void bb_put_u32(ByteBuf *b, uint32_t v) {
+  bb_put(b, &v, sizeof(v));
+}
 
-  for (size_t i = 0; i < menu->partial_count; ++i) {
-    PartialSlot *slot = &menu->partials[i];
-    if (!slot->name) continue;
-    char *partial_path = resolve_menu_path(slot->name);
-    if (!partial_path) continue;
+static void bb_put_str(ByteBuf *b, const char *s) {
+  if (!s) s = "";
+  uint32_t n = (uint32_t)strlen(s);
+  bb_put_u32(b, n);
+  bb_put(b, s, n + 1);
+}
 
-    Menu partial = {0};
-    if (menu_load(partial_path, &partial)) {
-      ValueMap *map = main_map;
-      if (partial_maps && i < partial_map_count && partial_maps[i]) map = partial_maps[i];
-      apply_inserts(&partial, map);
-      view_build_cells(&partial.view);
-      insert_view(&menu->view, &partial.view, slot->y0, slot->x0);
-    }
-    free_menu(&partial);
-    free(partial_path);
+static void bb_put_view(ByteBuf *b, const View *v) {
+  bb_put_u32(b, (uint32_t)v->line_count);
+  bb_put_u32(b, (uint32_t)v->max_cols);
+  for (size_t i = 0; i < v->line_count; ++i) {
+    bb_put_str(b, v->lines[i].text);
+    bb_put_u32(b, (uint32_t)v->lines[i].len_cells);
+    bb_put(b, v->lines[i].cells, v->lines[i].len_cells * sizeof(uint32_t));
   }
+}
 
-  size_t count = menu->art_count < art_arg_count ? menu->art_count : art_arg_count;
-  for (size_t i = 0; i < count; ++i) {
-    ArtArg *arg = &art_args[i];
-    if (!arg->name || !arg->path) continue;
-    char *art_path = resolve_art_path(arg->path);
-    if (!art_path) continue;
-
-    ArtFile file = {0};
-    if (artfile_load(art_path, &file)) {
-      Art *art = artfile_find(&file, arg->name);
-      if (!art && strcmp(arg->name, "normal") != 0) {
-        art = artfile_find(&file, "normal");
-      }
-      if (art) {
-        view_build_cells(&art->view);
-        int x = 0, y = 0;
-        align_art_to_field(&menu->arts[i], (int)art->view.max_cols, (int)art->view.line_count, &x, &y);
-        insert_view(&menu->view, &art->view, y, x);
-      }
-    }
-    free_art_file(&file);
-    free(art_path);
+static const void *rd_bytes(ByteReader *r, size_t n) {
+  size_t padded = (n + 3) & ~(size_t)3;
+  if (!r->ok || (size_t)(r->end - r->p) < padded) {
+    r->ok = false;
+    return NULL;
   }
+  const void *out = r->p;
+  r->p += padded;
+  return out;
 }
 
-static void render_state_free(RenderState *rs) {
-  if (!rs) return;
-  if (rs->tex) glDeleteTextures(1, &rs->tex);
-  rs->tex = 0;
-  free(rs->glyphs);
-  free(rs->glyph_list);
-  rs->glyphs = NULL;
-  rs->glyph_list = NULL;
-  rs->glyph_count = 0;
-  rs->glyph_list_count = 0;
-  rs->grid_w = 0;
-  rs->grid_h = 0;
+static uint32_t rd_u32(ByteReader *r) {
+  const uint32_t *v = (const uint32_t *)rd_bytes(r, sizeof(uint32_t));
+  return v ? *v : 0;
 }
 
-static bool has_codepoint(const uint32_t *arr, size_t count, uint32_t cp) {
-  for (size_t i = 0; i < count; ++i) {
-    if (arr[i] == cp) return true;
+static const char *rd_str(ByteReader *r) {
+  uint32_t n = rd_u32(r);
+  const char *s = (const char *)rd_bytes(r, (size_t)n + 1);
+  return (s && s[n] == '\0') ? s : "";
+}
+
+// Readers point text, cells and names straight into the read-only mapping; only the arrays that hold
+// them are allocated. Cached templates are never written, and copies get their own cells.
+static void rd_view(ByteReader *r, View *v) {
+  memset(v, 0, sizeof(*v));
+  uint32_t line_count = rd_u32(r);
+  uint32_t max_cols = rd_u32(r);
+  if (!r->ok || line_count == 0) return;
+  v->lines = (Line *)calloc(line_count, sizeof(Line));
+  if (!v->lines) {
+    r->ok = false;
+    return;
   }
-  return false;
+  v->mapped = true;
+  v->max_cols = max_cols;
+  for (uint32_t i = 0; i < line_count && r->ok; ++i) {
+    Line *line = &v->lines[v->line_count++];
+    line->text = (char *)rd_str(r);
+    uint32_t len_cells = rd_u32(r);
+    const void *cells = rd_bytes(r, (size_t)len_cells * sizeof(uint32_t));
+    if (!cells || len_cells == 0) continue;
+    line->cells = (uint32_t *)cells;
+    line->len_cells = len_cells;
+  }
+}
+
+static void bundle_put_menu(ByteBuf *b, const Menu *m) {
+  bb_put_view(b, &m->view);
+  bb_put_u32(b, (uint32_t)m->insert_count);
+  for (size_t i = 0; i < m->insert_count; ++i) {
+    const InsertOption *opt = &m->inserts[i];
+    bb_put_u32(b, (uint32_t)opt->line_idx);
+    bb_put_u32(b, (uint32_t)(unsigned char)opt->placeholder);
+    bb_put_u32(b, (uint32_t)(unsigned char)opt->modifier);
+    bb_put_u32(b, (uint32_t)opt->method_count);
+    for (size_t k = 0; k < opt->method_count; ++k) bb_put_str(b, opt->methods[k]);
+  }
+  bb_put_u32(b, (uint32_t)m->art_count);
+  for (size_t i = 0; i < m->art_count; ++i) {
+    const ArtSlot *a = &m->arts[i];
+    int32_t v[4] = {a->y0, a->y1, a->x0, a->x1};
+    bb_put(b, v, sizeof(v));
+  }
+  bb_put_u32(b, (uint32_t)m->partial_count);
+  for (size_t i = 0; i < m->partial_count; ++i) {
+    const PartialSlot *ps = &m->partials[i];
+    bb_put_u32(b, ps->name ? 1u : 0u);
+    bb_put_str(b, ps->name);
+    int32_t v[4] = {ps->y0, ps->y1, ps->x0, ps->x1};
+    bb_put(b, v, sizeof(v));
+  }
+}
+
+static bool bundle_read_menu(ByteReader *r, Menu *m) {
+  memset(m, 0, sizeof(*m));
+  m->mapped = true;
+  rd_view(r, &m->view);
+  uint32_t insert_count = rd_u32(r);
+  if (r->ok && insert_count > 0) {
+    m->inserts = (InsertOption *)calloc(insert_count, sizeof(InsertOption));
+    for (uint32_t i = 0; m->inserts && i < insert_count && r->ok; ++i) {
+      InsertOption *opt = &m->inserts[m->insert_count++];
+      opt->line_idx = (int)rd_u32(r);
+      opt->placeholder = (char)rd_u32(r);
+      opt->modifier = (char)rd_u32(r);
+      uint32_t method_count = rd_u32(r);
+      if (!r->ok || method_count == 0) continue;
+      opt->methods = (char **)calloc(method_count, sizeof(char *));
+      if (!opt->methods) continue;
+      for (uint32_t k = 0; k < method_count && r->ok; ++k) opt->methods[opt->method_count++] = (char *)rd_str(r);
+    }
+  }
+  uint32_t art_count = rd_u32(r);
+  if (r->ok && art_count > 0) {
+    m->arts = (ArtSlot *)calloc(art_count, sizeof(ArtSlot));
+    for (uint32_t i = 0; m->arts && i < art_count && r->ok; ++i) {
+      const int32_t *v = (const int32_t *)rd_bytes(r, 4 * sizeof(int32_t));
+      if (!v) break;
+      ArtSlot *a = &m->arts[m->art_count++];
+      a->y0 = v[0]; a->y1 = v[1]; a->x0 = v[2]; a->x1 = v[3];
+    }
+  }
+  uint32_t partial_count = rd_u32(r);
+  if (r->ok && partial_count > 0) {
+    m->partials = (PartialSlot *)calloc(partial_count, sizeof(PartialSlot));
+    for (uint32_t i = 0; m->partials && i < partial_count && r->ok; ++i) {
+      bool has_name = rd_u32(r) != 0;
+      const char *name = rd_str(r);
+      const int32_t *v = (const int32_t *)rd_bytes(r, 4 * sizeof(int32_t));
+      if (!v) break;
+      PartialSlot *ps = &m->partials[m->partial_count++];
+      ps->name = has_name ? (char *)name : NULL;
+      ps->y0 = v[0]; ps->y1 = v[1]; ps->x0 = v[2]; ps->x1 = v[3];
+    }
+  }
+  if (!r->ok) free_menu(m);
+  return r->ok && m->view.line_count > 0;
+}
+
+static void bundle_put_artfile(ByteBuf *b, const ArtFile *f) {
+  bb_put_u32(b, (uint32_t)f->art_count);
+  for (size_t i = 0; i < f->art_count; ++i) {
+    bb_put_str(b, f->arts[i].name);
+    bb_put_view(b, &f->arts[i].view);
+  }
+}
+
+static bool bundle_read_artfile(ByteReader *r, ArtFile *f) {
+  memset(f, 0, sizeof(*f));
+  uint32_t art_count = rd_u32(r);
+  if (!r->ok || art_count == 0) return false;
+  f->arts = (Art *)calloc(art_count, sizeof(Art));
+  if (!f->arts) return false;
+  f->mapped = true;
+  for (uint32_t i = 0; i < art_count && r->ok; ++i) {
+    Art *art = &f->arts[f->art_count++];
+    art->name = (char *)rd_str(r);
+    rd_view(r, &art->view);
+  }
+  if (!r->ok) free_art_file(f);
+  return r->ok && f->art_count > 0;
+}
+
+// Bundle keys are the path from the asset root ("views/menues/x.yml"), so the
+// same bundle serves whichever relative prefix the resolvers picked.
+static const char *bundle_key_for(const char *path) {
+  if (!path) return NULL;
+  const char *p = strstr(path, "views/");
+  while (p && p != path && p[-1] != '/') p = strstr(p + 1, "views/");
+  return p;
+}
+
+static void source_list_free(SourceList *list) {
+  for (size_t i = 0; i < list->count; ++i) free(list->paths[i]);
+  free(list->paths);
+  memset(list, 0, sizeof(*list));
+}
+
+static void source_list_scan(SourceList *list, const char *root, const char *rel) {
+  char dir_path[1024];
+  snprintf(dir_path, sizeof(dir_path), "%s%s", root, rel);
+  DIR *dir = opendir(dir_path);
+  if (!dir) return;
+  struct dirent *de;
+  while ((de = readdir(dir)) != NULL) {
+    if (de->d_name[0] == '.') continue;
+    char child_rel[1024];
+    snprintf(child_rel, sizeof(child_rel), "%s/%s", rel, de->d_name);
+    char child_path[1024];
+    snprintf(child_path, sizeof(child_path), "%s%s", root, child_rel);
+    struct stat st;
+    if (stat(child_path, &st) != 0) continue;
+    if (S_ISDIR(st.st_mode)) {
+      source_list_scan(list, root, child_rel);
+      continue;
+    }
+    size_t n = strlen(de->d_name);
+    if (n < 4 || strcmp(de->d_name + n - 4, ".yml") != 0) continue;
+    if (list->count + 1 > list->cap) {
+      size_t new_cap = list->cap == 0 ? 64 : list->cap * 2;
+      char **arr = (char **)realloc(list->paths, new_cap * sizeof(char *));
+      if (!arr) continue;
+      list->paths = arr;
+      list->cap = new_cap;
+    }
+    list->paths[list->count++] = strdup_safe(child_rel);
+  }
+  closedir(dir);
 }
 
-static Glyph *find_glyph(Glyph *glyphs, size_t count, uint32_t cp) {
-  for (size_t i = 0; i < count; ++i) {
-    if (glyphs[i].codepoint == cp) return &glyphs[i];
+static int cmp_cstr_ptr(const void *a, const void *b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static const char *view_bundle_root(void) {
+  static const char *roots[] = {"", "demo/pzdc_dungeon_2_gl/", "../", "../demo/pzdc_dungeon_2_gl/", "../../", "../../demo/pzdc_dungeon_2_gl/"};
+  for (size_t i = 0; i < sizeof(roots) / sizeof(roots[0]); ++i) {
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%sviews/menues", roots[i]);
+    if (dir_exists(buf)) return roots[i];
   }
   return NULL;
 }
 
-static bool build_atlas(Menu *menu, TTF_Font *font, int cell_w, int cell_h, RenderState *rs) {
-  if (!menu || !font || !rs) return false;
-  render_state_free(rs);
+static void view_sources_scan(const char *root, SourceList *list) {
+  memset(list, 0, sizeof(*list));
+  source_list_scan(list, root, "views/menues");
+  source_list_scan(list, root, "views/arts");
+  if (list->count > 1) qsort(list->paths, list->count, sizeof(char *), cmp_cstr_ptr);
+}
 
-  size_t glyph_cap = 128;
-  uint32_t *glyph_list = (uint32_t *)malloc(glyph_cap * sizeof(uint32_t));
-  size_t glyph_count = 0;
+// Size and mtime of every source are stored in the bundle header, so an edit, rename or swap of any
+// one view marks the bundle stale, not just a file newer than all the others.
+static bool source_stat(const char *root, const char *rel, int64_t out[2]) {
+  char path[1024];
+  snprintf(path, sizeof(path), "%s%s", root, rel);
+  struct stat st;
+  if (stat(path, &st) != 0) return false;
+  out[0] = (int64_t)st.st_size;
+  out[1] = (int64_t)st.st_mtime;
+  return true;
+}
 
-  for (size_t i = 0; i < menu->view.line_count; ++i) {
-    Line *line = &menu->view.lines[i];
-    for (size_t j = 0; j < line->len_cells; ++j) {
-      uint32_t cp = line->cells[j];
-      if (!has_codepoint(glyph_list, glyph_count, cp)) {
-        if (glyph_count + 1 > glyph_cap) {
-          glyph_cap *= 2;
-          glyph_list = (uint32_t *)realloc(glyph_list, glyph_cap * sizeof(uint32_t));
-        }
-        glyph_list[glyph_count++] = cp;
+static bool view_bundle_build(void) {
+  const char *root = view_bundle_root();
+  if (!root) {
+    fprintf(stderr, "[pzdc_dungeon_2_gl] bundle: views/ not found\n");
+    return false;
+  }
+  SourceList sources;
+  view_sources_scan(root, &sources);
+
+  ByteBuf b = {0};
+  bb_put(&b, VIEW_BUNDLE_MAGIC, 8);
+  bb_put_u32(&b, VIEW_BUNDLE_VERSION);
+  bb_put_u32(&b, (uint32_t)sources.count);
+  for (size_t i = 0; i < sources.count; ++i) {
+    int64_t st[2] = {-1, -1};
+    source_stat(root, sources.paths[i], st);
+    bb_put_str(&b, sources.paths[i]);
+    bb_put(&b, st, sizeof(st));
+  }
+
+  size_t written = 0;
+  for (size_t i = 0; i < sources.count; ++i) {
+    const char *rel = sources.paths[i];
+    char path[1024];
+    snprintf(path, sizeof(path), "%s%s", root, rel);
+    bool is_art = strncmp(rel, "views/arts/", 11) == 0;
+    ByteBuf payload = {0};
+    bool ok = false;
+    if (is_art) {
+      ArtFile file = {0};
+      ok = artfile_load(path, &file);
+      for (size_t j = 0; ok && j < file.art_count; ++j) view_build_cells(&file.arts[j].view);
+      if (ok) bundle_put_artfile(&payload, &file);
+      free_art_file(&file);
+    } else {
+      Menu menu = {0};
+      ok = menu_load(path, &menu);
+      if (ok) {
+        view_build_cells(&menu.view);
+        bundle_put_menu(&payload, &menu);
       }
+      free_menu(&menu);
     }
-  }
-
-  if (glyph_count == 0) {
-    free(glyph_list);
+    if (ok && payload.failed) {
+      b.failed = true;
+      free(payload.data);
+      break;
+    }
+    if (!ok) {
+      fprintf(stderr, "[pzdc_dungeon_2_gl] bundle: skipping %s\n", path);
+      free(payload.data);
+      continue;
+    }
+    bb_put_str(&b, rel);
+    bb_put_u32(&b, is_art ? 1u : 0u);
+    bb_put_u32(&b, (uint32_t)payload.len);
+    bb_put(&b, payload.data, payload.len);
+    free(payload.data);
+    written++;
+  }
+  source_list_free(&sources);
+
+  char out_path[512];
+  char tmp_path[520];
+  snprintf(out_path, sizeof(out_path), "%s%s", root, VIEW_BUNDLE_FILE);
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", out_path);
+  if (b.failed) {
+    fprintf(stderr, "[pzdc_dungeon_2_gl] bundle: out of memory, not writing %s\n", out_path);
+    free(b.data);
     return false;
   }
+  FILE *f = fopen(tmp_path, "wb");
+  bool ok = f && fwrite(b.data, 1, b.len, f) == b.len;
+  if (f && fclose(f) != 0) ok = false;
+  if (ok) ok = rename(tmp_path, out_path) == 0;
+  if (ok) {
+    fprintf(stderr, "[pzdc_dungeon_2_gl] bundle: %zu views, %zu bytes -> %s\n", written, b.len, out_path);
+  } else {
+    fprintf(stderr, "[pzdc_dungeon_2_gl] bundle: failed to write %s\n", out_path);
+    remove(tmp_path);
+  }
+  free(b.data);
+  return ok;
+}
 
-  size_t atlas_cols = (size_t)ceil(sqrt((double)glyph_count));
-  size_t atlas_rows = (size_t)ceil((double)glyph_count / (double)atlas_cols);
-  int atlas_w = (int)(atlas_cols * cell_w);
-  int atlas_h = (int)(atlas_rows * cell_h);
-
-  SDL_Surface *atlas = SDL_CreateRGBSurfaceWithFormat(0, atlas_w, atlas_h, 32, SDL_PIXELFORMAT_RGBA32);
-  SDL_FillRect(atlas, NULL, SDL_MapRGBA(atlas->format, 0, 0, 0, 0));
-
-  Glyph *glyphs = (Glyph *)calloc(glyph_count, sizeof(Glyph));
-  SDL_Color white = {255, 255, 255, 255};
+static void view_bundle_close(void) {
+  if (view_bundle.map) munmap(view_bundle.map, view_bundle.size);
+  free(view_bundle.entries);
+  memset(&view_bundle, 0, sizeof(view_bundle));
+}
 
-  for (size_t i = 0; i < glyph_count; ++i) {
-    uint32_t cp = glyph_list[i];
-    char utf8[5];
-    utf8_encode(cp, utf8);
+static bool view_bundle_open(void) {
+  const char *root = view_bundle_root();
+  if (!root) return false;
+  char path[512];
+  snprintf(path, sizeof(path), "%s%s", root, VIEW_BUNDLE_FILE);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < 24) {
+    close(fd);
+    return false;
+  }
+  void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return false;
+  view_bundle.map = map;
+  view_bundle.size = (size_t)st.st_size;
+
+  ByteReader r = {(const uint8_t *)map, (const uint8_t *)map + st.st_size, true};
+  const char *magic = (const char *)rd_bytes(&r, 8);
+  uint32_t version = rd_u32(&r);
+  uint32_t source_count = rd_u32(&r);
+  if (!magic || memcmp(magic, VIEW_BUNDLE_MAGIC, 8) != 0 || version != VIEW_BUNDLE_VERSION || !r.ok) {
+    fprintf(stderr, "[pzdc_dungeon_2_gl] bundle: %s has an unknown format, ignoring it\n", path);
+    view_bundle_close();
+    return false;
+  }
 
-    SDL_Surface *g = TTF_RenderUTF8_Blended(font, utf8, white);
-    if (!g) continue;
+  SourceList sources;
+  view_sources_scan(root, &sources);
+  bool stale = sources.count != source_count;
+  for (size_t i = 0; !stale && i < sources.count; ++i) {
+    const char *rel = rd_str(&r);
+    const void *saved = rd_bytes(&r, 2 * sizeof(int64_t));
+    int64_t st[2];
+    stale = !saved || strcmp(rel, sources.paths[i]) != 0 || !source_stat(root, rel, st) ||
+            memcmp(st, saved, sizeof(st)) != 0;
+  }
+  source_list_free(&sources);
+  if (stale) {
+    fprintf(stderr, "[pzdc_dungeon_2_gl] bundle: %s does not match views/, falling back to YAML (run `make bundle`)\n", path);
+    view_bundle_close();
+    return false;
+  }
 
-    int gx = (int)((i % atlas_cols) * cell_w);
-    int gy = (int)((i / atlas_cols) * cell_h);
+  view_bundle.entries = (BundleEntry *)calloc(source_count > 0 ? source_count : 1, sizeof(BundleEntry));
+  while (view_bundle.entries && r.ok && r.p < r.end && view_bundle.count < source_count) {
+    BundleEntry e;
+    e.key = rd_str(&r);
+    e.is_art = rd_u32(&r) != 0;
+    e.payload_len = rd_u32(&r);
+    e.payload = (const uint8_t *)rd_bytes(&r, e.payload_len);
+    if (!r.ok) break;
+    e.hash = hash_str(e.key);
+    view_bundle.entries[view_bundle.count++] = e;
+  }
+  if (!r.ok) {
+    fprintf(stderr, "[pzdc_dungeon_2_gl] bundle: %s is truncated, ignoring it\n", path);
+    view_bundle_close();
+    return false;
+  }
+  fprintf(stderr, "[pzdc_dungeon_2_gl] bundle: mapped %zu views from %s\n", view_bundle.count, path);
+  return true;
+}
 
-    SDL_Rect dst;
-    dst.w = g->w;
-    dst.h = g->h;
-    dst.x = gx + (cell_w - g->w) / 2;
-    dst.y = gy + (cell_h - g->h) / 2;
+static const BundleEntry *view_bundle_find(const char *path, bool is_art) {
+  if (!view_bundle.map) return NULL;
+  const char *key = bundle_key_for(path);
+  if (!key) return NULL;
+  uint32_t hash = hash_str(key);
+  for (size_t i = 0; i < view_bundle.count; ++i) {
+    const BundleEntry *e = &view_bundle.entries[i];
+    if (e->hash == hash && e->is_art == is_art && strcmp(e->key, key) == 0) return e;
+  }
+  return NULL;
+}
 
-    SDL_BlitSurface(g, NULL, atlas, &dst);
-    SDL_FreeSurface(g);
+// Every view under the asset root, indexed once by its root-relative key
+// ("views/arts/skills/_first_aid.yml"), so resolving a partial or art on a
+// redraw is a hash probe with no syscalls. Names that are not found are
+// recorded too, which keeps their diagnostic to a single line.
+typedef struct {
+  char *key;
+  char *path; // NULL if the asset is missing
+  uint32_t hash;
+} AssetIndexEntry;
 
-    glyphs[i].codepoint = cp;
-    glyphs[i].u0 = (float)gx / (float)atlas_w;
-    glyphs[i].v0 = (float)gy / (float)atlas_h;
-    glyphs[i].u1 = (float)(gx + cell_w) / (float)atlas_w;
-    glyphs[i].v1 = (float)(gy + cell_h) / (float)atlas_h;
+typedef struct {
+  AssetIndexEntry *slots;
+  size_t cap;
+  size_t count;
+  const char *root;
+  bool built;
+} AssetIndex;
+
+static AssetIndex asset_index;
+
+static AssetIndexEntry *asset_index_find(const char *key, uint32_t hash) {
+  if (asset_index.cap == 0) return NULL;
+  size_t mask = asset_index.cap - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    AssetIndexEntry *e = &asset_index.slots[i];
+    if (!e->key) return NULL;
+    if (e->hash == hash && strcmp(e->key, key) == 0) return e;
+  }
+}
+
+static AssetIndexEntry *asset_index_insert(const char *key, char *path) {
+  if ((asset_index.count + 1) * 2 > asset_index.cap) {
+    size_t new_cap = asset_index.cap == 0 ? 256 : asset_index.cap * 2;
+    AssetIndexEntry *slots = (AssetIndexEntry *)calloc(new_cap, sizeof(AssetIndexEntry));
+    if (!slots) {
+      free(path);
+      return NULL;
+    }
+    for (size_t i = 0; i < asset_index.cap; ++i) {
+      AssetIndexEntry *old = &asset_index.slots[i];
+      if (!old->key) continue;
+      size_t j = old->hash & (new_cap - 1);
+      while (slots[j].key) j = (j + 1) & (new_cap - 1);
+      slots[j] = *old;
+    }
+    free(asset_index.slots);
+    asset_index.slots = slots;
+    asset_index.cap = new_cap;
+  }
+  uint32_t hash = hash_str(key);
+  size_t mask = asset_index.cap - 1;
+  size_t i = hash & mask;
+  while (asset_index.slots[i].key) i = (i + 1) & mask;
+  AssetIndexEntry *e = &asset_index.slots[i];
+  e->key = strdup_safe(key);
+  e->path = path;
+  e->hash = hash;
+  asset_index.count++;
+  return e;
+}
+
+// Runs once at startup, after view_bundle_open, since bundle keys are indexed too.
+static void asset_index_build(void) {
+  if (asset_index.built) return;
+  asset_index.built = true;
+  asset_index.root = view_bundle_root();
+  if (asset_index.root) {
+    SourceList list;
+    view_sources_scan(asset_index.root, &list);
+    for (size_t i = 0; i < list.count; ++i) {
+      size_t n = strlen(asset_index.root) + strlen(list.paths[i]) + 1;
+      char *path = (char *)malloc(n);
+      if (!path) continue;
+      snprintf(path, n, "%s%s", asset_index.root, list.paths[i]);
+      asset_index_insert(list.paths[i], path);
+    }
+    source_list_free(&list);
+  }
+  // A bundle can ship without the views/ tree; its keys resolve to themselves.
+  for (size_t i = 0; i < view_bundle.count; ++i) {
+    const char *key = view_bundle.entries[i].key;
+    if (!asset_index_find(key, hash_str(key))) asset_index_insert(key, strdup_safe(key));
+  }
+  if (!asset_index.root && view_bundle.count == 0) {
+    fprintf(stderr, "[pzdc_dungeon_2_gl] assets: views/ not found, no menus or arts will load\n");
+  }
+}
+
+static void asset_index_free(void) {
+  for (size_t i = 0; i < asset_index.cap; ++i) {
+    free(asset_index.slots[i].key);
+    free(asset_index.slots[i].path);
+  }
+  free(asset_index.slots);
+  memset(&asset_index, 0, sizeof(asset_index));
+}
+
+// name is either a view name relative to views/<dir> ("enemyes/swamp/_spider")
+// or an explicit .yml path, which resolves through the index when it lies
+// under views/. Any other explicit path is looked for as given, then one and
+// two directories up, and the first hit is recorded under the path itself.
+static char *asset_index_resolve(const char *dir, const char *name) {
+  if (!name) return NULL;
+  char key[512];
+  bool explicit_path = strstr(name, ".yml") != NULL;
+  const char *view_key = explicit_path ? bundle_key_for(name) : NULL;
+  if (explicit_path) {
+    snprintf(key, sizeof(key), "%s", view_key ? view_key : name);
+  } else {
+    snprintf(key, sizeof(key), "views/%s/%s.yml", dir, name);
+  }
+  uint32_t hash = hash_str(key);
+  AssetIndexEntry *e = asset_index_find(key, hash);
+  if (!e && explicit_path && !view_key) {
+    char up1[512];
+    char up2[512];
+    snprintf(up1, sizeof(up1), "../%s", name);
+    snprintf(up2, sizeof(up2), "../../%s", name);
+    const char *candidates[] = {name, up1, up2};
+    const char *found = find_existing_path(candidates, 3);
+    e = asset_index_insert(key, found ? strdup_safe(found) : NULL);
+  } else if (!e) {
+    fprintf(stderr, "[pzdc_dungeon_2_gl] missing asset: %s (asset root: %s)\n", key,
+            asset_index.root ? (asset_index.root[0] ? asset_index.root : "./") : "not found");
+    e = asset_index_insert(key, NULL);
   }
+  if (e && e->path) return strdup_safe(e->path);
+  return strdup_safe(strstr(name, ".yml") ? name : key);
+}
 
-  GLuint tex = 0;
-  glGenTextures(1, &tex);
-  glBindTexture(GL_TEXTURE_2D, tex);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, atlas->w, atlas->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, atlas->pixels);
-  SDL_FreeSurface(atlas);
-
-  rs->tex = tex;
-  rs->glyphs = glyphs;
-  rs->glyph_count = glyph_count;
-  rs->glyph_list = glyph_list;
-  rs->glyph_list_count = glyph_count;
-  rs->grid_w = (int)menu->view.max_cols;
-  rs->grid_h = (int)menu->view.line_count;
-  return true;
+static char *resolve_menu_path(const char *path) {
+  return asset_index_resolve("menues", path);
 }
 
-static float shade_intensity(uint32_t cp) {
-  switch (cp) {
-    case 0x2591: return 0.25f; // ░
-    case 0x2592: return 0.5f;  // ▒
-    case 0x2593: return 0.75f; // ▓
-    default: return 1.0f;
-  }
+static char *resolve_art_path(const char *path) {
+  return asset_index_resolve("arts", path);
 }
 
-static void draw_menu(Menu *menu, RenderState *rs, int win_w, int win_h, int cell_w, int cell_h, float alpha, int max_chars) {
-  if (!menu || !rs || rs->glyph_count == 0) return;
+// Per-frame timings for the main loop. Zones nest: entering a zone charges the
+// time since the last mark to the zone below it, so every zone is exclusive and
+// the zones of a frame add up to its wall time. The last PROF_RING frames are
+// kept for the F3 overlay and written out by --profile on exit.
+typedef enum {
+  PROF_OTHER,
+  PROF_IDLE,
+  PROF_INPUT,
+  PROF_SCREEN,
+  PROF_LOAD,
+  PROF_COMPOSE,
+  PROF_ATLAS,
+  PROF_QUADS,
+  PROF_DRAW,
+  PROF_SWAP,
+  PROF_ZONE_COUNT
+} ProfZone;
+
+static const char *prof_zone_names[PROF_ZONE_COUNT] = {
+    "other", "idle", "input", "screen", "load", "compose", "atlas", "quads", "draw", "swap"};
+
+#define PROF_RING 1024
+#define PROF_STACK 16
 
-  float sx = (float)win_w / (float)(rs->grid_w * cell_w);
-  float sy = (float)win_h / (float)(rs->grid_h * cell_h);
-  float draw_w = cell_w * sx;
-  float draw_h = cell_h * sy;
+typedef struct {
+  uint32_t index;
+  uint32_t ticks;
+  int state;
+  uint64_t zone[PROF_ZONE_COUNT];
+} ProfFrame;
 
-  if (alpha < 0.f) alpha = 0.f;
-  if (alpha > 1.f) alpha = 1.f;
-  glClearColor(0.f, 0.f, 0.f, 1.f);
-  glClear(GL_COLOR_BUFFER_BIT);
-  glBindTexture(GL_TEXTURE_2D, rs->tex);
+typedef struct {
+  uint64_t freq;
+  uint64_t mark;
+  ProfZone stack[PROF_STACK];
+  int depth;
+  ProfFrame cur;
+  ProfFrame *ring;
+  uint32_t frames;
+  bool overlay;
+} Profiler;
 
-  glBegin(GL_QUADS);
-  int total_cells = rs->grid_w * rs->grid_h;
-  int limit = max_chars < 0 ? total_cells : max_chars;
-  int idx = 0;
-  for (int y = 0; y < rs->grid_h; ++y) {
-    Line *line = &menu->view.lines[y];
-    for (int x = 0; x < rs->grid_w; ++x) {
-      if (idx >= limit) {
-        y = rs->grid_h;
-        break;
-      }
-      idx++;
-      uint32_t cp = (x < (int)line->len_cells) ? line->cells[x] : (uint32_t)' ';
-      if (cp == (uint32_t)' ') continue;
-      Glyph *g = find_glyph(rs->glyphs, rs->glyph_count, cp);
-      if (!g) continue;
+static Profiler prof;
 
-      float intensity = shade_intensity(cp);
-      glColor4f(intensity, intensity, intensity, alpha);
+static void prof_init(void) {
+  prof.freq = SDL_GetPerformanceFrequency();
+  if (prof.freq == 0) prof.freq = 1;
+  prof.ring = (ProfFrame *)calloc(PROF_RING, sizeof(ProfFrame));
+  prof.mark = SDL_GetPerformanceCounter();
+  prof.depth = 0;
+  prof.stack[0] = PROF_OTHER;
+}
 
-      float px = x * draw_w;
-      float py = y * draw_h;
+static void prof_charge(void) {
+  uint64_t now = SDL_GetPerformanceCounter();
+  prof.cur.zone[prof.stack[prof.depth]] += now - prof.mark;
+  prof.mark = now;
+}
 
-      glTexCoord2f(g->u0, g->v0); glVertex2f(px, py);
-      glTexCoord2f(g->u1, g->v0); glVertex2f(px + draw_w, py);
-      glTexCoord2f(g->u1, g->v1); glVertex2f(px + draw_w, py + draw_h);
-      glTexCoord2f(g->u0, g->v1); glVertex2f(px, py + draw_h);
-    }
-  }
-  glEnd();
+static void prof_enter(ProfZone z) {
+  if (!prof.ring) return;
+  prof_charge();
+  if (prof.depth + 1 < PROF_STACK) prof.stack[++prof.depth] = z;
 }
 
-static void logbuffer_init(LogBuffer *lb) {
-  lb->lines = NULL;
-  lb->count = 0;
-  lb->cap = 0;
+static void prof_leave(void) {
+  if (!prof.ring) return;
+  prof_charge();
+  if (prof.depth > 0) prof.depth--;
 }
 
-static void logbuffer_clear(LogBuffer *lb) {
-  if (!lb) return;
-  for (size_t i = 0; i < lb->count; ++i) free(lb->lines[i]);
-  lb->count = 0;
+static void prof_frame_end(int state) {
+  if (!prof.ring) return;
+  prof_charge();
+  prof.cur.index = prof.frames;
+  prof.cur.ticks = SDL_GetTicks();
+  prof.cur.state = state;
+  prof.ring[prof.frames % PROF_RING] = prof.cur;
+  prof.frames++;
+  memset(prof.cur.zone, 0, sizeof(prof.cur.zone));
 }
 
-static void logbuffer_free(LogBuffer *lb) {
-  if (!lb) return;
-  logbuffer_clear(lb);
-  free(lb->lines);
-  lb->lines = NULL;
-  lb->cap = 0;
+static double prof_ms(uint64_t t) {
+  return (double)t * 1000.0 / (double)prof.freq;
 }
 
-static void logbuffer_push(LogBuffer *lb, const char *text) {
-  if (!lb || !text) return;
-  if (lb->count + 1 > lb->cap) {
-    size_t new_cap = lb->cap == 0 ? 8 : lb->cap * 2;
-    char **arr = (char **)realloc(lb->lines, new_cap * sizeof(char *));
-    if (!arr) return;
-    lb->lines = arr;
-    lb->cap = new_cap;
+static double prof_frame_work_ms(const ProfFrame *f) {
+  uint64_t sum = 0;
+  for (int z = 0; z < PROF_ZONE_COUNT; ++z) {
+    if (z != PROF_IDLE) sum += f->zone[z];
   }
-  lb->lines[lb->count++] = strdup_safe(text);
+  return prof_ms(sum);
 }
 
-static void logbuffer_apply_full(ValueMap *map, const LogBuffer *lb, size_t max_lines) {
-  char key[32];
-  for (size_t i = 0; i < max_lines; ++i) {
-    snprintf(key, sizeof(key), "log_%zu", i);
-    if (lb && i < lb->count) value_map_set(map, key, lb->lines[i]);
-    else value_map_set(map, key, "");
+static bool prof_write_csv(const char *path) {
+  if (!prof.ring || !path) return false;
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "[pzdc_dungeon_2_gl] cannot write profile: %s\n", path);
+    return false;
+  }
+  fprintf(f, "frame,ticks_ms,state,work_ms");
+  for (int z = 0; z < PROF_ZONE_COUNT; ++z) fprintf(f, ",%s_ms", prof_zone_names[z]);
+  fprintf(f, "\n");
+  uint32_t first = prof.frames > PROF_RING ? prof.frames - PROF_RING : 0;
+  for (uint32_t i = first; i < prof.frames; ++i) {
+    const ProfFrame *fr = &prof.ring[i % PROF_RING];
+    fprintf(f, "%u,%u,%d,%.3f", fr->index, fr->ticks, fr->state, prof_frame_work_ms(fr));
+    for (int z = 0; z < PROF_ZONE_COUNT; ++z) fprintf(f, ",%.3f", prof_ms(fr->zone[z]));
+    fprintf(f, "\n");
   }
+  fclose(f);
+  fprintf(stderr, "[pzdc_dungeon_2_gl] profile written: %s (%u frames)\n", path, prof.frames - first);
+  return true;
 }
 
-static void logbuffer_apply_last(ValueMap *map, const LogBuffer *lb, size_t last_count) {
-  char key[32];
-  for (size_t i = 0; i < last_count; ++i) {
-    snprintf(key, sizeof(key), "log_last%zu", i + 1);
-    if (lb && lb->count > i) {
-      value_map_set(map, key, lb->lines[lb->count - 1 - i]);
-    } else {
-      value_map_set(map, key, "");
+static void prof_free(void) {
+  free(prof.ring);
+  prof.ring = NULL;
+}
+
+// Compiles a method chain into key ids: the first method is a lookup, each
+// later one either rounds the current value or extends the dotted key and,
+// if that key is set, replaces the value with it.
+static void insert_compile_methods(InsertOption *opt) {
+  free(opt->ops);
+  opt->ops = NULL;
+  opt->op_count = 0;
+  if (opt->method_count == 0) return;
+  opt->ops = (MethodOp *)calloc(opt->method_count, sizeof(MethodOp));
+  if (!opt->ops) return;
+  char key[128];
+  snprintf(key, sizeof(key), "%s", opt->methods[0]);
+  opt->ops[opt->op_count++] = (MethodOp){METHOD_LOOKUP, key_intern_get(key, NULL)};
+  for (size_t i = 1; i < opt->method_count; ++i) {
+    if (strcmp(opt->methods[i], "round") == 0) {
+      opt->ops[opt->op_count++] = (MethodOp){METHOD_ROUND, 0};
+    } else if (strlen(key) + strlen(opt->methods[i]) + 2 < sizeof(key)) {
+      strcat(key, ".");
+      strcat(key, opt->methods[i]);
+      opt->ops[opt->op_count++] = (MethodOp){METHOD_LOOKUP, key_intern_get(key, NULL)};
     }
   }
 }
 
-static const char *default_font_path(void) {
-  static const char *candidates[] = {
-    "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf",
-    "/usr/share/fonts/truetype/liberation/LiberationMono-Regular.ttf",
-    "/Library/Fonts/Menlo.ttc",
-    "C:/Windows/Fonts/consola.ttf",
-  };
-  for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
-    if (file_exists(candidates[i])) return candidates[i];
+// Binds each insert to its placeholder run in the template's cells (the first
+// run of 3+ placeholder characters on its line that no earlier insert took)
+// and compiles its method chain. Done once per cached template, so
+// substitution is a few indexed fetches and a plain cell write.
+static void menu_bind_inserts(Menu *menu) {
+  for (size_t i = 0; i < menu->insert_count; ++i) {
+    InsertOption *opt = &menu->inserts[i];
+    insert_compile_methods(opt);
+    opt->col = -1;
+    opt->width = 0;
+    if (opt->line_idx < 0 || (size_t)opt->line_idx >= menu->view.line_count) continue;
+    const Line *line = &menu->view.lines[opt->line_idx];
+    uint32_t ph = (uint32_t)(unsigned char)opt->placeholder;
+    for (size_t x = 0; x < line->len_cells && opt->col < 0;) {
+      if (line->cells[x] != ph) {
+        x++;
+        continue;
+      }
+      size_t start = x;
+      while (x < line->len_cells && line->cells[x] == ph) x++;
+      if (x - start < 3) continue;
+      bool taken = false;
+      for (size_t k = 0; k < i && !taken; ++k) {
+        taken = menu->inserts[k].line_idx == opt->line_idx && menu->inserts[k].col == (int)start;
+      }
+      if (taken) continue;
+      opt->col = (int)start;
+      opt->width = (int)(x - start);
+    }
   }
-  return NULL;
 }
 
-static int character_min_dmg(const Character *c) {
-  int weapon_min = c->weapon.min_dmg + c->weapon.enhance_min_dmg;
-  int shield_min = c->shield.min_dmg + c->shield.enhance_min_dmg;
-  if (weapon_min < 0) weapon_min = 0;
-  if (shield_min < 0) shield_min = 0;
-  return c->min_dmg_base + weapon_min + shield_min;
-}
+// Views never change during a session, so every menu and art file is parsed
+// once per resolved path and kept with its cells already built.
+typedef struct {
+  char *path;
+  uint32_t hash;
+  bool is_art;
+  bool ok;
+  Menu menu;
+  ArtFile art;
+} AssetEntry;
 
-static int character_max_dmg(const Character *c) {
-  int weapon_max = c->weapon.max_dmg + c->weapon.enhance_max_dmg;
-  int shield_max = c->shield.max_dmg + c->shield.enhance_max_dmg;
-  if (weapon_max < 0) weapon_max = 0;
-  if (shield_max < 0) shield_max = 0;
-  return c->max_dmg_base + weapon_max + shield_max;
-}
+typedef struct {
+  AssetEntry *entries;
+  size_t count;
+  size_t cap;
+} AssetCache;
 
-static int character_accuracy(const Character *c) {
-  return c->accuracy_base + c->weapon.accuracy + c->weapon.enhance_accuracy +
-         c->body_armor.accuracy + c->body_armor.enhance_accuracy +
-         c->head_armor.accuracy + c->head_armor.enhance_accuracy +
-         c->arms_armor.accuracy + c->arms_armor.enhance_accuracy +
-         c->shield.accuracy + c->shield.enhance_accuracy;
-}
+static AssetCache asset_cache;
+static uint32_t asset_cache_generation;
 
-static int character_armor(const Character *c) {
-  int body = c->body_armor.armor + c->body_armor.enhance_armor;
-  int head = c->head_armor.armor + c->head_armor.enhance_armor;
-  int arms = c->arms_armor.armor + c->arms_armor.enhance_armor;
-  int shield = c->shield.armor + c->shield.enhance_armor;
-  if (body < 0) body = 0;
-  if (head < 0) head = 0;
-  if (arms < 0) arms = 0;
-  if (shield < 0) shield = 0;
-  return c->armor_base + body + head + arms + shield;
+static AssetEntry *asset_cache_get(const char *path, bool is_art) {
+  if (!path) return NULL;
+  uint32_t hash = hash_str(path);
+  for (size_t i = 0; i < asset_cache.count; ++i) {
+    AssetEntry *e = &asset_cache.entries[i];
+    if (e->hash == hash && e->is_art == is_art && strcmp(e->path, path) == 0) return e;
+  }
+
+  if (asset_cache.count + 1 > asset_cache.cap) {
+    size_t new_cap = asset_cache.cap == 0 ? 64 : asset_cache.cap * 2;
+    AssetEntry *arr = (AssetEntry *)realloc(asset_cache.entries, new_cap * sizeof(AssetEntry));
+    if (!arr) return NULL;
+    asset_cache.entries = arr;
+    asset_cache.cap = new_cap;
+  }
+  AssetEntry *e = &asset_cache.entries[asset_cache.count++];
+  memset(e, 0, sizeof(*e));
+  e->path = strdup_safe(path);
+  e->hash = hash;
+  e->is_art = is_art;
+  const BundleEntry *be = view_bundle_find(path, is_art);
+  if (be) {
+    ByteReader r = {be->payload, be->payload + be->payload_len, true};
+    e->ok = is_art ? bundle_read_artfile(&r, &e->art) : bundle_read_menu(&r, &e->menu);
+  }
+  if (!e->ok && is_art) {
+    e->ok = artfile_load(path, &e->art);
+    for (size_t i = 0; e->ok && i < e->art.art_count; ++i) view_build_cells(&e->art.arts[i].view);
+  } else if (!e->ok) {
+    e->ok = menu_load(path, &e->menu);
+    if (e->ok) view_build_cells(&e->menu.view);
+  }
+  if (e->ok && !is_art) menu_bind_inserts(&e->menu);
+  return e;
+}
+
+static bool menu_load_cached(const char *path, Menu *menu) {
+  if (!path || !menu) return false;
+  prof_enter(PROF_LOAD);
+  AssetEntry *e = asset_cache_get(path, false);
+  if (!e || !e->ok) {
+    memset(menu, 0, sizeof(*menu));
+  } else {
+    menu_copy(menu, &e->menu);
+  }
+  prof_leave();
+  return menu->view.line_count > 0;
 }
 
-static int character_armor_penetration(const Character *c) {
-  int pen = c->weapon.armor_penetration + c->weapon.enhance_armor_penetration;
-  if (pen < 0) pen = 0;
-  return c->armor_penetration_base + pen;
+static ArtFile *artfile_load_cached(const char *path) {
+  prof_enter(PROF_LOAD);
+  AssetEntry *e = asset_cache_get(path, true);
+  prof_leave();
+  return (e && e->ok) ? &e->art : NULL;
 }
 
-static int character_block_chance(const Character *c) {
-  int res = c->block_chance_base + c->weapon.block_chance + c->weapon.enhance_block_chance +
-            c->shield.block_chance + c->shield.enhance_block_chance;
-  if (strcmp(c->passive_skill.code, "shield_master") == 0 && strcmp(c->shield.code, "without") != 0) {
-    res += 10 + 2 * c->passive_skill.lvl;
+static void asset_cache_free(void) {
+  for (size_t i = 0; i < asset_cache.count; ++i) {
+    AssetEntry *e = &asset_cache.entries[i];
+    free(e->path);
+    free_menu(&e->menu);
+    free_art_file(&e->art);
   }
-  return res;
+  free(asset_cache.entries);
+  memset(&asset_cache, 0, sizeof(asset_cache));
+  asset_cache_generation++;
 }
 
-static int block_power_in_percents(const Character *c) {
-  if (!c) return 0;
-  double coeff = 1.0 + (double)c->hp / 200.0;
-  if (coeff <= 0.0) return 0;
-  int res = 100 - (int)(100.0 / coeff);
-  return res < 0 ? 0 : res;
+static char *read_version(const char *path) {
+  if (!path) return NULL;
+  FILE *f = fopen(path, "r");
+  if (!f) return NULL;
+  char *line = NULL;
+  size_t cap = 0;
+  char *version = NULL;
+  while (getline(&line, &cap, f) != -1) {
+    char *p = strstr(line, "VERSION");
+    if (p) {
+      char *q = strchr(p, '\'');
+      if (q) {
+        char *r = strchr(q + 1, '\'');
+        if (r && r > q + 1) {
+          size_t n = (size_t)(r - q - 1);
+          version = (char *)malloc(n + 4);
+          if (version) {
+            memcpy(version, "v ", 2);
+            memcpy(version + 2, q + 1, n);
+            version[2 + n] = '\0';
+          }
+          break;
+        }
+      }
+    }
+  }
+  free(line);
+  fclose(f);
+  return version;
 }
 
-static int character_recovery_hp(const Character *c) {
-  return (int)round(c->hp_max * 0.1);
+// Writes value into a bound placeholder run, truncated or padded to the run's
+// width in cells. 'm' centers the value and 'e' right-aligns it.
+static void insert_write_cells(uint32_t *row, const InsertOption *opt, const char *value) {
+  if (opt->col < 0) return;
+  uint32_t *cells = row + opt->col;
+  size_t width = (size_t)opt->width;
+  size_t len = strlen(value);
+  size_t n = 0;
+  for (size_t j = 0; j < len && n < width;) {
+    uint32_t cp = 0;
+    j += utf8_decode(value, len, j, &cp);
+    cells[n++] = cp;
+  }
+  if (n == width) return;
+  size_t pad = width - n;
+  size_t left = opt->modifier == 'm' ? pad / 2 : (opt->modifier == 'e' ? pad : 0);
+  if (left > 0) memmove(cells + left, cells, n * sizeof(uint32_t));
+  for (size_t c = 0; c < left; ++c) cells[c] = (uint32_t)' ';
+  for (size_t c = left + n; c < width; ++c) cells[c] = (uint32_t)' ';
+}
+
+static void menu_write_insert(View *view, const InsertOption *opt, const char *value) {
+  if (!view || !opt || !value || opt->col < 0) return;
+  insert_write_cells(view->lines[opt->line_idx].cells, opt, value);
+}
+
+// Evaluates a compiled method chain. The result points into the map or into
+// buf and stays valid until either changes.
+static const char *insert_eval(const ValueMap *map, const InsertOption *opt, char *buf, size_t buf_size) {
+  const char *current = "";
+  for (size_t i = 0; i < opt->op_count; ++i) {
+    const MethodOp *op = &opt->ops[i];
+    if (op->type == METHOD_ROUND) {
+      snprintf(buf, buf_size, "%.0f", round(atof(current)));
+      current = buf;
+      continue;
+    }
+    KV *kv = value_map_find(map, op->key_id);
+    const char *text = kv ? value_map_kv_text(kv, buf, buf_size) : NULL;
+    if (text) current = text;
+  }
+  return current;
 }
 
-static int character_recovery_mp(const Character *c) {
-  return (int)round(c->mp_max * 0.1);
+static void apply_inserts(Menu *menu, ValueMap *map, char **keep_values) {
+  char buf[64];
+  for (size_t i = 0; i < menu->insert_count; ++i) {
+    const InsertOption *opt = &menu->inserts[i];
+    const char *value = insert_eval(map, opt, buf, sizeof(buf));
+    menu_write_insert(&menu->view, opt, value);
+    if (keep_values) keep_values[i] = strdup_safe(value);
+  }
 }
 
-static void skill_init_empty(Skill *s, SkillType type) {
-  if (!s) return;
-  memset(s, 0, sizeof(*s));
-  s->type = type;
-  snprintf(s->code, sizeof(s->code), "none");
-  snprintf(s->name, sizeof(s->name), "---");
+static void insert_view(View *dst, const View *src, int y0, int x0) {
+  if (!dst || !src) return;
+  for (int y = 0; y < (int)src->line_count; ++y) {
+    int dy = y0 + y;
+    if (dy < 0 || dy >= (int)dst->line_count) continue;
+    Line *dline = &dst->lines[dy];
+    Line *sline = (Line *)&src->lines[y];
+    for (int x = 0; x < (int)src->max_cols; ++x) {
+      int dx = x0 + x;
+      if (dx < 0 || dx >= (int)dst->max_cols) continue;
+      dline->cells[dx] = sline->cells[x];
+    }
+  }
 }
 
-static void skill_assign(Skill *s, SkillType type, const char *code) {
-  if (!s) return;
-  memset(s, 0, sizeof(*s));
-  s->type = type;
-  snprintf(s->code, sizeof(s->code), "%s", code ? code : "none");
-  s->lvl = 0;
-
-  if (strcmp(s->code, "ascetic_strike") == 0) { snprintf(s->name, sizeof(s->name), "Ascetic strike"); s->mp_cost = 2; }
-  else if (strcmp(s->code, "precise_strike") == 0) { snprintf(s->name, sizeof(s->name), "Precise strike"); s->mp_cost = 8; }
-  else if (strcmp(s->code, "strong_strike") == 0) { snprintf(s->name, sizeof(s->name), "Strong strike"); s->mp_cost = 12; }
-  else if (strcmp(s->code, "traumatic_strike") == 0) { snprintf(s->name, sizeof(s->name), "Traumatic strike"); s->mp_cost = 6; }
-  else if (strcmp(s->code, "berserk") == 0) { snprintf(s->name, sizeof(s->name), "Berserk"); }
-  else if (strcmp(s->code, "concentration") == 0) { snprintf(s->name, sizeof(s->name), "Concentration"); }
-  else if (strcmp(s->code, "dazed") == 0) { snprintf(s->name, sizeof(s->name), "Dazed"); }
-  else if (strcmp(s->code, "shield_master") == 0) { snprintf(s->name, sizeof(s->name), "Shield master"); }
-  else if (strcmp(s->code, "bloody_ritual") == 0) { snprintf(s->name, sizeof(s->name), "Bloody ritual"); s->hp_cost = 10; }
-  else if (strcmp(s->code, "first_aid") == 0) { snprintf(s->name, sizeof(s->name), "First aid"); s->mp_cost = 10; }
-  else if (strcmp(s->code, "treasure_hunter") == 0) { snprintf(s->name, sizeof(s->name), "Treasure hunter"); }
-  else { snprintf(s->name, sizeof(s->name), "---"); }
+static void align_art_to_field(const ArtSlot *slot, int art_w, int art_h, int *out_x, int *out_y) {
+  int field_y_center = (slot->y0 + slot->y1) / 2;
+  int field_x_center = (slot->x0 + slot->x1) / 2;
+  int y_half_1 = art_h / 2 - ((art_h % 2 == 1) ? 0 : 1);
+  int y_min = field_y_center - y_half_1;
+  int x_half_1 = art_w / 2 - ((art_w % 2 == 1) ? 0 : 1);
+  int x_min = field_x_center - x_half_1;
+  *out_x = x_min;
+  *out_y = y_min;
 }
 
-static WeaponItem weapon_from_code(const Game *g, const char *code);
-static ArmorItem armor_from_code(const ArmorItem *items, size_t count, const char *code);
-static ShieldItem shield_from_code(const Game *g, const char *code);
-static const char *pick_random_option(char **list, size_t count);
-static const HeroTemplate *hero_template_by_code(const Game *g, const char *code);
-static bool save_warehouse_data(const WarehouseData *wh);
-static const char *ammo_name(Game *g, const char *type, const char *code);
-static void hero_rest(Character *hero, LogBuffer *log);
-static bool save_shop_data(const ShopData *shop);
-static bool save_monolith_data(const MonolithData *m);
-static void titleize_token(const char *in, char *out, size_t out_sz);
-static const EnemyTemplate *enemy_template_boss(const DungeonData *d);
-static const EnemyTemplate *enemy_template_random_standard(const DungeonData *d, int leveling);
-static int enemy_choices_count_for(const Character *hero);
-
-static const HeroTemplate *hero_template_by_code(const Game *g, const char *code) {
-  if (!g || !code) return NULL;
-  for (size_t i = 0; i < g->hero_count; ++i) {
-    if (strcmp(g->heroes[i].code, code) == 0) return &g->heroes[i];
+static const Art *compose_find_art(const ArtArg *arg) {
+  if (!arg->name || !arg->path) return NULL;
+  char *art_path = resolve_art_path(arg->path);
+  if (!art_path) return NULL;
+  const Art *art = NULL;
+  ArtFile *file = artfile_load_cached(art_path);
+  if (file) {
+    art = artfile_find(file, arg->name);
+    if (!art && strcmp(arg->name, "normal") != 0) art = artfile_find(file, "normal");
   }
-  return NULL;
+  free(art_path);
+  return art;
 }
 
-static Character character_from_hero(Game *g, const HeroTemplate *t, const char *name) {
-  Character c;
-  memset(&c, 0, sizeof(c));
-  snprintf(c.code, sizeof(c.code), "%s", t->code);
-  snprintf(c.name, sizeof(c.name), "%s", name ? name : t->name);
-  snprintf(c.background, sizeof(c.background), "%s", t->code);
-  c.hp = t->hp;
-  c.hp_max = t->hp;
-  c.mp = t->mp;
-  c.mp_max = t->mp;
-  c.regen_hp_base = 0;
-  c.regen_mp_base = 0;
-  c.min_dmg_base = t->min_dmg;
-  c.max_dmg_base = t->max_dmg;
-  c.armor_penetration_base = t->armor_penetration;
-  c.accuracy_base = t->accuracy;
-  c.armor_base = t->armor;
-  c.block_chance_base = 0;
-  c.exp = 0;
-  c.lvl = 0;
-  c.stat_points = 5;
-  c.skill_points = t->skill_points;
-  c.pzdc_monolith_points = 0;
-  c.coins = 0;
-  c.exp_gived = 0;
-  c.coins_gived = 0;
-  c.dungeon_part_number = 1;
-  c.leveling = 0;
-  c.ingredients.items = NULL;
-  c.ingredients.count = 0;
-  snprintf(c.ingredient, sizeof(c.ingredient), "without");
+static void compose_values_free(char **values, size_t count) {
+  if (!values) return;
+  for (size_t i = 0; i < count; ++i) free(values[i]);
+  free(values);
+}
 
-  const char *weapon_code = pick_random_option(t->weapon_options, t->weapon_count);
-  const char *body_code = pick_random_option(t->body_armor_options, t->body_armor_count);
-  const char *head_code = pick_random_option(t->head_armor_options, t->head_armor_count);
-  const char *arms_code = pick_random_option(t->arms_armor_options, t->arms_armor_count);
-  const char *shield_code = pick_random_option(t->shield_options, t->shield_count);
+// Composed partials, shared by every screen and compose that binds the same
+// values. A layer is immutable while more than one holder references it; a
+// holder that needs other values takes its own copy first. Layers borrow the
+// asset cache's templates and are dropped once it is flushed.
+#define PARTIAL_LAYER_MAX 32
 
-  c.weapon = weapon_from_code(g, weapon_code);
-  c.body_armor = armor_from_code(g->body_armors, g->body_armor_count, body_code);
-  c.head_armor = armor_from_code(g->head_armors, g->head_armor_count, head_code);
-  c.arms_armor = armor_from_code(g->arms_armors, g->arms_armor_count, arms_code);
-  c.shield = shield_from_code(g, shield_code);
+typedef struct {
+  char *path;
+  uint32_t generation;
+  uint64_t hash; // of the substituted values
+  Menu menu;
+  char **values;
+  uint32_t refs;
+  uint32_t last_used;
+} PartialLayer;
 
-  skill_init_empty(&c.active_skill, SKILL_ACTIVE);
-  skill_init_empty(&c.passive_skill, SKILL_PASSIVE);
-  skill_init_empty(&c.camp_skill, SKILL_CAMP);
+typedef struct {
+  PartialLayer **items;
+  size_t count;
+  size_t cap;
+  uint32_t clock;
+} PartialLayerPool;
 
-  return c;
-}
+static PartialLayerPool partial_layers;
 
-static Character character_from_enemy(Game *g, const EnemyTemplate *t) {
-  Character c;
-  memset(&c, 0, sizeof(c));
-  snprintf(c.code, sizeof(c.code), "%s", t->code_name);
-  snprintf(c.name, sizeof(c.name), "%s", t->name);
-  c.hp = t->hp;
-  c.hp_max = t->hp;
-  c.mp = 0;
-  c.mp_max = 0;
-  c.regen_hp_base = t->regen_hp;
-  c.regen_mp_base = 0;
-  c.min_dmg_base = t->min_dmg;
-  c.max_dmg_base = t->max_dmg;
-  c.armor_penetration_base = t->armor_penetration;
-  c.accuracy_base = t->accuracy;
-  c.armor_base = t->armor;
-  c.block_chance_base = 0;
-  c.exp = 0;
-  c.lvl = 0;
-  c.stat_points = 0;
-  c.skill_points = 0;
-  c.exp_gived = t->exp_gived;
-  c.coins_gived = t->coins_gived;
-  c.ingredients.items = NULL;
-  c.ingredients.count = 0;
-  snprintf(c.ingredient, sizeof(c.ingredient), "without");
+static uint64_t partial_values_hash(const Menu *tmpl, const ValueMap *map) {
+  char buf[64];
+  uint64_t h = 1469598103934665603ull;
+  for (size_t i = 0; i < tmpl->insert_count; ++i) {
+    for (const char *v = insert_eval(map, &tmpl->inserts[i], buf, sizeof(buf)); *v; ++v) {
+      h = (h ^ (unsigned char)*v) * 1099511628211ull;
+    }
+    h = (h ^ 0xffu) * 1099511628211ull;
+  }
+  return h;
+}
 
-  const char *weapon_code = pick_random_option(t->weapon_options, t->weapon_count);
-  const char *body_code = pick_random_option(t->body_armor_options, t->body_armor_count);
-  const char *head_code = pick_random_option(t->head_armor_options, t->head_armor_count);
-  const char *arms_code = pick_random_option(t->arms_armor_options, t->arms_armor_count);
-  const char *shield_code = pick_random_option(t->shield_options, t->shield_count);
-  const char *ingredient_code = pick_random_option(t->ingredient_options, t->ingredient_count);
+static bool partial_layer_matches(const PartialLayer *l, const ValueMap *map) {
+  char buf[64];
+  for (size_t i = 0; i < l->menu.insert_count; ++i) {
+    const char *value = insert_eval(map, &l->menu.inserts[i], buf, sizeof(buf));
+    if (!l->values[i] || strcmp(l->values[i], value) != 0) return false;
+  }
+  return true;
+}
 
-  c.weapon = weapon_from_code(g, weapon_code);
-  c.body_armor = armor_from_code(g->body_armors, g->body_armor_count, body_code);
-  c.head_armor = armor_from_code(g->head_armors, g->head_armor_count, head_code);
-  c.arms_armor = armor_from_code(g->arms_armors, g->arms_armor_count, arms_code);
-  c.shield = shield_from_code(g, shield_code);
-  snprintf(c.ingredient, sizeof(c.ingredient), "%s", ingredient_code ? ingredient_code : "without");
+static void partial_layer_destroy(PartialLayer *l) {
+  compose_values_free(l->values, l->menu.insert_count);
+  free_menu(&l->menu);
+  free(l->path);
+  free(l);
+}
 
-  skill_init_empty(&c.active_skill, SKILL_ACTIVE);
-  skill_init_empty(&c.passive_skill, SKILL_PASSIVE);
-  skill_init_empty(&c.camp_skill, SKILL_CAMP);
+// Drops unreferenced layers of a flushed asset cache, then the least recently
+// used unreferenced ones until at most keep remain.
+static void partial_layers_trim(size_t keep) {
+  size_t n = 0;
+  for (size_t i = 0; i < partial_layers.count; ++i) {
+    PartialLayer *l = partial_layers.items[i];
+    if (l->refs == 0 && l->generation != asset_cache_generation) {
+      partial_layer_destroy(l);
+    } else {
+      partial_layers.items[n++] = l;
+    }
+  }
+  partial_layers.count = n;
+  while (partial_layers.count > keep) {
+    size_t victim = partial_layers.count;
+    for (size_t i = 0; i < partial_layers.count; ++i) {
+      const PartialLayer *l = partial_layers.items[i];
+      if (l->refs == 0 && (victim == partial_layers.count || l->last_used < partial_layers.items[victim]->last_used)) {
+        victim = i;
+      }
+    }
+    if (victim == partial_layers.count) break;
+    partial_layer_destroy(partial_layers.items[victim]);
+    partial_layers.items[victim] = partial_layers.items[--partial_layers.count];
+  }
+}
+
+// Adds a layer holding a copy of src's cells, referenced once by the caller.
+static PartialLayer *partial_layer_add(const char *path, const Menu *src) {
+  partial_layers_trim(PARTIAL_LAYER_MAX - 1);
+  if (partial_layers.count + 1 > partial_layers.cap) {
+    size_t new_cap = partial_layers.cap == 0 ? PARTIAL_LAYER_MAX : partial_layers.cap * 2;
+    PartialLayer **items = (PartialLayer **)realloc(partial_layers.items, new_cap * sizeof(PartialLayer *));
+    if (!items) return NULL;
+    partial_layers.items = items;
+    partial_layers.cap = new_cap;
+  }
+  PartialLayer *l = (PartialLayer *)calloc(1, sizeof(PartialLayer));
+  if (!l) return NULL;
+  l->path = strdup_safe(path);
+  l->values = (char **)calloc(src->insert_count ? src->insert_count : 1, sizeof(char *));
+  menu_copy(&l->menu, src);
+  if (!l->path || !l->values || l->menu.view.line_count != src->view.line_count) {
+    partial_layer_destroy(l);
+    return NULL;
+  }
+  l->generation = asset_cache_generation;
+  l->refs = 1;
+  l->last_used = ++partial_layers.clock;
+  partial_layers.items[partial_layers.count++] = l;
+  return l;
+}
+
+// Returns the partial at path composed with map's values, reusing a layer
+// that already holds them.
+static PartialLayer *partial_layer_acquire(const char *path, const ValueMap *map) {
+  AssetEntry *e = asset_cache_get(path, false);
+  if (!e || !e->ok || e->menu.view.line_count == 0) return NULL;
+  uint64_t hash = partial_values_hash(&e->menu, map);
+  for (size_t i = 0; i < partial_layers.count; ++i) {
+    PartialLayer *l = partial_layers.items[i];
+    if (l->generation != asset_cache_generation || l->hash != hash || strcmp(l->path, path) != 0) continue;
+    if (!partial_layer_matches(l, map)) continue;
+    l->refs++;
+    l->last_used = ++partial_layers.clock;
+    return l;
+  }
+  PartialLayer *l = partial_layer_add(path, &e->menu);
+  if (!l) return NULL;
+  apply_inserts(&l->menu, (ValueMap *)map, l->values);
+  l->hash = hash;
+  return l;
+}
+
+// Returns a layer the caller may modify: l itself if nobody else holds it,
+// otherwise a private copy with l's values.
+static PartialLayer *partial_layer_unshare(PartialLayer *l) {
+  if (l->refs == 1) return l;
+  PartialLayer *copy = partial_layer_add(l->path, &l->menu);
+  if (!copy) return NULL;
+  for (size_t i = 0; i < l->menu.insert_count; ++i) {
+    copy->values[i] = l->values[i] ? strdup_safe(l->values[i]) : NULL;
+  }
+  copy->hash = l->hash;
+  l->refs--;
+  return copy;
+}
+
+static void partial_layer_release(PartialLayer *l) {
+  if (l && l->refs > 0) l->refs--;
+}
+
+static void partial_layers_free(void) {
+  for (size_t i = 0; i < partial_layers.count; ++i) partial_layer_destroy(partial_layers.items[i]);
+  free(partial_layers.items);
+  memset(&partial_layers, 0, sizeof(partial_layers));
+}
+
+// What the last compose of a screen was built from. A battle turn usually
+// changes a handful of values on an otherwise identical screen, so the next
+// compose of the same template rewrites only the runs whose values changed
+// and rebuilds just those rows from their layers: template row with the main
+// inserts, then partials, then arts, in the same order compose_menu blits them.
+typedef struct {
+  PartialLayer *layer;
+  ValueMap *map;
+} ComposePartial;
 
-  return c;
-}
+typedef struct {
+  const View *view;
+  int x, y, h;
+} ComposeArt;
 
-static void hero_add_dmg_base(Character *h, int n) {
-  if (!h || n <= 0) return;
-  for (int i = 0; i < n; ++i) {
-    if (h->min_dmg_base < h->max_dmg_base && rand_range(0, 1) == 0) {
-      h->min_dmg_base += 1;
+typedef struct {
+  bool valid;
+  uint32_t asset_generation; // partial and art views point into the asset cache
+  char *menu_path;
+  char **values; // last value per main insert
+  size_t value_count;
+  ComposePartial *partials;
+  size_t partial_count;
+  ComposeArt *arts;
+  size_t art_count;
+  size_t rows;
+  size_t cols;
+  bool *row_marks;
+  uint32_t *scratch;
+  // Result of the last compose: full, or one bit per changed cell, row-major.
+  bool full;
+  uint32_t *dirty_bits;
+  size_t cells_touched;
+} Composer;
+
+static size_t composer_dirty_words(const Composer *c) {
+  return (c->rows * c->cols + 31) / 32;
+}
+
+static void composer_reset(Composer *c) {
+  compose_values_free(c->values, c->value_count);
+  for (size_t i = 0; i < c->partial_count; ++i) partial_layer_release(c->partials[i].layer);
+  free(c->partials);
+  free(c->arts);
+  free(c->menu_path);
+  free(c->row_marks);
+  free(c->scratch);
+  free(c->dirty_bits);
+  memset(c, 0, sizeof(*c));
+}
+
+static void compose_menu_ex(Menu *menu, ValueMap *main_map, ValueMap **partial_maps, size_t partial_map_count,
+                            ArtArg *art_args, size_t art_arg_count, Composer *c, const char *menu_path) {
+  if (c) {
+    composer_reset(c);
+    c->values = (char **)calloc(menu->insert_count ? menu->insert_count : 1, sizeof(char *));
+    c->partials = (ComposePartial *)calloc(menu->partial_count ? menu->partial_count : 1, sizeof(ComposePartial));
+    c->arts = (ComposeArt *)calloc(menu->art_count ? menu->art_count : 1, sizeof(ComposeArt));
+    if (!c->values || !c->partials || !c->arts) {
+      composer_reset(c);
+      c = NULL;
     } else {
-      h->max_dmg_base += 1;
+      c->value_count = menu->insert_count;
+      c->partial_count = menu->partial_count;
+      c->art_count = menu->art_count;
     }
   }
-}
 
-static void hero_reduce_dmg_base(Character *h, int n) {
-  if (!h || n <= 0) return;
-  for (int i = 0; i < n; ++i) {
-    if (h->max_dmg_base > h->min_dmg_base && rand_range(0, 1) == 0) {
-      if (h->max_dmg_base > 0) h->max_dmg_base -= 1;
+  apply_inserts(menu, main_map, c ? c->values : NULL);
+
+  for (size_t i = 0; i < menu->partial_count; ++i) {
+    PartialSlot *slot = &menu->partials[i];
+    if (!slot->name) continue;
+    char *partial_path = resolve_menu_path(slot->name);
+    if (!partial_path) continue;
+
+    ValueMap *map = main_map;
+    if (partial_maps && i < partial_map_count && partial_maps[i]) map = partial_maps[i];
+    PartialLayer *layer = partial_layer_acquire(partial_path, map);
+    free(partial_path);
+    if (!layer) continue;
+    insert_view(&menu->view, &layer->menu.view, slot->y0, slot->x0);
+    if (c) {
+      c->partials[i] = (ComposePartial){layer, map};
     } else {
-      if (h->min_dmg_base > 0) h->min_dmg_base -= 1;
+      partial_layer_release(layer);
     }
-    if (h->max_dmg_base < h->min_dmg_base) h->max_dmg_base = h->min_dmg_base;
   }
-}
 
-static void hero_add_hp(Character *h, int amount) {
-  if (!h || amount <= 0) return;
-  if (h->hp + amount > h->hp_max) amount = h->hp_max - h->hp;
-  if (amount < 0) amount = 0;
-  h->hp += amount;
+  size_t count = menu->art_count < art_arg_count ? menu->art_count : art_arg_count;
+  for (size_t i = 0; i < count; ++i) {
+    const Art *art = compose_find_art(&art_args[i]);
+    if (!art) continue;
+    int x = 0, y = 0;
+    align_art_to_field(&menu->arts[i], (int)art->view.max_cols, (int)art->view.line_count, &x, &y);
+    insert_view(&menu->view, &art->view, y, x);
+    if (c) c->arts[i] = (ComposeArt){&art->view, x, y, (int)art->view.line_count};
+  }
+
+  if (c) {
+    c->rows = menu->view.line_count;
+    c->cols = menu->view.max_cols;
+    c->row_marks = (bool *)calloc(c->rows ? c->rows : 1, sizeof(bool));
+    c->scratch = (uint32_t *)malloc((c->cols ? c->cols : 1) * sizeof(uint32_t));
+    c->dirty_bits = (uint32_t *)calloc(composer_dirty_words(c) + 1, sizeof(uint32_t));
+    c->menu_path = menu_path ? strdup_safe(menu_path) : NULL;
+    c->asset_generation = asset_cache_generation;
+    c->full = true;
+    c->cells_touched = c->rows * c->cols;
+    c->valid = c->menu_path && c->row_marks && c->scratch && c->dirty_bits;
+  }
 }
 
-static void hero_add_mp(Character *h, int amount) {
-  if (!h || amount <= 0) return;
-  if (h->mp + amount > h->mp_max) amount = h->mp_max - h->mp;
-  if (amount < 0) amount = 0;
-  h->mp += amount;
+static void compose_menu(Menu *menu, ValueMap *main_map, ValueMap **partial_maps, size_t partial_map_count, ArtArg *art_args, size_t art_arg_count) {
+  compose_menu_ex(menu, main_map, partial_maps, partial_map_count, art_args, art_arg_count, NULL, NULL);
 }
 
-static void hero_reduce_mp(Character *h, int amount) {
-  if (!h || amount <= 0) return;
-  if (amount > h->mp) amount = h->mp;
-  h->mp -= amount;
+static void compose_mark_rows(Composer *c, int y0, int count) {
+  for (int y = y0; y < y0 + count; ++y) {
+    if (y >= 0 && (size_t)y < c->rows) c->row_marks[y] = true;
+  }
 }
 
-static void hero_reduce_coins(Character *h, int amount) {
-  if (!h || amount <= 0) return;
-  if (amount > h->coins) amount = h->coins;
-  h->coins -= amount;
+static void compose_blit_row(uint32_t *row, size_t cols, const View *src, int y, int y0, int x0) {
+  int r = y - y0;
+  if (r < 0 || r >= (int)src->line_count) return;
+  const uint32_t *cells = src->lines[r].cells;
+  for (int x = 0; x < (int)src->max_cols; ++x) {
+    int dx = x0 + x;
+    if (dx >= 0 && dx < (int)cols) row[dx] = cells[x];
+  }
 }
 
-static void apply_monolith_bonuses(const MonolithData *m, Character *h) {
-  if (!m || !h) return;
-  h->hp_max += m->hp;
-  h->hp += m->hp;
-  h->mp_max += m->mp;
-  h->mp += m->mp;
-  h->accuracy_base += m->accuracy;
-  hero_add_dmg_base(h, m->damage);
-  h->stat_points += m->stat_points;
-  h->skill_points += m->skill_points;
-  h->armor_base += m->armor;
-  h->armor_penetration_base += m->armor_penetration;
-  h->regen_hp_base += m->regen_hp;
-  h->regen_mp_base += m->regen_mp;
-  h->block_chance_base += m->block_chance;
+// Recomputes row y from the pristine template row: main inserts, then
+// partials, then arts. Only cells that differ are written back and marked dirty.
+static void compose_rebuild_row(Composer *c, Menu *menu, const View *tmpl, int y) {
+  Line *line = &menu->view.lines[y];
+  uint32_t *row = c->scratch;
+  memcpy(row, tmpl->lines[y].cells, c->cols * sizeof(uint32_t));
+  for (size_t i = 0; i < menu->insert_count; ++i) {
+    const InsertOption *opt = &menu->inserts[i];
+    if (opt->line_idx == y && c->values[i]) insert_write_cells(row, opt, c->values[i]);
+  }
+  for (size_t i = 0; i < c->partial_count; ++i) {
+    const PartialLayer *l = c->partials[i].layer;
+    if (l) compose_blit_row(row, c->cols, &l->menu.view, y, menu->partials[i].y0, menu->partials[i].x0);
+  }
+  for (size_t i = 0; i < c->art_count; ++i) {
+    if (c->arts[i].view) compose_blit_row(row, c->cols, c->arts[i].view, y, c->arts[i].y, c->arts[i].x);
+  }
+  size_t base = (size_t)y * c->cols;
+  for (size_t x = 0; x < c->cols; ++x) {
+    if (line->cells[x] == row[x]) continue;
+    line->cells[x] = row[x];
+    c->dirty_bits[(base + x) / 32] |= 1u << ((base + x) % 32);
+    c->cells_touched++;
+  }
 }
 
-static void apply_statistics_bonuses(const StatisticsTotal *s, Game *g, Character *h) {
-  if (!s || !g || !h) return;
-  if (s->bandits[0] >= 30) h->weapon = weapon_from_code(g, "stick");
-  if (s->bandits[1] >= 30) { h->hp_max += 2; h->hp += 2; }
-  if (s->bandits[2] >= 30) h->accuracy_base += 1;
-  if (s->bandits[3] >= 30) { h->hp_max += 5; h->hp += 5; }
-  if (s->bandits[4] >= 30) h->stat_points += 1;
-  if (s->bandits[5] >= 5) h->skill_points += 1;
+// Re-evaluates every insert of m and records the changed ones. A partial's
+// cells are a layer for compose_rebuild_row, so its runs are rewritten here;
+// the main view's rows are rebuilt from the template afterwards.
+static bool compose_patch_values(Composer *c, Menu *m, char **values, ValueMap *map, int row_offset, bool layer) {
+  char buf[64];
+  for (size_t i = 0; i < m->insert_count; ++i) {
+    const InsertOption *opt = &m->inserts[i];
+    const char *value = insert_eval(map, opt, buf, sizeof(buf));
+    if (values[i] && strcmp(values[i], value) == 0) continue;
+    free(values[i]);
+    values[i] = strdup_safe(value);
+    if (opt->col < 0) continue;
+    if (layer) menu_write_insert(&m->view, opt, value);
+    compose_mark_rows(c, row_offset + opt->line_idx, 1);
+  }
+  return true;
+}
 
-  if (s->undeads[0] >= 30) h->arms_armor = armor_from_code(g->arms_armors, g->arms_armor_count, "worn_gloves");
-  if (s->undeads[1] >= 30) { h->mp_max += 3; h->mp += 3; }
-  if (s->undeads[2] >= 30) h->accuracy_base += 1;
-  if (s->undeads[3] >= 30) { h->hp_max += 7; h->hp += 7; }
-  if (s->undeads[4] >= 30) h->block_chance_base += 3;
-  if (s->undeads[5] >= 5) h->regen_mp_base += 1;
+// Brings a menu composed by compose_menu_ex up to date in place. Returns false
+// when it cannot (different template, different partial maps, a flushed asset
+// cache); the caller then recomposes from the template.
+static bool compose_menu_patch(Composer *c, Menu *menu, const char *menu_path, ValueMap *main_map,
+                               ValueMap **partial_maps, size_t partial_map_count, ArtArg *art_args, size_t art_arg_count) {
+  if (!c || !c->valid || c->asset_generation != asset_cache_generation) return false;
+  if (!menu_path || strcmp(c->menu_path, menu_path) != 0) return false;
+  if (menu->view.line_count != c->rows || menu->view.max_cols != c->cols) return false;
+  for (size_t i = 0; i < c->partial_count; ++i) {
+    ValueMap *map = main_map;
+    if (partial_maps && i < partial_map_count && partial_maps[i]) map = partial_maps[i];
+    if (c->partials[i].layer && c->partials[i].map != map) return false;
+  }
+
+  memset(c->row_marks, 0, c->rows * sizeof(bool));
+  memset(c->dirty_bits, 0, composer_dirty_words(c) * sizeof(uint32_t));
+  c->full = false;
+  c->cells_touched = 0;
+
+  if (!compose_patch_values(c, menu, c->values, main_map, 0, false)) return false;
+  for (size_t i = 0; i < c->partial_count; ++i) {
+    ComposePartial *p = &c->partials[i];
+    if (!p->layer || partial_layer_matches(p->layer, p->map)) continue;
+    PartialLayer *own = partial_layer_unshare(p->layer);
+    if (!own) return false;
+    p->layer = own;
+    if (!compose_patch_values(c, &own->menu, own->values, p->map, menu->partials[i].y0, true)) return false;
+    own->hash = partial_values_hash(&own->menu, p->map);
+  }
 
-  if (s->swamp[0] >= 30) { h->mp_max += 3; h->mp += 3; }
-  if (s->swamp[1] >= 30) h->shield = shield_from_code(g, "holey_wicker_buckler");
-  if (s->swamp[2] >= 30) { h->hp_max += 3; h->hp += 3; }
-  if (s->swamp[3] >= 30) h->accuracy_base += 1;
-  if (s->swamp[4] >= 30) h->max_dmg_base += 1;
-  if (s->swamp[5] >= 5) h->armor_base += 1;
+  size_t count = menu->art_count < art_arg_count ? menu->art_count : art_arg_count;
+  for (size_t i = 0; i < c->art_count; ++i) {
+    ComposeArt next = {NULL, 0, 0, 0};
+    const Art *art = i < count ? compose_find_art(&art_args[i]) : NULL;
+    if (art) {
+      next.view = &art->view;
+      align_art_to_field(&menu->arts[i], (int)art->view.max_cols, (int)art->view.line_count, &next.x, &next.y);
+      next.h = (int)art->view.line_count;
+    }
+    ComposeArt *prev = &c->arts[i];
+    if (prev->view == next.view && prev->x == next.x && prev->y == next.y) continue;
+    if (prev->view) compose_mark_rows(c, prev->y, prev->h);
+    if (next.view) compose_mark_rows(c, next.y, next.h);
+    *prev = next;
+  }
+
+  // Rows are rebuilt from the asset cache's pristine template; fetched last
+  // because the art lookups above may grow the cache.
+  AssetEntry *e = asset_cache_get(menu_path, false);
+  if (!e || !e->ok || e->menu.view.line_count != c->rows || e->menu.view.max_cols != c->cols) return false;
+  for (size_t y = 0; y < c->rows; ++y) {
+    if (c->row_marks[y]) compose_rebuild_row(c, menu, &e->menu.view, (int)y);
+  }
+  return true;
 }
 
-static void apply_warehouse_bonuses(Game *g, Character *h) {
-  if (!g || !h) return;
-  bool changed = false;
-  if (strcmp(g->warehouse.weapon, "without") != 0) {
-    h->weapon = weapon_from_code(g, g->warehouse.weapon);
-    snprintf(g->warehouse.weapon, sizeof(g->warehouse.weapon), "without");
-    changed = true;
-  }
-  if (strcmp(g->warehouse.body_armor, "without") != 0) {
-    h->body_armor = armor_from_code(g->body_armors, g->body_armor_count, g->warehouse.body_armor);
-    snprintf(g->warehouse.body_armor, sizeof(g->warehouse.body_armor), "without");
-    changed = true;
-  }
-  if (strcmp(g->warehouse.head_armor, "without") != 0) {
-    h->head_armor = armor_from_code(g->head_armors, g->head_armor_count, g->warehouse.head_armor);
-    snprintf(g->warehouse.head_armor, sizeof(g->warehouse.head_armor), "without");
-    changed = true;
+// Vertex buffer entry points are GL 1.5, past what the platform gl.h is
+// guaranteed to declare, so they are fetched from the context. Without them
+// draw_menu keeps submitting client-side arrays.
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER 0x8892
+#endif
+#ifndef GL_DYNAMIC_DRAW
+#define GL_DYNAMIC_DRAW 0x88E8
+#endif
+
+typedef struct {
+  bool tried;
+  void(APIENTRY *gen_buffers)(GLsizei n, GLuint *buffers);
+  void(APIENTRY *delete_buffers)(GLsizei n, const GLuint *buffers);
+  void(APIENTRY *bind_buffer)(GLenum target, GLuint buffer);
+  void(APIENTRY *buffer_data)(GLenum target, ptrdiff_t size, const void *data, GLenum usage);
+  void(APIENTRY *buffer_sub_data)(GLenum target, ptrdiff_t offset, ptrdiff_t size, const void *data);
+} GlBuffers;
+
+static GlBuffers gl_buffers;
+
+static bool gl_buffers_available(void) {
+  if (!gl_buffers.tried) {
+    gl_buffers.tried = true;
+    *(void **)&gl_buffers.gen_buffers = SDL_GL_GetProcAddress("glGenBuffers");
+    *(void **)&gl_buffers.delete_buffers = SDL_GL_GetProcAddress("glDeleteBuffers");
+    *(void **)&gl_buffers.bind_buffer = SDL_GL_GetProcAddress("glBindBuffer");
+    *(void **)&gl_buffers.buffer_data = SDL_GL_GetProcAddress("glBufferData");
+    *(void **)&gl_buffers.buffer_sub_data = SDL_GL_GetProcAddress("glBufferSubData");
+    if (!gl_buffers.gen_buffers || !gl_buffers.delete_buffers || !gl_buffers.bind_buffer || !gl_buffers.buffer_data ||
+        !gl_buffers.buffer_sub_data) {
+      memset(&gl_buffers, 0, sizeof(gl_buffers));
+      gl_buffers.tried = true;
+    }
   }
-  if (strcmp(g->warehouse.arms_armor, "without") != 0) {
-    h->arms_armor = armor_from_code(g->arms_armors, g->arms_armor_count, g->warehouse.arms_armor);
-    snprintf(g->warehouse.arms_armor, sizeof(g->warehouse.arms_armor), "without");
-    changed = true;
+  return gl_buffers.gen_buffers != NULL;
+}
+
+static void render_state_free(RenderState *rs) {
+  if (!rs) return;
+  if (rs->tex) glDeleteTextures(1, &rs->tex);
+  free(rs->glyphs);
+  free(rs->glyph_slots);
+  free(rs->pixels);
+  if (rs->vbo) gl_buffers.delete_buffers(1, &rs->vbo);
+  free(rs->verts);
+  free(rs->overlay_verts);
+  memset(rs, 0, sizeof(*rs));
+}
+
+static uint32_t glyph_slot_hash(uint32_t cp) {
+  return cp * 0x9E3779B1u;
+}
+
+static void glyph_slot_insert(uint32_t *slots, size_t slot_cap, uint32_t cp, uint32_t value) {
+  size_t mask = slot_cap - 1;
+  size_t i = glyph_slot_hash(cp) & mask;
+  while (slots[i]) i = (i + 1) & mask;
+  slots[i] = value;
+}
+
+static const Glyph *atlas_lookup(const RenderState *rs, uint32_t cp) {
+  if (!rs || rs->glyph_slot_cap == 0) return NULL;
+  size_t mask = rs->glyph_slot_cap - 1;
+  for (size_t i = glyph_slot_hash(cp) & mask;; i = (i + 1) & mask) {
+    uint32_t slot = rs->glyph_slots[i];
+    if (slot == 0) return NULL;
+    if (rs->glyphs[slot - 1].codepoint == cp) return &rs->glyphs[slot - 1];
+  }
+}
+
+static void atlas_index_rebuild(RenderState *rs, size_t slot_cap) {
+  uint32_t *slots = (uint32_t *)calloc(slot_cap, sizeof(uint32_t));
+  if (!slots) return;
+  free(rs->glyph_slots);
+  rs->glyph_slots = slots;
+  rs->glyph_slot_cap = slot_cap;
+  for (size_t k = 0; k < rs->glyph_count; ++k) glyph_slot_insert(slots, slot_cap, rs->glyphs[k].codepoint, (uint32_t)(k + 1));
+}
+
+static void atlas_glyph_uv(RenderState *rs, Glyph *g, size_t idx) {
+  int atlas_w = rs->atlas_cols * rs->cell_w;
+  int atlas_h = rs->atlas_rows * rs->cell_h;
+  int gx = (int)(idx % (size_t)rs->atlas_cols) * rs->cell_w;
+  int gy = (int)(idx / (size_t)rs->atlas_cols) * rs->cell_h;
+  g->u0 = (float)gx / (float)atlas_w;
+  g->v0 = (float)gy / (float)atlas_h;
+  g->u1 = (float)(gx + rs->cell_w) / (float)atlas_w;
+  g->v1 = (float)(gy + rs->cell_h) / (float)atlas_h;
+}
+
+// Grows the atlas by doubling its rows, up to atlas_max_rows; existing glyphs
+// keep their pixels, only their v coordinates change.
+static bool atlas_grow(RenderState *rs) {
+  if (rs->atlas_rows >= rs->atlas_max_rows) return false;
+  int rows = rs->atlas_rows == 0 ? 8 : rs->atlas_rows * 2;
+  if (rows > rs->atlas_max_rows) rows = rs->atlas_max_rows;
+  size_t row_bytes = (size_t)rs->atlas_cols * (size_t)rs->cell_w * 4;
+  size_t old_size = row_bytes * (size_t)rs->atlas_rows * (size_t)rs->cell_h;
+  size_t new_size = row_bytes * (size_t)rows * (size_t)rs->cell_h;
+  uint8_t *pixels = (uint8_t *)realloc(rs->pixels, new_size);
+  if (!pixels) return false;
+  memset(pixels + old_size, 0, new_size - old_size);
+  rs->pixels = pixels;
+  rs->atlas_rows = rows;
+  for (size_t i = 0; i < rs->glyph_count; ++i) atlas_glyph_uv(rs, &rs->glyphs[i], i);
+
+  if (!rs->tex) glGenTextures(1, &rs->tex);
+  glBindTexture(GL_TEXTURE_2D, rs->tex);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, rs->atlas_cols * rs->cell_w, rows * rs->cell_h, 0, GL_RGBA, GL_UNSIGNED_BYTE, rs->pixels);
+  return true;
+}
+
+// Renders cp white on transparent black, centered in a cell_w x cell_h RGBA32 surface. Shared by the
+// atlas and the --render soft rasterizer so goldens match what the window draws. Caller frees.
+static SDL_Surface *glyph_render_cell(TTF_Font *font, uint32_t cp, int cell_w, int cell_h) {
+  SDL_Surface *cell = SDL_CreateRGBSurfaceWithFormat(0, cell_w, cell_h, 32, SDL_PIXELFORMAT_RGBA32);
+  if (!cell) return NULL;
+  SDL_FillRect(cell, NULL, SDL_MapRGBA(cell->format, 0, 0, 0, 0));
+  char utf8[5];
+  utf8_encode(cp, utf8);
+  SDL_Color white = {255, 255, 255, 255};
+  SDL_Surface *rendered = TTF_RenderUTF8_Blended(font, utf8, white);
+  if (rendered) {
+    SDL_Rect dst;
+    dst.w = rendered->w;
+    dst.h = rendered->h;
+    dst.x = (cell_w - rendered->w) / 2;
+    dst.y = (cell_h - rendered->h) / 2;
+    SDL_BlitSurface(rendered, NULL, cell, &dst);
+    SDL_FreeSurface(rendered);
+  }
+  return cell;
+}
+
+static const Glyph *atlas_add(RenderState *rs, uint32_t cp) {
+  const Glyph *found = atlas_lookup(rs, cp);
+  if (found) return found;
+  if (rs->glyph_count >= (size_t)rs->atlas_cols * (size_t)rs->atlas_rows) {
+    if (!atlas_grow(rs)) return NULL;
+  }
+  if ((rs->glyph_count + 1) * 2 > rs->glyph_slot_cap) {
+    atlas_index_rebuild(rs, rs->glyph_slot_cap == 0 ? 256 : rs->glyph_slot_cap * 2);
+    if ((rs->glyph_count + 1) * 2 > rs->glyph_slot_cap) return NULL;
+  }
+  if (rs->glyph_count + 1 > rs->glyph_cap) {
+    size_t new_cap = rs->glyph_cap == 0 ? 128 : rs->glyph_cap * 2;
+    Glyph *glyphs = (Glyph *)realloc(rs->glyphs, new_cap * sizeof(Glyph));
+    if (!glyphs) return NULL;
+    rs->glyphs = glyphs;
+    rs->glyph_cap = new_cap;
+  }
+
+  size_t idx = rs->glyph_count;
+  Glyph *g = &rs->glyphs[idx];
+  g->codepoint = cp;
+  atlas_glyph_uv(rs, g, idx);
+
+  SDL_Surface *cell = glyph_render_cell(rs->font, cp, rs->cell_w, rs->cell_h);
+  if (cell) {
+    int gx = (int)(idx % (size_t)rs->atlas_cols) * rs->cell_w;
+    int gy = (int)(idx / (size_t)rs->atlas_cols) * rs->cell_h;
+    size_t atlas_pitch = (size_t)rs->atlas_cols * (size_t)rs->cell_w * 4;
+    for (int y = 0; y < rs->cell_h; ++y) {
+      memcpy(rs->pixels + (size_t)(gy + y) * atlas_pitch + (size_t)gx * 4,
+             (const uint8_t *)cell->pixels + (size_t)y * (size_t)cell->pitch, (size_t)rs->cell_w * 4);
+    }
+    glBindTexture(GL_TEXTURE_2D, rs->tex);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, rs->atlas_cols * rs->cell_w);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, gx, gy, rs->cell_w, rs->cell_h, GL_RGBA, GL_UNSIGNED_BYTE,
+                    rs->pixels + (size_t)gy * atlas_pitch + (size_t)gx * 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    SDL_FreeSurface(cell);
+  }
+
+  rs->glyph_count++;
+  glyph_slot_insert(rs->glyph_slots, rs->glyph_slot_cap, cp, (uint32_t)rs->glyph_count);
+  return g;
+}
+
+// Empties a full atlas so the next screen can fill it again; printable ASCII
+// is re-added first for the profiler overlay.
+static void atlas_evict(RenderState *rs) {
+  rs->glyph_count = 0;
+  if (rs->glyph_slots) memset(rs->glyph_slots, 0, rs->glyph_slot_cap * sizeof(uint32_t));
+  rs->atlas_generation++;
+  for (uint32_t cp = 0x21; cp < 0x7F; ++cp) atlas_add(rs, cp);
+}
+
+// The atlas lives for the whole session: each codepoint is rasterized once
+// per font, and a screen change only uploads glyphs it has not seen yet. It
+// never outgrows GL_MAX_TEXTURE_SIZE; once full, it is emptied and refilled
+// with the glyphs of the screen being drawn.
+static bool atlas_init(RenderState *rs, TTF_Font *font, int cell_w, int cell_h) {
+  if (!rs || !font || cell_w <= 0 || cell_h <= 0) return false;
+  render_state_free(rs);
+  GLint max_size = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+  if (max_size <= 0) max_size = 1024;
+  rs->font = font;
+  rs->cell_w = cell_w;
+  rs->cell_h = cell_h;
+  rs->atlas_cols = 32;
+  if (rs->atlas_cols * cell_w > max_size) rs->atlas_cols = max_size / cell_w;
+  rs->atlas_max_rows = max_size / cell_h;
+  if (rs->atlas_cols <= 0 || rs->atlas_max_rows <= 0) {
+    fprintf(stderr, "[pzdc_dungeon_2_gl] atlas: %dx%d cells do not fit a %d px texture\n", cell_w, cell_h, (int)max_size);
+    return false;
   }
-  if (strcmp(g->warehouse.shield, "without") != 0) {
-    h->shield = shield_from_code(g, g->warehouse.shield);
-    snprintf(g->warehouse.shield, sizeof(g->warehouse.shield), "without");
-    changed = true;
+  if (!atlas_grow(rs)) return false;
+  for (uint32_t cp = 0x21; cp < 0x7F; ++cp) atlas_add(rs, cp);
+  return true;
+}
+
+// Returns false once the atlas is full and cannot take a glyph the view needs.
+static bool atlas_add_view_glyphs(RenderState *rs, const View *view) {
+  for (size_t i = 0; i < view->line_count; ++i) {
+    const Line *line = &view->lines[i];
+    for (size_t j = 0; j < line->len_cells; ++j) {
+      uint32_t cp = line->cells[j];
+      if (cp != (uint32_t)' ' && !atlas_lookup(rs, cp) && !atlas_add(rs, cp)) return false;
+    }
   }
-  if (changed) save_warehouse_data(&g->warehouse);
+  return true;
 }
 
-static void shop_add_from_hero(Game *g, const Character *h) {
-  if (!g || !h) return;
-  const int sell_chance = 3;
-  for (int t = 0; t < 5; ++t) {
-    const char *code = "without";
-    if (t == 0) code = h->weapon.code;
-    else if (t == 1) code = h->body_armor.code;
-    else if (t == 2) code = h->head_armor.code;
-    else if (t == 3) code = h->arms_armor.code;
-    else code = h->shield.code;
-    if (strcmp(code, "without") == 0) continue;
-    if (rand_range(0, sell_chance - 1) != 0) continue;
-    char (*arr)[32] = NULL;
-    if (t == 0) arr = g->shop.weapon;
-    else if (t == 1) arr = g->shop.body_armor;
-    else if (t == 2) arr = g->shop.head_armor;
-    else if (t == 3) arr = g->shop.arms_armor;
-    else arr = g->shop.shield;
-    int slot = -1;
-    for (int i = 0; i < 3; ++i) {
-      if (strcmp(arr[i], "without") == 0) { slot = i; break; }
+static bool atlas_add_menu_glyphs(RenderState *rs, const Menu *menu) {
+  if (!rs || !menu || !rs->font) return false;
+  if (!atlas_add_view_glyphs(rs, &menu->view)) {
+    atlas_evict(rs);
+    if (!atlas_add_view_glyphs(rs, &menu->view) && !rs->atlas_overflow_logged) {
+      fprintf(stderr, "[pzdc_dungeon_2_gl] atlas: screen needs more glyphs than fit one texture, some are not drawn\n");
+      rs->atlas_overflow_logged = true;
     }
-    if (slot < 0) slot = rand_range(0, 2);
-    snprintf(arr[slot], sizeof(arr[slot]), "%s", code);
   }
-  save_shop_data(&g->shop);
+  rs->grid_w = (int)menu->view.max_cols;
+  rs->grid_h = (int)menu->view.line_count;
+  return rs->glyph_count > 0;
 }
 
-static void delete_hero_in_run_file(void) {
-  char *saves_dir = resolve_saves_dir();
-  if (!saves_dir) return;
-  char path[512];
-  snprintf(path, sizeof(path), "%s/hero_in_run.yml", saves_dir);
-  free(saves_dir);
-  if (file_exists(path)) remove(path);
+static float shade_intensity(uint32_t cp) {
+  switch (cp) {
+    case 0x2591: return 0.25f; // ░
+    case 0x2592: return 0.5f;  // ▒
+    case 0x2593: return 0.75f; // ▓
+    default: return 1.0f;
+  }
 }
 
-static void end_run_transfer(Game *g, bool hero_alive) {
-  if (!g) return;
-  if (strcmp(g->hero.name, "Cheater") != 0) {
-    g->monolith.points += g->hero.pzdc_monolith_points;
-    g->hero.pzdc_monolith_points = 0;
-    save_monolith_data(&g->monolith);
-    if (hero_alive) {
-      shop_add_from_hero(g, &g->hero);
-      g->warehouse.coins += g->hero.coins;
-      g->hero.coins = 0;
-      save_warehouse_data(&g->warehouse);
+// Geometry is kept in cell units with a fixed quad per cell, so a cell's
+// vertices never move; draw_menu only scales it to the window and submits it
+// with a single glDrawArrays call. Blank cells are zero-area quads.
+static void render_write_cell(RenderState *rs, int x, int y, uint32_t cp) {
+  QuadVertex *v = &rs->verts[((size_t)y * (size_t)rs->grid_w + (size_t)x) * 4];
+  float px = (float)x;
+  float py = (float)y;
+  const Glyph *g = cp == (uint32_t)' ' ? NULL : atlas_lookup(rs, cp);
+  if (!g) {
+    v[0] = v[1] = v[2] = v[3] = (QuadVertex){px, py, 0.f, 0.f, 0, 0, 0, 0};
+    return;
+  }
+  uint8_t shade = (uint8_t)(shade_intensity(cp) * 255.0f + 0.5f);
+  v[0] = (QuadVertex){px, py, g->u0, g->v0, shade, shade, shade, 255};
+  v[1] = (QuadVertex){px + 1.f, py, g->u1, g->v0, shade, shade, shade, 255};
+  v[2] = (QuadVertex){px + 1.f, py + 1.f, g->u1, g->v1, shade, shade, shade, 255};
+  v[3] = (QuadVertex){px, py + 1.f, g->u0, g->v1, shade, shade, shade, 255};
+}
+
+// Copies quads [first, first + count) to the vertex buffer, reallocating it
+// when the grid outgrew it.
+static void render_upload(RenderState *rs, size_t first, size_t count) {
+  if (!rs->vbo || count == 0) return;
+  gl_buffers.bind_buffer(GL_ARRAY_BUFFER, rs->vbo);
+  if (rs->quad_count > rs->vbo_quads) {
+    gl_buffers.buffer_data(GL_ARRAY_BUFFER, (ptrdiff_t)(rs->quad_count * 4 * sizeof(QuadVertex)), rs->verts,
+                           GL_DYNAMIC_DRAW);
+    rs->vbo_quads = rs->quad_count;
+  } else {
+    gl_buffers.buffer_sub_data(GL_ARRAY_BUFFER, (ptrdiff_t)(first * 4 * sizeof(QuadVertex)),
+                               (ptrdiff_t)(count * 4 * sizeof(QuadVertex)), &rs->verts[first * 4]);
+  }
+  gl_buffers.bind_buffer(GL_ARRAY_BUFFER, 0);
+}
+
+static bool render_set_menu(RenderState *rs, const Menu *menu) {
+  prof_enter(PROF_ATLAS);
+  bool have_glyphs = atlas_add_menu_glyphs(rs, menu);
+  prof_leave();
+  if (!have_glyphs) return false;
+  size_t cells = (size_t)rs->grid_w * (size_t)rs->grid_h;
+  if (cells > rs->quad_cap) {
+    QuadVertex *verts = (QuadVertex *)realloc(rs->verts, cells * 4 * sizeof(QuadVertex));
+    if (!verts) return false;
+    rs->verts = verts;
+    rs->quad_cap = cells;
+  }
+
+  for (int y = 0; y < rs->grid_h; ++y) {
+    const Line *line = &menu->view.lines[y];
+    for (int x = 0; x < rs->grid_w; ++x) {
+      render_write_cell(rs, x, y, (x < (int)line->len_cells) ? line->cells[x] : (uint32_t)' ');
     }
   }
-  delete_hero_in_run_file();
+  rs->quad_count = cells;
+  if (!rs->vbo && gl_buffers_available()) gl_buffers.gen_buffers(1, &rs->vbo);
+  render_upload(rs, 0, cells);
+  return true;
 }
 
-static int treasure_hunter_coeff(const Skill *camp_skill) {
-  if (!camp_skill || strcmp(camp_skill->code, "treasure_hunter") != 0) return 0;
-  return 50 + 10 * camp_skill->lvl;
+// Brings the geometry up to date after game_compose_screen. A patched compose
+// rewrites only the quads of the cells it marked dirty and uploads each row's
+// changed range; anything else, or a glyph that grows the atlas, rebuilds all.
+static bool render_update_menu(RenderState *rs, const Menu *menu, const Composer *c) {
+  if (!c || c->full || !c->valid || !rs->verts || rs->grid_w != (int)c->cols || rs->grid_h != (int)c->rows) {
+    return render_set_menu(rs, menu);
+  }
+  int atlas_rows = rs->atlas_rows;
+  uint32_t atlas_generation = rs->atlas_generation;
+  size_t run_first = 0, run_end = 0;
+  size_t words = composer_dirty_words(c);
+  for (size_t w = 0; w < words; ++w) {
+    if (!c->dirty_bits[w]) continue;
+    for (size_t bit = 0; bit < 32; ++bit) {
+      if (!(c->dirty_bits[w] & (1u << bit))) continue;
+      size_t i = w * 32 + bit;
+      int y = (int)(i / c->cols);
+      int x = (int)(i % c->cols);
+      uint32_t cp = menu->view.lines[y].cells[x];
+      if (cp != (uint32_t)' ' && !atlas_lookup(rs, cp) && !atlas_add(rs, cp)) return render_set_menu(rs, menu);
+      if (rs->atlas_rows != atlas_rows || rs->atlas_generation != atlas_generation) return render_set_menu(rs, menu);
+      render_write_cell(rs, x, y, cp);
+      if (run_end > run_first && run_first / c->cols != (size_t)y) {
+        render_upload(rs, run_first, run_end - run_first);
+        run_end = run_first;
+      }
+      if (run_end == run_first) run_first = i;
+      run_end = i + 1;
+    }
+  }
+  render_upload(rs, run_first, run_end - run_first);
+  return true;
 }
 
-static bool loot_should_drop(Game *g) {
-  if (!g) return false;
-  if (strcmp(g->hero.camp_skill.code, "treasure_hunter") == 0) {
-    int coeff = treasure_hunter_coeff(&g->hero.camp_skill);
-    return rand_range(0, 1) == 1 || rand_range(0, 150) < coeff;
+static void draw_menu(RenderState *rs, int win_w, int win_h, int cell_w, int cell_h, float alpha, int max_chars) {
+  if (!rs || rs->glyph_count == 0 || rs->grid_w <= 0 || rs->grid_h <= 0) return;
+
+  float sx = (float)win_w / (float)(rs->grid_w * cell_w);
+  float sy = (float)win_h / (float)(rs->grid_h * cell_h);
+  float draw_w = cell_w * sx;
+  float draw_h = cell_h * sy;
+
+  if (alpha < 0.f) alpha = 0.f;
+  if (alpha > 1.f) alpha = 1.f;
+  glClearColor(0.f, 0.f, 0.f, 1.f);
+  glClear(GL_COLOR_BUFFER_BIT);
+
+  // Quads are in cell order, so the typewriter prefix is a plain count.
+  size_t quads = rs->quad_count;
+  if (max_chars >= 0 && (size_t)max_chars < quads) quads = (size_t)max_chars;
+  if (quads > 0) {
+    // With a vertex buffer bound the attribute pointers are offsets into it.
+    uintptr_t base = rs->vbo ? 0 : (uintptr_t)rs->verts;
+    if (rs->vbo) gl_buffers.bind_buffer(GL_ARRAY_BUFFER, rs->vbo);
+    glPushMatrix();
+    glScalef(draw_w, draw_h, 1.f);
+    glBindTexture(GL_TEXTURE_2D, rs->tex);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, sizeof(QuadVertex), (const void *)(base + offsetof(QuadVertex, x)));
+    glTexCoordPointer(2, GL_FLOAT, sizeof(QuadVertex), (const void *)(base + offsetof(QuadVertex, u)));
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(QuadVertex), (const void *)(base + offsetof(QuadVertex, r)));
+    glDrawArrays(GL_QUADS, 0, (GLsizei)(quads * 4));
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glPopMatrix();
+    if (rs->vbo) gl_buffers.bind_buffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  if (alpha < 1.f) {
+    glDisable(GL_TEXTURE_2D);
+    glColor4f(0.f, 0.f, 0.f, 1.f - alpha);
+    glBegin(GL_QUADS);
+    glVertex2f(0.f, 0.f);
+    glVertex2f((float)win_w, 0.f);
+    glVertex2f((float)win_w, (float)win_h);
+    glVertex2f(0.f, (float)win_h);
+    glEnd();
+    glEnable(GL_TEXTURE_2D);
+  }
+}
+
+// Draws ASCII text over the top-left corner of the screen on a dimmed
+// background, using the same cell grid and atlas as the menu. The quads are
+// rebuilt on every call, so they never hold stale coordinates after the atlas grows.
+static void draw_overlay_text(RenderState *rs, int win_w, int win_h, char (*lines)[64], int line_count) {
+  if (!rs || rs->grid_w <= 0 || rs->grid_h <= 0 || line_count <= 0) return;
+  size_t need = (size_t)line_count * 64;
+  if (need > rs->overlay_cap) {
+    QuadVertex *verts = (QuadVertex *)realloc(rs->overlay_verts, need * 4 * sizeof(QuadVertex));
+    if (!verts) return;
+    rs->overlay_verts = verts;
+    rs->overlay_cap = need;
+  }
+  size_t quads = 0;
+  int cols = 0;
+  for (int y = 0; y < line_count; ++y) {
+    int x = 0;
+    for (const char *c = lines[y]; *c && x < 64; ++c, ++x) {
+      if (*c == ' ') continue;
+      const Glyph *g = atlas_lookup(rs, (uint32_t)(unsigned char)*c);
+      if (!g) continue;
+      QuadVertex *v = &rs->overlay_verts[quads++ * 4];
+      float px = (float)x;
+      float py = (float)y;
+      v[0] = (QuadVertex){px, py, g->u0, g->v0, 255, 224, 96, 255};
+      v[1] = (QuadVertex){px + 1.f, py, g->u1, g->v0, 255, 224, 96, 255};
+      v[2] = (QuadVertex){px + 1.f, py + 1.f, g->u1, g->v1, 255, 224, 96, 255};
+      v[3] = (QuadVertex){px, py + 1.f, g->u0, g->v1, 255, 224, 96, 255};
+    }
+    if (x > cols) cols = x;
+  }
+
+  float draw_w = (float)win_w / (float)rs->grid_w;
+  float draw_h = (float)win_h / (float)rs->grid_h;
+  glPushMatrix();
+  glScalef(draw_w, draw_h, 1.f);
+  glDisable(GL_TEXTURE_2D);
+  glColor4f(0.f, 0.f, 0.f, 0.8f);
+  glBegin(GL_QUADS);
+  glVertex2f(0.f, 0.f);
+  glVertex2f((float)cols + 1.f, 0.f);
+  glVertex2f((float)cols + 1.f, (float)line_count);
+  glVertex2f(0.f, (float)line_count);
+  glEnd();
+  glEnable(GL_TEXTURE_2D);
+  if (quads > 0) {
+    glBindTexture(GL_TEXTURE_2D, rs->tex);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, sizeof(QuadVertex), &rs->overlay_verts[0].x);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(QuadVertex), &rs->overlay_verts[0].u);
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(QuadVertex), &rs->overlay_verts[0].r);
+    glDrawArrays(GL_QUADS, 0, (GLsizei)(quads * 4));
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+  }
+  glColor4f(1.f, 1.f, 1.f, 1.f);
+  glPopMatrix();
+}
+
+// Overlay text for the last committed frame plus the worst value over the
+// last PROF_OVERLAY_WINDOW frames, one row per zone.
+#define PROF_OVERLAY_WINDOW 120
+
+static int prof_overlay_lines(char (*lines)[64], int max_lines) {
+  if (!prof.ring || prof.frames == 0 || max_lines < 3) return 0;
+  const ProfFrame *last = &prof.ring[(prof.frames - 1) % PROF_RING];
+  uint32_t window = prof.frames < PROF_OVERLAY_WINDOW ? prof.frames : PROF_OVERLAY_WINDOW;
+  double work_sum = 0.0;
+  double work_max = 0.0;
+  uint64_t zone_max[PROF_ZONE_COUNT] = {0};
+  for (uint32_t i = prof.frames - window; i < prof.frames; ++i) {
+    const ProfFrame *f = &prof.ring[i % PROF_RING];
+    double w = prof_frame_work_ms(f);
+    work_sum += w;
+    if (w > work_max) work_max = w;
+    for (int z = 0; z < PROF_ZONE_COUNT; ++z) {
+      if (f->zone[z] > zone_max[z]) zone_max[z] = f->zone[z];
+    }
+  }
+  int n = 0;
+  snprintf(lines[n++], 64, "frame %u  work %.2f ms  avg %.2f  max %.2f",
+           last->index, prof_frame_work_ms(last), work_sum / window, work_max);
+  snprintf(lines[n++], 64, "zone        last ms   max ms");
+  for (int z = 0; z < PROF_ZONE_COUNT && n < max_lines; ++z) {
+    snprintf(lines[n++], 64, "%-8s %10.3f %8.3f", prof_zone_names[z], prof_ms(last->zone[z]), prof_ms(zone_max[z]));
   }
-  return rand_range(0, 1) == 1;
+  return n;
 }
 
-static void loot_reset(Game *g) {
-  if (!g) return;
-  g->loot_count = 0;
-  g->loot_index = 0;
-  g->loot_show_coins = 0;
-  g->loot_show_ingredient = 0;
-  g->loot_message_mode = 0;
-  g->loot_coins = 0;
-  g->loot_ingredient[0] = '\0';
-  g->loot_message[0] = '\0';
-  g->pending_levelup = 0;
-  g->loot_return_pending = 0;
-  g->loot_return_state = STATE_CAMPFIRE;
-  g->loot_last_taken = -1;
+static void logbuffer_init(LogBuffer *lb) {
+  lb->lines = NULL;
+  lb->count = 0;
+  lb->cap = 0;
 }
 
-static void loot_add(Game *g, const char *type, const char *code) {
-  if (!g || !type || !code) return;
-  if (g->loot_count >= (int)(sizeof(g->loot_items) / sizeof(g->loot_items[0]))) return;
-  snprintf(g->loot_items[g->loot_count].type, sizeof(g->loot_items[g->loot_count].type), "%s", type);
-  snprintf(g->loot_items[g->loot_count].code, sizeof(g->loot_items[g->loot_count].code), "%s", code);
-  g->loot_count += 1;
+static void logbuffer_clear(LogBuffer *lb) {
+  if (!lb) return;
+  for (size_t i = 0; i < lb->count; ++i) free(lb->lines[i]);
+  lb->count = 0;
 }
 
-static void loot_setup(Game *g) {
-  if (!g) return;
-  loot_reset(g);
-  if (loot_should_drop(g) && strcmp(g->enemy.weapon.code, "without") != 0) loot_add(g, "weapon", g->enemy.weapon.code);
-  if (loot_should_drop(g) && strcmp(g->enemy.body_armor.code, "without") != 0) loot_add(g, "body_armor", g->enemy.body_armor.code);
-  if (loot_should_drop(g) && strcmp(g->enemy.head_armor.code, "without") != 0) loot_add(g, "head_armor", g->enemy.head_armor.code);
-  if (loot_should_drop(g) && strcmp(g->enemy.arms_armor.code, "without") != 0) loot_add(g, "arms_armor", g->enemy.arms_armor.code);
-  if (loot_should_drop(g) && strcmp(g->enemy.shield.code, "without") != 0) loot_add(g, "shield", g->enemy.shield.code);
-  if (g->enemy.coins_gived > 0) {
-    g->loot_show_coins = 1;
-    g->loot_coins = g->enemy.coins_gived;
-  }
-  if (strcmp(g->enemy.ingredient, "without") != 0) {
-    g->loot_show_ingredient = 1;
-    snprintf(g->loot_ingredient, sizeof(g->loot_ingredient), "%s", g->enemy.ingredient);
-  }
+static void logbuffer_free(LogBuffer *lb) {
+  if (!lb) return;
+  logbuffer_clear(lb);
+  free(lb->lines);
+  lb->lines = NULL;
+  lb->cap = 0;
 }
 
-static void loot_advance(Game *g) {
-  if (!g) return;
-  if (g->loot_index < g->loot_count) {
-    const LootEntry *le = &g->loot_items[g->loot_index];
-    char item_name[128];
-    const char *name = ammo_name(g, le->type, le->code);
-    snprintf(item_name, sizeof(item_name), "%s", name);
-    snprintf(g->loot_message, sizeof(g->loot_message),
-             "After searching the %s's body you found %s", g->enemy.name, item_name);
-    g->state = STATE_LOOT;
-    return;
-  }
-  if (g->loot_show_coins) {
-    g->loot_message_mode = 1;
-    g->state = STATE_LOOT_MESSAGE;
-    return;
+static void logbuffer_push(LogBuffer *lb, const char *text) {
+  if (!lb || !text) return;
+  if (lb->count + 1 > lb->cap) {
+    size_t new_cap = lb->cap == 0 ? 8 : lb->cap * 2;
+    char **arr = (char **)realloc(lb->lines, new_cap * sizeof(char *));
+    if (!arr) return;
+    lb->lines = arr;
+    lb->cap = new_cap;
   }
-  if (g->loot_show_ingredient) {
-    g->loot_message_mode = 2;
-    g->state = STATE_LOOT_MESSAGE;
-    return;
+  lb->lines[lb->count++] = strdup_safe(text);
+}
+
+static void logbuffer_apply_full(ValueMap *map, const LogBuffer *lb, size_t max_lines) {
+  char key[32];
+  for (size_t i = 0; i < max_lines; ++i) {
+    snprintf(key, sizeof(key), "log_%zu", i);
+    if (lb && i < lb->count) value_map_set(map, key, lb->lines[i]);
+    else value_map_set(map, key, "");
   }
-  if (g->loot_return_pending) {
-    g->loot_return_pending = 0;
-    g->state = g->loot_return_state;
-    if (g->state == STATE_EVENT_RESULT) {
-      event_after_loot(g);
+}
+
+static void logbuffer_apply_last(ValueMap *map, const LogBuffer *lb, size_t last_count) {
+  char key[32];
+  for (size_t i = 0; i < last_count; ++i) {
+    snprintf(key, sizeof(key), "log_last%zu", i + 1);
+    if (lb && lb->count > i) {
+      value_map_set(map, key, lb->lines[lb->count - 1 - i]);
+    } else {
+      value_map_set(map, key, "");
     }
-    return;
-  }
-  if (!g->enemy_is_boss) {
-    g->hero.leveling += 1;
   }
-  g->hero.dungeon_part_number += 1;
-  logbuffer_clear(&g->log);
-  hero_rest(&g->hero, &g->log);
-  g->state = STATE_CAMPFIRE;
 }
 
-static const EventDef kEvents[] = {
-  {
-    "loot_field",
-    "Some scrub",
-    {
-      "In this pile of scrub...",
-      "...you might find some",
-      "",
-      "",
-      ""
-    },
-    "events/_loot_field",
-    EVENT_EFFECT_NONE,
-    0,
-    ""
-  },
-  {
-    "loot_secret",
-    "Secret something",
-    {
-      "There might be something...",
-      "...unusual here",
-      "",
-      ""
-    },
-    "events/_loot_secret",
-    EVENT_EFFECT_NONE,
-    0,
-    ""
-  },
-  {
-    "gambler",
-    "Gambler",
-    {
-      "Little man...",
-      "...he juggling dice...",
-      "...easy way to get rich",
-      ""
-    },
-    "events/_gambler",
-    EVENT_EFFECT_NONE,
-    0,
-    ""
-  },
-  {
-    "altar_of_blood",
-    "Altar of Blood",
-    {
-      "Old Altar...",
-      "...its take your blood...",
-      "...and give you some",
-      "",
-      ""
-    },
-    "events/_altar_of_blood",
-    EVENT_EFFECT_NONE,
-    0,
-    ""
-  },
-  {
-    "boatman_eugene",
-    "Who are you and who am i...",
-    {
-      "Boatman will take you...",
-      "...will ask for something...",
-      "...path will be shorter?",
-      "",
-      ""
-    },
-    "events/_boatman_eugene",
-    EVENT_EFFECT_NONE,
-    0,
-    ""
-  },
-  {
-    "briedge_keeper",
-    "Bridge of death",
-    {
-      "Bridge keeper...",
-      "...will ask questions...",
-      "...answer correctly...",
-      "...and otherwise",
-      ""
-    },
-    "events/_briedge_keeper",
-    EVENT_EFFECT_NONE,
-    0,
-    ""
-  },
-  {
-    "wariors_grave",
-    "Warior's Grave",
-    {
-      "Old grave...",
-      "...warrior is buried here...",
-      "...maybe with ammunition?",
-      "",
-      ""
-    },
-    "events/_warriors_grave",
-    EVENT_EFFECT_NONE,
-    0,
-    ""
-  },
-  {
-    "pig_with_saucepan",
-    "Pig with saucepan",
-    {
-      "Pigman is eating something...",
-      "...smelly in his saucepan...",
-      "...the saucepan looks like...",
-      "...on a shiny helmet",
-      ""
-    },
-    "events/_pig_with_saucepan",
-    EVENT_EFFECT_NONE,
-    0,
-    ""
-  },
-  {
-    "black_mage",
-    "Black mage",
-    {
-      "Casts spells...",
-      "...for your coins",
-      "",
-      "",
-      ""
-    },
-    "events/_black_mage",
-    EVENT_EFFECT_NONE,
-    0,
-    ""
-  },
-  {
-    "exit_run",
-    "Exit from dugeon",
-    {
-      "Looks like an exit...",
-      "...you can save life...",
-      "...you can save coins...",
-      "...but be careful...",
-      "...you might fall"
-    },
-    "events/_exit_run",
-    EVENT_EFFECT_NONE,
-    0,
-    ""
+static const char *default_font_path(void) {
+  static const char *candidates[] = {
+    "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf",
+    "/usr/share/fonts/truetype/liberation/LiberationMono-Regular.ttf",
+    "/Library/Fonts/Menlo.ttc",
+    "C:/Windows/Fonts/consola.ttf",
+  };
+  for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
+    if (file_exists(candidates[i])) return candidates[i];
   }
-};
+  return NULL;
+}
 
-static void event_to_map(const EventDef *ev, ValueMap *map) {
-  if (!ev || !map) return;
-  value_map_clear(map);
-  value_map_set(map, "name", ev->name);
-  value_map_set(map, "description1", ev->desc[0]);
-  value_map_set(map, "description2", ev->desc[1]);
-  value_map_set(map, "description3", ev->desc[2]);
-  value_map_set(map, "description4", ev->desc[3]);
-  value_map_set(map, "description5", ev->desc[4]);
+static void character_touch(Character *c) {
+  c->gen++;
 }
 
-static void pick_random_events(Game *g) {
-  if (!g) return;
-  int random = rand_range(1, 200);
-  int th = treasure_hunter_coeff(&g->hero.camp_skill);
-  int res = random + th;
-  g->event_choice_count = res > 150 ? 3 : res > 80 ? 2 : 1;
-  int total = (int)(sizeof(kEvents) / sizeof(kEvents[0]));
-  int used[16] = {0};
-  for (int i = 0; i < g->event_choice_count; ++i) {
-    int idx = rand_range(0, total - 1);
-    int guard = 0;
-    while (used[idx] && guard < 20) {
-      idx = rand_range(0, total - 1);
-      guard++;
-    }
-    used[idx] = 1;
-    g->event_choices[i] = kEvents[idx];
+static void character_compute_stats(const Character *c, CharacterStats *out) {
+  int weapon_min = c->weapon.min_dmg + c->weapon.enhance_min_dmg;
+  int shield_min = c->shield.min_dmg + c->shield.enhance_min_dmg;
+  if (weapon_min < 0) weapon_min = 0;
+  if (shield_min < 0) shield_min = 0;
+  out->min_dmg = c->min_dmg_base + weapon_min + shield_min;
+
+  int weapon_max = c->weapon.max_dmg + c->weapon.enhance_max_dmg;
+  int shield_max = c->shield.max_dmg + c->shield.enhance_max_dmg;
+  if (weapon_max < 0) weapon_max = 0;
+  if (shield_max < 0) shield_max = 0;
+  out->max_dmg = c->max_dmg_base + weapon_max + shield_max;
+
+  out->accuracy = c->accuracy_base + c->weapon.accuracy + c->weapon.enhance_accuracy +
+                  c->body_armor.accuracy + c->body_armor.enhance_accuracy +
+                  c->head_armor.accuracy + c->head_armor.enhance_accuracy +
+                  c->arms_armor.accuracy + c->arms_armor.enhance_accuracy +
+                  c->shield.accuracy + c->shield.enhance_accuracy;
+
+  int body = c->body_armor.armor + c->body_armor.enhance_armor;
+  int head = c->head_armor.armor + c->head_armor.enhance_armor;
+  int arms = c->arms_armor.armor + c->arms_armor.enhance_armor;
+  int shield = c->shield.armor + c->shield.enhance_armor;
+  if (body < 0) body = 0;
+  if (head < 0) head = 0;
+  if (arms < 0) arms = 0;
+  if (shield < 0) shield = 0;
+  out->armor = c->armor_base + body + head + arms + shield;
+
+  int pen = c->weapon.armor_penetration + c->weapon.enhance_armor_penetration;
+  if (pen < 0) pen = 0;
+  out->armor_penetration = c->armor_penetration_base + pen;
+
+  int block = c->block_chance_base + c->weapon.block_chance + c->weapon.enhance_block_chance +
+              c->shield.block_chance + c->shield.enhance_block_chance;
+  if (strcmp(c->passive_skill.code, "shield_master") == 0 && strcmp(c->shield.code, "without") != 0) {
+    block += 10 + 2 * c->passive_skill.lvl;
   }
-  if (th > 0) {
-    snprintf(g->event_choose_message, sizeof(g->event_choose_message),
-             "Random is %d + treasure hunter %d = you find %d ways. Which way will you go?",
-             random, th, g->event_choice_count);
-  } else {
-    snprintf(g->event_choose_message, sizeof(g->event_choose_message),
-             "Random is %d = you find %d ways. Which way will you go?",
-             random, g->event_choice_count);
+  out->block_chance = block;
+}
+
+// The cache is not part of a character's value, so it is refreshed through a
+// const pointer.
+static const CharacterStats *character_stats(const Character *c) {
+  if (c->stats_gen != c->gen + 1) {
+    Character *m = (Character *)c;
+    character_compute_stats(c, &m->stats);
+    m->stats_gen = c->gen + 1;
   }
+  return &c->stats;
 }
 
-static void event_clear_input(Game *g) {
-  if (!g) return;
-  g->event_text_len = 0;
-  g->event_text[0] = '\0';
+static int character_min_dmg(const Character *c) {
+  return character_stats(c)->min_dmg;
 }
 
-static void event_set_input(Game *g, EventInputMode mode) {
-  if (!g) return;
-  g->event_input_mode = mode;
-  if (mode != EVENT_INPUT_TEXT) event_clear_input(g);
+static int character_max_dmg(const Character *c) {
+  return character_stats(c)->max_dmg;
 }
 
-static void event_set_main(Game *g, const char *text) {
-  if (!g || !text) return;
-  snprintf(g->event_message, sizeof(g->event_message), "%s", text);
+static int character_accuracy(const Character *c) {
+  return character_stats(c)->accuracy;
 }
 
-static void event_set_art(Game *g, const char *name) {
-  if (!g || !name) return;
-  snprintf(g->event_art_name, sizeof(g->event_art_name), "%s", name);
+static int character_armor(const Character *c) {
+  return character_stats(c)->armor;
 }
 
-static void event_finish(Game *g) {
-  if (!g) return;
-  g->event_pending_action = EVENT_PENDING_NONE;
-  g->hero.dungeon_part_number += 1;
-  logbuffer_clear(&g->log);
-  hero_rest(&g->hero, &g->log);
-  g->state = STATE_CAMPFIRE;
+static int character_armor_penetration(const Character *c) {
+  return character_stats(c)->armor_penetration;
 }
 
-static void event_end_run(Game *g, const char *title, const char *log_line, bool alive) {
-  if (!g) return;
-  logbuffer_clear(&g->log);
-  if (log_line && log_line[0]) logbuffer_push(&g->log, log_line);
-  end_run_transfer(g, alive);
-  snprintf(g->message_title, sizeof(g->message_title), "%s", title ? title : "Run ended");
-  if (!alive) {
-    snprintf(g->message_art_name, sizeof(g->message_art_name), "game_over");
-    snprintf(g->message_art_path, sizeof(g->message_art_path), "_game_over");
-  } else {
-    g->message_art_name[0] = '\0';
-    g->message_art_path[0] = '\0';
-  }
-  g->next_state = STATE_START;
-  g->state = STATE_MESSAGE;
+static int character_block_chance(const Character *c) {
+  return character_stats(c)->block_chance;
 }
 
-static void event_offer_loot(Game *g, const char *type, const char *code, const char *message, EventPendingAction pending) {
-  if (!g || !type || !code) return;
-  loot_reset(g);
-  g->event_pending_action = pending;
-  g->loot_last_taken = -1;
-  g->loot_return_pending = 1;
-  g->loot_return_state = STATE_EVENT_RESULT;
-  snprintf(g->loot_message, sizeof(g->loot_message), "%s", message ? message : "Loot found");
-  loot_add(g, type, code);
-  g->state = STATE_LOOT;
+static int block_power_in_percents(const Character *c) {
+  if (!c) return 0;
+  double coeff = 1.0 + (double)c->hp / 200.0;
+  if (coeff <= 0.0) return 0;
+  int res = 100 - (int)(100.0 / coeff);
+  return res < 0 ? 0 : res;
 }
 
-static void event_after_loot(Game *g) {
-  if (!g) return;
-  if (g->event_pending_action == EVENT_PENDING_GRAVE_DIG) {
-    int taken = g->loot_last_taken == 1;
-    int mp = taken ? rand_range(20, 100) : rand_range(5, 20);
-    hero_reduce_mp(&g->hero, mp);
-    logbuffer_clear(&g->log);
-    if (taken) {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "The warrior's spirit is furious, he took %d MP from you", mp);
-      logbuffer_push(&g->log, msg);
-    } else {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "The warrior spirit is not happy, he took %d MP from you", mp);
-      logbuffer_push(&g->log, msg);
-    }
-    event_set_main(g, "Leave [Enter 0]");
-    event_set_art(g, "diged");
-    event_set_input(g, EVENT_INPUT_DIGIT);
-    g->event_step = 31;
-  } else if (g->event_pending_action == EVENT_PENDING_GRAVE_REWARD) {
-    logbuffer_clear(&g->log);
-    logbuffer_push(&g->log, "\"Good luck, brother. With people like you, we will cleanse these lands.\"");
-    event_set_main(g, "Leave [Enter 0]");
-    event_set_art(g, "clean");
-    event_set_input(g, EVENT_INPUT_DIGIT);
-    g->event_step = 41;
-  } else if (g->event_pending_action == EVENT_PENDING_PIG_SALLET) {
-    g->event_pending_action = EVENT_PENDING_NONE;
-    event_finish(g);
-    return;
+static int character_recovery_hp(const Character *c) {
+  return (int)round(c->hp_max * 0.1);
+}
+
+static int character_recovery_mp(const Character *c) {
+  return (int)round(c->mp_max * 0.1);
+}
+
+static void skill_init_empty(Skill *s, SkillType type) {
+  if (!s) return;
+  memset(s, 0, sizeof(*s));
+  s->type = type;
+  snprintf(s->code, sizeof(s->code), "none");
+  snprintf(s->name, sizeof(s->name), "---");
+}
+
+static void skill_assign(Skill *s, SkillType type, const char *code) {
+  if (!s) return;
+  memset(s, 0, sizeof(*s));
+  s->type = type;
+  snprintf(s->code, sizeof(s->code), "%s", code ? code : "none");
+  s->lvl = 0;
+
+  if (strcmp(s->code, "ascetic_strike") == 0) { snprintf(s->name, sizeof(s->name), "Ascetic strike"); s->mp_cost = 2; }
+  else if (strcmp(s->code, "precise_strike") == 0) { snprintf(s->name, sizeof(s->name), "Precise strike"); s->mp_cost = 8; }
+  else if (strcmp(s->code, "strong_strike") == 0) { snprintf(s->name, sizeof(s->name), "Strong strike"); s->mp_cost = 12; }
+  else if (strcmp(s->code, "traumatic_strike") == 0) { snprintf(s->name, sizeof(s->name), "Traumatic strike"); s->mp_cost = 6; }
+  else if (strcmp(s->code, "berserk") == 0) { snprintf(s->name, sizeof(s->name), "Berserk"); }
+  else if (strcmp(s->code, "concentration") == 0) { snprintf(s->name, sizeof(s->name), "Concentration"); }
+  else if (strcmp(s->code, "dazed") == 0) { snprintf(s->name, sizeof(s->name), "Dazed"); }
+  else if (strcmp(s->code, "shield_master") == 0) { snprintf(s->name, sizeof(s->name), "Shield master"); }
+  else if (strcmp(s->code, "bloody_ritual") == 0) { snprintf(s->name, sizeof(s->name), "Bloody ritual"); s->hp_cost = 10; }
+  else if (strcmp(s->code, "first_aid") == 0) { snprintf(s->name, sizeof(s->name), "First aid"); s->mp_cost = 10; }
+  else if (strcmp(s->code, "treasure_hunter") == 0) { snprintf(s->name, sizeof(s->name), "Treasure hunter"); }
+  else { snprintf(s->name, sizeof(s->name), "---"); }
+}
+
+static WeaponItem weapon_from_code(const Game *g, const char *code);
+static ArmorItem armor_from_code(const ArmorItem *items, size_t count, const char *code);
+static ShieldItem shield_from_code(const Game *g, const char *code);
+static const char *pick_random_option(char **list, size_t count, Rng *rng);
+static const HeroTemplate *hero_template_by_code(const Game *g, const char *code);
+static bool save_warehouse_data(const WarehouseData *wh);
+static const char *ammo_name(Game *g, const char *type, const char *code);
+static void hero_rest(Character *hero, LogBuffer *log);
+static bool save_shop_data(const ShopData *shop);
+static bool save_monolith_data(const MonolithData *m);
+static void titleize_token(const char *in, char *out, size_t out_sz);
+static const EnemyTemplate *enemy_template_boss(const DungeonData *d);
+static const EnemyTemplate *enemy_template_random_standard(const DungeonData *d, int leveling, Rng *rng);
+static int enemy_choices_count_for(const Character *hero, Rng *rng);
+
+static const HeroTemplate *hero_template_by_code(const Game *g, const char *code) {
+  if (!g || !code) return NULL;
+  for (size_t i = 0; i < g->hero_count; ++i) {
+    if (strcmp(g->heroes[i].code, code) == 0) return &g->heroes[i];
   }
-  g->event_pending_action = EVENT_PENDING_NONE;
+  return NULL;
 }
 
-static void event_enter_step(Game *g) {
-  if (!g) return;
-  logbuffer_clear(&g->log);
-  event_set_art(g, "normal");
+static Character character_from_hero(Game *g, const HeroTemplate *t, const char *name) {
+  Character c;
+  memset(&c, 0, sizeof(c));
+  snprintf(c.code, sizeof(c.code), "%s", t->code);
+  snprintf(c.name, sizeof(c.name), "%s", name ? name : t->name);
+  snprintf(c.background, sizeof(c.background), "%s", t->code);
+  c.hp = t->hp;
+  c.hp_max = t->hp;
+  c.mp = t->mp;
+  c.mp_max = t->mp;
+  c.regen_hp_base = 0;
+  c.regen_mp_base = 0;
+  c.min_dmg_base = t->min_dmg;
+  c.max_dmg_base = t->max_dmg;
+  c.armor_penetration_base = t->armor_penetration;
+  c.accuracy_base = t->accuracy;
+  c.armor_base = t->armor;
+  c.block_chance_base = 0;
+  c.exp = 0;
+  c.lvl = 0;
+  c.stat_points = 5;
+  c.skill_points = t->skill_points;
+  c.pzdc_monolith_points = 0;
+  c.coins = 0;
+  c.exp_gived = 0;
+  c.coins_gived = 0;
+  c.dungeon_part_number = 1;
+  c.leveling = 0;
+  memset(&c.ingredients, 0, sizeof(c.ingredients));
+  snprintf(c.ingredient, sizeof(c.ingredient), "without");
 
-  if (strcmp(g->event_code, "loot_field") == 0) {
-    int base = rand_range(1, 200);
-    int th = treasure_hunter_coeff(&g->hero.camp_skill);
-    int chance = base + th;
-    g->event_data[0] = base;
-    g->event_data[1] = chance;
-    event_set_main(g, "To continue press Enter");
-    logbuffer_push(&g->log, "Search everything around...");
-    if (th > 0) {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "Random luck is %d + treasure hunter %d = %d...", base, th, chance);
-      logbuffer_push(&g->log, msg);
-    } else {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "Random luck is %d...", chance);
-      logbuffer_push(&g->log, msg);
-    }
-    if (chance > 130) {
-      logbuffer_push(&g->log, "...more then 130");
-      hero_add_hp(&g->hero, 20);
-      char msg[128];
-      snprintf(msg, sizeof(msg), "Found a potion that restores 20 HP, now you have %d/%d HP", g->hero.hp, g->hero.hp_max);
-      logbuffer_push(&g->log, msg);
-    } else if (chance > 70) {
-      logbuffer_push(&g->log, "...lower then 130");
-      logbuffer_push(&g->log, "There is nothing valuable");
+  const char *weapon_code = pick_random_option(t->weapon_options, t->weapon_count, &g->rng[RNG_RUN]);
+  const char *body_code = pick_random_option(t->body_armor_options, t->body_armor_count, &g->rng[RNG_RUN]);
+  const char *head_code = pick_random_option(t->head_armor_options, t->head_armor_count, &g->rng[RNG_RUN]);
+  const char *arms_code = pick_random_option(t->arms_armor_options, t->arms_armor_count, &g->rng[RNG_RUN]);
+  const char *shield_code = pick_random_option(t->shield_options, t->shield_count, &g->rng[RNG_RUN]);
+
+  c.weapon = weapon_from_code(g, weapon_code);
+  c.body_armor = armor_from_code(g->body_armors, g->body_armor_count, body_code);
+  c.head_armor = armor_from_code(g->head_armors, g->head_armor_count, head_code);
+  c.arms_armor = armor_from_code(g->arms_armors, g->arms_armor_count, arms_code);
+  c.shield = shield_from_code(g, shield_code);
+
+  skill_init_empty(&c.active_skill, SKILL_ACTIVE);
+  skill_init_empty(&c.passive_skill, SKILL_PASSIVE);
+  skill_init_empty(&c.camp_skill, SKILL_CAMP);
+
+  return c;
+}
+
+static Character character_from_enemy(Game *g, const EnemyTemplate *t) {
+  Character c;
+  memset(&c, 0, sizeof(c));
+  snprintf(c.code, sizeof(c.code), "%s", t->code_name);
+  snprintf(c.name, sizeof(c.name), "%s", t->name);
+  c.hp = t->hp;
+  c.hp_max = t->hp;
+  c.mp = 0;
+  c.mp_max = 0;
+  c.regen_hp_base = t->regen_hp;
+  c.regen_mp_base = 0;
+  c.min_dmg_base = t->min_dmg;
+  c.max_dmg_base = t->max_dmg;
+  c.armor_penetration_base = t->armor_penetration;
+  c.accuracy_base = t->accuracy;
+  c.armor_base = t->armor;
+  c.block_chance_base = 0;
+  c.exp = 0;
+  c.lvl = 0;
+  c.stat_points = 0;
+  c.skill_points = 0;
+  c.exp_gived = t->exp_gived;
+  c.coins_gived = t->coins_gived;
+  memset(&c.ingredients, 0, sizeof(c.ingredients));
+  snprintf(c.ingredient, sizeof(c.ingredient), "without");
+
+  const char *weapon_code = pick_random_option(t->weapon_options, t->weapon_count, &g->rng[RNG_RUN]);
+  const char *body_code = pick_random_option(t->body_armor_options, t->body_armor_count, &g->rng[RNG_RUN]);
+  const char *head_code = pick_random_option(t->head_armor_options, t->head_armor_count, &g->rng[RNG_RUN]);
+  const char *arms_code = pick_random_option(t->arms_armor_options, t->arms_armor_count, &g->rng[RNG_RUN]);
+  const char *shield_code = pick_random_option(t->shield_options, t->shield_count, &g->rng[RNG_RUN]);
+  const char *ingredient_code = pick_random_option(t->ingredient_options, t->ingredient_count, &g->rng[RNG_RUN]);
+
+  c.weapon = weapon_from_code(g, weapon_code);
+  c.body_armor = armor_from_code(g->body_armors, g->body_armor_count, body_code);
+  c.head_armor = armor_from_code(g->head_armors, g->head_armor_count, head_code);
+  c.arms_armor = armor_from_code(g->arms_armors, g->arms_armor_count, arms_code);
+  c.shield = shield_from_code(g, shield_code);
+  snprintf(c.ingredient, sizeof(c.ingredient), "%s", ingredient_code ? ingredient_code : "without");
+
+  skill_init_empty(&c.active_skill, SKILL_ACTIVE);
+  skill_init_empty(&c.passive_skill, SKILL_PASSIVE);
+  skill_init_empty(&c.camp_skill, SKILL_CAMP);
+
+  return c;
+}
+
+static void hero_add_dmg_base(Character *h, int n, Rng *rng) {
+  if (!h || n <= 0) return;
+  for (int i = 0; i < n; ++i) {
+    if (h->min_dmg_base < h->max_dmg_base && rand_range(rng, 0, 1) == 0) {
+      h->min_dmg_base += 1;
     } else {
-      logbuffer_push(&g->log, "...lower then 70");
-      g->hero.hp -= 5;
-      event_set_main(g, "You died from a rat bite. A miserable death. To continue press Enter");
-      char msg[160];
-      snprintf(msg, sizeof(msg), "While you were rummaging around the corners, you were bitten by a rat (-5 HP), now you have %d/%d HP", g->hero.hp, g->hero.hp_max);
-      logbuffer_push(&g->log, msg);
+      h->max_dmg_base += 1;
     }
-    event_set_input(g, EVENT_INPUT_NONE);
-  } else if (strcmp(g->event_code, "loot_secret") == 0) {
-    int base = rand_range(1, 200);
-    int th = treasure_hunter_coeff(&g->hero.camp_skill);
-    int chance = base + th;
-    event_set_main(g, "To continue press Enter");
-    logbuffer_push(&g->log, "Looking around, you noticed the magician's hiding place, and in it... ");
-    if (th > 0) {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "Random luck is %d + treasure hunter %d = %d...", base, th, chance);
-      logbuffer_push(&g->log, msg);
+  }
+  character_touch(h);
+}
+
+static void hero_reduce_dmg_base(Character *h, int n, Rng *rng) {
+  if (!h || n <= 0) return;
+  for (int i = 0; i < n; ++i) {
+    if (h->max_dmg_base > h->min_dmg_base && rand_range(rng, 0, 1) == 0) {
+      if (h->max_dmg_base > 0) h->max_dmg_base -= 1;
     } else {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "Random luck is %d...", chance);
-      logbuffer_push(&g->log, msg);
+      if (h->min_dmg_base > 0) h->min_dmg_base -= 1;
     }
-    if (chance >= 130) {
-      logbuffer_push(&g->log, "...more then 130");
-      int stash = rand_range(1, 32);
-      if (stash <= 10) {
-        int bonus = rand_range(1, 3);
-        char msg[128];
-        snprintf(msg, sizeof(msg), "Elixir of Health. Your HP %d/%d increase by %d", g->hero.hp, g->hero.hp_max, bonus);
-        logbuffer_push(&g->log, msg);
-        g->hero.hp_max += bonus;
-        g->hero.hp += bonus;
-        snprintf(msg, sizeof(msg), "Now you have %d/%d HP", g->hero.hp, g->hero.hp_max);
-        logbuffer_push(&g->log, msg);
-      } else if (stash <= 20) {
-        int bonus = rand_range(1, 3);
-        char msg[128];
-        snprintf(msg, sizeof(msg), "Elixir of Endurance. Your MP %d/%d increase by %d", g->hero.mp, g->hero.mp_max, bonus);
+    if (h->max_dmg_base < h->min_dmg_base) h->max_dmg_base = h->min_dmg_base;
+  }
+  character_touch(h);
+}
+
+static void hero_add_hp(Character *h, int amount) {
+  if (!h || amount <= 0) return;
+  if (h->hp + amount > h->hp_max) amount = h->hp_max - h->hp;
+  if (amount < 0) amount = 0;
+  h->hp += amount;
+}
+
+static void hero_add_mp(Character *h, int amount) {
+  if (!h || amount <= 0) return;
+  if (h->mp + amount > h->mp_max) amount = h->mp_max - h->mp;
+  if (amount < 0) amount = 0;
+  h->mp += amount;
+}
+
+static void hero_reduce_mp(Character *h, int amount) {
+  if (!h || amount <= 0) return;
+  if (amount > h->mp) amount = h->mp;
+  h->mp -= amount;
+}
+
+static void hero_reduce_coins(Character *h, int amount) {
+  if (!h || amount <= 0) return;
+  if (amount > h->coins) amount = h->coins;
+  h->coins -= amount;
+}
+
+static void apply_monolith_bonuses(const MonolithData *m, Character *h, Rng *rng) {
+  if (!m || !h) return;
+  h->hp_max += m->hp;
+  h->hp += m->hp;
+  h->mp_max += m->mp;
+  h->mp += m->mp;
+  h->accuracy_base += m->accuracy;
+  hero_add_dmg_base(h, m->damage, rng);
+  h->stat_points += m->stat_points;
+  h->skill_points += m->skill_points;
+  h->armor_base += m->armor;
+  h->armor_penetration_base += m->armor_penetration;
+  h->regen_hp_base += m->regen_hp;
+  h->regen_mp_base += m->regen_mp;
+  h->block_chance_base += m->block_chance;
+  character_touch(h);
+}
+
+static void apply_statistics_bonuses(const StatisticsTotal *s, Game *g, Character *h) {
+  if (!s || !g || !h) return;
+  if (s->bandits[0] >= 30) h->weapon = weapon_from_code(g, "stick");
+  if (s->bandits[1] >= 30) { h->hp_max += 2; h->hp += 2; }
+  if (s->bandits[2] >= 30) h->accuracy_base += 1;
+  if (s->bandits[3] >= 30) { h->hp_max += 5; h->hp += 5; }
+  if (s->bandits[4] >= 30) h->stat_points += 1;
+  if (s->bandits[5] >= 5) h->skill_points += 1;
+
+  if (s->undeads[0] >= 30) h->arms_armor = armor_from_code(g->arms_armors, g->arms_armor_count, "worn_gloves");
+  if (s->undeads[1] >= 30) { h->mp_max += 3; h->mp += 3; }
+  if (s->undeads[2] >= 30) h->accuracy_base += 1;
+  if (s->undeads[3] >= 30) { h->hp_max += 7; h->hp += 7; }
+  if (s->undeads[4] >= 30) h->block_chance_base += 3;
+  if (s->undeads[5] >= 5) h->regen_mp_base += 1;
+
+  if (s->swamp[0] >= 30) { h->mp_max += 3; h->mp += 3; }
+  if (s->swamp[1] >= 30) h->shield = shield_from_code(g, "holey_wicker_buckler");
+  if (s->swamp[2] >= 30) { h->hp_max += 3; h->hp += 3; }
+  if (s->swamp[3] >= 30) h->accuracy_base += 1;
+  if (s->swamp[4] >= 30) h->max_dmg_base += 1;
+  if (s->swamp[5] >= 5) h->armor_base += 1;
+  character_touch(h);
+}
+
+static void apply_warehouse_bonuses(Game *g, Character *h) {
+  if (!g || !h) return;
+  bool changed = false;
+  if (strcmp(g->warehouse.weapon, "without") != 0) {
+    h->weapon = weapon_from_code(g, g->warehouse.weapon);
+    snprintf(g->warehouse.weapon, sizeof(g->warehouse.weapon), "without");
+    changed = true;
+  }
+  if (strcmp(g->warehouse.body_armor, "without") != 0) {
+    h->body_armor = armor_from_code(g->body_armors, g->body_armor_count, g->warehouse.body_armor);
+    snprintf(g->warehouse.body_armor, sizeof(g->warehouse.body_armor), "without");
+    changed = true;
+  }
+  if (strcmp(g->warehouse.head_armor, "without") != 0) {
+    h->head_armor = armor_from_code(g->head_armors, g->head_armor_count, g->warehouse.head_armor);
+    snprintf(g->warehouse.head_armor, sizeof(g->warehouse.head_armor), "without");
+    changed = true;
+  }
+  if (strcmp(g->warehouse.arms_armor, "without") != 0) {
+    h->arms_armor = armor_from_code(g->arms_armors, g->arms_armor_count, g->warehouse.arms_armor);
+    snprintf(g->warehouse.arms_armor, sizeof(g->warehouse.arms_armor), "without");
+    changed = true;
+  }
+  if (strcmp(g->warehouse.shield, "without") != 0) {
+    h->shield = shield_from_code(g, g->warehouse.shield);
+    snprintf(g->warehouse.shield, sizeof(g->warehouse.shield), "without");
+    changed = true;
+  }
+  if (changed) {
+    character_touch(h);
+    save_warehouse_data(&g->warehouse);
+  }
+}
+
+static void shop_add_from_hero(Game *g, const Character *h) {
+  if (!g || !h) return;
+  const int sell_chance = 3;
+  for (int t = 0; t < 5; ++t) {
+    const char *code = "without";
+    if (t == 0) code = h->weapon.code;
+    else if (t == 1) code = h->body_armor.code;
+    else if (t == 2) code = h->head_armor.code;
+    else if (t == 3) code = h->arms_armor.code;
+    else code = h->shield.code;
+    if (strcmp(code, "without") == 0) continue;
+    if (rand_range(&g->rng[RNG_SHOP], 0, sell_chance - 1) != 0) continue;
+    char (*arr)[32] = NULL;
+    if (t == 0) arr = g->shop.weapon;
+    else if (t == 1) arr = g->shop.body_armor;
+    else if (t == 2) arr = g->shop.head_armor;
+    else if (t == 3) arr = g->shop.arms_armor;
+    else arr = g->shop.shield;
+    int slot = -1;
+    for (int i = 0; i < 3; ++i) {
+      if (strcmp(arr[i], "without") == 0) { slot = i; break; }
+    }
+    if (slot < 0) slot = rand_range(&g->rng[RNG_SHOP], 0, 2);
+    snprintf(arr[slot], sizeof(arr[slot]), "%s", code);
+  }
+  save_shop_data(&g->shop);
+}
+
+static void delete_hero_in_run_file(void) {
+  char *saves_dir = resolve_saves_dir();
+  if (!saves_dir) return;
+  char path[512];
+  snprintf(path, sizeof(path), "%s/hero_in_run.yml", saves_dir);
+  free(saves_dir);
+  if (file_exists(path)) remove(path);
+}
+
+static void end_run_transfer(Game *g, bool hero_alive) {
+  if (!g) return;
+  if (strcmp(g->hero.name, "Cheater") != 0) {
+    g->monolith.points += g->hero.pzdc_monolith_points;
+    g->hero.pzdc_monolith_points = 0;
+    save_monolith_data(&g->monolith);
+    if (hero_alive) {
+      shop_add_from_hero(g, &g->hero);
+      g->warehouse.coins += g->hero.coins;
+      g->hero.coins = 0;
+      save_warehouse_data(&g->warehouse);
+    }
+  }
+  delete_hero_in_run_file();
+}
+
+static int treasure_hunter_coeff(const Skill *camp_skill) {
+  if (!camp_skill || strcmp(camp_skill->code, "treasure_hunter") != 0) return 0;
+  return 50 + 10 * camp_skill->lvl;
+}
+
+static bool loot_should_drop(Game *g) {
+  if (!g) return false;
+  if (strcmp(g->hero.camp_skill.code, "treasure_hunter") == 0) {
+    int coeff = treasure_hunter_coeff(&g->hero.camp_skill);
+    return rand_range(&g->rng[RNG_LOOT], 0, 1) == 1 || rand_range(&g->rng[RNG_LOOT], 0, 150) < coeff;
+  }
+  return rand_range(&g->rng[RNG_LOOT], 0, 1) == 1;
+}
+
+static void loot_reset(Game *g) {
+  if (!g) return;
+  g->loot_count = 0;
+  g->loot_index = 0;
+  g->loot_show_coins = 0;
+  g->loot_show_ingredient = 0;
+  g->loot_message_mode = 0;
+  g->loot_coins = 0;
+  g->loot_ingredient[0] = '\0';
+  g->loot_message[0] = '\0';
+  g->pending_levelup = 0;
+  g->loot_return_pending = 0;
+  g->loot_return_state = STATE_CAMPFIRE;
+  g->loot_last_taken = -1;
+}
+
+static void loot_add(Game *g, const char *type, const char *code) {
+  if (!g || !type || !code) return;
+  if (g->loot_count >= (int)(sizeof(g->loot_items) / sizeof(g->loot_items[0]))) return;
+  snprintf(g->loot_items[g->loot_count].type, sizeof(g->loot_items[g->loot_count].type), "%s", type);
+  snprintf(g->loot_items[g->loot_count].code, sizeof(g->loot_items[g->loot_count].code), "%s", code);
+  g->loot_count += 1;
+}
+
+static void loot_setup(Game *g) {
+  if (!g) return;
+  loot_reset(g);
+  if (loot_should_drop(g) && strcmp(g->enemy.weapon.code, "without") != 0) loot_add(g, "weapon", g->enemy.weapon.code);
+  if (loot_should_drop(g) && strcmp(g->enemy.body_armor.code, "without") != 0) loot_add(g, "body_armor", g->enemy.body_armor.code);
+  if (loot_should_drop(g) && strcmp(g->enemy.head_armor.code, "without") != 0) loot_add(g, "head_armor", g->enemy.head_armor.code);
+  if (loot_should_drop(g) && strcmp(g->enemy.arms_armor.code, "without") != 0) loot_add(g, "arms_armor", g->enemy.arms_armor.code);
+  if (loot_should_drop(g) && strcmp(g->enemy.shield.code, "without") != 0) loot_add(g, "shield", g->enemy.shield.code);
+  if (g->enemy.coins_gived > 0) {
+    g->loot_show_coins = 1;
+    g->loot_coins = g->enemy.coins_gived;
+  }
+  if (strcmp(g->enemy.ingredient, "without") != 0) {
+    g->loot_show_ingredient = 1;
+    snprintf(g->loot_ingredient, sizeof(g->loot_ingredient), "%s", g->enemy.ingredient);
+  }
+}
+
+static void loot_advance(Game *g) {
+  if (!g) return;
+  if (g->loot_index < g->loot_count) {
+    const LootEntry *le = &g->loot_items[g->loot_index];
+    char item_name[128];
+    const char *name = ammo_name(g, le->type, le->code);
+    snprintf(item_name, sizeof(item_name), "%s", name);
+    snprintf(g->loot_message, sizeof(g->loot_message),
+             "After searching the %s's body you found %s", g->enemy.name, item_name);
+    g->state = STATE_LOOT;
+    return;
+  }
+  if (g->loot_show_coins) {
+    g->loot_message_mode = 1;
+    g->state = STATE_LOOT_MESSAGE;
+    return;
+  }
+  if (g->loot_show_ingredient) {
+    g->loot_message_mode = 2;
+    g->state = STATE_LOOT_MESSAGE;
+    return;
+  }
+  if (g->loot_return_pending) {
+    g->loot_return_pending = 0;
+    g->state = g->loot_return_state;
+    if (g->state == STATE_EVENT_RESULT) {
+      event_after_loot(g);
+    }
+    return;
+  }
+  if (!g->enemy_is_boss) {
+    g->hero.leveling += 1;
+  }
+  g->hero.dungeon_part_number += 1;
+  logbuffer_clear(&g->log);
+  hero_rest(&g->hero, &g->log);
+  g->state = STATE_CAMPFIRE;
+}
+
+static const EventDef kEvents[] = {
+  {
+    "loot_field",
+    "Some scrub",
+    {
+      "In this pile of scrub...",
+      "...you might find some",
+      "",
+      "",
+      ""
+    },
+    "events/_loot_field",
+    EVENT_EFFECT_NONE,
+    0,
+    ""
+  },
+  {
+    "loot_secret",
+    "Secret something",
+    {
+      "There might be something...",
+      "...unusual here",
+      "",
+      ""
+    },
+    "events/_loot_secret",
+    EVENT_EFFECT_NONE,
+    0,
+    ""
+  },
+  {
+    "gambler",
+    "Gambler",
+    {
+      "Little man...",
+      "...he juggling dice...",
+      "...easy way to get rich",
+      ""
+    },
+    "events/_gambler",
+    EVENT_EFFECT_NONE,
+    0,
+    ""
+  },
+  {
+    "altar_of_blood",
+    "Altar of Blood",
+    {
+      "Old Altar...",
+      "...its take your blood...",
+      "...and give you some",
+      "",
+      ""
+    },
+    "events/_altar_of_blood",
+    EVENT_EFFECT_NONE,
+    0,
+    ""
+  },
+  {
+    "boatman_eugene",
+    "Who are you and who am i...",
+    {
+      "Boatman will take you...",
+      "...will ask for something...",
+      "...path will be shorter?",
+      "",
+      ""
+    },
+    "events/_boatman_eugene",
+    EVENT_EFFECT_NONE,
+    0,
+    ""
+  },
+  {
+    "briedge_keeper",
+    "Bridge of death",
+    {
+      "Bridge keeper...",
+      "...will ask questions...",
+      "...answer correctly...",
+      "...and otherwise",
+      ""
+    },
+    "events/_briedge_keeper",
+    EVENT_EFFECT_NONE,
+    0,
+    ""
+  },
+  {
+    "wariors_grave",
+    "Warior's Grave",
+    {
+      "Old grave...",
+      "...warrior is buried here...",
+      "...maybe with ammunition?",
+      "",
+      ""
+    },
+    "events/_warriors_grave",
+    EVENT_EFFECT_NONE,
+    0,
+    ""
+  },
+  {
+    "pig_with_saucepan",
+    "Pig with saucepan",
+    {
+      "Pigman is eating something...",
+      "...smelly in his saucepan...",
+      "...the saucepan looks like...",
+      "...on a shiny helmet",
+      ""
+    },
+    "events/_pig_with_saucepan",
+    EVENT_EFFECT_NONE,
+    0,
+    ""
+  },
+  {
+    "black_mage",
+    "Black mage",
+    {
+      "Casts spells...",
+      "...for your coins",
+      "",
+      "",
+      ""
+    },
+    "events/_black_mage",
+    EVENT_EFFECT_NONE,
+    0,
+    ""
+  },
+  {
+    "exit_run",
+    "Exit from dugeon",
+    {
+      "Looks like an exit...",
+      "...you can save life...",
+      "...you can save coins...",
+      "...but be careful...",
+      "...you might fall"
+    },
+    "events/_exit_run",
+    EVENT_EFFECT_NONE,
+    0,
+    ""
+  }
+};
+
+static void event_to_map(const EventDef *ev, ValueMap *map) {
+  if (!ev || !map) return;
+  value_map_clear(map);
+  value_map_set(map, "name", ev->name);
+  value_map_set(map, "description1", ev->desc[0]);
+  value_map_set(map, "description2", ev->desc[1]);
+  value_map_set(map, "description3", ev->desc[2]);
+  value_map_set(map, "description4", ev->desc[3]);
+  value_map_set(map, "description5", ev->desc[4]);
+}
+
+static void pick_random_events(Game *g) {
+  if (!g) return;
+  int random = rand_range(&g->rng[RNG_EVENTS], 1, 200);
+  int th = treasure_hunter_coeff(&g->hero.camp_skill);
+  int res = random + th;
+  g->event_choice_count = res > 150 ? 3 : res > 80 ? 2 : 1;
+  int total = (int)(sizeof(kEvents) / sizeof(kEvents[0]));
+  int used[16] = {0};
+  for (int i = 0; i < g->event_choice_count; ++i) {
+    int idx = rand_range(&g->rng[RNG_EVENTS], 0, total - 1);
+    int guard = 0;
+    while (used[idx] && guard < 20) {
+      idx = rand_range(&g->rng[RNG_EVENTS], 0, total - 1);
+      guard++;
+    }
+    used[idx] = 1;
+    g->event_choices[i] = kEvents[idx];
+  }
+  if (th > 0) {
+    snprintf(g->event_choose_message, sizeof(g->event_choose_message),
+             "Random is %d + treasure hunter %d = you find %d ways. Which way will you go?",
+             random, th, g->event_choice_count);
+  } else {
+    snprintf(g->event_choose_message, sizeof(g->event_choose_message),
+             "Random is %d = you find %d ways. Which way will you go?",
+             random, g->event_choice_count);
+  }
+}
+
+static void event_clear_input(Game *g) {
+  if (!g) return;
+  g->event_text_len = 0;
+  g->event_text[0] = '\0';
+}
+
+static void event_set_input(Game *g, EventInputMode mode) {
+  if (!g) return;
+  g->event_input_mode = mode;
+  if (mode != EVENT_INPUT_TEXT) event_clear_input(g);
+}
+
+static void event_set_main(Game *g, const char *text) {
+  if (!g || !text) return;
+  snprintf(g->event_message, sizeof(g->event_message), "%s", text);
+}
+
+static void event_set_art(Game *g, const char *name) {
+  if (!g || !name) return;
+  snprintf(g->event_art_name, sizeof(g->event_art_name), "%s", name);
+}
+
+static void event_finish(Game *g) {
+  if (!g) return;
+  g->event_pending_action = EVENT_PENDING_NONE;
+  g->hero.dungeon_part_number += 1;
+  logbuffer_clear(&g->log);
+  hero_rest(&g->hero, &g->log);
+  g->state = STATE_CAMPFIRE;
+}
+
+static void event_end_run(Game *g, const char *title, const char *log_line, bool alive) {
+  if (!g) return;
+  logbuffer_clear(&g->log);
+  if (log_line && log_line[0]) logbuffer_push(&g->log, log_line);
+  end_run_transfer(g, alive);
+  snprintf(g->message_title, sizeof(g->message_title), "%s", title ? title : "Run ended");
+  if (!alive) {
+    snprintf(g->message_art_name, sizeof(g->message_art_name), "game_over");
+    snprintf(g->message_art_path, sizeof(g->message_art_path), "_game_over");
+  } else {
+    g->message_art_name[0] = '\0';
+    g->message_art_path[0] = '\0';
+  }
+  g->next_state = STATE_START;
+  g->state = STATE_MESSAGE;
+}
+
+static void event_offer_loot(Game *g, const char *type, const char *code, const char *message, EventPendingAction pending) {
+  if (!g || !type || !code) return;
+  loot_reset(g);
+  g->event_pending_action = pending;
+  g->loot_last_taken = -1;
+  g->loot_return_pending = 1;
+  g->loot_return_state = STATE_EVENT_RESULT;
+  snprintf(g->loot_message, sizeof(g->loot_message), "%s", message ? message : "Loot found");
+  loot_add(g, type, code);
+  g->state = STATE_LOOT;
+}
+
+static void event_after_loot(Game *g) {
+  if (!g) return;
+  if (g->event_pending_action == EVENT_PENDING_GRAVE_DIG) {
+    int taken = g->loot_last_taken == 1;
+    int mp = taken ? rand_range(&g->rng[RNG_EVENTS], 20, 100) : rand_range(&g->rng[RNG_EVENTS], 5, 20);
+    hero_reduce_mp(&g->hero, mp);
+    logbuffer_clear(&g->log);
+    if (taken) {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "The warrior's spirit is furious, he took %d MP from you", mp);
+      logbuffer_push(&g->log, msg);
+    } else {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "The warrior spirit is not happy, he took %d MP from you", mp);
+      logbuffer_push(&g->log, msg);
+    }
+    event_set_main(g, "Leave [Enter 0]");
+    event_set_art(g, "diged");
+    event_set_input(g, EVENT_INPUT_DIGIT);
+    g->event_step = 31;
+  } else if (g->event_pending_action == EVENT_PENDING_GRAVE_REWARD) {
+    logbuffer_clear(&g->log);
+    logbuffer_push(&g->log, "\"Good luck, brother. With people like you, we will cleanse these lands.\"");
+    event_set_main(g, "Leave [Enter 0]");
+    event_set_art(g, "clean");
+    event_set_input(g, EVENT_INPUT_DIGIT);
+    g->event_step = 41;
+  } else if (g->event_pending_action == EVENT_PENDING_PIG_SALLET) {
+    g->event_pending_action = EVENT_PENDING_NONE;
+    event_finish(g);
+    return;
+  }
+  g->event_pending_action = EVENT_PENDING_NONE;
+}
+
+static void event_enter_step(Game *g) {
+  if (!g) return;
+  logbuffer_clear(&g->log);
+  event_set_art(g, "normal");
+
+  if (strcmp(g->event_code, "loot_field") == 0) {
+    int base = rand_range(&g->rng[RNG_EVENTS], 1, 200);
+    int th = treasure_hunter_coeff(&g->hero.camp_skill);
+    int chance = base + th;
+    g->event_data[0] = base;
+    g->event_data[1] = chance;
+    event_set_main(g, "To continue press Enter");
+    logbuffer_push(&g->log, "Search everything around...");
+    if (th > 0) {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "Random luck is %d + treasure hunter %d = %d...", base, th, chance);
+      logbuffer_push(&g->log, msg);
+    } else {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "Random luck is %d...", chance);
+      logbuffer_push(&g->log, msg);
+    }
+    if (chance > 130) {
+      logbuffer_push(&g->log, "...more then 130");
+      hero_add_hp(&g->hero, 20);
+      char msg[128];
+      snprintf(msg, sizeof(msg), "Found a potion that restores 20 HP, now you have %d/%d HP", g->hero.hp, g->hero.hp_max);
+      logbuffer_push(&g->log, msg);
+    } else if (chance > 70) {
+      logbuffer_push(&g->log, "...lower then 130");
+      logbuffer_push(&g->log, "There is nothing valuable");
+    } else {
+      logbuffer_push(&g->log, "...lower then 70");
+      g->hero.hp -= 5;
+      event_set_main(g, "You died from a rat bite. A miserable death. To continue press Enter");
+      char msg[160];
+      snprintf(msg, sizeof(msg), "While you were rummaging around the corners, you were bitten by a rat (-5 HP), now you have %d/%d HP", g->hero.hp, g->hero.hp_max);
+      logbuffer_push(&g->log, msg);
+    }
+    event_set_input(g, EVENT_INPUT_NONE);
+  } else if (strcmp(g->event_code, "loot_secret") == 0) {
+    int base = rand_range(&g->rng[RNG_EVENTS], 1, 200);
+    int th = treasure_hunter_coeff(&g->hero.camp_skill);
+    int chance = base + th;
+    event_set_main(g, "To continue press Enter");
+    logbuffer_push(&g->log, "Looking around, you noticed the magician's hiding place, and in it... ");
+    if (th > 0) {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "Random luck is %d + treasure hunter %d = %d...", base, th, chance);
+      logbuffer_push(&g->log, msg);
+    } else {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "Random luck is %d...", chance);
+      logbuffer_push(&g->log, msg);
+    }
+    if (chance >= 130) {
+      logbuffer_push(&g->log, "...more then 130");
+      int stash = rand_range(&g->rng[RNG_EVENTS], 1, 32);
+      if (stash <= 10) {
+        int bonus = rand_range(&g->rng[RNG_EVENTS], 1, 3);
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Elixir of Health. Your HP %d/%d increase by %d", g->hero.hp, g->hero.hp_max, bonus);
+        logbuffer_push(&g->log, msg);
+        g->hero.hp_max += bonus;
+        g->hero.hp += bonus;
+        snprintf(msg, sizeof(msg), "Now you have %d/%d HP", g->hero.hp, g->hero.hp_max);
+        logbuffer_push(&g->log, msg);
+      } else if (stash <= 20) {
+        int bonus = rand_range(&g->rng[RNG_EVENTS], 1, 3);
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Elixir of Endurance. Your MP %d/%d increase by %d", g->hero.mp, g->hero.mp_max, bonus);
         logbuffer_push(&g->log, msg);
         g->hero.mp_max += bonus;
         g->hero.mp += bonus;
         snprintf(msg, sizeof(msg), "Now you have %d/%d MP", g->hero.mp, g->hero.mp_max);
         logbuffer_push(&g->log, msg);
       } else if (stash <= 25) {
-        int bonus = rand_range(1, 2);
+        int bonus = rand_range(&g->rng[RNG_EVENTS], 1, 2);
         char msg[128];
         snprintf(msg, sizeof(msg), "Elixir of Precision. Your accuracy %d increase by %d", g->hero.accuracy_base, bonus);
         logbuffer_push(&g->log, msg);
         g->hero.accuracy_base += bonus;
+        character_touch(&g->hero);
         snprintf(msg, sizeof(msg), "Now you have %d accuracy", g->hero.accuracy_base);
         logbuffer_push(&g->log, msg);
       } else if (stash <= 27) {
@@ -2609,6 +4553,7 @@ static void event_enter_step(Game *g) {
         logbuffer_push(&g->log, "Book of Skills. Your skill points increase by 1");
       } else if (stash == 30) {
         g->hero.armor_base += 1;
+        character_touch(&g->hero);
         logbuffer_push(&g->log, "Elixir of Stone. Your armor increase by 1");
         char msg[64];
         snprintf(msg, sizeof(msg), "Now you have %d armor", g->hero.armor_base);
@@ -2769,10 +4714,10 @@ static void event_enter_step(Game *g) {
           snprintf(msg, sizeof(msg), "\"You did a great job %d %ss is killed, here is your reward\"", g->wg_count, enemy_name);
           const char *reward_code = "sword";
           if (g->wg_level == 1) {
-            reward_code = (rand_range(0, 4) < 4) ? "sword" : "hatchet";
+            reward_code = (rand_range(&g->rng[RNG_EVENTS], 0, 4) < 4) ? "sword" : "hatchet";
           } else {
             const char *pool[] = {"falchion", "pernach", "axe", "flail"};
-            reward_code = pool[rand_range(0, 3)];
+            reward_code = pool[rand_range(&g->rng[RNG_EVENTS], 0, 3)];
           }
           event_offer_loot(g, "weapon", reward_code, msg, EVENT_PENDING_GRAVE_REWARD);
           return;
@@ -2896,7 +4841,7 @@ static void event_handle_digit(Game *g, int digit) {
         g->event_step = 1;
         event_enter_step(g);
       } else if (digit == 2) {
-        int random = rand_range(1, 100);
+        int random = rand_range(&g->rng[RNG_EVENTS], 1, 100);
         int acc = character_accuracy(&g->hero);
         int chance = random + acc;
         logbuffer_clear(&g->log);
@@ -2904,7 +4849,7 @@ static void event_handle_digit(Game *g, int digit) {
         snprintf(msg, sizeof(msg), "Accuracy check: Random %d + Accuracy %d = %d", random, acc, chance);
         logbuffer_push(&g->log, msg);
         if (chance >= 140) {
-          int coins = rand_range(1, 10);
+          int coins = rand_range(&g->rng[RNG_EVENTS], 1, 10);
           g->hero.coins += coins;
           logbuffer_push(&g->log, "140 or more. You caught the little one");
           snprintf(msg, sizeof(msg), "He had %d coins in his pocket. What was yours became mine!!!", coins);
@@ -2914,13 +4859,14 @@ static void event_handle_digit(Game *g, int digit) {
           char old_name[64];
           snprintf(old_name, sizeof(old_name), "%s", g->hero.weapon.name);
           g->hero.weapon = weapon_from_code(g, "without");
+          character_touch(&g->hero);
           logbuffer_push(&g->log, "You didn't catch the little one");
           snprintf(msg, sizeof(msg), "The little guy not only ran away, but also stole %s", old_name);
           logbuffer_push(&g->log, msg);
           logbuffer_push(&g->log, "What a disgrace and now there is nothing to kill myself with");
           event_set_art(g, "rob_fail");
         } else if (chance < 120 && g->hero.coins > 0) {
-          int coins = rand_range(1, g->hero.coins);
+          int coins = rand_range(&g->rng[RNG_EVENTS], 1, g->hero.coins);
           g->hero.coins -= coins;
           logbuffer_push(&g->log, "You didn't catch the little one");
           snprintf(msg, sizeof(msg), "The little guy not only ran away, but also stole %d coins", coins);
@@ -2943,10 +4889,10 @@ static void event_handle_digit(Game *g, int digit) {
         g->event_step = 0;
         event_handle_digit(g, 2);
       } else if (digit == 1 && g->hero.coins > 0) {
-        int y1 = rand_range(1, 6);
-        int y2 = rand_range(1, 6);
-        int e1 = rand_range(1, 6);
-        int e2 = rand_range(1, 7);
+        int y1 = rand_range(&g->rng[RNG_EVENTS], 1, 6);
+        int y2 = rand_range(&g->rng[RNG_EVENTS], 1, 6);
+        int e1 = rand_range(&g->rng[RNG_EVENTS], 1, 6);
+        int e2 = rand_range(&g->rng[RNG_EVENTS], 1, 7);
         logbuffer_clear(&g->log);
         char msg[160];
         snprintf(msg, sizeof(msg), "Your result is %d + %d = %d, the little one's result is %d + %d = %d",
@@ -2997,8 +4943,8 @@ static void event_handle_digit(Game *g, int digit) {
         char gift[32];
         if (digit == 1) { snprintf(gift, sizeof(gift), "5 max-HP"); g->hero.hp_max += 5; g->hero.hp += 5; }
         else if (digit == 2) { snprintf(gift, sizeof(gift), "5 max-MP"); g->hero.mp_max += 5; g->hero.mp += 5; }
-        else if (digit == 3) { snprintf(gift, sizeof(gift), "1 Accuracy"); g->hero.accuracy_base += 1; }
-        else { snprintf(gift, sizeof(gift), "1 Damage"); hero_add_dmg_base(&g->hero, 1); }
+        else if (digit == 3) { snprintf(gift, sizeof(gift), "1 Accuracy"); g->hero.accuracy_base += 1; character_touch(&g->hero); }
+        else { snprintf(gift, sizeof(gift), "1 Damage"); hero_add_dmg_base(&g->hero, 1, &g->rng[RNG_EVENTS]); }
         char msg[128];
         snprintf(msg, sizeof(msg), "Bloody god for your blood gives you: %s", gift);
         logbuffer_push(&g->log, msg);
@@ -3012,13 +4958,13 @@ static void event_handle_digit(Game *g, int digit) {
         event_finish(g);
       } else if (digit == 1) {
         int choices[] = {1,1,2,2,3};
-        int pick = choices[rand_range(0, 4)];
+        int pick = choices[rand_range(&g->rng[RNG_EVENTS], 0, 4)];
         g->hero.hp -= hp_taken;
         logbuffer_clear(&g->log);
         const char *gift = "nothing";
         if (pick == 1) { gift = "5 max-HP"; g->hero.hp_max += 5; g->hero.hp += 5; }
         else if (pick == 2) { gift = "5 max-MP"; g->hero.mp_max += 5; g->hero.mp += 5; }
-        else { gift = "1 Accuracy"; g->hero.accuracy_base += 1; }
+        else { gift = "1 Accuracy"; g->hero.accuracy_base += 1; character_touch(&g->hero); }
         char msg[128];
         snprintf(msg, sizeof(msg), "Bloody god for your blood gives you: %s", gift);
         logbuffer_push(&g->log, msg);
@@ -3031,7 +4977,7 @@ static void event_handle_digit(Game *g, int digit) {
   } else if (strcmp(g->event_code, "boatman_eugene") == 0) {
     if (g->event_step == 0) {
       if (digit == 1) {
-        int random = rand_range(1, 150);
+        int random = rand_range(&g->rng[RNG_EVENTS], 1, 150);
         int acc = character_accuracy(&g->hero);
         bool success = random < acc;
         logbuffer_clear(&g->log);
@@ -3043,6 +4989,7 @@ static void event_handle_digit(Game *g, int digit) {
         if (success) {
           hero_reduce_mp(&g->hero, 20);
           g->hero.accuracy_base += 1;
+          character_touch(&g->hero);
           logbuffer_push(&g->log, "You quickly noticed this and stopped wasting time. You lost 20 MP, but gained 1 accuracy");
         } else {
           hero_reduce_mp(&g->hero, 40);
@@ -3070,12 +5017,13 @@ static void event_handle_digit(Game *g, int digit) {
     } else if (g->event_step == 5) {
       g->hero.accuracy_base -= 1;
       g->hero.armor_penetration_base += 1;
+      character_touch(&g->hero);
       event_finish(g);
     }
   } else if (strcmp(g->event_code, "exit_run") == 0) {
     if (g->event_step == 0) {
       if (digit == 1) {
-        int base = rand_range(1, 200);
+        int base = rand_range(&g->rng[RNG_EVENTS], 1, 200);
         int th = treasure_hunter_coeff(&g->hero.camp_skill);
         int chance = base + th;
         logbuffer_clear(&g->log);
@@ -3138,11 +5086,11 @@ static void event_handle_digit(Game *g, int digit) {
           g->hero.coins -= price;
           logbuffer_clear(&g->log);
           logbuffer_push(&g->log, "Black magician pronounces the magic words: 'Klaatu Verata Nikto'");
-          int bonus_give = rand_range(1, b);
-          int bonus_take = rand_range(1, b);
-          while (bonus_give + 1 == bonus_take) bonus_take = rand_range(1, b);
-          int bonus_give_power = rand_range(bp, 5);
-          int bonus_take_power = rand_range(1, 5);
+          int bonus_give = rand_range(&g->rng[RNG_EVENTS], 1, b);
+          int bonus_take = rand_range(&g->rng[RNG_EVENTS], 1, b);
+          while (bonus_give + 1 == bonus_take) bonus_take = rand_range(&g->rng[RNG_EVENTS], 1, b);
+          int bonus_give_power = rand_range(&g->rng[RNG_EVENTS], bp, 5);
+          int bonus_take_power = rand_range(&g->rng[RNG_EVENTS], 1, 5);
           if (adept && bonus_give_power < bonus_take_power) bonus_give_power = bonus_take_power;
           if (bonus_give == 1) {
             g->hero.hp_max += bonus_give_power;
@@ -3158,11 +5106,12 @@ static void event_handle_digit(Game *g, int digit) {
             logbuffer_push(&g->log, msg);
           } else if (bonus_give == 3) {
             g->hero.accuracy_base += 1;
+            character_touch(&g->hero);
             char msg[128];
             snprintf(msg, sizeof(msg), "You got 1 accuracy, now you have %d accuracy", g->hero.accuracy_base);
             logbuffer_push(&g->log, msg);
           } else if (bonus_give == 4) {
-            hero_add_dmg_base(&g->hero, 1);
+            hero_add_dmg_base(&g->hero, 1, &g->rng[RNG_EVENTS]);
             char msg[128];
             snprintf(msg, sizeof(msg), "You got 1 damage, now you have %d-%d damage", g->hero.min_dmg_base, g->hero.max_dmg_base);
             logbuffer_push(&g->log, msg);
@@ -3185,11 +5134,12 @@ static void event_handle_digit(Game *g, int digit) {
             logbuffer_push(&g->log, msg);
           } else if (bonus_take == 4) {
             g->hero.accuracy_base -= 1;
+            character_touch(&g->hero);
             char msg[128];
             snprintf(msg, sizeof(msg), "...but you lose 1 accuracy, now you have %d accuracy", g->hero.accuracy_base);
             logbuffer_push(&g->log, msg);
           } else {
-            hero_reduce_dmg_base(&g->hero, 1);
+            hero_reduce_dmg_base(&g->hero, 1, &g->rng[RNG_EVENTS]);
             char msg[128];
             snprintf(msg, sizeof(msg), "...but you lose 1 damage, now you have %d-%d damage", g->hero.min_dmg_base, g->hero.max_dmg_base);
             logbuffer_push(&g->log, msg);
@@ -3312,3200 +5262,6551 @@ static void event_handle_digit(Game *g, int digit) {
           hero_reduce_coins(&g->hero, price);
           event_offer_loot(g, "head_armor", "sallet", "Sallet is yours, you want to equip it?", EVENT_PENDING_PIG_SALLET);
           return;
-        } else if (digit == 2) {
-          g->event_step = 3;
-          g->event_data[1] = 0;
-          event_handle_digit(g, 2);
-        } else if (digit == 0) {
-          event_finish(g);
+        } else if (digit == 2) {
+          g->event_step = 3;
+          g->event_data[1] = 0;
+          event_handle_digit(g, 2);
+        } else if (digit == 0) {
+          event_finish(g);
+        }
+      }
+    } else if (g->event_step == 3) {
+      if (digit == 2 && g->event_data[1] == 0) {
+        int random = rand_range(&g->rng[RNG_EVENTS], 1, 100);
+        int acc = character_accuracy(&g->hero);
+        int chance = random + acc;
+        logbuffer_clear(&g->log);
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Accuracy check: Random %d + Accuracy %d = %d", random, acc, chance);
+        logbuffer_push(&g->log, msg);
+        if (chance >= 170) {
+          logbuffer_push(&g->log, "You caught the pigman");
+          logbuffer_push(&g->log, "Now Sallet is yours, and the pigman can be used for meat");
+          event_set_art(g, "catch");
+          event_set_main(g, "Press Enter to view Sallet");
+          g->event_pending_action = EVENT_PENDING_PIG_SALLET;
+        } else if (chance < 130 && g->hero.coins > 0) {
+          int coins = rand_range(&g->rng[RNG_EVENTS], 1, g->hero.coins);
+          g->hero.coins -= coins;
+          logbuffer_push(&g->log, "You didn't catch the pigman");
+          char msg2[128];
+          snprintf(msg2, sizeof(msg2), "The pigman not only run away, but also stole %d coins", coins);
+          logbuffer_push(&g->log, msg2);
+          event_set_art(g, "run");
+          event_set_main(g, "Press Enter to leave");
+        } else {
+          logbuffer_push(&g->log, "You didn't catch the pigman");
+          event_set_art(g, "run");
+          event_set_main(g, "Press Enter to leave");
+        }
+        event_set_input(g, EVENT_INPUT_NONE);
+        g->event_data[1] = 1;
+      } else {
+        if (g->event_data[1] == 1 && g->event_pending_action == EVENT_PENDING_PIG_SALLET) {
+          event_offer_loot(g, "head_armor", "sallet", "Sallet is yours, you want to equip it?", EVENT_PENDING_PIG_SALLET);
+        } else if (g->event_data[1] == 1) {
+          event_finish(g);
+        }
+      }
+    }
+  } else if (strcmp(g->event_code, "wariors_grave") == 0) {
+    if (!g->wg_taken && g->event_step == 2) {
+      if (digit == 1) {
+        int stats_count = stats_total_get(&g->stats_total, g->hero.dungeon_name, g->wg_enemy);
+        g->wg_taken = 1;
+        g->wg_count = stats_count + 3;
+        logbuffer_clear(&g->log);
+        event_set_main(g, "Leave [Enter 0]");
+        logbuffer_push(&g->log, "\"I immediately realized that you are one of us, let's cleanse these lands\"");
+        event_set_art(g, "clean");
+        event_set_input(g, EVENT_INPUT_DIGIT);
+        g->event_step = 21;
+      } else if (digit == 0) {
+        event_finish(g);
+      }
+      return;
+    }
+    if (!g->wg_taken && (g->event_step == 31 || g->event_step == 41)) {
+      if (digit == 0) event_finish(g);
+      return;
+    }
+    if (!g->wg_taken) {
+      if (digit == 0) {
+        event_finish(g);
+      } else if (digit == 1) {
+        int base = rand_range(&g->rng[RNG_EVENTS], 0, 200);
+        int th = treasure_hunter_coeff(&g->hero.camp_skill);
+        int chance = base + th;
+        if (chance > 220) {
+          char msg[192];
+          if (th > 0) {
+            snprintf(msg, sizeof(msg), "Random luck is %d + treasure hunter %d = %d > 220. You dug up Rusty falchion, take it or bury it back?",
+                     base, th, chance);
+          } else {
+            snprintf(msg, sizeof(msg), "Random luck is %d > 220. You dug up a grave and Rusty falchion there, take it or bury it back?",
+                     chance);
+          }
+          event_offer_loot(g, "weapon", "rusty_falchion", msg, EVENT_PENDING_GRAVE_DIG);
+          return;
+        } else if (chance > 150) {
+          char msg[192];
+          if (th > 0) {
+            snprintf(msg, sizeof(msg), "Random luck is %d + treasure hunter %d = %d > 150. You dug up Rusty sword, take it or bury it back?",
+                     base, th, chance);
+          } else {
+            snprintf(msg, sizeof(msg), "Random luck is %d > 150. You dug up a grave and Rusty sword there, take it or bury it back?",
+                     chance);
+          }
+          event_offer_loot(g, "weapon", "rusty_sword", msg, EVENT_PENDING_GRAVE_DIG);
+          return;
+        } else if (chance > 80) {
+          char msg[192];
+          if (th > 0) {
+            snprintf(msg, sizeof(msg), "Random luck is %d + treasure hunter %d = %d > 80. You dug up Rusty hatchet, take it or bury it back?",
+                     base, th, chance);
+          } else {
+            snprintf(msg, sizeof(msg), "Random luck is %d > 80. You dug up a grave and Rusty hatchet there, take it or bury it back?",
+                     chance);
+          }
+          event_offer_loot(g, "weapon", "rusty_hatchet", msg, EVENT_PENDING_GRAVE_DIG);
+          return;
+        } else {
+          logbuffer_clear(&g->log);
+          char msg[160];
+          if (th > 0) {
+            snprintf(msg, sizeof(msg), "Random luck is %d + treasure hunter %d = %d <= 80. You dug up a grave and nothing there", base, th, chance);
+          } else {
+            snprintf(msg, sizeof(msg), "Random luck is %d <= 80. You dug up a grave and nothing there", chance);
+          }
+          logbuffer_push(&g->log, msg);
+          int mp = rand_range(&g->rng[RNG_EVENTS], 20, 100);
+          hero_reduce_mp(&g->hero, mp);
+          snprintf(msg, sizeof(msg), "The warrior's spirit is furious, he took %d MP from you", mp);
+          logbuffer_push(&g->log, msg);
+          event_set_main(g, "Leave [Enter 0]");
+          event_set_art(g, "diged");
+          event_set_input(g, EVENT_INPUT_DIGIT);
+          g->event_step = 31;
         }
-      }
-    } else if (g->event_step == 3) {
-      if (digit == 2 && g->event_data[1] == 0) {
-        int random = rand_range(1, 100);
-        int acc = character_accuracy(&g->hero);
-        int chance = random + acc;
+      } else if (digit == 2) {
+        hero_add_hp(&g->hero, 5);
+        hero_add_mp(&g->hero, 5);
+        const char *enemy = "poacher";
+        int level = g->hero.lvl < 5 ? 1 : 2;
+        if (strcmp(g->hero.dungeon_name, "bandits") == 0) enemy = level == 1 ? "poacher" : "deserter";
+        else if (strcmp(g->hero.dungeon_name, "undeads") == 0) enemy = level == 1 ? "skeleton" : "skeleton_soldier";
+        else if (strcmp(g->hero.dungeon_name, "swamp") == 0) enemy = level == 1 ? "goblin" : "orc";
+        char enemy_name[64];
+        titleize_token(enemy, enemy_name, sizeof(enemy_name));
         logbuffer_clear(&g->log);
-        char msg[128];
-        snprintf(msg, sizeof(msg), "Accuracy check: Random %d + Accuracy %d = %d", random, acc, chance);
+        logbuffer_push(&g->log, "After cleaning the grave you felt better, the warrior's spirit restored you 5 HP and 5 MP");
+        logbuffer_push(&g->log, "\"I see that you are also a warrior and could continue my work and cleanse these lands\"");
+        char msg[160];
+        snprintf(msg, sizeof(msg), "\"If you kill 3 %ss and go to any warrior's grave, you will receive a reward\"", enemy_name);
         logbuffer_push(&g->log, msg);
-        if (chance >= 170) {
-          logbuffer_push(&g->log, "You caught the pigman");
-          logbuffer_push(&g->log, "Now Sallet is yours, and the pigman can be used for meat");
-          event_set_art(g, "catch");
-          event_set_main(g, "Press Enter to view Sallet");
-          g->event_pending_action = EVENT_PENDING_PIG_SALLET;
-        } else if (chance < 130 && g->hero.coins > 0) {
-          int coins = rand_range(1, g->hero.coins);
-          g->hero.coins -= coins;
-          logbuffer_push(&g->log, "You didn't catch the pigman");
-          char msg2[128];
-          snprintf(msg2, sizeof(msg2), "The pigman not only run away, but also stole %d coins", coins);
-          logbuffer_push(&g->log, msg2);
-          event_set_art(g, "run");
-          event_set_main(g, "Press Enter to leave");
-        } else {
-          logbuffer_push(&g->log, "You didn't catch the pigman");
-          event_set_art(g, "run");
-          event_set_main(g, "Press Enter to leave");
-        }
-        event_set_input(g, EVENT_INPUT_NONE);
-        g->event_data[1] = 1;
-      } else {
-        if (g->event_data[1] == 1 && g->event_pending_action == EVENT_PENDING_PIG_SALLET) {
-          event_offer_loot(g, "head_armor", "sallet", "Sallet is yours, you want to equip it?", EVENT_PENDING_PIG_SALLET);
-        } else if (g->event_data[1] == 1) {
-          event_finish(g);
-        }
+        event_set_main(g, "Take quest [Enter 1]                 Leave [Enter 0]");
+        event_set_art(g, "clean");
+        event_set_input(g, EVENT_INPUT_DIGIT);
+        snprintf(g->wg_enemy, sizeof(g->wg_enemy), "%s", enemy);
+        g->wg_level = level;
+        g->event_step = 2;
       }
+    } else {
+      if (digit == 0) event_finish(g);
+    }
+  }
+}
+
+static void skill_show_cost(const Skill *s, char *out, size_t out_sz) {
+  if (!s || !out || out_sz == 0) return;
+  if (s->type == SKILL_ACTIVE) {
+    snprintf(out, out_sz, "%d MP", s->mp_cost);
+  } else if (strcmp(s->code, "bloody_ritual") == 0) {
+    snprintf(out, out_sz, "%d HP", s->hp_cost);
+  } else if (strcmp(s->code, "first_aid") == 0) {
+    snprintf(out, out_sz, "%d MP", s->mp_cost);
+  } else {
+    snprintf(out, out_sz, "passive");
+  }
+}
+
+static double skill_active_damage_mod(const Skill *s, const Character *hero) {
+  if (!s) return 1.0;
+  if (strcmp(s->code, "ascetic_strike") == 0) return 1.0 + 0.007 * s->lvl * hero->stat_points;
+  if (strcmp(s->code, "precise_strike") == 0) return 1.1 + 0.05 * s->lvl;
+  if (strcmp(s->code, "strong_strike") == 0) return 1.5 + 0.15 * s->lvl;
+  if (strcmp(s->code, "traumatic_strike") == 0) return 1.0;
+  return 1.0;
+}
+
+static double skill_active_accuracy_mod(const Skill *s, const Character *hero) {
+  (void)hero;
+  if (!s) return 1.0;
+  if (strcmp(s->code, "ascetic_strike") == 0) return 1.0 + 0.007 * s->lvl * hero->stat_points;
+  if (strcmp(s->code, "precise_strike") == 0) return 1.3 + 0.1 * s->lvl;
+  if (strcmp(s->code, "strong_strike") == 0) return 1.0;
+  if (strcmp(s->code, "traumatic_strike") == 0) return 1.0;
+  return 1.0;
+}
+
+static double skill_traumatic_effect_coef(const Skill *s) {
+  if (!s) return 1.0;
+  if (strcmp(s->code, "traumatic_strike") != 0) return 1.0;
+  double effect = 30 + 3.0 * s->lvl;
+  double coef = (100.0 - effect) / 100.0;
+  return coef < 0 ? 0 : coef;
+}
+
+static double skill_berserk_coef(const Skill *s, const Character *hero) {
+  if (!s || strcmp(s->code, "berserk") != 0) return 1.0;
+  double hp_part = (hero->hp_max > 0) ? (double)hero->hp / hero->hp_max : 0.0;
+  double mod = 0.5 + 0.05 * s->lvl;
+  return 1.0 + (1.0 - hp_part) * mod;
+}
+
+static double skill_concentration_bonus(const Skill *s, const Character *hero, Rng *rng) {
+  if (!s || strcmp(s->code, "concentration") != 0) return 0.0;
+  double coef = hero->mp_max * (0.1 + 0.005 * s->lvl) - 10.0;
+  if (coef <= 0) return 0.0;
+  return (double)rand_range(rng, 0, (int)coef);
+}
+
+static double skill_dazed_hp_part_coef(const Skill *s) {
+  if (!s || strcmp(s->code, "dazed") != 0) return 0.0;
+  return 1.2 + 0.15 * s->lvl;
+}
+
+static double skill_dazed_accuracy_reduce_coef(const Skill *s, Rng *rng) {
+  if (!s || strcmp(s->code, "dazed") != 0) return 1.0;
+  int min_reduce = 10 + 3 * s->lvl;
+  if (min_reduce > 90) min_reduce = 90;
+  int reduce = rand_range(rng, min_reduce, 90);
+  return 0.01 * (100 - reduce);
+}
+
+static void skill_description(const Skill *s, const Character *hero, char *out, size_t out_sz) {
+  if (!s || !out || out_sz == 0) return;
+  if (strcmp(s->code, "ascetic_strike") == 0) {
+    int dmg = (int)round((skill_active_damage_mod(s, hero) - 1) * 100);
+    int acc = (int)round((skill_active_accuracy_mod(s, hero) - 1) * 100);
+    snprintf(out, out_sz, "Free stat points %d. Additional damage +%d%%. Additional accuracy +%d%%", hero->stat_points, dmg, acc);
+  } else if (strcmp(s->code, "precise_strike") == 0) {
+    int dmg = (int)round((skill_active_damage_mod(s, hero) - 1) * 100);
+    int acc = (int)round((skill_active_accuracy_mod(s, hero) - 1) * 100);
+    snprintf(out, out_sz, "Additional damage +%d%%. Additional accuracy +%d%%", dmg, acc);
+  } else if (strcmp(s->code, "strong_strike") == 0) {
+    int dmg = (int)round((skill_active_damage_mod(s, hero) - 1) * 100);
+    snprintf(out, out_sz, "Additional damage +%d%%", dmg);
+  } else if (strcmp(s->code, "traumatic_strike") == 0) {
+    int effect = 30 + 3 * s->lvl;
+    snprintf(out, out_sz, "Attack reduces enemy damage by %d%%", effect);
+  } else if (strcmp(s->code, "berserk") == 0) {
+    int dmg = (int)round((skill_berserk_coef(s, hero) - 1) * 100);
+    int hp_part = hero->hp_max > 0 ? (int)round((double)hero->hp / hero->hp_max * 100) : 0;
+    snprintf(out, out_sz, "The less HP - the more damage. HP is %d%% from the maximum. Additional damage +%d%%", hp_part, dmg);
+  } else if (strcmp(s->code, "concentration") == 0) {
+    double coef = hero->mp_max * (0.1 + 0.005 * s->lvl) - 10.0;
+    snprintf(out, out_sz, "If max MP is more than 100(%d) random additional damage up to %.1f", hero->mp_max, coef);
+  } else if (strcmp(s->code, "dazed") == 0) {
+    double hp_part = skill_dazed_hp_part_coef(s);
+    int min_reduce = 10 + 3 * s->lvl;
+    if (min_reduce > 90) min_reduce = 90;
+    int percent = (int)round(100 / (2 * hp_part));
+    snprintf(out, out_sz, "If damage is greater %d%% remaining enemy HP then he loses %d-90%% accuracy", percent, min_reduce);
+  } else if (strcmp(s->code, "shield_master") == 0) {
+    int bonus = 10 + 2 * s->lvl;
+    snprintf(out, out_sz, "Shield block chance increased by %d%%", bonus);
+  } else if (strcmp(s->code, "bloody_ritual") == 0) {
+    int mp_dif = hero->mp_max - hero->mp;
+    int min_effect = mp_dif < 10 ? mp_dif : 10;
+    double effect = mp_dif * 0.3 * (1 + 0.1 * s->lvl);
+    int restore = (int)round(effect);
+    if (restore < min_effect) restore = min_effect;
+    if (restore > mp_dif) restore = mp_dif;
+    snprintf(out, out_sz, "Restores %d MP, the more MP lost the greater the effect", restore);
+  } else if (strcmp(s->code, "first_aid") == 0) {
+    int hp_dif = hero->hp_max - hero->hp;
+    int min_effect = hp_dif < 5 ? hp_dif : 5;
+    double effect = hp_dif * 0.2 * (1 + 0.1 * s->lvl);
+    int restore = (int)round(effect);
+    if (restore < min_effect) restore = min_effect;
+    if (restore > hp_dif) restore = hp_dif;
+    snprintf(out, out_sz, "Restores %d HP, the more HP lost the greater the effect", restore);
+  } else if (strcmp(s->code, "treasure_hunter") == 0) {
+    int bonus = 50 + 10 * s->lvl;
+    snprintf(out, out_sz, "Positively affects random actions. Luck bonus %d", bonus);
+  } else {
+    if (out_sz > 0) out[0] = '\0';
+  }
+}
+
+static void skill_description_short(const Skill *s, const Character *hero, char *out, size_t out_sz) {
+  (void)hero;
+  if (!s || !out || out_sz == 0) return;
+  if (strcmp(s->code, "ascetic_strike") == 0) {
+    snprintf(out, out_sz, "Cost %d MP. More free stat points = more damage/accuracy", s->mp_cost);
+  } else if (strcmp(s->code, "precise_strike") == 0) {
+    snprintf(out, out_sz, "Cost %d MP. Attack much more accurately", s->mp_cost);
+  } else if (strcmp(s->code, "strong_strike") == 0) {
+    snprintf(out, out_sz, "Cost %d MP. Attack much stronger", s->mp_cost);
+  } else if (strcmp(s->code, "traumatic_strike") == 0) {
+    snprintf(out, out_sz, "Cost %d MP. Reduces enemy damage", s->mp_cost);
+  } else if (strcmp(s->code, "berserk") == 0) {
+    snprintf(out, out_sz, "The less HP are left - the more damage you do");
+  } else if (strcmp(s->code, "concentration") == 0) {
+    snprintf(out, out_sz, "More max MP -> more random additional damage");
+  } else if (strcmp(s->code, "dazed") == 0) {
+    snprintf(out, out_sz, "Big hit can drastically reduce enemy accuracy");
+  } else if (strcmp(s->code, "shield_master") == 0) {
+    snprintf(out, out_sz, "Shield block chance increased");
+  } else if (strcmp(s->code, "bloody_ritual") == 0) {
+    snprintf(out, out_sz, "Cost %d HP. Restores MP based on missing MP", s->hp_cost);
+  } else if (strcmp(s->code, "first_aid") == 0) {
+    snprintf(out, out_sz, "Cost %d MP. Restores HP based on missing HP", s->mp_cost);
+  } else if (strcmp(s->code, "treasure_hunter") == 0) {
+    snprintf(out, out_sz, "Positively affects random actions in game");
+  } else {
+    if (out_sz > 0) out[0] = '\0';
+  }
+}
+
+static int hero_next_lvl_exp(const Character *c) {
+  static const int EXP_LVL[] = {0, 2, 5, 9, 14, 20, 27, 35, 44, 54, 65, 77, 90, 104, 129, 145, 162, 180, 200};
+  int idx = c->lvl + 1;
+  if (idx < 0) idx = 0;
+  if (idx >= (int)(sizeof(EXP_LVL) / sizeof(EXP_LVL[0]))) idx = (int)(sizeof(EXP_LVL) / sizeof(EXP_LVL[0])) - 1;
+  return EXP_LVL[idx];
+}
+
+static void hero_add_exp(Character *hero, int added_exp, LogBuffer *log) {
+  static const int EXP_LVL[] = {0, 2, 5, 9, 14, 20, 27, 35, 44, 54, 65, 77, 90, 104, 129, 145, 162, 180, 200};
+  if (!hero) return;
+  hero->exp += added_exp;
+  if (log) {
+    char msg[128];
+    snprintf(msg, sizeof(msg), "You have gained %d exp, now you have %d exp", added_exp, hero->exp);
+    logbuffer_push(log, msg);
+  }
+  int new_levels = 0;
+  int max_idx = (int)(sizeof(EXP_LVL) / sizeof(EXP_LVL[0])) - 1;
+  for (int i = 0; i <= max_idx; ++i) {
+    if (hero->exp >= EXP_LVL[i] && hero->lvl < i) {
+      new_levels = i - hero->lvl;
+      hero->lvl = i;
     }
-  } else if (strcmp(g->event_code, "wariors_grave") == 0) {
-    if (!g->wg_taken && g->event_step == 2) {
-      if (digit == 1) {
-        int stats_count = stats_total_get(&g->stats_total, g->hero.dungeon_name, g->wg_enemy);
-        g->wg_taken = 1;
-        g->wg_count = stats_count + 3;
-        logbuffer_clear(&g->log);
-        event_set_main(g, "Leave [Enter 0]");
-        logbuffer_push(&g->log, "\"I immediately realized that you are one of us, let's cleanse these lands\"");
-        event_set_art(g, "clean");
-        event_set_input(g, EVENT_INPUT_DIGIT);
-        g->event_step = 21;
-      } else if (digit == 0) {
-        event_finish(g);
-      }
+  }
+  if (new_levels > 0) {
+    hero->stat_points += new_levels;
+    hero->skill_points += new_levels;
+    if (log) {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "You have gained %d new level(s). Now lvl %d", new_levels, hero->lvl);
+      logbuffer_push(log, msg);
+      snprintf(msg, sizeof(msg), "You gained %d stat and %d skill points", new_levels, new_levels);
+      logbuffer_push(log, msg);
+    }
+  }
+}
+
+static void hero_rest(Character *hero, LogBuffer *log) {
+  if (!hero) return;
+  if (hero->hp < hero->hp_max) {
+    int rec = character_recovery_hp(hero);
+    int gain = rec;
+    if (hero->hp + gain > hero->hp_max) gain = hero->hp_max - hero->hp;
+    hero->hp += gain;
+    if (log && gain > 0) {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "After resting, you restore %d HP (%d/%d)", gain, hero->hp, hero->hp_max);
+      logbuffer_push(log, msg);
+    }
+  }
+  if (hero->mp < hero->mp_max) {
+    int rec = character_recovery_mp(hero);
+    int gain = rec;
+    if (hero->mp + gain > hero->mp_max) gain = hero->mp_max - hero->mp;
+    hero->mp += gain;
+    if (log && gain > 0) {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "After resting, you restore %d MP (%d/%d)", gain, hero->mp, hero->mp_max);
+      logbuffer_push(log, msg);
+    }
+  }
+}
+
+static int camp_skill_restore_hp(const Character *hero) {
+  if (!hero) return 0;
+  int hp_dif = hero->hp_max - hero->hp;
+  if (hp_dif <= 0) return 0;
+  int min_effect = hp_dif < 5 ? hp_dif : 5;
+  double effect = hp_dif * 0.2 * (1 + 0.1 * hero->camp_skill.lvl);
+  int restore = (int)round(effect);
+  if (restore < min_effect) restore = min_effect;
+  if (restore > hp_dif) restore = hp_dif;
+  return restore;
+}
+
+static int camp_skill_restore_mp(const Character *hero) {
+  if (!hero) return 0;
+  int mp_dif = hero->mp_max - hero->mp;
+  if (mp_dif <= 0) return 0;
+  int min_effect = mp_dif < 10 ? mp_dif : 10;
+  double effect = mp_dif * 0.3 * (1 + 0.1 * hero->camp_skill.lvl);
+  int restore = (int)round(effect);
+  if (restore < min_effect) restore = min_effect;
+  if (restore > mp_dif) restore = mp_dif;
+  return restore;
+}
+
+static void game_use_camp_skill(Game *g) {
+  if (!g) return;
+  Character *hero = &g->hero;
+  logbuffer_clear(&g->log);
+  if (strcmp(hero->camp_skill.code, "first_aid") == 0) {
+    if (hero->hp_max <= hero->hp) {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "You dont need use %s", hero->camp_skill.name);
+      logbuffer_push(&g->log, msg);
       return;
     }
-    if (!g->wg_taken && (g->event_step == 31 || g->event_step == 41)) {
-      if (digit == 0) event_finish(g);
+    if (hero->mp < hero->camp_skill.mp_cost) {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "Not enough MP for \"%s\"", hero->camp_skill.name);
+      logbuffer_push(&g->log, msg);
       return;
     }
-    if (!g->wg_taken) {
-      if (digit == 0) {
-        event_finish(g);
-      } else if (digit == 1) {
-        int base = rand_range(0, 200);
-        int th = treasure_hunter_coeff(&g->hero.camp_skill);
-        int chance = base + th;
-        if (chance > 220) {
-          char msg[192];
-          if (th > 0) {
-            snprintf(msg, sizeof(msg), "Random luck is %d + treasure hunter %d = %d > 220. You dug up Rusty falchion, take it or bury it back?",
-                     base, th, chance);
-          } else {
-            snprintf(msg, sizeof(msg), "Random luck is %d > 220. You dug up a grave and Rusty falchion there, take it or bury it back?",
-                     chance);
-          }
-          event_offer_loot(g, "weapon", "rusty_falchion", msg, EVENT_PENDING_GRAVE_DIG);
-          return;
-        } else if (chance > 150) {
-          char msg[192];
-          if (th > 0) {
-            snprintf(msg, sizeof(msg), "Random luck is %d + treasure hunter %d = %d > 150. You dug up Rusty sword, take it or bury it back?",
-                     base, th, chance);
-          } else {
-            snprintf(msg, sizeof(msg), "Random luck is %d > 150. You dug up a grave and Rusty sword there, take it or bury it back?",
-                     chance);
-          }
-          event_offer_loot(g, "weapon", "rusty_sword", msg, EVENT_PENDING_GRAVE_DIG);
-          return;
-        } else if (chance > 80) {
-          char msg[192];
-          if (th > 0) {
-            snprintf(msg, sizeof(msg), "Random luck is %d + treasure hunter %d = %d > 80. You dug up Rusty hatchet, take it or bury it back?",
-                     base, th, chance);
-          } else {
-            snprintf(msg, sizeof(msg), "Random luck is %d > 80. You dug up a grave and Rusty hatchet there, take it or bury it back?",
-                     chance);
-          }
-          event_offer_loot(g, "weapon", "rusty_hatchet", msg, EVENT_PENDING_GRAVE_DIG);
-          return;
-        } else {
-          logbuffer_clear(&g->log);
-          char msg[160];
-          if (th > 0) {
-            snprintf(msg, sizeof(msg), "Random luck is %d + treasure hunter %d = %d <= 80. You dug up a grave and nothing there", base, th, chance);
-          } else {
-            snprintf(msg, sizeof(msg), "Random luck is %d <= 80. You dug up a grave and nothing there", chance);
-          }
-          logbuffer_push(&g->log, msg);
-          int mp = rand_range(20, 100);
-          hero_reduce_mp(&g->hero, mp);
-          snprintf(msg, sizeof(msg), "The warrior's spirit is furious, he took %d MP from you", mp);
-          logbuffer_push(&g->log, msg);
-          event_set_main(g, "Leave [Enter 0]");
-          event_set_art(g, "diged");
-          event_set_input(g, EVENT_INPUT_DIGIT);
-          g->event_step = 31;
-        }
-      } else if (digit == 2) {
-        hero_add_hp(&g->hero, 5);
-        hero_add_mp(&g->hero, 5);
-        const char *enemy = "poacher";
-        int level = g->hero.lvl < 5 ? 1 : 2;
-        if (strcmp(g->hero.dungeon_name, "bandits") == 0) enemy = level == 1 ? "poacher" : "deserter";
-        else if (strcmp(g->hero.dungeon_name, "undeads") == 0) enemy = level == 1 ? "skeleton" : "skeleton_soldier";
-        else if (strcmp(g->hero.dungeon_name, "swamp") == 0) enemy = level == 1 ? "goblin" : "orc";
-        char enemy_name[64];
-        titleize_token(enemy, enemy_name, sizeof(enemy_name));
-        logbuffer_clear(&g->log);
-        logbuffer_push(&g->log, "After cleaning the grave you felt better, the warrior's spirit restored you 5 HP and 5 MP");
-        logbuffer_push(&g->log, "\"I see that you are also a warrior and could continue my work and cleanse these lands\"");
-        char msg[160];
-        snprintf(msg, sizeof(msg), "\"If you kill 3 %ss and go to any warrior's grave, you will receive a reward\"", enemy_name);
-        logbuffer_push(&g->log, msg);
-        event_set_main(g, "Take quest [Enter 1]                 Leave [Enter 0]");
-        event_set_art(g, "clean");
-        event_set_input(g, EVENT_INPUT_DIGIT);
-        snprintf(g->wg_enemy, sizeof(g->wg_enemy), "%s", enemy);
-        g->wg_level = level;
-        g->event_step = 2;
+    int restore = camp_skill_restore_hp(hero);
+    hero->hp += restore;
+    if (hero->hp > hero->hp_max) hero->hp = hero->hp_max;
+    hero->mp -= hero->camp_skill.mp_cost;
+    if (hero->mp < 0) hero->mp = 0;
+    char msg[160];
+    snprintf(msg, sizeof(msg), "You restored %d HP for %d MP, now you have %d/%d HP and %d/%d MP",
+             restore, hero->camp_skill.mp_cost, hero->hp, hero->hp_max, hero->mp, hero->mp_max);
+    logbuffer_push(&g->log, msg);
+    return;
+  }
+  if (strcmp(hero->camp_skill.code, "bloody_ritual") == 0) {
+    if (hero->mp_max <= hero->mp) {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "You dont need use %s", hero->camp_skill.name);
+      logbuffer_push(&g->log, msg);
+      return;
+    }
+    if (hero->hp <= hero->camp_skill.hp_cost) {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "Not enough HP for \"%s\"", hero->camp_skill.name);
+      logbuffer_push(&g->log, msg);
+      return;
+    }
+    int restore = camp_skill_restore_mp(hero);
+    hero->mp += restore;
+    if (hero->mp > hero->mp_max) hero->mp = hero->mp_max;
+    hero->hp -= hero->camp_skill.hp_cost;
+    if (hero->hp < 0) hero->hp = 0;
+    char msg[160];
+    snprintf(msg, sizeof(msg), "You restored %d MP for %d HP, now you have %d/%d MP and %d/%d HP",
+             restore, hero->camp_skill.hp_cost, hero->mp, hero->mp_max, hero->hp, hero->hp_max);
+    logbuffer_push(&g->log, msg);
+    return;
+  }
+  char msg[128];
+  snprintf(msg, sizeof(msg), "You dont need use %s", hero->camp_skill.name);
+  logbuffer_push(&g->log, msg);
+}
+
+static void ammo_display_name(const char *name, bool enhanced, char *out, size_t out_sz) {
+  if (!out || out_sz == 0) return;
+  if (!name) name = "---";
+  if (enhanced) snprintf(out, out_sz, "(E+) %s", name);
+  else snprintf(out, out_sz, "%s", name);
+}
+
+static void character_to_map(const Character *c, ValueMap *map) {
+  char buf[128];
+  value_map_set(map, "name", c->name);
+  value_map_set_int(map, "hp", c->hp);
+  value_map_set_int(map, "hp_max", c->hp_max);
+  value_map_set_int(map, "regen_hp_base", c->regen_hp_base);
+  value_map_set_int(map, "mp", c->mp);
+  value_map_set_int(map, "mp_max", c->mp_max);
+  value_map_set_int(map, "regen_mp_base", c->regen_mp_base);
+  value_map_set_int(map, "min_dmg", character_min_dmg(c));
+  value_map_set_int(map, "max_dmg", character_max_dmg(c));
+  value_map_set_int(map, "armor_penetration", character_armor_penetration(c));
+  value_map_set_int(map, "accuracy", character_accuracy(c));
+  value_map_set_int(map, "armor", character_armor(c));
+  value_map_set_int(map, "block_chance", character_block_chance(c));
+  value_map_set_int(map, "block_power_in_percents", block_power_in_percents(c));
+
+  value_map_set_int(map, "min_dmg_base", c->min_dmg_base);
+  value_map_set_int(map, "max_dmg_base", c->max_dmg_base);
+  value_map_set_int(map, "accuracy_base", c->accuracy_base);
+  value_map_set_int(map, "armor_base", c->armor_base);
+  value_map_set_int(map, "block_chance_base", c->block_chance_base);
+  value_map_set_int(map, "armor_penetration_base", c->armor_penetration_base);
+
+  value_map_set_int(map, "stat_points", c->stat_points);
+  value_map_set_int(map, "skill_points", c->skill_points);
+  value_map_set_int(map, "exp", c->exp);
+  value_map_set_int(map, "lvl", c->lvl);
+  value_map_set_int(map, "next_lvl_exp", hero_next_lvl_exp(c));
+  value_map_set_int(map, "pzdc_monolith_points", c->pzdc_monolith_points);
+  value_map_set_int(map, "coins", c->coins);
+
+  value_map_set_int(map, "recovery_hp", character_recovery_hp(c));
+  value_map_set_int(map, "recovery_mp", character_recovery_mp(c));
+
+  ammo_display_name(c->weapon.name, c->weapon.enhanced, buf, sizeof(buf));
+  value_map_set(map, "weapon.name", buf);
+  ammo_display_name(c->head_armor.name, c->head_armor.enhanced, buf, sizeof(buf));
+  value_map_set(map, "head_armor.name", buf);
+  ammo_display_name(c->body_armor.name, c->body_armor.enhanced, buf, sizeof(buf));
+  value_map_set(map, "body_armor.name", buf);
+  ammo_display_name(c->arms_armor.name, c->arms_armor.enhanced, buf, sizeof(buf));
+  value_map_set(map, "arms_armor.name", buf);
+  ammo_display_name(c->shield.name, c->shield.enhanced, buf, sizeof(buf));
+  value_map_set(map, "shield.name", buf);
+
+  value_map_set(map, "active_skill.name", c->active_skill.name);
+  value_map_set_int(map, "active_skill.lvl", c->active_skill.lvl);
+  char cost[64];
+  skill_show_cost(&c->active_skill, cost, sizeof(cost));
+  value_map_set(map, "active_skill.show_cost", cost);
+  char desc[256];
+  skill_description(&c->active_skill, c, desc, sizeof(desc));
+  value_map_set(map, "active_skill.description", desc);
+
+  value_map_set(map, "passive_skill.name", c->passive_skill.name);
+  value_map_set_int(map, "passive_skill.lvl", c->passive_skill.lvl);
+  skill_show_cost(&c->passive_skill, cost, sizeof(cost));
+  value_map_set(map, "passive_skill.show_cost", cost);
+  skill_description(&c->passive_skill, c, desc, sizeof(desc));
+  value_map_set(map, "passive_skill.description", desc);
+
+  value_map_set(map, "camp_skill.name", c->camp_skill.name);
+  value_map_set_int(map, "camp_skill.lvl", c->camp_skill.lvl);
+  skill_show_cost(&c->camp_skill, cost, sizeof(cost));
+  value_map_set(map, "camp_skill.show_cost", cost);
+  skill_description(&c->camp_skill, c, desc, sizeof(desc));
+  value_map_set(map, "camp_skill.description", desc);
+}
+
+// Schema-directed loading for the data/ and saves/ files: libyaml events are consumed
+// directly into the target structs through a field table, without building a
+// Node tree. Keys the table does not know are reported and skipped.
+typedef struct {
+  yaml_parser_t parser;
+  yaml_event_t event;
+  bool have_event;
+  const char *path;
+} YamlStream;
+
+typedef enum {
+  FIELD_INT,
+  FIELD_STR,
+  FIELD_LIST,
+  FIELD_MAP,
+  FIELD_CUSTOM,
+  FIELD_IGNORE
+} FieldType;
+
+typedef struct FieldSpec FieldSpec;
+
+struct FieldSpec {
+  const char *key;
+  FieldType type;
+  size_t offset;
+  size_t arg; // FIELD_STR: buffer size; FIELD_LIST: offset of the size_t count
+  const FieldSpec *fields; // FIELD_MAP
+  void (*read)(YamlStream *ys, void *record); // FIELD_CUSTOM
+};
+
+#define FIELD_SPEC_INT(key, T, m) {key, FIELD_INT, offsetof(T, m), 0, NULL, NULL}
+#define FIELD_SPEC_STR(key, T, m) {key, FIELD_STR, offsetof(T, m), sizeof(((T *)0)->m), NULL, NULL}
+#define FIELD_SPEC_LIST(key, T, m, c) {key, FIELD_LIST, offsetof(T, m), offsetof(T, c), NULL, NULL}
+#define FIELD_SPEC_MAP(key, T, m, sub) {key, FIELD_MAP, offsetof(T, m), 0, sub, NULL}
+#define FIELD_SPEC_CUSTOM(key, fn) {key, FIELD_CUSTOM, 0, 0, NULL, fn}
+#define FIELD_SPEC_IGNORE(key) {key, FIELD_IGNORE, 0, 0, NULL, NULL}
+#define FIELD_SPEC_END FIELD_SPEC_IGNORE(NULL)
+
+static bool ys_next(YamlStream *ys) {
+  if (ys->have_event) yaml_event_delete(&ys->event);
+  ys->have_event = false;
+  if (!yaml_parser_parse(&ys->parser, &ys->event)) {
+    fprintf(stderr, "[pzdc_dungeon_2_gl] %s:%zu: %s\n", ys->path, ys->parser.problem_mark.line + 1,
+            ys->parser.problem ? ys->parser.problem : "parse error");
+    return false;
+  }
+  ys->have_event = true;
+  return ys->event.type != YAML_STREAM_END_EVENT;
+}
+
+static const char *ys_scalar(const YamlStream *ys) {
+  return ys->event.type == YAML_SCALAR_EVENT ? (const char *)ys->event.data.scalar.value : NULL;
+}
+
+// Skips the value that starts at the current event, nested containers included.
+static bool ys_skip(YamlStream *ys) {
+  int depth = 0;
+  do {
+    if (ys->event.type == YAML_MAPPING_START_EVENT || ys->event.type == YAML_SEQUENCE_START_EVENT) depth++;
+    else if (ys->event.type == YAML_MAPPING_END_EVENT || ys->event.type == YAML_SEQUENCE_END_EVENT) depth--;
+    if (depth == 0) return true;
+  } while (ys_next(ys));
+  return false;
+}
+
+static void ys_read_list(YamlStream *ys, char ***out_list, size_t *out_count) {
+  char **list = NULL;
+  size_t count = 0;
+  size_t cap = 0;
+  if (ys->event.type == YAML_SCALAR_EVENT) {
+    list = (char **)malloc(sizeof(char *));
+    if (list) list[count++] = strdup_safe(ys_scalar(ys));
+  } else if (ys->event.type == YAML_SEQUENCE_START_EVENT) {
+    while (ys_next(ys) && ys->event.type != YAML_SEQUENCE_END_EVENT) {
+      const char *s = ys_scalar(ys);
+      if (!s) {
+        if (!ys_skip(ys)) break;
+        continue;
       }
-    } else {
-      if (digit == 0) event_finish(g);
+      if (count == cap) {
+        size_t new_cap = cap ? cap * 2 : 4;
+        char **arr = (char **)realloc(list, new_cap * sizeof(char *));
+        if (!arr) continue;
+        list = arr;
+        cap = new_cap;
+      }
+      list[count++] = strdup_safe(s);
     }
+  } else {
+    ys_skip(ys);
   }
+  free_string_list(*out_list, *out_count);
+  *out_list = list;
+  *out_count = count;
 }
 
-static void skill_show_cost(const Skill *s, char *out, size_t out_sz) {
-  if (!s || !out || out_sz == 0) return;
-  if (s->type == SKILL_ACTIVE) {
-    snprintf(out, out_sz, "%d MP", s->mp_cost);
-  } else if (strcmp(s->code, "bloody_ritual") == 0) {
-    snprintf(out, out_sz, "%d HP", s->hp_cost);
-  } else if (strcmp(s->code, "first_aid") == 0) {
-    snprintf(out, out_sz, "%d MP", s->mp_cost);
-  } else {
-    snprintf(out, out_sz, "passive");
+// Current event must be the MAPPING_START of the record; stops on its MAPPING_END.
+static bool ys_read_fields(YamlStream *ys, const FieldSpec *fields, void *base, const char *where) {
+  while (ys_next(ys)) {
+    if (ys->event.type == YAML_MAPPING_END_EVENT) return true;
+    const char *key = ys_scalar(ys);
+    if (!key) {
+      if (!ys_skip(ys) || !ys_next(ys) || !ys_skip(ys)) return false;
+      continue;
+    }
+    const FieldSpec *f = fields;
+    while (f->key && strcmp(f->key, key) != 0) f++;
+    if (!f->key) {
+      fprintf(stderr, "[pzdc_dungeon_2_gl] %s:%zu: unknown key '%s' in '%s'\n",
+              ys->path, ys->event.start_mark.line + 1, key, where);
+    }
+    if (!ys_next(ys)) return false;
+    char *field = (char *)base + (f->key ? f->offset : 0);
+    const char *value = ys_scalar(ys);
+    if (!f->key || f->type == FIELD_IGNORE) {
+      if (!ys_skip(ys)) return false;
+    } else if (f->type == FIELD_INT) {
+      if (value) *(int *)field = atoi(value);
+      else if (!ys_skip(ys)) return false;
+    } else if (f->type == FIELD_STR) {
+      if (value) snprintf(field, f->arg, "%s", value);
+      else if (!ys_skip(ys)) return false;
+    } else if (f->type == FIELD_LIST) {
+      ys_read_list(ys, (char ***)field, (size_t *)((char *)base + f->arg));
+    } else if (f->type == FIELD_MAP) {
+      if (ys->event.type != YAML_MAPPING_START_EVENT) {
+        if (!ys_skip(ys)) return false;
+      } else if (!ys_read_fields(ys, f->fields, field, where)) {
+        return false;
+      }
+    } else if (f->type == FIELD_CUSTOM) {
+      f->read(ys, base);
+    }
   }
+  return false;
 }
 
-static double skill_active_damage_mod(const Skill *s, const Character *hero) {
-  if (!s) return 1.0;
-  if (strcmp(s->code, "ascetic_strike") == 0) return 1.0 + 0.007 * s->lvl * hero->stat_points;
-  if (strcmp(s->code, "precise_strike") == 0) return 1.1 + 0.05 * s->lvl;
-  if (strcmp(s->code, "strong_strike") == 0) return 1.5 + 0.15 * s->lvl;
-  if (strcmp(s->code, "traumatic_strike") == 0) return 1.0;
-  return 1.0;
+static void ys_close(YamlStream *ys, FILE *f) {
+  if (ys->have_event) yaml_event_delete(&ys->event);
+  ys->have_event = false;
+  yaml_parser_delete(&ys->parser);
+  fclose(f);
 }
 
-static double skill_active_accuracy_mod(const Skill *s, const Character *hero) {
-  (void)hero;
-  if (!s) return 1.0;
-  if (strcmp(s->code, "ascetic_strike") == 0) return 1.0 + 0.007 * s->lvl * hero->stat_points;
-  if (strcmp(s->code, "precise_strike") == 0) return 1.3 + 0.1 * s->lvl;
-  if (strcmp(s->code, "strong_strike") == 0) return 1.0;
-  if (strcmp(s->code, "traumatic_strike") == 0) return 1.0;
-  return 1.0;
+// Opens path and stops on the MAPPING_START of the document root. Any other root,
+// an empty document included, is an error.
+static FILE *ys_open(YamlStream *ys, const char *path) {
+  memset(ys, 0, sizeof(*ys));
+  ys->path = path;
+  if (!path) return NULL;
+  FILE *f = fopen(path, "r");
+  if (!f) return NULL;
+  if (!yaml_parser_initialize(&ys->parser)) {
+    fclose(f);
+    return NULL;
+  }
+  yaml_parser_set_input_file(&ys->parser, f);
+  while (ys_next(ys) && (ys->event.type == YAML_STREAM_START_EVENT || ys->event.type == YAML_DOCUMENT_START_EVENT)) {
+  }
+  if (ys->have_event && ys->event.type == YAML_MAPPING_START_EVENT) return f;
+  if (ys->have_event) fprintf(stderr, "[pzdc_dungeon_2_gl] %s: document root is not a mapping\n", path);
+  ys_close(ys, f);
+  return NULL;
 }
 
-static double skill_traumatic_effect_coef(const Skill *s) {
-  if (!s) return 1.0;
-  if (strcmp(s->code, "traumatic_strike") != 0) return 1.0;
-  double effect = 30 + 3.0 * s->lvl;
-  double coef = (100.0 - effect) / 100.0;
-  return coef < 0 ? 0 : coef;
+// Loads a top-level map of code -> record. finish() runs after each record's
+// fields and fills in the code and any defaults.
+static size_t ys_load_records(const char *path, const FieldSpec *fields, size_t record_size,
+                              void (*finish)(void *record, const char *code), void **out) {
+  *out = NULL;
+  YamlStream ys;
+  FILE *f = ys_open(&ys, path);
+  if (!f) return 0;
+
+  char *records = NULL;
+  size_t count = 0;
+  size_t cap = 0;
+  while (ys_next(&ys) && ys.event.type != YAML_MAPPING_END_EVENT) {
+    char code[64];
+    const char *key = ys_scalar(&ys);
+    snprintf(code, sizeof(code), "%s", key ? key : "");
+    if (!key && !ys_skip(&ys)) break;
+    if (!ys_next(&ys)) break;
+    if (!key || ys.event.type != YAML_MAPPING_START_EVENT) {
+      if (!ys_skip(&ys)) break;
+      continue;
+    }
+    if (count == cap) {
+      size_t new_cap = cap ? cap * 2 : 16;
+      char *arr = (char *)realloc(records, new_cap * record_size);
+      if (!arr) break;
+      records = arr;
+      cap = new_cap;
+    }
+    void *rec = records + count * record_size;
+    memset(rec, 0, record_size);
+    bool ok = ys_read_fields(&ys, fields, rec, code);
+    finish(rec, code);
+    count++;
+    if (!ok) break;
+  }
+
+  ys_close(&ys, f);
+  *out = records;
+  return count;
 }
 
-static double skill_berserk_coef(const Skill *s, const Character *hero) {
-  if (!s || strcmp(s->code, "berserk") != 0) return 1.0;
-  double hp_part = (hero->hp_max > 0) ? (double)hero->hp / hero->hp_max : 0.0;
-  double mod = 0.5 + 0.05 * s->lvl;
-  return 1.0 + (1.0 - hp_part) * mod;
+// Loads a file whose root map is a single record, e.g. a save. Fields missing from
+// the file keep whatever the caller put in base; like yaml_load_file, a parse error
+// is logged and the fields read before it are kept.
+static bool ys_load_record(const char *path, const FieldSpec *fields, void *base) {
+  YamlStream ys;
+  FILE *f = ys_open(&ys, path);
+  if (!f) return false;
+  ys_read_fields(&ys, fields, base, "root");
+  ys_close(&ys, f);
+  return true;
 }
 
-static double skill_concentration_bonus(const Skill *s, const Character *hero) {
-  if (!s || strcmp(s->code, "concentration") != 0) return 0.0;
-  double coef = hero->mp_max * (0.1 + 0.005 * s->lvl) - 10.0;
-  if (coef <= 0) return 0.0;
-  return (double)rand_range(0, (int)coef);
+static void string_list_default(char ***list, size_t *count) {
+  if (*count > 0) return;
+  free(*list);
+  *list = (char **)malloc(sizeof(char *));
+  if (!*list) return;
+  (*list)[0] = strdup_safe("without");
+  *count = 1;
+}
+
+static const FieldSpec hero_fields[] = {
+    FIELD_SPEC_IGNORE("n"),
+    FIELD_SPEC_STR("name", HeroTemplate, name),
+    FIELD_SPEC_INT("hp", HeroTemplate, hp),
+    FIELD_SPEC_INT("mp", HeroTemplate, mp),
+    FIELD_SPEC_INT("min_dmg", HeroTemplate, min_dmg),
+    FIELD_SPEC_INT("max_dmg", HeroTemplate, max_dmg),
+    FIELD_SPEC_INT("armor_penetration", HeroTemplate, armor_penetration),
+    FIELD_SPEC_INT("accurasy", HeroTemplate, accuracy),
+    FIELD_SPEC_INT("armor", HeroTemplate, armor),
+    FIELD_SPEC_INT("skill_points", HeroTemplate, skill_points),
+    FIELD_SPEC_LIST("weapon", HeroTemplate, weapon_options, weapon_count),
+    FIELD_SPEC_LIST("body_armor", HeroTemplate, body_armor_options, body_armor_count),
+    FIELD_SPEC_LIST("head_armor", HeroTemplate, head_armor_options, head_armor_count),
+    FIELD_SPEC_LIST("arms_armor", HeroTemplate, arms_armor_options, arms_armor_count),
+    FIELD_SPEC_LIST("shield", HeroTemplate, shield_options, shield_count),
+    FIELD_SPEC_END,
+};
+
+static void hero_template_finish(void *record, const char *code) {
+  HeroTemplate *ht = (HeroTemplate *)record;
+  snprintf(ht->code, sizeof(ht->code), "%s", code);
+  if (!ht->name[0]) snprintf(ht->name, sizeof(ht->name), "%s", code);
+  string_list_default(&ht->weapon_options, &ht->weapon_count);
+  string_list_default(&ht->body_armor_options, &ht->body_armor_count);
+  string_list_default(&ht->head_armor_options, &ht->head_armor_count);
+  string_list_default(&ht->arms_armor_options, &ht->arms_armor_count);
+  string_list_default(&ht->shield_options, &ht->shield_count);
+}
+
+static const FieldSpec enemy_fields[] = {
+    FIELD_SPEC_STR("code_name", EnemyTemplate, code_name),
+    FIELD_SPEC_STR("name", EnemyTemplate, name),
+    FIELD_SPEC_INT("hp", EnemyTemplate, hp),
+    FIELD_SPEC_INT("min_dmg", EnemyTemplate, min_dmg),
+    FIELD_SPEC_INT("max_dmg", EnemyTemplate, max_dmg),
+    FIELD_SPEC_INT("armor_penetration", EnemyTemplate, armor_penetration),
+    FIELD_SPEC_INT("accurasy", EnemyTemplate, accuracy),
+    FIELD_SPEC_INT("armor", EnemyTemplate, armor),
+    FIELD_SPEC_INT("regen_hp_base", EnemyTemplate, regen_hp),
+    FIELD_SPEC_INT("exp_gived", EnemyTemplate, exp_gived),
+    FIELD_SPEC_INT("coins_gived", EnemyTemplate, coins_gived),
+    FIELD_SPEC_LIST("weapon", EnemyTemplate, weapon_options, weapon_count),
+    FIELD_SPEC_LIST("body_armor", EnemyTemplate, body_armor_options, body_armor_count),
+    FIELD_SPEC_LIST("head_armor", EnemyTemplate, head_armor_options, head_armor_count),
+    FIELD_SPEC_LIST("arms_armor", EnemyTemplate, arms_armor_options, arms_armor_count),
+    FIELD_SPEC_LIST("shield", EnemyTemplate, shield_options, shield_count),
+    FIELD_SPEC_LIST("ingredients", EnemyTemplate, ingredient_options, ingredient_count),
+    FIELD_SPEC_END,
+};
+
+static void enemy_template_finish(void *record, const char *code) {
+  EnemyTemplate *et = (EnemyTemplate *)record;
+  snprintf(et->code, sizeof(et->code), "%s", code);
+  et->is_boss = (strcmp(code, "boss") == 0);
+  if (!et->code_name[0]) snprintf(et->code_name, sizeof(et->code_name), "%s", code);
+  if (!et->name[0]) snprintf(et->name, sizeof(et->name), "%s", et->code_name);
+  string_list_default(&et->weapon_options, &et->weapon_count);
+  string_list_default(&et->body_armor_options, &et->body_armor_count);
+  string_list_default(&et->head_armor_options, &et->head_armor_count);
+  string_list_default(&et->arms_armor_options, &et->arms_armor_count);
+  string_list_default(&et->shield_options, &et->shield_count);
+  string_list_default(&et->ingredient_options, &et->ingredient_count);
+}
+
+static const FieldSpec weapon_fields[] = {
+    FIELD_SPEC_STR("name", WeaponItem, name),
+    FIELD_SPEC_INT("min_dmg", WeaponItem, min_dmg),
+    FIELD_SPEC_INT("max_dmg", WeaponItem, max_dmg),
+    FIELD_SPEC_INT("accuracy", WeaponItem, accuracy),
+    FIELD_SPEC_INT("block_chance", WeaponItem, block_chance),
+    FIELD_SPEC_INT("armor_penetration", WeaponItem, armor_penetration),
+    FIELD_SPEC_INT("price", WeaponItem, price),
+    FIELD_SPEC_END,
+};
+
+static void weapon_item_finish(void *record, const char *code) {
+  WeaponItem *it = (WeaponItem *)record;
+  snprintf(it->code, sizeof(it->code), "%s", code);
+  if (!it->name[0]) snprintf(it->name, sizeof(it->name), "%s", code);
 }
 
-static double skill_dazed_hp_part_coef(const Skill *s) {
-  if (!s || strcmp(s->code, "dazed") != 0) return 0.0;
-  return 1.2 + 0.15 * s->lvl;
+static const FieldSpec armor_fields[] = {
+    FIELD_SPEC_STR("name", ArmorItem, name),
+    FIELD_SPEC_INT("armor", ArmorItem, armor),
+    FIELD_SPEC_INT("accuracy", ArmorItem, accuracy),
+    FIELD_SPEC_INT("price", ArmorItem, price),
+    FIELD_SPEC_END,
+};
+
+static void armor_item_finish(void *record, const char *code) {
+  ArmorItem *it = (ArmorItem *)record;
+  snprintf(it->code, sizeof(it->code), "%s", code);
+  if (!it->name[0]) snprintf(it->name, sizeof(it->name), "%s", code);
+}
+
+static const FieldSpec shield_fields[] = {
+    FIELD_SPEC_STR("name", ShieldItem, name),
+    FIELD_SPEC_INT("armor", ShieldItem, armor),
+    FIELD_SPEC_INT("accuracy", ShieldItem, accuracy),
+    FIELD_SPEC_INT("block_chance", ShieldItem, block_chance),
+    FIELD_SPEC_INT("min_dmg", ShieldItem, min_dmg),
+    FIELD_SPEC_INT("max_dmg", ShieldItem, max_dmg),
+    FIELD_SPEC_INT("price", ShieldItem, price),
+    FIELD_SPEC_END,
+};
+
+static void shield_item_finish(void *record, const char *code) {
+  ShieldItem *it = (ShieldItem *)record;
+  snprintf(it->code, sizeof(it->code), "%s", code);
+  if (!it->name[0]) snprintf(it->name, sizeof(it->name), "%s", code);
 }
 
-static double skill_dazed_accuracy_reduce_coef(const Skill *s) {
-  if (!s || strcmp(s->code, "dazed") != 0) return 1.0;
-  int min_reduce = 10 + 3 * s->lvl;
-  if (min_reduce > 90) min_reduce = 90;
-  int reduce = rand_range(min_reduce, 90);
-  return 0.01 * (100 - reduce);
+static bool load_heroes(const char *path, HeroTemplate **out, size_t *out_count) {
+  *out_count = ys_load_records(path, hero_fields, sizeof(HeroTemplate), hero_template_finish, (void **)out);
+  return *out_count > 0;
 }
 
-static void skill_description(const Skill *s, const Character *hero, char *out, size_t out_sz) {
-  if (!s || !out || out_sz == 0) return;
-  if (strcmp(s->code, "ascetic_strike") == 0) {
-    int dmg = (int)round((skill_active_damage_mod(s, hero) - 1) * 100);
-    int acc = (int)round((skill_active_accuracy_mod(s, hero) - 1) * 100);
-    snprintf(out, out_sz, "Free stat points %d. Additional damage +%d%%. Additional accuracy +%d%%", hero->stat_points, dmg, acc);
-  } else if (strcmp(s->code, "precise_strike") == 0) {
-    int dmg = (int)round((skill_active_damage_mod(s, hero) - 1) * 100);
-    int acc = (int)round((skill_active_accuracy_mod(s, hero) - 1) * 100);
-    snprintf(out, out_sz, "Additional damage +%d%%. Additional accuracy +%d%%", dmg, acc);
-  } else if (strcmp(s->code, "strong_strike") == 0) {
-    int dmg = (int)round((skill_active_damage_mod(s, hero) - 1) * 100);
-    snprintf(out, out_sz, "Additional damage +%d%%", dmg);
-  } else if (strcmp(s->code, "traumatic_strike") == 0) {
-    int effect = 30 + 3 * s->lvl;
-    snprintf(out, out_sz, "Attack reduces enemy damage by %d%%", effect);
-  } else if (strcmp(s->code, "berserk") == 0) {
-    int dmg = (int)round((skill_berserk_coef(s, hero) - 1) * 100);
-    int hp_part = hero->hp_max > 0 ? (int)round((double)hero->hp / hero->hp_max * 100) : 0;
-    snprintf(out, out_sz, "The less HP - the more damage. HP is %d%% from the maximum. Additional damage +%d%%", hp_part, dmg);
-  } else if (strcmp(s->code, "concentration") == 0) {
-    double coef = hero->mp_max * (0.1 + 0.005 * s->lvl) - 10.0;
-    snprintf(out, out_sz, "If max MP is more than 100(%d) random additional damage up to %.1f", hero->mp_max, coef);
-  } else if (strcmp(s->code, "dazed") == 0) {
-    double hp_part = skill_dazed_hp_part_coef(s);
-    int min_reduce = 10 + 3 * s->lvl;
-    if (min_reduce > 90) min_reduce = 90;
-    int percent = (int)round(100 / (2 * hp_part));
-    snprintf(out, out_sz, "If damage is greater %d%% remaining enemy HP then he loses %d-90%% accuracy", percent, min_reduce);
-  } else if (strcmp(s->code, "shield_master") == 0) {
-    int bonus = 10 + 2 * s->lvl;
-    snprintf(out, out_sz, "Shield block chance increased by %d%%", bonus);
-  } else if (strcmp(s->code, "bloody_ritual") == 0) {
-    int mp_dif = hero->mp_max - hero->mp;
-    int min_effect = mp_dif < 10 ? mp_dif : 10;
-    double effect = mp_dif * 0.3 * (1 + 0.1 * s->lvl);
-    int restore = (int)round(effect);
-    if (restore < min_effect) restore = min_effect;
-    if (restore > mp_dif) restore = mp_dif;
-    snprintf(out, out_sz, "Restores %d MP, the more MP lost the greater the effect", restore);
-  } else if (strcmp(s->code, "first_aid") == 0) {
-    int hp_dif = hero->hp_max - hero->hp;
-    int min_effect = hp_dif < 5 ? hp_dif : 5;
-    double effect = hp_dif * 0.2 * (1 + 0.1 * s->lvl);
-    int restore = (int)round(effect);
-    if (restore < min_effect) restore = min_effect;
-    if (restore > hp_dif) restore = hp_dif;
-    snprintf(out, out_sz, "Restores %d HP, the more HP lost the greater the effect", restore);
-  } else if (strcmp(s->code, "treasure_hunter") == 0) {
-    int bonus = 50 + 10 * s->lvl;
-    snprintf(out, out_sz, "Positively affects random actions. Luck bonus %d", bonus);
-  } else {
-    if (out_sz > 0) out[0] = '\0';
+static bool load_enemies(const char *path, EnemyTemplate **out, size_t *out_count) {
+  *out_count = ys_load_records(path, enemy_fields, sizeof(EnemyTemplate), enemy_template_finish, (void **)out);
+  return *out_count > 0;
+}
+
+static bool load_weapons(const char *path, WeaponItem **out, size_t *out_count) {
+  *out_count = ys_load_records(path, weapon_fields, sizeof(WeaponItem), weapon_item_finish, (void **)out);
+  return *out_count > 0;
+}
+
+static bool load_armors(const char *path, ArmorItem **out, size_t *out_count) {
+  *out_count = ys_load_records(path, armor_fields, sizeof(ArmorItem), armor_item_finish, (void **)out);
+  return *out_count > 0;
+}
+
+static bool load_shields(const char *path, ShieldItem **out, size_t *out_count) {
+  *out_count = ys_load_records(path, shield_fields, sizeof(ShieldItem), shield_item_finish, (void **)out);
+  return *out_count > 0;
+}
+
+static WeaponItem weapon_from_code(const Game *g, const char *code) {
+  WeaponItem empty = {0};
+  snprintf(empty.code, sizeof(empty.code), "%s", code ? code : "without");
+  snprintf(empty.name, sizeof(empty.name), "%s", code ? code : "---");
+  if (!g || !code) return empty;
+  for (size_t i = 0; i < g->weapon_count; ++i) {
+    if (strcmp(g->weapons[i].code, code) == 0) return g->weapons[i];
   }
+  return empty;
 }
 
-static void skill_description_short(const Skill *s, const Character *hero, char *out, size_t out_sz) {
-  (void)hero;
-  if (!s || !out || out_sz == 0) return;
-  if (strcmp(s->code, "ascetic_strike") == 0) {
-    snprintf(out, out_sz, "Cost %d MP. More free stat points = more damage/accuracy", s->mp_cost);
-  } else if (strcmp(s->code, "precise_strike") == 0) {
-    snprintf(out, out_sz, "Cost %d MP. Attack much more accurately", s->mp_cost);
-  } else if (strcmp(s->code, "strong_strike") == 0) {
-    snprintf(out, out_sz, "Cost %d MP. Attack much stronger", s->mp_cost);
-  } else if (strcmp(s->code, "traumatic_strike") == 0) {
-    snprintf(out, out_sz, "Cost %d MP. Reduces enemy damage", s->mp_cost);
-  } else if (strcmp(s->code, "berserk") == 0) {
-    snprintf(out, out_sz, "The less HP are left - the more damage you do");
-  } else if (strcmp(s->code, "concentration") == 0) {
-    snprintf(out, out_sz, "More max MP -> more random additional damage");
-  } else if (strcmp(s->code, "dazed") == 0) {
-    snprintf(out, out_sz, "Big hit can drastically reduce enemy accuracy");
-  } else if (strcmp(s->code, "shield_master") == 0) {
-    snprintf(out, out_sz, "Shield block chance increased");
-  } else if (strcmp(s->code, "bloody_ritual") == 0) {
-    snprintf(out, out_sz, "Cost %d HP. Restores MP based on missing MP", s->hp_cost);
-  } else if (strcmp(s->code, "first_aid") == 0) {
-    snprintf(out, out_sz, "Cost %d MP. Restores HP based on missing HP", s->mp_cost);
-  } else if (strcmp(s->code, "treasure_hunter") == 0) {
-    snprintf(out, out_sz, "Positively affects random actions in game");
-  } else {
-    if (out_sz > 0) out[0] = '\0';
+static ArmorItem armor_from_code(const ArmorItem *items, size_t count, const char *code) {
+  ArmorItem empty = {0};
+  snprintf(empty.code, sizeof(empty.code), "%s", code ? code : "without");
+  snprintf(empty.name, sizeof(empty.name), "%s", code ? code : "---");
+  if (!items || !code) return empty;
+  for (size_t i = 0; i < count; ++i) {
+    if (strcmp(items[i].code, code) == 0) return items[i];
+  }
+  return empty;
+}
+
+static ShieldItem shield_from_code(const Game *g, const char *code) {
+  ShieldItem empty = {0};
+  snprintf(empty.code, sizeof(empty.code), "%s", code ? code : "without");
+  snprintf(empty.name, sizeof(empty.name), "%s", code ? code : "---");
+  if (!g || !code) return empty;
+  for (size_t i = 0; i < g->shield_count; ++i) {
+    if (strcmp(g->shields[i].code, code) == 0) return g->shields[i];
+  }
+  return empty;
+}
+
+static const char *pick_random_option(char **list, size_t count, Rng *rng) {
+  if (!list || count == 0) return "without";
+  size_t idx = (size_t)rand_range(rng, 0, (int)count - 1);
+  return list[idx] ? list[idx] : "without";
+}
+
+static void shop_init_default(ShopData *shop) {
+  if (!shop) return;
+  for (int i = 0; i < 3; ++i) {
+    snprintf(shop->weapon[i], sizeof(shop->weapon[i]), "without");
+    snprintf(shop->body_armor[i], sizeof(shop->body_armor[i]), "without");
+    snprintf(shop->head_armor[i], sizeof(shop->head_armor[i]), "without");
+    snprintf(shop->arms_armor[i], sizeof(shop->arms_armor[i]), "without");
+    snprintf(shop->shield[i], sizeof(shop->shield[i]), "without");
   }
 }
 
-static int hero_next_lvl_exp(const Character *c) {
-  static const int EXP_LVL[] = {0, 2, 5, 9, 14, 20, 27, 35, 44, 54, 65, 77, 90, 104, 129, 145, 162, 180, 200};
-  int idx = c->lvl + 1;
-  if (idx < 0) idx = 0;
-  if (idx >= (int)(sizeof(EXP_LVL) / sizeof(EXP_LVL[0]))) idx = (int)(sizeof(EXP_LVL) / sizeof(EXP_LVL[0])) - 1;
-  return EXP_LVL[idx];
-}
+static void warehouse_init_default(WarehouseData *wh) {
+  if (!wh) return;
+  wh->coins = 0;
+  snprintf(wh->weapon, sizeof(wh->weapon), "without");
+  snprintf(wh->body_armor, sizeof(wh->body_armor), "without");
+  snprintf(wh->head_armor, sizeof(wh->head_armor), "without");
+  snprintf(wh->arms_armor, sizeof(wh->arms_armor), "without");
+  snprintf(wh->shield, sizeof(wh->shield), "without");
+}
+
+// Read through lists, then clipped into the three fixed slots of each type.
+typedef struct {
+  char **codes[5];
+  size_t counts[5];
+} ShopSave;
+
+static const FieldSpec shop_ammo_fields[] = {
+    FIELD_SPEC_LIST("weapon", ShopSave, codes[0], counts[0]),
+    FIELD_SPEC_LIST("body_armor", ShopSave, codes[1], counts[1]),
+    FIELD_SPEC_LIST("head_armor", ShopSave, codes[2], counts[2]),
+    FIELD_SPEC_LIST("arms_armor", ShopSave, codes[3], counts[3]),
+    FIELD_SPEC_LIST("shield", ShopSave, codes[4], counts[4]),
+    FIELD_SPEC_END,
+};
 
-static void hero_add_exp(Character *hero, int added_exp, LogBuffer *log) {
-  static const int EXP_LVL[] = {0, 2, 5, 9, 14, 20, 27, 35, 44, 54, 65, 77, 90, 104, 129, 145, 162, 180, 200};
-  if (!hero) return;
-  hero->exp += added_exp;
-  if (log) {
-    char msg[128];
-    snprintf(msg, sizeof(msg), "You have gained %d exp, now you have %d exp", added_exp, hero->exp);
-    logbuffer_push(log, msg);
-  }
-  int new_levels = 0;
-  int max_idx = (int)(sizeof(EXP_LVL) / sizeof(EXP_LVL[0])) - 1;
-  for (int i = 0; i <= max_idx; ++i) {
-    if (hero->exp >= EXP_LVL[i] && hero->lvl < i) {
-      new_levels = i - hero->lvl;
-      hero->lvl = i;
+static const FieldSpec shop_save_fields[] = {
+    {"ammunition", FIELD_MAP, 0, 0, shop_ammo_fields, NULL},
+    FIELD_SPEC_END,
+};
+
+static bool load_shop_data(ShopData *shop) {
+  if (!shop) return false;
+  char *saves_dir = resolve_saves_dir();
+  if (!saves_dir) return false;
+  char path[512];
+  snprintf(path, sizeof(path), "%s/shop.yml", saves_dir);
+  free(saves_dir);
+
+  if (!file_exists(path)) {
+    shop_init_default(shop);
+    FILE *f = fopen(path, "w");
+    if (f) {
+      fprintf(f, "ammunition:\n");
+      fprintf(f, "  weapon: [without, without, without]\n");
+      fprintf(f, "  body_armor: [without, without, without]\n");
+      fprintf(f, "  head_armor: [without, without, without]\n");
+      fprintf(f, "  arms_armor: [without, without, without]\n");
+      fprintf(f, "  shield: [without, without, without]\n");
+      fclose(f);
     }
+    return true;
   }
-  if (new_levels > 0) {
-    hero->stat_points += new_levels;
-    hero->skill_points += new_levels;
-    if (log) {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "You have gained %d new level(s). Now lvl %d", new_levels, hero->lvl);
-      logbuffer_push(log, msg);
-      snprintf(msg, sizeof(msg), "You gained %d stat and %d skill points", new_levels, new_levels);
-      logbuffer_push(log, msg);
+
+  ShopSave save;
+  memset(&save, 0, sizeof(save));
+  bool ok = ys_load_record(path, shop_save_fields, &save);
+  if (ok) {
+    shop_init_default(shop);
+    char (*slots[5])[32] = {shop->weapon, shop->body_armor, shop->head_armor, shop->arms_armor, shop->shield};
+    for (int t = 0; t < 5; ++t) {
+      for (size_t i = 0; i < 3 && i < save.counts[t]; ++i) {
+        snprintf(slots[t][i], sizeof(slots[t][i]), "%s", save.codes[t][i] ? save.codes[t][i] : "without");
+      }
     }
   }
+  for (int t = 0; t < 5; ++t) free_string_list(save.codes[t], save.counts[t]);
+  return ok;
 }
 
-static void hero_rest(Character *hero, LogBuffer *log) {
-  if (!hero) return;
-  if (hero->hp < hero->hp_max) {
-    int rec = character_recovery_hp(hero);
-    int gain = rec;
-    if (hero->hp + gain > hero->hp_max) gain = hero->hp_max - hero->hp;
-    hero->hp += gain;
-    if (log && gain > 0) {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "After resting, you restore %d HP (%d/%d)", gain, hero->hp, hero->hp_max);
-      logbuffer_push(log, msg);
-    }
-  }
-  if (hero->mp < hero->mp_max) {
-    int rec = character_recovery_mp(hero);
-    int gain = rec;
-    if (hero->mp + gain > hero->mp_max) gain = hero->mp_max - hero->mp;
-    hero->mp += gain;
-    if (log && gain > 0) {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "After resting, you restore %d MP (%d/%d)", gain, hero->mp, hero->mp_max);
-      logbuffer_push(log, msg);
+static bool save_shop_data(const ShopData *shop) {
+  if (!shop) return false;
+  char *saves_dir = resolve_saves_dir();
+  if (!saves_dir) return false;
+  char path[512];
+  snprintf(path, sizeof(path), "%s/shop.yml", saves_dir);
+  free(saves_dir);
+  FILE *f = fopen(path, "w");
+  if (!f) return false;
+  fprintf(f, "ammunition:\n");
+  fprintf(f, "  weapon: [%s, %s, %s]\n", shop->weapon[0], shop->weapon[1], shop->weapon[2]);
+  fprintf(f, "  body_armor: [%s, %s, %s]\n", shop->body_armor[0], shop->body_armor[1], shop->body_armor[2]);
+  fprintf(f, "  head_armor: [%s, %s, %s]\n", shop->head_armor[0], shop->head_armor[1], shop->head_armor[2]);
+  fprintf(f, "  arms_armor: [%s, %s, %s]\n", shop->arms_armor[0], shop->arms_armor[1], shop->arms_armor[2]);
+  fprintf(f, "  shield: [%s, %s, %s]\n", shop->shield[0], shop->shield[1], shop->shield[2]);
+  fclose(f);
+  return true;
+}
+
+static const FieldSpec warehouse_fields[] = {
+    FIELD_SPEC_INT("coins", WarehouseData, coins),
+    FIELD_SPEC_STR("weapon", WarehouseData, weapon),
+    FIELD_SPEC_STR("body_armor", WarehouseData, body_armor),
+    FIELD_SPEC_STR("head_armor", WarehouseData, head_armor),
+    FIELD_SPEC_STR("arms_armor", WarehouseData, arms_armor),
+    FIELD_SPEC_STR("shield", WarehouseData, shield),
+    FIELD_SPEC_END,
+};
+
+static bool load_warehouse_data(WarehouseData *wh) {
+  if (!wh) return false;
+  char *saves_dir = resolve_saves_dir();
+  if (!saves_dir) return false;
+  char path[512];
+  snprintf(path, sizeof(path), "%s/warehouse.yml", saves_dir);
+  free(saves_dir);
+
+  if (!file_exists(path)) {
+    warehouse_init_default(wh);
+    FILE *f = fopen(path, "w");
+    if (f) {
+      fprintf(f, "coins: 0\n");
+      fprintf(f, "weapon: without\n");
+      fprintf(f, "body_armor: without\n");
+      fprintf(f, "head_armor: without\n");
+      fprintf(f, "arms_armor: without\n");
+      fprintf(f, "shield: without\n");
+      fclose(f);
     }
+    return true;
   }
+
+  WarehouseData loaded;
+  warehouse_init_default(&loaded);
+  if (!ys_load_record(path, warehouse_fields, &loaded)) return false;
+  *wh = loaded;
+  return true;
 }
 
-static int camp_skill_restore_hp(const Character *hero) {
-  if (!hero) return 0;
-  int hp_dif = hero->hp_max - hero->hp;
-  if (hp_dif <= 0) return 0;
-  int min_effect = hp_dif < 5 ? hp_dif : 5;
-  double effect = hp_dif * 0.2 * (1 + 0.1 * hero->camp_skill.lvl);
-  int restore = (int)round(effect);
-  if (restore < min_effect) restore = min_effect;
-  if (restore > hp_dif) restore = hp_dif;
-  return restore;
+static bool save_warehouse_data(const WarehouseData *wh) {
+  if (!wh) return false;
+  char *saves_dir = resolve_saves_dir();
+  if (!saves_dir) return false;
+  char path[512];
+  snprintf(path, sizeof(path), "%s/warehouse.yml", saves_dir);
+  free(saves_dir);
+  FILE *f = fopen(path, "w");
+  if (!f) return false;
+  fprintf(f, "coins: %d\n", wh->coins);
+  fprintf(f, "weapon: %s\n", wh->weapon);
+  fprintf(f, "body_armor: %s\n", wh->body_armor);
+  fprintf(f, "head_armor: %s\n", wh->head_armor);
+  fprintf(f, "arms_armor: %s\n", wh->arms_armor);
+  fprintf(f, "shield: %s\n", wh->shield);
+  fclose(f);
+  return true;
 }
 
-static int camp_skill_restore_mp(const Character *hero) {
-  if (!hero) return 0;
-  int mp_dif = hero->mp_max - hero->mp;
-  if (mp_dif <= 0) return 0;
-  int min_effect = mp_dif < 10 ? mp_dif : 10;
-  double effect = mp_dif * 0.3 * (1 + 0.1 * hero->camp_skill.lvl);
-  int restore = (int)round(effect);
-  if (restore < min_effect) restore = min_effect;
-  if (restore > mp_dif) restore = mp_dif;
-  return restore;
+static const char *shop_items_for_fill(const char *type, int idx, Rng *rng) {
+  static const char *weapon_items[] = {"stick", "knife", "club"};
+  static const char *body_items[] = {"leather_jacket", "rusty_gambeson"};
+  static const char *head_items[] = {"rusty_quilted_helmet", "leather_helmet"};
+  static const char *arms_items[] = {"worn_gloves", "leather_gloves"};
+  static const char *shield_items[] = {"holey_wicker_buckler", "braided_buckler", "wooden_buckler"};
+  (void)idx;
+  if (strcmp(type, "weapon") == 0) return weapon_items[rand_range(rng, 0, 2)];
+  if (strcmp(type, "body_armor") == 0) return body_items[rand_range(rng, 0, 1)];
+  if (strcmp(type, "head_armor") == 0) return head_items[rand_range(rng, 0, 1)];
+  if (strcmp(type, "arms_armor") == 0) return arms_items[rand_range(rng, 0, 1)];
+  if (strcmp(type, "shield") == 0) return shield_items[rand_range(rng, 0, 2)];
+  return "without";
 }
 
-static void game_use_camp_skill(Game *g) {
-  if (!g) return;
-  Character *hero = &g->hero;
-  logbuffer_clear(&g->log);
-  if (strcmp(hero->camp_skill.code, "first_aid") == 0) {
-    if (hero->hp_max <= hero->hp) {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "You dont need use %s", hero->camp_skill.name);
-      logbuffer_push(&g->log, msg);
-      return;
-    }
-    if (hero->mp < hero->camp_skill.mp_cost) {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "Not enough MP for \"%s\"", hero->camp_skill.name);
-      logbuffer_push(&g->log, msg);
-      return;
+static void shop_fill(ShopData *shop, Rng *rng) {
+  if (!shop) return;
+  const char *types[] = {"weapon", "body_armor", "head_armor", "arms_armor", "shield"};
+  for (int t = 0; t < 5; ++t) {
+    char (*arr)[32] = NULL;
+    if (t == 0) arr = shop->weapon;
+    else if (t == 1) arr = shop->body_armor;
+    else if (t == 2) arr = shop->head_armor;
+    else if (t == 3) arr = shop->arms_armor;
+    else arr = shop->shield;
+    int without_count = 0;
+    for (int i = 0; i < 3; ++i) if (strcmp(arr[i], "without") == 0) without_count++;
+    int n = without_count == 3 ? 2 : without_count == 2 ? 1 : 0;
+    for (int k = 0; k < n; ++k) {
+      int idx = -1;
+      for (int i = 0; i < 3; ++i) {
+        if (strcmp(arr[i], "without") == 0) { idx = i; break; }
+      }
+      if (idx >= 0) snprintf(arr[idx], sizeof(arr[idx]), "%s", shop_items_for_fill(types[t], idx, rng));
     }
-    int restore = camp_skill_restore_hp(hero);
-    hero->hp += restore;
-    if (hero->hp > hero->hp_max) hero->hp = hero->hp_max;
-    hero->mp -= hero->camp_skill.mp_cost;
-    if (hero->mp < 0) hero->mp = 0;
-    char msg[160];
-    snprintf(msg, sizeof(msg), "You restored %d HP for %d MP, now you have %d/%d HP and %d/%d MP",
-             restore, hero->camp_skill.mp_cost, hero->hp, hero->hp_max, hero->mp, hero->mp_max);
-    logbuffer_push(&g->log, msg);
-    return;
   }
-  if (strcmp(hero->camp_skill.code, "bloody_ritual") == 0) {
-    if (hero->mp_max <= hero->mp) {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "You dont need use %s", hero->camp_skill.name);
-      logbuffer_push(&g->log, msg);
-      return;
-    }
-    if (hero->hp <= hero->camp_skill.hp_cost) {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "Not enough HP for \"%s\"", hero->camp_skill.name);
-      logbuffer_push(&g->log, msg);
-      return;
+}
+
+static void monolith_init_default(MonolithData *m) {
+  if (!m) return;
+  memset(m, 0, sizeof(*m));
+}
+
+static const FieldSpec monolith_fields[] = {
+    FIELD_SPEC_INT("points", MonolithData, points),
+    FIELD_SPEC_INT("hp", MonolithData, hp),
+    FIELD_SPEC_INT("mp", MonolithData, mp),
+    FIELD_SPEC_INT("accuracy", MonolithData, accuracy),
+    FIELD_SPEC_INT("damage", MonolithData, damage),
+    FIELD_SPEC_INT("stat_points", MonolithData, stat_points),
+    FIELD_SPEC_INT("skill_points", MonolithData, skill_points),
+    FIELD_SPEC_INT("armor", MonolithData, armor),
+    FIELD_SPEC_INT("regen_hp", MonolithData, regen_hp),
+    FIELD_SPEC_INT("regen_mp", MonolithData, regen_mp),
+    FIELD_SPEC_INT("armor_penetration", MonolithData, armor_penetration),
+    FIELD_SPEC_INT("block_chance", MonolithData, block_chance),
+    FIELD_SPEC_END,
+};
+
+static bool load_monolith_data(MonolithData *m) {
+  if (!m) return false;
+  char *saves_dir = resolve_saves_dir();
+  if (!saves_dir) return false;
+  char path[512];
+  snprintf(path, sizeof(path), "%s/pzdc_monolith.yml", saves_dir);
+  free(saves_dir);
+
+  if (!file_exists(path)) {
+    monolith_init_default(m);
+    FILE *f = fopen(path, "w");
+    if (f) {
+      fprintf(f, "points: 0\n");
+      fprintf(f, "hp: 0\n");
+      fprintf(f, "mp: 0\n");
+      fprintf(f, "accuracy: 0\n");
+      fprintf(f, "damage: 0\n");
+      fprintf(f, "stat_points: 0\n");
+      fprintf(f, "skill_points: 0\n");
+      fprintf(f, "armor: 0\n");
+      fprintf(f, "regen_hp: 0\n");
+      fprintf(f, "regen_mp: 0\n");
+      fprintf(f, "armor_penetration: 0\n");
+      fprintf(f, "block_chance: 0\n");
+      fclose(f);
     }
-    int restore = camp_skill_restore_mp(hero);
-    hero->mp += restore;
-    if (hero->mp > hero->mp_max) hero->mp = hero->mp_max;
-    hero->hp -= hero->camp_skill.hp_cost;
-    if (hero->hp < 0) hero->hp = 0;
-    char msg[160];
-    snprintf(msg, sizeof(msg), "You restored %d MP for %d HP, now you have %d/%d MP and %d/%d HP",
-             restore, hero->camp_skill.hp_cost, hero->mp, hero->mp_max, hero->hp, hero->hp_max);
-    logbuffer_push(&g->log, msg);
-    return;
+    return true;
   }
-  char msg[128];
-  snprintf(msg, sizeof(msg), "You dont need use %s", hero->camp_skill.name);
-  logbuffer_push(&g->log, msg);
-}
 
-static void ammo_display_name(const char *name, bool enhanced, char *out, size_t out_sz) {
-  if (!out || out_sz == 0) return;
-  if (!name) name = "---";
-  if (enhanced) snprintf(out, out_sz, "(E+) %s", name);
-  else snprintf(out, out_sz, "%s", name);
+  MonolithData loaded;
+  monolith_init_default(&loaded);
+  if (!ys_load_record(path, monolith_fields, &loaded)) return false;
+  *m = loaded;
+  return true;
 }
 
-static void character_to_map(const Character *c, ValueMap *map) {
-  char buf[128];
-  value_map_set(map, "name", c->name);
-  snprintf(buf, sizeof(buf), "%d", c->hp); value_map_set(map, "hp", buf);
-  snprintf(buf, sizeof(buf), "%d", c->hp_max); value_map_set(map, "hp_max", buf);
-  snprintf(buf, sizeof(buf), "%d", c->regen_hp_base); value_map_set(map, "regen_hp_base", buf);
-  snprintf(buf, sizeof(buf), "%d", c->mp); value_map_set(map, "mp", buf);
-  snprintf(buf, sizeof(buf), "%d", c->mp_max); value_map_set(map, "mp_max", buf);
-  snprintf(buf, sizeof(buf), "%d", c->regen_mp_base); value_map_set(map, "regen_mp_base", buf);
-  snprintf(buf, sizeof(buf), "%d", character_min_dmg(c)); value_map_set(map, "min_dmg", buf);
-  snprintf(buf, sizeof(buf), "%d", character_max_dmg(c)); value_map_set(map, "max_dmg", buf);
-  snprintf(buf, sizeof(buf), "%d", character_armor_penetration(c)); value_map_set(map, "armor_penetration", buf);
-  snprintf(buf, sizeof(buf), "%d", character_accuracy(c)); value_map_set(map, "accuracy", buf);
-  snprintf(buf, sizeof(buf), "%d", character_armor(c)); value_map_set(map, "armor", buf);
-  snprintf(buf, sizeof(buf), "%d", character_block_chance(c)); value_map_set(map, "block_chance", buf);
-  snprintf(buf, sizeof(buf), "%d", block_power_in_percents(c)); value_map_set(map, "block_power_in_percents", buf);
-
-  snprintf(buf, sizeof(buf), "%d", c->min_dmg_base); value_map_set(map, "min_dmg_base", buf);
-  snprintf(buf, sizeof(buf), "%d", c->max_dmg_base); value_map_set(map, "max_dmg_base", buf);
-  snprintf(buf, sizeof(buf), "%d", c->accuracy_base); value_map_set(map, "accuracy_base", buf);
-  snprintf(buf, sizeof(buf), "%d", c->armor_base); value_map_set(map, "armor_base", buf);
-  snprintf(buf, sizeof(buf), "%d", c->block_chance_base); value_map_set(map, "block_chance_base", buf);
-  snprintf(buf, sizeof(buf), "%d", c->armor_penetration_base); value_map_set(map, "armor_penetration_base", buf);
-
-  snprintf(buf, sizeof(buf), "%d", c->stat_points); value_map_set(map, "stat_points", buf);
-  snprintf(buf, sizeof(buf), "%d", c->skill_points); value_map_set(map, "skill_points", buf);
-  snprintf(buf, sizeof(buf), "%d", c->exp); value_map_set(map, "exp", buf);
-  snprintf(buf, sizeof(buf), "%d", c->lvl); value_map_set(map, "lvl", buf);
-  snprintf(buf, sizeof(buf), "%d", hero_next_lvl_exp(c)); value_map_set(map, "next_lvl_exp", buf);
-  snprintf(buf, sizeof(buf), "%d", c->pzdc_monolith_points); value_map_set(map, "pzdc_monolith_points", buf);
-  snprintf(buf, sizeof(buf), "%d", c->coins); value_map_set(map, "coins", buf);
-
-  snprintf(buf, sizeof(buf), "%d", character_recovery_hp(c)); value_map_set(map, "recovery_hp", buf);
-  snprintf(buf, sizeof(buf), "%d", character_recovery_mp(c)); value_map_set(map, "recovery_mp", buf);
+static bool save_monolith_data(const MonolithData *m) {
+  if (!m) return false;
+  char *saves_dir = resolve_saves_dir();
+  if (!saves_dir) return false;
+  char path[512];
+  snprintf(path, sizeof(path), "%s/pzdc_monolith.yml", saves_dir);
+  free(saves_dir);
+  FILE *f = fopen(path, "w");
+  if (!f) return false;
+  fprintf(f, "points: %d\n", m->points);
+  fprintf(f, "hp: %d\n", m->hp);
+  fprintf(f, "mp: %d\n", m->mp);
+  fprintf(f, "accuracy: %d\n", m->accuracy);
+  fprintf(f, "damage: %d\n", m->damage);
+  fprintf(f, "stat_points: %d\n", m->stat_points);
+  fprintf(f, "skill_points: %d\n", m->skill_points);
+  fprintf(f, "armor: %d\n", m->armor);
+  fprintf(f, "regen_hp: %d\n", m->regen_hp);
+  fprintf(f, "regen_mp: %d\n", m->regen_mp);
+  fprintf(f, "armor_penetration: %d\n", m->armor_penetration);
+  fprintf(f, "block_chance: %d\n", m->block_chance);
+  fclose(f);
+  return true;
+}
 
-  ammo_display_name(c->weapon.name, c->weapon.enhanced, buf, sizeof(buf));
-  value_map_set(map, "weapon.name", buf);
-  ammo_display_name(c->head_armor.name, c->head_armor.enhanced, buf, sizeof(buf));
-  value_map_set(map, "head_armor.name", buf);
-  ammo_display_name(c->body_armor.name, c->body_armor.enhanced, buf, sizeof(buf));
-  value_map_set(map, "body_armor.name", buf);
-  ammo_display_name(c->arms_armor.name, c->arms_armor.enhanced, buf, sizeof(buf));
-  value_map_set(map, "arms_armor.name", buf);
-  ammo_display_name(c->shield.name, c->shield.enhanced, buf, sizeof(buf));
-  value_map_set(map, "shield.name", buf);
+static int monolith_get_stat(const MonolithData *m, const char *key) {
+  if (!m || !key) return 0;
+  if (strcmp(key, "hp") == 0) return m->hp;
+  if (strcmp(key, "mp") == 0) return m->mp;
+  if (strcmp(key, "accuracy") == 0) return m->accuracy;
+  if (strcmp(key, "damage") == 0) return m->damage;
+  if (strcmp(key, "stat_points") == 0) return m->stat_points;
+  if (strcmp(key, "skill_points") == 0) return m->skill_points;
+  if (strcmp(key, "armor") == 0) return m->armor;
+  if (strcmp(key, "regen_hp") == 0) return m->regen_hp;
+  if (strcmp(key, "regen_mp") == 0) return m->regen_mp;
+  if (strcmp(key, "armor_penetration") == 0) return m->armor_penetration;
+  if (strcmp(key, "block_chance") == 0) return m->block_chance;
+  return 0;
+}
 
-  value_map_set(map, "active_skill.name", c->active_skill.name);
-  snprintf(buf, sizeof(buf), "%d", c->active_skill.lvl); value_map_set(map, "active_skill.lvl", buf);
-  char cost[64];
-  skill_show_cost(&c->active_skill, cost, sizeof(cost));
-  value_map_set(map, "active_skill.show_cost", cost);
-  char desc[256];
-  skill_description(&c->active_skill, c, desc, sizeof(desc));
-  value_map_set(map, "active_skill.description", desc);
+static int monolith_price_for(const MonolithData *m, const char *key) {
+  if (!m || !key) return 0;
+  const char *stats[] = {"hp","mp","accuracy","damage","stat_points","skill_points","armor","regen_hp","regen_mp","armor_penetration","block_chance"};
+  const int base[] = {1,1,5,10,7,15,40,70,60,30,5};
+  const double mult[] = {1.04,1.04,1.4,1.4,1.3,1.3,1.7,2.0,2.0,1.4,1.5};
+  for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); ++i) {
+    if (strcmp(stats[i], key) == 0) {
+      int cur = monolith_get_stat(m, key);
+      double price = base[i] * pow(mult[i], cur);
+      return (int)floor(price);
+    }
+  }
+  return 0;
+}
 
-  value_map_set(map, "passive_skill.name", c->passive_skill.name);
-  snprintf(buf, sizeof(buf), "%d", c->passive_skill.lvl); value_map_set(map, "passive_skill.lvl", buf);
-  skill_show_cost(&c->passive_skill, cost, sizeof(cost));
-  value_map_set(map, "passive_skill.show_cost", cost);
-  skill_description(&c->passive_skill, c, desc, sizeof(desc));
-  value_map_set(map, "passive_skill.description", desc);
+static bool monolith_buy(MonolithData *m, const char *key) {
+  if (!m || !key) return false;
+  int price = monolith_price_for(m, key);
+  if (m->points < price || price <= 0) return false;
+  m->points -= price;
+  if (strcmp(key, "hp") == 0) m->hp += 1;
+  else if (strcmp(key, "mp") == 0) m->mp += 1;
+  else if (strcmp(key, "accuracy") == 0) m->accuracy += 1;
+  else if (strcmp(key, "damage") == 0) m->damage += 1;
+  else if (strcmp(key, "stat_points") == 0) m->stat_points += 1;
+  else if (strcmp(key, "skill_points") == 0) m->skill_points += 1;
+  else if (strcmp(key, "armor") == 0) m->armor += 1;
+  else if (strcmp(key, "regen_hp") == 0) m->regen_hp += 1;
+  else if (strcmp(key, "regen_mp") == 0) m->regen_mp += 1;
+  else if (strcmp(key, "armor_penetration") == 0) m->armor_penetration += 1;
+  else if (strcmp(key, "block_chance") == 0) m->block_chance += 1;
+  return true;
+}
 
-  value_map_set(map, "camp_skill.name", c->camp_skill.name);
-  snprintf(buf, sizeof(buf), "%d", c->camp_skill.lvl); value_map_set(map, "camp_skill.lvl", buf);
-  skill_show_cost(&c->camp_skill, cost, sizeof(cost));
-  value_map_set(map, "camp_skill.show_cost", cost);
-  skill_description(&c->camp_skill, c, desc, sizeof(desc));
-  value_map_set(map, "camp_skill.description", desc);
+static void statistics_total_init_default(StatisticsTotal *s) {
+  if (!s) return;
+  memset(s, 0, sizeof(*s));
 }
 
-static bool load_heroes(const char *path, HeroTemplate **out, size_t *out_count) {
-  Node *root = yaml_load_file(path);
-  if (!root || root->type != NODE_MAP) {
-    node_free(root);
-    return false;
-  }
+static const FieldSpec stats_bandits_fields[] = {
+    FIELD_SPEC_INT("rabble", StatisticsTotal, bandits[0]),
+    FIELD_SPEC_INT("rabid_dog", StatisticsTotal, bandits[1]),
+    FIELD_SPEC_INT("poacher", StatisticsTotal, bandits[2]),
+    FIELD_SPEC_INT("thug", StatisticsTotal, bandits[3]),
+    FIELD_SPEC_INT("deserter", StatisticsTotal, bandits[4]),
+    FIELD_SPEC_INT("bandit_leader", StatisticsTotal, bandits[5]),
+    FIELD_SPEC_END,
+};
 
-  HeroTemplate *heroes = NULL;
-  size_t count = 0;
+static const FieldSpec stats_undeads_fields[] = {
+    FIELD_SPEC_INT("zombie", StatisticsTotal, undeads[0]),
+    FIELD_SPEC_INT("skeleton", StatisticsTotal, undeads[1]),
+    FIELD_SPEC_INT("ghost", StatisticsTotal, undeads[2]),
+    FIELD_SPEC_INT("fat_ghoul", StatisticsTotal, undeads[3]),
+    FIELD_SPEC_INT("skeleton_soldier", StatisticsTotal, undeads[4]),
+    FIELD_SPEC_INT("zombie_knight", StatisticsTotal, undeads[5]),
+    FIELD_SPEC_END,
+};
 
-  for (size_t i = 0; i < root->map.len; ++i) {
-    const char *code = root->map.keys[i];
-    Node *h = root->map.values[i];
-    if (!code || !h || h->type != NODE_MAP) continue;
-
-    HeroTemplate ht = {0};
-    snprintf(ht.code, sizeof(ht.code), "%s", code);
-    Node *name = node_map_get(h, "name");
-    Node *hp = node_map_get(h, "hp");
-    Node *mp = node_map_get(h, "mp");
-    Node *min_dmg = node_map_get(h, "min_dmg");
-    Node *max_dmg = node_map_get(h, "max_dmg");
-    Node *armor_pen = node_map_get(h, "armor_penetration");
-    Node *acc = node_map_get(h, "accurasy");
-    Node *armor = node_map_get(h, "armor");
-    Node *skill_points = node_map_get(h, "skill_points");
-    Node *weapon = node_map_get(h, "weapon");
-    Node *body_armor = node_map_get(h, "body_armor");
-    Node *head_armor = node_map_get(h, "head_armor");
-    Node *arms_armor = node_map_get(h, "arms_armor");
-    Node *shield = node_map_get(h, "shield");
-
-    snprintf(ht.name, sizeof(ht.name), "%s", name ? node_scalar(name) : code);
-    ht.hp = node_int(hp, 0);
-    ht.mp = node_int(mp, 0);
-    ht.min_dmg = node_int(min_dmg, 0);
-    ht.max_dmg = node_int(max_dmg, 0);
-    ht.armor_penetration = node_int(armor_pen, 0);
-    ht.accuracy = node_int(acc, 0);
-    ht.armor = node_int(armor, 0);
-    ht.skill_points = node_int(skill_points, 0);
-
-    ht.weapon_options = node_string_list(weapon, &ht.weapon_count);
-    ht.body_armor_options = node_string_list(body_armor, &ht.body_armor_count);
-    ht.head_armor_options = node_string_list(head_armor, &ht.head_armor_count);
-    ht.arms_armor_options = node_string_list(arms_armor, &ht.arms_armor_count);
-    ht.shield_options = node_string_list(shield, &ht.shield_count);
-
-    if (ht.weapon_count == 0) {
-      ht.weapon_options = (char **)malloc(sizeof(char *));
-      ht.weapon_options[0] = strdup_safe("without");
-      ht.weapon_count = 1;
-    }
-    if (ht.body_armor_count == 0) {
-      ht.body_armor_options = (char **)malloc(sizeof(char *));
-      ht.body_armor_options[0] = strdup_safe("without");
-      ht.body_armor_count = 1;
-    }
-    if (ht.head_armor_count == 0) {
-      ht.head_armor_options = (char **)malloc(sizeof(char *));
-      ht.head_armor_options[0] = strdup_safe("without");
-      ht.head_armor_count = 1;
-    }
-    if (ht.arms_armor_count == 0) {
-      ht.arms_armor_options = (char **)malloc(sizeof(char *));
-      ht.arms_armor_options[0] = strdup_safe("without");
-      ht.arms_armor_count = 1;
-    }
-    if (ht.shield_count == 0) {
-      ht.shield_options = (char **)malloc(sizeof(char *));
-      ht.shield_options[0] = strdup_safe("without");
-      ht.shield_count = 1;
-    }
-
-    HeroTemplate *arr = (HeroTemplate *)realloc(heroes, (count + 1) * sizeof(HeroTemplate));
-    if (!arr) continue;
-    heroes = arr;
-    heroes[count++] = ht;
-  }
+static const FieldSpec stats_swamp_fields[] = {
+    FIELD_SPEC_INT("leech", StatisticsTotal, swamp[0]),
+    FIELD_SPEC_INT("goblin", StatisticsTotal, swamp[1]),
+    FIELD_SPEC_INT("sworm", StatisticsTotal, swamp[2]),
+    FIELD_SPEC_INT("spider", StatisticsTotal, swamp[3]),
+    FIELD_SPEC_INT("orc", StatisticsTotal, swamp[4]),
+    FIELD_SPEC_INT("ancient_snail", StatisticsTotal, swamp[5]),
+    FIELD_SPEC_END,
+};
 
-  node_free(root);
-  *out = heroes;
-  *out_count = count;
-  return count > 0;
-}
+static const FieldSpec stats_pzdc_fields[] = {
+    FIELD_SPEC_INT("stage_1_mimic", StatisticsTotal, pzdc[0]),
+    FIELD_SPEC_INT("stage_2_thing", StatisticsTotal, pzdc[1]),
+    FIELD_SPEC_INT("stage_3_dog", StatisticsTotal, pzdc[2]),
+    FIELD_SPEC_END,
+};
 
-static bool load_enemies(const char *path, EnemyTemplate **out, size_t *out_count) {
-  Node *root = yaml_load_file(path);
-  if (!root || root->type != NODE_MAP) {
-    node_free(root);
-    return false;
-  }
+// Each dungeon section fills its own array of StatisticsTotal.
+static const FieldSpec statistics_total_fields[] = {
+    {"bandits", FIELD_MAP, 0, 0, stats_bandits_fields, NULL},
+    {"undeads", FIELD_MAP, 0, 0, stats_undeads_fields, NULL},
+    {"swamp", FIELD_MAP, 0, 0, stats_swamp_fields, NULL},
+    {"pzdc", FIELD_MAP, 0, 0, stats_pzdc_fields, NULL},
+    FIELD_SPEC_END,
+};
 
-  EnemyTemplate *enemies = NULL;
-  size_t count = 0;
+static bool load_statistics_total(StatisticsTotal *s) {
+  if (!s) return false;
+  char *saves_dir = resolve_saves_dir();
+  if (!saves_dir) return false;
+  char path[512];
+  snprintf(path, sizeof(path), "%s/statistics_total.yml", saves_dir);
+  free(saves_dir);
 
-  for (size_t i = 0; i < root->map.len; ++i) {
-    const char *code = root->map.keys[i];
-    Node *e = root->map.values[i];
-    if (!code || !e || e->type != NODE_MAP) continue;
-
-    EnemyTemplate et = {0};
-    snprintf(et.code, sizeof(et.code), "%s", code);
-    et.is_boss = (strcmp(code, "boss") == 0);
-
-    Node *code_name = node_map_get(e, "code_name");
-    Node *name = node_map_get(e, "name");
-    Node *hp = node_map_get(e, "hp");
-    Node *min_dmg = node_map_get(e, "min_dmg");
-    Node *max_dmg = node_map_get(e, "max_dmg");
-    Node *armor_pen = node_map_get(e, "armor_penetration");
-    Node *acc = node_map_get(e, "accurasy");
-    Node *armor = node_map_get(e, "armor");
-    Node *regen_hp = node_map_get(e, "regen_hp_base");
-    Node *exp_gived = node_map_get(e, "exp_gived");
-    Node *coins_gived = node_map_get(e, "coins_gived");
-    Node *weapon = node_map_get(e, "weapon");
-    Node *body_armor = node_map_get(e, "body_armor");
-    Node *head_armor = node_map_get(e, "head_armor");
-    Node *arms_armor = node_map_get(e, "arms_armor");
-    Node *shield = node_map_get(e, "shield");
-    Node *ingredients = node_map_get(e, "ingredients");
-
-    snprintf(et.code_name, sizeof(et.code_name), "%s", code_name ? node_scalar(code_name) : code);
-    snprintf(et.name, sizeof(et.name), "%s", name ? node_scalar(name) : et.code_name);
-    et.hp = node_int(hp, 0);
-    et.min_dmg = node_int(min_dmg, 0);
-    et.max_dmg = node_int(max_dmg, 0);
-    et.armor_penetration = node_int(armor_pen, 0);
-    et.accuracy = node_int(acc, 0);
-    et.armor = node_int(armor, 0);
-    et.regen_hp = node_int(regen_hp, 0);
-    et.exp_gived = node_int(exp_gived, 0);
-    et.coins_gived = node_int(coins_gived, 0);
-
-    et.weapon_options = node_string_list(weapon, &et.weapon_count);
-    et.body_armor_options = node_string_list(body_armor, &et.body_armor_count);
-    et.head_armor_options = node_string_list(head_armor, &et.head_armor_count);
-    et.arms_armor_options = node_string_list(arms_armor, &et.arms_armor_count);
-    et.shield_options = node_string_list(shield, &et.shield_count);
-    et.ingredient_options = node_string_list(ingredients, &et.ingredient_count);
-
-    if (et.weapon_count == 0) {
-      et.weapon_options = (char **)malloc(sizeof(char *));
-      et.weapon_options[0] = strdup_safe("without");
-      et.weapon_count = 1;
-    }
-    if (et.body_armor_count == 0) {
-      et.body_armor_options = (char **)malloc(sizeof(char *));
-      et.body_armor_options[0] = strdup_safe("without");
-      et.body_armor_count = 1;
-    }
-    if (et.head_armor_count == 0) {
-      et.head_armor_options = (char **)malloc(sizeof(char *));
-      et.head_armor_options[0] = strdup_safe("without");
-      et.head_armor_count = 1;
-    }
-    if (et.arms_armor_count == 0) {
-      et.arms_armor_options = (char **)malloc(sizeof(char *));
-      et.arms_armor_options[0] = strdup_safe("without");
-      et.arms_armor_count = 1;
-    }
-    if (et.shield_count == 0) {
-      et.shield_options = (char **)malloc(sizeof(char *));
-      et.shield_options[0] = strdup_safe("without");
-      et.shield_count = 1;
-    }
-    if (et.ingredient_count == 0) {
-      et.ingredient_options = (char **)malloc(sizeof(char *));
-      et.ingredient_options[0] = strdup_safe("without");
-      et.ingredient_count = 1;
-    }
-
-    EnemyTemplate *arr = (EnemyTemplate *)realloc(enemies, (count + 1) * sizeof(EnemyTemplate));
-    if (!arr) continue;
-    enemies = arr;
-    enemies[count++] = et;
+  if (!file_exists(path)) {
+    statistics_total_init_default(s);
+    FILE *f = fopen(path, "w");
+    if (f) {
+      fprintf(f, "bandits:\n");
+      fprintf(f, "  rabble: 0\n  rabid_dog: 0\n  poacher: 0\n  thug: 0\n  deserter: 0\n  bandit_leader: 0\n");
+      fprintf(f, "undeads:\n");
+      fprintf(f, "  zombie: 0\n  skeleton: 0\n  ghost: 0\n  fat_ghoul: 0\n  skeleton_soldier: 0\n  zombie_knight: 0\n");
+      fprintf(f, "swamp:\n");
+      fprintf(f, "  leech: 0\n  goblin: 0\n  sworm: 0\n  spider: 0\n  orc: 0\n  ancient_snail: 0\n");
+      fprintf(f, "pzdc:\n");
+      fprintf(f, "  stage_1_mimic: 0\n  stage_2_thing: 0\n  stage_3_dog: 0\n");
+      fclose(f);
+    }
+    return true;
   }
 
-  node_free(root);
-  *out = enemies;
-  *out_count = count;
-  return count > 0;
+  StatisticsTotal loaded;
+  statistics_total_init_default(&loaded);
+  if (!ys_load_record(path, statistics_total_fields, &loaded)) return false;
+  *s = loaded;
+  return true;
 }
 
-static bool load_weapons(const char *path, WeaponItem **out, size_t *out_count) {
-  Node *root = yaml_load_file(path);
-  if (!root || root->type != NODE_MAP) {
-    node_free(root);
-    return false;
-  }
-  WeaponItem *items = NULL;
-  size_t count = 0;
-  for (size_t i = 0; i < root->map.len; ++i) {
-    const char *code = root->map.keys[i];
-    Node *w = root->map.values[i];
-    if (!code || !w || w->type != NODE_MAP) continue;
-    WeaponItem it = {0};
-    snprintf(it.code, sizeof(it.code), "%s", code);
-    Node *name = node_map_get(w, "name");
-    Node *min_dmg = node_map_get(w, "min_dmg");
-    Node *max_dmg = node_map_get(w, "max_dmg");
-    Node *acc = node_map_get(w, "accuracy");
-    Node *block = node_map_get(w, "block_chance");
-    Node *armor_pen = node_map_get(w, "armor_penetration");
-    Node *price = node_map_get(w, "price");
-    snprintf(it.name, sizeof(it.name), "%s", name ? node_scalar(name) : code);
-    it.min_dmg = node_int(min_dmg, 0);
-    it.max_dmg = node_int(max_dmg, 0);
-    it.accuracy = node_int(acc, 0);
-    it.block_chance = node_int(block, 0);
-    it.armor_penetration = node_int(armor_pen, 0);
-    it.price = node_int(price, 0);
-    WeaponItem *arr = (WeaponItem *)realloc(items, (count + 1) * sizeof(WeaponItem));
-    if (!arr) continue;
-    items = arr;
-    items[count++] = it;
-  }
-  node_free(root);
-  *out = items;
-  *out_count = count;
-  return count > 0;
+static bool save_statistics_total(const StatisticsTotal *s) {
+  if (!s) return false;
+  char *saves_dir = resolve_saves_dir();
+  if (!saves_dir) return false;
+  char path[512];
+  snprintf(path, sizeof(path), "%s/statistics_total.yml", saves_dir);
+  free(saves_dir);
+  FILE *f = fopen(path, "w");
+  if (!f) return false;
+  fprintf(f, "bandits:\n");
+  fprintf(f, "  rabble: %d\n  rabid_dog: %d\n  poacher: %d\n  thug: %d\n  deserter: %d\n  bandit_leader: %d\n",
+          s->bandits[0], s->bandits[1], s->bandits[2], s->bandits[3], s->bandits[4], s->bandits[5]);
+  fprintf(f, "undeads:\n");
+  fprintf(f, "  zombie: %d\n  skeleton: %d\n  ghost: %d\n  fat_ghoul: %d\n  skeleton_soldier: %d\n  zombie_knight: %d\n",
+          s->undeads[0], s->undeads[1], s->undeads[2], s->undeads[3], s->undeads[4], s->undeads[5]);
+  fprintf(f, "swamp:\n");
+  fprintf(f, "  leech: %d\n  goblin: %d\n  sworm: %d\n  spider: %d\n  orc: %d\n  ancient_snail: %d\n",
+          s->swamp[0], s->swamp[1], s->swamp[2], s->swamp[3], s->swamp[4], s->swamp[5]);
+  fprintf(f, "pzdc:\n");
+  fprintf(f, "  stage_1_mimic: %d\n  stage_2_thing: %d\n  stage_3_dog: %d\n", s->pzdc[0], s->pzdc[1], s->pzdc[2]);
+  fclose(f);
+  return true;
 }
 
-static bool load_armors(const char *path, ArmorItem **out, size_t *out_count) {
-  Node *root = yaml_load_file(path);
-  if (!root || root->type != NODE_MAP) {
-    node_free(root);
-    return false;
-  }
-  ArmorItem *items = NULL;
-  size_t count = 0;
-  for (size_t i = 0; i < root->map.len; ++i) {
-    const char *code = root->map.keys[i];
-    Node *a = root->map.values[i];
-    if (!code || !a || a->type != NODE_MAP) continue;
-    ArmorItem it = {0};
-    snprintf(it.code, sizeof(it.code), "%s", code);
-    Node *name = node_map_get(a, "name");
-    Node *armor = node_map_get(a, "armor");
-    Node *acc = node_map_get(a, "accuracy");
-    Node *price = node_map_get(a, "price");
-    snprintf(it.name, sizeof(it.name), "%s", name ? node_scalar(name) : code);
-    it.armor = node_int(armor, 0);
-    it.accuracy = node_int(acc, 0);
-    it.price = node_int(price, 0);
-    ArmorItem *arr = (ArmorItem *)realloc(items, (count + 1) * sizeof(ArmorItem));
-    if (!arr) continue;
-    items = arr;
-    items[count++] = it;
+static int stats_total_get(const StatisticsTotal *s, const char *dungeon, const char *enemy_code) {
+  if (!s || !dungeon || !enemy_code) return 0;
+  const char *bandits[] = {"rabble","rabid_dog","poacher","thug","deserter","bandit_leader"};
+  const char *undeads[] = {"zombie","skeleton","ghost","fat_ghoul","skeleton_soldier","zombie_knight"};
+  const char *swamp[] = {"leech","goblin","sworm","spider","orc","ancient_snail"};
+  const char *pzdc[] = {"stage_1_mimic","stage_2_thing","stage_3_dog"};
+  if (strcmp(dungeon, "bandits") == 0) {
+    for (int i = 0; i < 6; ++i) if (strcmp(bandits[i], enemy_code) == 0) return s->bandits[i];
+  } else if (strcmp(dungeon, "undeads") == 0) {
+    for (int i = 0; i < 6; ++i) if (strcmp(undeads[i], enemy_code) == 0) return s->undeads[i];
+  } else if (strcmp(dungeon, "swamp") == 0) {
+    for (int i = 0; i < 6; ++i) if (strcmp(swamp[i], enemy_code) == 0) return s->swamp[i];
+  } else if (strcmp(dungeon, "pzdc") == 0) {
+    for (int i = 0; i < 3; ++i) if (strcmp(pzdc[i], enemy_code) == 0) return s->pzdc[i];
   }
-  node_free(root);
-  *out = items;
-  *out_count = count;
-  return count > 0;
+  return 0;
 }
 
-static bool load_shields(const char *path, ShieldItem **out, size_t *out_count) {
-  Node *root = yaml_load_file(path);
-  if (!root || root->type != NODE_MAP) {
-    node_free(root);
-    return false;
-  }
-  ShieldItem *items = NULL;
-  size_t count = 0;
-  for (size_t i = 0; i < root->map.len; ++i) {
-    const char *code = root->map.keys[i];
-    Node *s = root->map.values[i];
-    if (!code || !s || s->type != NODE_MAP) continue;
-    ShieldItem it = {0};
-    snprintf(it.code, sizeof(it.code), "%s", code);
-    Node *name = node_map_get(s, "name");
-    Node *armor = node_map_get(s, "armor");
-    Node *acc = node_map_get(s, "accuracy");
-    Node *block = node_map_get(s, "block_chance");
-    Node *min_dmg = node_map_get(s, "min_dmg");
-    Node *max_dmg = node_map_get(s, "max_dmg");
-    Node *price = node_map_get(s, "price");
-    snprintf(it.name, sizeof(it.name), "%s", name ? node_scalar(name) : code);
-    it.armor = node_int(armor, 0);
-    it.accuracy = node_int(acc, 0);
-    it.block_chance = node_int(block, 0);
-    it.min_dmg = node_int(min_dmg, 0);
-    it.max_dmg = node_int(max_dmg, 0);
-    it.price = node_int(price, 0);
-    ShieldItem *arr = (ShieldItem *)realloc(items, (count + 1) * sizeof(ShieldItem));
-    if (!arr) continue;
-    items = arr;
-    items[count++] = it;
+static void stats_total_increment(StatisticsTotal *s, const char *dungeon, const char *enemy_code) {
+  if (!s || !dungeon || !enemy_code) return;
+  const char *bandits[] = {"rabble","rabid_dog","poacher","thug","deserter","bandit_leader"};
+  const char *undeads[] = {"zombie","skeleton","ghost","fat_ghoul","skeleton_soldier","zombie_knight"};
+  const char *swamp[] = {"leech","goblin","sworm","spider","orc","ancient_snail"};
+  const char *pzdc[] = {"stage_1_mimic","stage_2_thing","stage_3_dog"};
+  if (strcmp(dungeon, "bandits") == 0) {
+    for (int i = 0; i < 6; ++i) if (strcmp(bandits[i], enemy_code) == 0) { s->bandits[i] += 1; return; }
+  } else if (strcmp(dungeon, "undeads") == 0) {
+    for (int i = 0; i < 6; ++i) if (strcmp(undeads[i], enemy_code) == 0) { s->undeads[i] += 1; return; }
+  } else if (strcmp(dungeon, "swamp") == 0) {
+    for (int i = 0; i < 6; ++i) if (strcmp(swamp[i], enemy_code) == 0) { s->swamp[i] += 1; return; }
+  } else if (strcmp(dungeon, "pzdc") == 0) {
+    for (int i = 0; i < 3; ++i) if (strcmp(pzdc[i], enemy_code) == 0) { s->pzdc[i] += 1; return; }
   }
-  node_free(root);
-  *out = items;
-  *out_count = count;
-  return count > 0;
 }
 
-static WeaponItem weapon_from_code(const Game *g, const char *code) {
-  WeaponItem empty = {0};
-  snprintf(empty.code, sizeof(empty.code), "%s", code ? code : "without");
-  snprintf(empty.name, sizeof(empty.name), "%s", code ? code : "---");
-  if (!g || !code) return empty;
-  for (size_t i = 0; i < g->weapon_count; ++i) {
-    if (strcmp(g->weapons[i].code, code) == 0) return g->weapons[i];
+static void occult_library_free(OccultLibraryData *ol) {
+  if (!ol) return;
+  for (size_t i = 0; i < ol->recipe_count; ++i) {
+    free(ol->recipes[i].ingredients);
   }
-  return empty;
+  free(ol->recipes);
+  ol->recipes = NULL;
+  ol->recipe_count = 0;
 }
 
-static ArmorItem armor_from_code(const ArmorItem *items, size_t count, const char *code) {
-  ArmorItem empty = {0};
-  snprintf(empty.code, sizeof(empty.code), "%s", code ? code : "without");
-  snprintf(empty.name, sizeof(empty.name), "%s", code ? code : "---");
-  if (!items || !code) return empty;
-  for (size_t i = 0; i < count; ++i) {
-    if (strcmp(items[i].code, code) == 0) return items[i];
+static const FieldSpec recipe_effect_fields[] = {
+    FIELD_SPEC_INT("accuracy", RecipeEffect, accuracy),
+    FIELD_SPEC_INT("min_dmg", RecipeEffect, min_dmg),
+    FIELD_SPEC_INT("max_dmg", RecipeEffect, max_dmg),
+    FIELD_SPEC_INT("block_chance", RecipeEffect, block_chance),
+    FIELD_SPEC_INT("armor", RecipeEffect, armor),
+    FIELD_SPEC_INT("armor_penetration", RecipeEffect, armor_penetration),
+    FIELD_SPEC_END,
+};
+
+static const FieldSpec recipe_effects_fields[] = {
+    FIELD_SPEC_MAP("weapon", OccultRecipe, weapon, recipe_effect_fields),
+    FIELD_SPEC_MAP("head_armor", OccultRecipe, head_armor, recipe_effect_fields),
+    FIELD_SPEC_MAP("body_armor", OccultRecipe, body_armor, recipe_effect_fields),
+    FIELD_SPEC_MAP("arms_armor", OccultRecipe, arms_armor, recipe_effect_fields),
+    FIELD_SPEC_MAP("shield", OccultRecipe, shield, recipe_effect_fields),
+    FIELD_SPEC_END,
+};
+
+// recipe: is a map of ingredient -> count, so its keys are data, not fields.
+static void occult_read_recipe(YamlStream *ys, void *record) {
+  OccultRecipe *rec = (OccultRecipe *)record;
+  if (ys->event.type != YAML_MAPPING_START_EVENT) {
+    ys_skip(ys);
+    return;
+  }
+  size_t cap = 0;
+  while (ys_next(ys) && ys->event.type != YAML_MAPPING_END_EVENT) {
+    char name[32];
+    const char *key = ys_scalar(ys);
+    snprintf(name, sizeof(name), "%s", key ? key : "");
+    if (!key && !ys_skip(ys)) return;
+    if (!ys_next(ys)) return;
+    const char *value = ys_scalar(ys);
+    if (!value && !ys_skip(ys)) return;
+    if (rec->ingredient_count == cap) {
+      size_t new_cap = cap ? cap * 2 : 4;
+      RecipeIngredient *arr = (RecipeIngredient *)realloc(rec->ingredients, new_cap * sizeof(RecipeIngredient));
+      if (!arr) continue;
+      rec->ingredients = arr;
+      cap = new_cap;
+    }
+    RecipeIngredient *ing = &rec->ingredients[rec->ingredient_count++];
+    memcpy(ing->name, name, sizeof(ing->name));
+    ing->count = value ? atoi(value) : 0;
   }
-  return empty;
 }
 
-static ShieldItem shield_from_code(const Game *g, const char *code) {
-  ShieldItem empty = {0};
-  snprintf(empty.code, sizeof(empty.code), "%s", code ? code : "without");
-  snprintf(empty.name, sizeof(empty.name), "%s", code ? code : "---");
-  if (!g || !code) return empty;
-  for (size_t i = 0; i < g->shield_count; ++i) {
-    if (strcmp(g->shields[i].code, code) == 0) return g->shields[i];
-  }
-  return empty;
+static const FieldSpec occult_recipe_fields[] = {
+    FIELD_SPEC_INT("view_code", OccultRecipe, view_code),
+    FIELD_SPEC_STR("name", OccultRecipe, name),
+    FIELD_SPEC_INT("price", OccultRecipe, price),
+    FIELD_SPEC_CUSTOM("recipe", occult_read_recipe),
+    {"effect", FIELD_MAP, 0, 0, recipe_effects_fields, NULL}, // slots are fields of the recipe itself
+    FIELD_SPEC_END,
+};
+
+static void occult_recipe_finish(void *record, const char *code) {
+  OccultRecipe *rec = (OccultRecipe *)record;
+  snprintf(rec->code, sizeof(rec->code), "%s", code);
+  if (!rec->name[0]) snprintf(rec->name, sizeof(rec->name), "%s", code);
 }
 
-static const char *pick_random_option(char **list, size_t count) {
-  if (!list || count == 0) return "without";
-  size_t idx = (size_t)rand_range(0, (int)count - 1);
-  return list[idx] ? list[idx] : "without";
+static OccultRecipe *occult_recipe_by_view_code(OccultLibraryData *ol, int view_code) {
+  if (!ol || view_code <= 0) return NULL;
+  for (size_t i = 0; i < ol->recipe_count; ++i) {
+    if (ol->recipes[i].view_code == view_code) return &ol->recipes[i];
+  }
+  return NULL;
 }
 
-static void shop_init_default(ShopData *shop) {
-  if (!shop) return;
-  for (int i = 0; i < 3; ++i) {
-    snprintf(shop->weapon[i], sizeof(shop->weapon[i]), "without");
-    snprintf(shop->body_armor[i], sizeof(shop->body_armor[i]), "without");
-    snprintf(shop->head_armor[i], sizeof(shop->head_armor[i]), "without");
-    snprintf(shop->arms_armor[i], sizeof(shop->arms_armor[i]), "without");
-    snprintf(shop->shield[i], sizeof(shop->shield[i]), "without");
+static OccultRecipe *occult_recipe_by_code(OccultLibraryData *ol, const char *code) {
+  if (!ol || !code) return NULL;
+  for (size_t i = 0; i < ol->recipe_count; ++i) {
+    if (strcmp(ol->recipes[i].code, code) == 0) return &ol->recipes[i];
   }
+  return NULL;
 }
 
-static void warehouse_init_default(WarehouseData *wh) {
-  if (!wh) return;
-  wh->coins = 0;
-  snprintf(wh->weapon, sizeof(wh->weapon), "without");
-  snprintf(wh->body_armor, sizeof(wh->body_armor), "without");
-  snprintf(wh->head_armor, sizeof(wh->head_armor), "without");
-  snprintf(wh->arms_armor, sizeof(wh->arms_armor), "without");
-  snprintf(wh->shield, sizeof(wh->shield), "without");
+// Recipes from data/ only, none purchased; --render and --bench-compose stop here
+// so they never read or write saves/.
+static bool load_occult_recipes(OccultLibraryData *ol) {
+  if (!ol) return false;
+  occult_library_free(ol);
+  char *data_path = resolve_data_path("data/camp/occult_library.yml");
+  if (!data_path) return false;
+  void *recipes = NULL;
+  size_t count = ys_load_records(data_path, occult_recipe_fields, sizeof(OccultRecipe), occult_recipe_finish, &recipes);
+  free(data_path);
+  if (count == 0) return false;
+  ol->recipes = (OccultRecipe *)recipes;
+  ol->recipe_count = count;
+  return true;
 }
 
-static bool load_shop_data(ShopData *shop) {
-  if (!shop) return false;
+static bool load_occult_library_data(OccultLibraryData *ol) {
+  if (!load_occult_recipes(ol)) return false;
+
   char *saves_dir = resolve_saves_dir();
-  if (!saves_dir) return false;
+  if (!saves_dir) return true;
   char path[512];
-  snprintf(path, sizeof(path), "%s/shop.yml", saves_dir);
+  snprintf(path, sizeof(path), "%s/occult_library.yml", saves_dir);
   free(saves_dir);
-
   if (!file_exists(path)) {
-    shop_init_default(shop);
     FILE *f = fopen(path, "w");
     if (f) {
-      fprintf(f, "ammunition:\n");
-      fprintf(f, "  weapon: [without, without, without]\n");
-      fprintf(f, "  body_armor: [without, without, without]\n");
-      fprintf(f, "  head_armor: [without, without, without]\n");
-      fprintf(f, "  arms_armor: [without, without, without]\n");
-      fprintf(f, "  shield: [without, without, without]\n");
+      for (size_t i = 0; i < ol->recipe_count; ++i) {
+        fprintf(f, "%s: false\n", ol->recipes[i].code);
+      }
       fclose(f);
     }
     return true;
   }
-
-  Node *root = yaml_load_file(path);
-  if (!root || root->type != NODE_MAP) {
-    node_free(root);
-    return false;
-  }
-  Node *ammo = node_map_get(root, "ammunition");
-  shop_init_default(shop);
-  if (ammo && ammo->type == NODE_MAP) {
-    const char *types[] = {"weapon", "body_armor", "head_armor", "arms_armor", "shield"};
-    for (int t = 0; t < 5; ++t) {
-      Node *seq = node_map_get(ammo, types[t]);
-      if (!seq || seq->type != NODE_SEQ) continue;
-      for (int i = 0; i < 3 && i < (int)seq->seq_len; ++i) {
-        const char *code = node_scalar(seq->seq[i]);
-        if (!code) code = "without";
-        if (t == 0) snprintf(shop->weapon[i], sizeof(shop->weapon[i]), "%s", code);
-        else if (t == 1) snprintf(shop->body_armor[i], sizeof(shop->body_armor[i]), "%s", code);
-        else if (t == 2) snprintf(shop->head_armor[i], sizeof(shop->head_armor[i]), "%s", code);
-        else if (t == 3) snprintf(shop->arms_armor[i], sizeof(shop->arms_armor[i]), "%s", code);
-        else if (t == 4) snprintf(shop->shield[i], sizeof(shop->shield[i]), "%s", code);
-      }
-    }
-  }
-  node_free(root);
+  // The save is a map of recipe code -> purchased; codes are data, so it is read
+  // pair by pair rather than through a field table.
+  YamlStream ys;
+  FILE *f = ys_open(&ys, path);
+  if (!f) return true;
+  while (ys_next(&ys) && ys.event.type != YAML_MAPPING_END_EVENT) {
+    OccultRecipe *r = occult_recipe_by_code(ol, ys_scalar(&ys));
+    if (!ys_scalar(&ys) && !ys_skip(&ys)) break;
+    if (!ys_next(&ys)) break;
+    const char *val = ys_scalar(&ys);
+    if (r && val) r->purchased = (strcmp(val, "true") == 0 || strcmp(val, "1") == 0);
+    if (!val && !ys_skip(&ys)) break;
+  }
+  ys_close(&ys, f);
   return true;
 }
 
-static bool save_shop_data(const ShopData *shop) {
-  if (!shop) return false;
+static bool save_occult_library_data(const OccultLibraryData *ol) {
+  if (!ol) return false;
   char *saves_dir = resolve_saves_dir();
   if (!saves_dir) return false;
   char path[512];
-  snprintf(path, sizeof(path), "%s/shop.yml", saves_dir);
+  snprintf(path, sizeof(path), "%s/occult_library.yml", saves_dir);
   free(saves_dir);
   FILE *f = fopen(path, "w");
   if (!f) return false;
-  fprintf(f, "ammunition:\n");
-  fprintf(f, "  weapon: [%s, %s, %s]\n", shop->weapon[0], shop->weapon[1], shop->weapon[2]);
-  fprintf(f, "  body_armor: [%s, %s, %s]\n", shop->body_armor[0], shop->body_armor[1], shop->body_armor[2]);
-  fprintf(f, "  head_armor: [%s, %s, %s]\n", shop->head_armor[0], shop->head_armor[1], shop->head_armor[2]);
-  fprintf(f, "  arms_armor: [%s, %s, %s]\n", shop->arms_armor[0], shop->arms_armor[1], shop->arms_armor[2]);
-  fprintf(f, "  shield: [%s, %s, %s]\n", shop->shield[0], shop->shield[1], shop->shield[2]);
+  for (size_t i = 0; i < ol->recipe_count; ++i) {
+    fprintf(f, "%s: %s\n", ol->recipes[i].code, ol->recipes[i].purchased ? "true" : "false");
+  }
   fclose(f);
   return true;
 }
 
-static bool load_warehouse_data(WarehouseData *wh) {
-  if (!wh) return false;
-  char *saves_dir = resolve_saves_dir();
-  if (!saves_dir) return false;
-  char path[512];
-  snprintf(path, sizeof(path), "%s/warehouse.yml", saves_dir);
-  free(saves_dir);
+static void titleize_token(const char *in, char *out, size_t out_sz) {
+  if (!out || out_sz == 0) return;
+  if (!in) { snprintf(out, out_sz, "---"); return; }
+  size_t n = strlen(in);
+  if (n + 1 > out_sz) n = out_sz - 1;
+  for (size_t i = 0; i < n; ++i) {
+    char ch = in[i];
+    if (ch == '_') ch = ' ';
+    out[i] = (i == 0) ? (char)toupper((unsigned char)ch) : ch;
+  }
+  out[n] = '\0';
+}
 
-  if (!file_exists(path)) {
-    warehouse_init_default(wh);
-    FILE *f = fopen(path, "w");
-    if (f) {
-      fprintf(f, "coins: 0\n");
-      fprintf(f, "weapon: without\n");
-      fprintf(f, "body_armor: without\n");
-      fprintf(f, "head_armor: without\n");
-      fprintf(f, "arms_armor: without\n");
-      fprintf(f, "shield: without\n");
-      fclose(f);
-    }
-    return true;
+static void append_kv(char *out, size_t out_sz, const char *name, int val, bool *first) {
+  if (!out || out_sz == 0 || !name) return;
+  char buf[128];
+  snprintf(buf, sizeof(buf), "%s: %d", name, val);
+  if (*first) {
+    snprintf(out, out_sz, "%s", buf);
+    *first = false;
+  } else {
+    size_t len = strlen(out);
+    snprintf(out + len, out_sz - len, ";   %s", buf);
+  }
+}
+
+static void format_recipe_ingredients(const OccultRecipe *r, char *out, size_t out_sz) {
+  if (!out || out_sz == 0) return;
+  out[0] = '\0';
+  if (!r || r->ingredient_count == 0) return;
+  bool first = true;
+  for (size_t i = 0; i < r->ingredient_count; ++i) {
+    char name_buf[64];
+    titleize_token(r->ingredients[i].name, name_buf, sizeof(name_buf));
+    append_kv(out, out_sz, name_buf, r->ingredients[i].count, &first);
+  }
+}
+
+static void format_effect(const RecipeEffect *e, char *out, size_t out_sz) {
+  if (!out || out_sz == 0) return;
+  out[0] = '\0';
+  if (!e) return;
+  bool first = true;
+  if (e->accuracy) append_kv(out, out_sz, "Accuracy", e->accuracy, &first);
+  if (e->min_dmg) append_kv(out, out_sz, "Min dmg", e->min_dmg, &first);
+  if (e->max_dmg) append_kv(out, out_sz, "Max dmg", e->max_dmg, &first);
+  if (e->block_chance) append_kv(out, out_sz, "Block chance", e->block_chance, &first);
+  if (e->armor) append_kv(out, out_sz, "Armor", e->armor, &first);
+  if (e->armor_penetration) append_kv(out, out_sz, "Armor penetration", e->armor_penetration, &first);
+}
+
+static bool recipe_hero_has_ingredients(const OccultRecipe *r, const Character *hero) {
+  if (!r || !hero) return false;
+  for (size_t i = 0; i < r->ingredient_count; ++i) {
+    int have = value_map_get_int(&hero->ingredients, r->ingredients[i].name, 0);
+    if (have < r->ingredients[i].count) return false;
+  }
+  return true;
+}
+
+static void recipe_consume_ingredients(const OccultRecipe *r, Character *hero) {
+  if (!r || !hero) return;
+  for (size_t i = 0; i < r->ingredient_count; ++i) {
+    int have = value_map_get_int(&hero->ingredients, r->ingredients[i].name, 0);
+    int left = have - r->ingredients[i].count;
+    if (left < 0) left = 0;
+    value_map_set_int(&hero->ingredients, r->ingredients[i].name, left);
+  }
+}
+
+static void recipe_apply_weapon(const OccultRecipe *r, WeaponItem *w) {
+  if (!r || !w || strcmp(w->code, "without") == 0) return;
+  w->enhanced = true;
+  snprintf(w->enhance_name, sizeof(w->enhance_name), "%s", r->code);
+  w->enhance_accuracy += r->weapon.accuracy;
+  w->enhance_min_dmg += r->weapon.min_dmg;
+  w->enhance_max_dmg += r->weapon.max_dmg;
+  w->enhance_block_chance += r->weapon.block_chance;
+  w->enhance_armor_penetration += r->weapon.armor_penetration;
+}
+
+static void recipe_apply_armor(const OccultRecipe *r, ArmorItem *a, const RecipeEffect *e) {
+  if (!r || !a || !e || strcmp(a->code, "without") == 0) return;
+  a->enhanced = true;
+  snprintf(a->enhance_name, sizeof(a->enhance_name), "%s", r->code);
+  a->enhance_accuracy += e->accuracy;
+  a->enhance_armor += e->armor;
+}
+
+static void recipe_apply_shield(const OccultRecipe *r, ShieldItem *s) {
+  if (!r || !s || strcmp(s->code, "without") == 0) return;
+  s->enhanced = true;
+  snprintf(s->enhance_name, sizeof(s->enhance_name), "%s", r->code);
+  s->enhance_accuracy += r->shield.accuracy;
+  s->enhance_armor += r->shield.armor;
+  s->enhance_block_chance += r->shield.block_chance;
+  s->enhance_min_dmg += r->shield.min_dmg;
+  s->enhance_max_dmg += r->shield.max_dmg;
+}
+
+static int compare_recipe_code(const void *a, const void *b, void *ctx) {
+  const OccultLibraryData *ol = (const OccultLibraryData *)ctx;
+  size_t ia = *(const size_t *)a;
+  size_t ib = *(const size_t *)b;
+  if (!ol) return 0;
+  return strcmp(ol->recipes[ia].code, ol->recipes[ib].code);
+}
+
+static size_t *occult_accessible_indices(const OccultLibraryData *ol, size_t *out_count) {
+  if (out_count) *out_count = 0;
+  if (!ol) return NULL;
+  size_t *indices = (size_t *)calloc(ol->recipe_count, sizeof(size_t));
+  if (!indices) return NULL;
+  size_t count = 0;
+  for (size_t i = 0; i < ol->recipe_count; ++i) {
+    if (ol->recipes[i].purchased) indices[count++] = i;
   }
-
-  Node *root = yaml_load_file(path);
-  if (!root || root->type != NODE_MAP) {
-    node_free(root);
-    return false;
+  if (count > 1) {
+    qsort_r(indices, count, sizeof(size_t), compare_recipe_code, (void *)ol);
   }
-  warehouse_init_default(wh);
-  wh->coins = node_map_int(root, "coins", 0);
-  snprintf(wh->weapon, sizeof(wh->weapon), "%s", node_map_str(root, "weapon", "without"));
-  snprintf(wh->body_armor, sizeof(wh->body_armor), "%s", node_map_str(root, "body_armor", "without"));
-  snprintf(wh->head_armor, sizeof(wh->head_armor), "%s", node_map_str(root, "head_armor", "without"));
-  snprintf(wh->arms_armor, sizeof(wh->arms_armor), "%s", node_map_str(root, "arms_armor", "without"));
-  snprintf(wh->shield, sizeof(wh->shield), "%s", node_map_str(root, "shield", "without"));
-  node_free(root);
-  return true;
+  if (out_count) *out_count = count;
+  return indices;
 }
 
-static bool save_warehouse_data(const WarehouseData *wh) {
-  if (!wh) return false;
+static bool save_hero_in_run(const Game *g) {
+  if (!g) return false;
   char *saves_dir = resolve_saves_dir();
   if (!saves_dir) return false;
   char path[512];
-  snprintf(path, sizeof(path), "%s/warehouse.yml", saves_dir);
+  snprintf(path, sizeof(path), "%s/hero_in_run.yml", saves_dir);
   free(saves_dir);
+
   FILE *f = fopen(path, "w");
   if (!f) return false;
-  fprintf(f, "coins: %d\n", wh->coins);
-  fprintf(f, "weapon: %s\n", wh->weapon);
-  fprintf(f, "body_armor: %s\n", wh->body_armor);
-  fprintf(f, "head_armor: %s\n", wh->head_armor);
-  fprintf(f, "arms_armor: %s\n", wh->arms_armor);
-  fprintf(f, "shield: %s\n", wh->shield);
-  fclose(f);
-  return true;
-}
 
-static const char *shop_items_for_fill(const char *type, int idx) {
-  static const char *weapon_items[] = {"stick", "knife", "club"};
-  static const char *body_items[] = {"leather_jacket", "rusty_gambeson"};
-  static const char *head_items[] = {"rusty_quilted_helmet", "leather_helmet"};
-  static const char *arms_items[] = {"worn_gloves", "leather_gloves"};
-  static const char *shield_items[] = {"holey_wicker_buckler", "braided_buckler", "wooden_buckler"};
-  (void)idx;
-  if (strcmp(type, "weapon") == 0) return weapon_items[rand_range(0, 2)];
-  if (strcmp(type, "body_armor") == 0) return body_items[rand_range(0, 1)];
-  if (strcmp(type, "head_armor") == 0) return head_items[rand_range(0, 1)];
-  if (strcmp(type, "arms_armor") == 0) return arms_items[rand_range(0, 1)];
-  if (strcmp(type, "shield") == 0) return shield_items[rand_range(0, 2)];
-  return "without";
-}
+  const Character *h = &g->hero;
+  fprintf(f, "hero_create:\n");
+  fprintf(f, "  name: ");
+  yaml_write_escaped(f, h->name);
+  fprintf(f, "\n");
+  fprintf(f, "  background: %s\n", h->background[0] ? h->background : h->code);
 
-static void shop_fill(ShopData *shop) {
-  if (!shop) return;
-  const char *types[] = {"weapon", "body_armor", "head_armor", "arms_armor", "shield"};
-  for (int t = 0; t < 5; ++t) {
-    char (*arr)[32] = NULL;
-    if (t == 0) arr = shop->weapon;
-    else if (t == 1) arr = shop->body_armor;
-    else if (t == 2) arr = shop->head_armor;
-    else if (t == 3) arr = shop->arms_armor;
-    else arr = shop->shield;
-    int without_count = 0;
-    for (int i = 0; i < 3; ++i) if (strcmp(arr[i], "without") == 0) without_count++;
-    int n = without_count == 3 ? 2 : without_count == 2 ? 1 : 0;
-    for (int k = 0; k < n; ++k) {
-      int idx = -1;
-      for (int i = 0; i < 3; ++i) {
-        if (strcmp(arr[i], "without") == 0) { idx = i; break; }
-      }
-      if (idx >= 0) snprintf(arr[idx], sizeof(arr[idx]), "%s", shop_items_for_fill(types[t], idx));
-    }
-  }
-}
+  fprintf(f, "hero_stats:\n");
+  fprintf(f, "  hp: %d\n", h->hp);
+  fprintf(f, "  hp_max: %d\n", h->hp_max);
+  fprintf(f, "  regen_hp_base: %d\n", h->regen_hp_base);
+  fprintf(f, "  mp: %d\n", h->mp);
+  fprintf(f, "  mp_max: %d\n", h->mp_max);
+  fprintf(f, "  regen_mp_base: %d\n", h->regen_mp_base);
+  fprintf(f, "  min_dmg_base: %d\n", h->min_dmg_base);
+  fprintf(f, "  max_dmg_base: %d\n", h->max_dmg_base);
+  fprintf(f, "  accuracy_base: %d\n", h->accuracy_base);
+  fprintf(f, "  armor_base: %d\n", h->armor_base);
+  fprintf(f, "  block_chance_base: %d\n", h->block_chance_base);
+  fprintf(f, "  armor_penetration_base: %d\n", h->armor_penetration_base);
+  fprintf(f, "  exp: %d\n", h->exp);
+  fprintf(f, "  lvl: %d\n", h->lvl);
+  fprintf(f, "  stat_points: %d\n", h->stat_points);
+  fprintf(f, "  skill_points: %d\n", h->skill_points);
 
-static void monolith_init_default(MonolithData *m) {
-  if (!m) return;
-  memset(m, 0, sizeof(*m));
-}
+  fprintf(f, "hero_skills:\n");
+  fprintf(f, "  active_skill:\n");
+  fprintf(f, "    code: %s\n", h->active_skill.code);
+  fprintf(f, "    lvl: %d\n", h->active_skill.lvl);
+  fprintf(f, "  passive_skill:\n");
+  fprintf(f, "    code: %s\n", h->passive_skill.code);
+  fprintf(f, "    lvl: %d\n", h->passive_skill.lvl);
+  fprintf(f, "  camp_skill:\n");
+  fprintf(f, "    code: %s\n", h->camp_skill.code);
+  fprintf(f, "    lvl: %d\n", h->camp_skill.lvl);
 
-static bool load_monolith_data(MonolithData *m) {
-  if (!m) return false;
-  char *saves_dir = resolve_saves_dir();
-  if (!saves_dir) return false;
-  char path[512];
-  snprintf(path, sizeof(path), "%s/pzdc_monolith.yml", saves_dir);
-  free(saves_dir);
+  fprintf(f, "hero_ammunition:\n");
+  fprintf(f, "  weapon:\n");
+  fprintf(f, "    code: %s\n", h->weapon.code);
+  fprintf(f, "    enhance_code: ");
+  yaml_write_escaped(f, h->weapon.enhanced ? h->weapon.enhance_name : "");
+  fprintf(f, "\n");
+  fprintf(f, "  body_armor:\n");
+  fprintf(f, "    code: %s\n", h->body_armor.code);
+  fprintf(f, "    enhance_code: ");
+  yaml_write_escaped(f, h->body_armor.enhanced ? h->body_armor.enhance_name : "");
+  fprintf(f, "\n");
+  fprintf(f, "  head_armor:\n");
+  fprintf(f, "    code: %s\n", h->head_armor.code);
+  fprintf(f, "    enhance_code: ");
+  yaml_write_escaped(f, h->head_armor.enhanced ? h->head_armor.enhance_name : "");
+  fprintf(f, "\n");
+  fprintf(f, "  arms_armor:\n");
+  fprintf(f, "    code: %s\n", h->arms_armor.code);
+  fprintf(f, "    enhance_code: ");
+  yaml_write_escaped(f, h->arms_armor.enhanced ? h->arms_armor.enhance_name : "");
+  fprintf(f, "\n");
+  fprintf(f, "  shield:\n");
+  fprintf(f, "    code: %s\n", h->shield.code);
+  fprintf(f, "    enhance_code: ");
+  yaml_write_escaped(f, h->shield.enhanced ? h->shield.enhance_name : "");
+  fprintf(f, "\n");
 
-  if (!file_exists(path)) {
-    monolith_init_default(m);
-    FILE *f = fopen(path, "w");
-    if (f) {
-      fprintf(f, "points: 0\n");
-      fprintf(f, "hp: 0\n");
-      fprintf(f, "mp: 0\n");
-      fprintf(f, "accuracy: 0\n");
-      fprintf(f, "damage: 0\n");
-      fprintf(f, "stat_points: 0\n");
-      fprintf(f, "skill_points: 0\n");
-      fprintf(f, "armor: 0\n");
-      fprintf(f, "regen_hp: 0\n");
-      fprintf(f, "regen_mp: 0\n");
-      fprintf(f, "armor_penetration: 0\n");
-      fprintf(f, "block_chance: 0\n");
-      fclose(f);
+  fprintf(f, "dungeon_name: %s\n", h->dungeon_name[0] ? h->dungeon_name : g->dungeons[g->dungeon_index].name);
+  fprintf(f, "dungeon_part_number: %d\n", h->dungeon_part_number);
+  fprintf(f, "leveling: %d\n", h->leveling);
+
+  fprintf(f, "camp_loot:\n");
+  fprintf(f, "  pzdc_monolith_points: %d\n", h->pzdc_monolith_points);
+  fprintf(f, "  coins: %d\n", h->coins);
+
+  fprintf(f, "ingredients:\n");
+  if (h->ingredients.count == 0) {
+    fprintf(f, "  {}\n");
+  } else {
+    for (size_t i = 0; i < h->ingredients.count; ++i) {
+      char num[16];
+      fprintf(f, "  %s: %s\n", h->ingredients.items[i].key, value_map_value_at(&h->ingredients, i, num, sizeof(num)));
     }
-    return true;
+  }
+  if (g->wg_taken) {
+    fprintf(f, "events_data:\n");
+    fprintf(f, "  wariors_grave:\n");
+    fprintf(f, "    taken: 1\n");
+    fprintf(f, "    enemy: %s\n", g->wg_enemy[0] ? g->wg_enemy : "poacher");
+    fprintf(f, "    count: %d\n", g->wg_count);
+    fprintf(f, "    level: %d\n", g->wg_level);
+  } else {
+    fprintf(f, "events_data: {}\n");
   }
 
-  Node *root = yaml_load_file(path);
-  if (!root || root->type != NODE_MAP) {
-    node_free(root);
-    return false;
+  // Seed, draws and state words of each stream, so a bug report can be replayed exactly.
+  fprintf(f, "rng:\n");
+  fprintf(f, "  seed: %llu\n", (unsigned long long)g->seed);
+  for (int i = 0; i < RNG_STREAMS; ++i) {
+    const Rng *r = &g->rng[i];
+    fprintf(f, "  %s:\n", rng_stream_names[i]);
+    fprintf(f, "    draws: %llu\n", (unsigned long long)r->draws);
+    fprintf(f, "    state: [0x%016llx, 0x%016llx, 0x%016llx, 0x%016llx]\n", (unsigned long long)r->s[0],
+            (unsigned long long)r->s[1], (unsigned long long)r->s[2], (unsigned long long)r->s[3]);
   }
-  monolith_init_default(m);
-  m->points = node_map_int(root, "points", 0);
-  m->hp = node_map_int(root, "hp", 0);
-  m->mp = node_map_int(root, "mp", 0);
-  m->accuracy = node_map_int(root, "accuracy", 0);
-  m->damage = node_map_int(root, "damage", 0);
-  m->stat_points = node_map_int(root, "stat_points", 0);
-  m->skill_points = node_map_int(root, "skill_points", 0);
-  m->armor = node_map_int(root, "armor", 0);
-  m->regen_hp = node_map_int(root, "regen_hp", 0);
-  m->regen_mp = node_map_int(root, "regen_mp", 0);
-  m->armor_penetration = node_map_int(root, "armor_penetration", 0);
-  m->block_chance = node_map_int(root, "block_chance", 0);
-  node_free(root);
-  return true;
-}
 
-static bool save_monolith_data(const MonolithData *m) {
-  if (!m) return false;
-  char *saves_dir = resolve_saves_dir();
-  if (!saves_dir) return false;
-  char path[512];
-  snprintf(path, sizeof(path), "%s/pzdc_monolith.yml", saves_dir);
-  free(saves_dir);
-  FILE *f = fopen(path, "w");
-  if (!f) return false;
-  fprintf(f, "points: %d\n", m->points);
-  fprintf(f, "hp: %d\n", m->hp);
-  fprintf(f, "mp: %d\n", m->mp);
-  fprintf(f, "accuracy: %d\n", m->accuracy);
-  fprintf(f, "damage: %d\n", m->damage);
-  fprintf(f, "stat_points: %d\n", m->stat_points);
-  fprintf(f, "skill_points: %d\n", m->skill_points);
-  fprintf(f, "armor: %d\n", m->armor);
-  fprintf(f, "regen_hp: %d\n", m->regen_hp);
-  fprintf(f, "regen_mp: %d\n", m->regen_mp);
-  fprintf(f, "armor_penetration: %d\n", m->armor_penetration);
-  fprintf(f, "block_chance: %d\n", m->block_chance);
   fclose(f);
   return true;
 }
 
-static int monolith_get_stat(const MonolithData *m, const char *key) {
-  if (!m || !key) return 0;
-  if (strcmp(key, "hp") == 0) return m->hp;
-  if (strcmp(key, "mp") == 0) return m->mp;
-  if (strcmp(key, "accuracy") == 0) return m->accuracy;
-  if (strcmp(key, "damage") == 0) return m->damage;
-  if (strcmp(key, "stat_points") == 0) return m->stat_points;
-  if (strcmp(key, "skill_points") == 0) return m->skill_points;
-  if (strcmp(key, "armor") == 0) return m->armor;
-  if (strcmp(key, "regen_hp") == 0) return m->regen_hp;
-  if (strcmp(key, "regen_mp") == 0) return m->regen_mp;
-  if (strcmp(key, "armor_penetration") == 0) return m->armor_penetration;
-  if (strcmp(key, "block_chance") == 0) return m->block_chance;
-  return 0;
-}
+typedef struct {
+  char code[32];
+  int lvl;
+} SkillSave;
+
+typedef struct {
+  char code[32];
+  char enhance_code[64];
+} AmmoSave;
+
+typedef struct {
+  char draws[32];
+  char **state;
+  size_t state_count;
+} RngStreamSave;
+
+// hero_in_run.yml as read. hero_stats lands in a scratch Character whose fields
+// start at INT_MIN, so a stat the file leaves out keeps the template value.
+typedef struct {
+  char name[64];
+  char background[32];
+  Character hero_stats;
+  SkillSave active_skill;
+  SkillSave passive_skill;
+  SkillSave camp_skill;
+  AmmoSave weapon;
+  AmmoSave body_armor;
+  AmmoSave head_armor;
+  AmmoSave arms_armor;
+  AmmoSave shield;
+  char dungeon_name[16];
+  int dungeon_part_number;
+  int leveling;
+  int pzdc_monolith_points;
+  int coins;
+  ValueMap ingredients;
+  int wg_taken;
+  char wg_enemy[32];
+  int wg_count;
+  int wg_level;
+  bool has_rng;
+  char seed[32];
+  RngStreamSave streams[RNG_STREAMS];
+} HeroSave;
+
+static const FieldSpec hero_create_fields[] = {
+    FIELD_SPEC_STR("name", HeroSave, name),
+    FIELD_SPEC_STR("background", HeroSave, background),
+    FIELD_SPEC_END,
+};
+
+static const FieldSpec hero_stats_fields[] = {
+    FIELD_SPEC_INT("hp", Character, hp),
+    FIELD_SPEC_INT("hp_max", Character, hp_max),
+    FIELD_SPEC_INT("regen_hp_base", Character, regen_hp_base),
+    FIELD_SPEC_INT("mp", Character, mp),
+    FIELD_SPEC_INT("mp_max", Character, mp_max),
+    FIELD_SPEC_INT("regen_mp_base", Character, regen_mp_base),
+    FIELD_SPEC_INT("min_dmg_base", Character, min_dmg_base),
+    FIELD_SPEC_INT("max_dmg_base", Character, max_dmg_base),
+    FIELD_SPEC_INT("accuracy_base", Character, accuracy_base),
+    FIELD_SPEC_INT("armor_base", Character, armor_base),
+    FIELD_SPEC_INT("block_chance_base", Character, block_chance_base),
+    FIELD_SPEC_INT("armor_penetration_base", Character, armor_penetration_base),
+    FIELD_SPEC_INT("exp", Character, exp),
+    FIELD_SPEC_INT("lvl", Character, lvl),
+    FIELD_SPEC_INT("stat_points", Character, stat_points),
+    FIELD_SPEC_INT("skill_points", Character, skill_points),
+    FIELD_SPEC_END,
+};
+
+static const FieldSpec skill_save_fields[] = {
+    FIELD_SPEC_STR("code", SkillSave, code),
+    FIELD_SPEC_INT("lvl", SkillSave, lvl),
+    FIELD_SPEC_END,
+};
+
+static const FieldSpec hero_skills_fields[] = {
+    FIELD_SPEC_MAP("active_skill", HeroSave, active_skill, skill_save_fields),
+    FIELD_SPEC_MAP("passive_skill", HeroSave, passive_skill, skill_save_fields),
+    FIELD_SPEC_MAP("camp_skill", HeroSave, camp_skill, skill_save_fields),
+    FIELD_SPEC_END,
+};
+
+static const FieldSpec ammo_save_fields[] = {
+    FIELD_SPEC_STR("code", AmmoSave, code),
+    FIELD_SPEC_STR("enhance_code", AmmoSave, enhance_code),
+    FIELD_SPEC_END,
+};
+
+static const FieldSpec hero_ammunition_fields[] = {
+    FIELD_SPEC_MAP("weapon", HeroSave, weapon, ammo_save_fields),
+    FIELD_SPEC_MAP("body_armor", HeroSave, body_armor, ammo_save_fields),
+    FIELD_SPEC_MAP("head_armor", HeroSave, head_armor, ammo_save_fields),
+    FIELD_SPEC_MAP("arms_armor", HeroSave, arms_armor, ammo_save_fields),
+    FIELD_SPEC_MAP("shield", HeroSave, shield, ammo_save_fields),
+    FIELD_SPEC_END,
+};
+
+static const FieldSpec camp_loot_fields[] = {
+    FIELD_SPEC_INT("pzdc_monolith_points", HeroSave, pzdc_monolith_points),
+    FIELD_SPEC_INT("coins", HeroSave, coins),
+    FIELD_SPEC_END,
+};
+
+static const FieldSpec wariors_grave_fields[] = {
+    FIELD_SPEC_INT("taken", HeroSave, wg_taken),
+    FIELD_SPEC_STR("enemy", HeroSave, wg_enemy),
+    FIELD_SPEC_INT("count", HeroSave, wg_count),
+    FIELD_SPEC_INT("level", HeroSave, wg_level),
+    FIELD_SPEC_END,
+};
+
+static const FieldSpec events_data_fields[] = {
+    {"wariors_grave", FIELD_MAP, 0, 0, wariors_grave_fields, NULL},
+    FIELD_SPEC_END,
+};
+
+static const FieldSpec rng_stream_save_fields[] = {
+    FIELD_SPEC_STR("draws", RngStreamSave, draws),
+    FIELD_SPEC_LIST("state", RngStreamSave, state, state_count),
+    FIELD_SPEC_END,
+};
 
-static int monolith_price_for(const MonolithData *m, const char *key) {
-  if (!m || !key) return 0;
-  const char *stats[] = {"hp","mp","accuracy","damage","stat_points","skill_points","armor","regen_hp","regen_mp","armor_penetration","block_chance"};
-  const int base[] = {1,1,5,10,7,15,40,70,60,30,5};
-  const double mult[] = {1.04,1.04,1.4,1.4,1.3,1.3,1.7,2.0,2.0,1.4,1.5};
-  for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); ++i) {
-    if (strcmp(stats[i], key) == 0) {
-      int cur = monolith_get_stat(m, key);
-      double price = base[i] * pow(mult[i], cur);
-      return (int)floor(price);
-    }
+// ingredients: is a map of ingredient -> count, so its keys are data, not fields.
+static void hero_save_read_ingredients(YamlStream *ys, void *record) {
+  HeroSave *hs = (HeroSave *)record;
+  if (ys->event.type != YAML_MAPPING_START_EVENT) {
+    ys_skip(ys);
+    return;
+  }
+  while (ys_next(ys) && ys->event.type != YAML_MAPPING_END_EVENT) {
+    char name[64];
+    const char *key = ys_scalar(ys);
+    snprintf(name, sizeof(name), "%s", key ? key : "");
+    if (!key && !ys_skip(ys)) return;
+    if (!ys_next(ys)) return;
+    const char *value = ys_scalar(ys);
+    if (key && value) value_map_set(&hs->ingredients, name, value);
+    if (!value && !ys_skip(ys)) return;
   }
-  return 0;
 }
 
-static bool monolith_buy(MonolithData *m, const char *key) {
-  if (!m || !key) return false;
-  int price = monolith_price_for(m, key);
-  if (m->points < price || price <= 0) return false;
-  m->points -= price;
-  if (strcmp(key, "hp") == 0) m->hp += 1;
-  else if (strcmp(key, "mp") == 0) m->mp += 1;
-  else if (strcmp(key, "accuracy") == 0) m->accuracy += 1;
-  else if (strcmp(key, "damage") == 0) m->damage += 1;
-  else if (strcmp(key, "stat_points") == 0) m->stat_points += 1;
-  else if (strcmp(key, "skill_points") == 0) m->skill_points += 1;
-  else if (strcmp(key, "armor") == 0) m->armor += 1;
-  else if (strcmp(key, "regen_hp") == 0) m->regen_hp += 1;
-  else if (strcmp(key, "regen_mp") == 0) m->regen_mp += 1;
-  else if (strcmp(key, "armor_penetration") == 0) m->armor_penetration += 1;
-  else if (strcmp(key, "block_chance") == 0) m->block_chance += 1;
-  return true;
+// A stream is a map of draws and state words, or in older saves a bare draw count.
+static void hero_save_read_rng(YamlStream *ys, void *record) {
+  HeroSave *hs = (HeroSave *)record;
+  if (ys->event.type != YAML_MAPPING_START_EVENT) {
+    ys_skip(ys);
+    return;
+  }
+  hs->has_rng = true;
+  while (ys_next(ys) && ys->event.type != YAML_MAPPING_END_EVENT) {
+    char name[32];
+    const char *key = ys_scalar(ys);
+    snprintf(name, sizeof(name), "%s", key ? key : "");
+    if (!key && !ys_skip(ys)) return;
+    if (!ys_next(ys)) return;
+    int i = 0;
+    while (i < RNG_STREAMS && strcmp(rng_stream_names[i], name) != 0) i++;
+    const char *value = ys_scalar(ys);
+    if (strcmp(name, "seed") == 0) {
+      if (value) snprintf(hs->seed, sizeof(hs->seed), "%s", value);
+    } else if (i < RNG_STREAMS && ys->event.type == YAML_MAPPING_START_EVENT) {
+      hs->streams[i].draws[0] = '\0';
+      if (!ys_read_fields(ys, rng_stream_save_fields, &hs->streams[i], name)) return;
+      continue;
+    } else if (i < RNG_STREAMS) {
+      snprintf(hs->streams[i].draws, sizeof(hs->streams[i].draws), "%s", value ? value : "0");
+    }
+    if (!value && !ys_skip(ys)) return;
+  }
+}
+
+static const FieldSpec hero_save_fields[] = {
+    FIELD_SPEC_MAP("hero_create", HeroSave, name, hero_create_fields),
+    FIELD_SPEC_MAP("hero_stats", HeroSave, hero_stats, hero_stats_fields),
+    {"hero_skills", FIELD_MAP, 0, 0, hero_skills_fields, NULL},
+    {"hero_ammunition", FIELD_MAP, 0, 0, hero_ammunition_fields, NULL},
+    FIELD_SPEC_STR("dungeon_name", HeroSave, dungeon_name),
+    FIELD_SPEC_INT("dungeon_part_number", HeroSave, dungeon_part_number),
+    FIELD_SPEC_INT("leveling", HeroSave, leveling),
+    {"camp_loot", FIELD_MAP, 0, 0, camp_loot_fields, NULL},
+    FIELD_SPEC_CUSTOM("ingredients", hero_save_read_ingredients),
+    {"events_data", FIELD_MAP, 0, 0, events_data_fields, NULL},
+    FIELD_SPEC_CUSTOM("rng", hero_save_read_rng),
+    FIELD_SPEC_END,
+};
+
+static void hero_save_init(HeroSave *hs, const Game *g) {
+  memset(hs, 0, sizeof(*hs));
+  snprintf(hs->name, sizeof(hs->name), "Hero");
+  snprintf(hs->background, sizeof(hs->background), "passerby");
+  for (const FieldSpec *f = hero_stats_fields; f->key; ++f) {
+    *(int *)((char *)&hs->hero_stats + f->offset) = INT_MIN;
+  }
+  SkillSave *skills[] = {&hs->active_skill, &hs->passive_skill, &hs->camp_skill};
+  for (int i = 0; i < 3; ++i) snprintf(skills[i]->code, sizeof(skills[i]->code), "none");
+  AmmoSave *ammo[] = {&hs->weapon, &hs->body_armor, &hs->head_armor, &hs->arms_armor, &hs->shield};
+  for (int i = 0; i < 5; ++i) snprintf(ammo[i]->code, sizeof(ammo[i]->code), "without");
+  snprintf(hs->dungeon_name, sizeof(hs->dungeon_name), "%s", g->dungeons[g->dungeon_index].name);
+  for (int i = 0; i < RNG_STREAMS; ++i) snprintf(hs->streams[i].draws, sizeof(hs->streams[i].draws), "0");
 }
 
-static void statistics_total_init_default(StatisticsTotal *s) {
-  if (!s) return;
-  memset(s, 0, sizeof(*s));
+static void hero_save_free(HeroSave *hs) {
+  value_map_free(&hs->ingredients);
+  for (int i = 0; i < RNG_STREAMS; ++i) {
+    free_string_list(hs->streams[i].state, hs->streams[i].state_count);
+    hs->streams[i].state = NULL;
+    hs->streams[i].state_count = 0;
+  }
 }
 
-static bool load_statistics_total(StatisticsTotal *s) {
-  if (!s) return false;
+static bool load_hero_in_run(Game *g) {
+  if (!g) return false;
   char *saves_dir = resolve_saves_dir();
   if (!saves_dir) return false;
   char path[512];
-  snprintf(path, sizeof(path), "%s/statistics_total.yml", saves_dir);
+  snprintf(path, sizeof(path), "%s/hero_in_run.yml", saves_dir);
   free(saves_dir);
 
-  if (!file_exists(path)) {
-    statistics_total_init_default(s);
-    FILE *f = fopen(path, "w");
-    if (f) {
-      fprintf(f, "bandits:\n");
-      fprintf(f, "  rabble: 0\n  rabid_dog: 0\n  poacher: 0\n  thug: 0\n  deserter: 0\n  bandit_leader: 0\n");
-      fprintf(f, "undeads:\n");
-      fprintf(f, "  zombie: 0\n  skeleton: 0\n  ghost: 0\n  fat_ghoul: 0\n  skeleton_soldier: 0\n  zombie_knight: 0\n");
-      fprintf(f, "swamp:\n");
-      fprintf(f, "  leech: 0\n  goblin: 0\n  sworm: 0\n  spider: 0\n  orc: 0\n  ancient_snail: 0\n");
-      fprintf(f, "pzdc:\n");
-      fprintf(f, "  stage_1_mimic: 0\n  stage_2_thing: 0\n  stage_3_dog: 0\n");
-      fclose(f);
-    }
-    return true;
+  HeroSave hs;
+  hero_save_init(&hs, g);
+  if (!ys_load_record(path, hero_save_fields, &hs)) {
+    hero_save_free(&hs);
+    return false;
   }
 
-  Node *root = yaml_load_file(path);
-  if (!root || root->type != NODE_MAP) {
-    node_free(root);
+  const HeroTemplate *tmpl = hero_template_by_code(g, hs.background);
+  if (!tmpl) tmpl = (g->hero_count > 0) ? &g->heroes[0] : NULL;
+  if (!tmpl) {
+    hero_save_free(&hs);
     return false;
   }
-  statistics_total_init_default(s);
-  const char *bandits[] = {"rabble","rabid_dog","poacher","thug","deserter","bandit_leader"};
-  const char *undeads[] = {"zombie","skeleton","ghost","fat_ghoul","skeleton_soldier","zombie_knight"};
-  const char *swamp[] = {"leech","goblin","sworm","spider","orc","ancient_snail"};
-  const char *pzdc[] = {"stage_1_mimic","stage_2_thing","stage_3_dog"};
-  Node *b = node_map_get(root, "bandits");
-  Node *u = node_map_get(root, "undeads");
-  Node *w = node_map_get(root, "swamp");
-  Node *p = node_map_get(root, "pzdc");
-  for (int i = 0; i < 6; ++i) {
-    s->bandits[i] = b ? node_map_int(b, bandits[i], 0) : 0;
-    s->undeads[i] = u ? node_map_int(u, undeads[i], 0) : 0;
-    s->swamp[i] = w ? node_map_int(w, swamp[i], 0) : 0;
+
+  g->hero = character_from_hero(g, tmpl, hs.name);
+  snprintf(g->hero.background, sizeof(g->hero.background), "%s", hs.background);
+
+  for (const FieldSpec *f = hero_stats_fields; f->key; ++f) {
+    int v = *(int *)((char *)&hs.hero_stats + f->offset);
+    if (v != INT_MIN) *(int *)((char *)&g->hero + f->offset) = v;
   }
-  for (int i = 0; i < 3; ++i) {
-    s->pzdc[i] = p ? node_map_int(p, pzdc[i], 0) : 0;
+
+  skill_assign(&g->hero.active_skill, SKILL_ACTIVE, hs.active_skill.code);
+  g->hero.active_skill.lvl = hs.active_skill.lvl;
+  skill_assign(&g->hero.passive_skill, SKILL_PASSIVE, hs.passive_skill.code);
+  g->hero.passive_skill.lvl = hs.passive_skill.lvl;
+  skill_assign(&g->hero.camp_skill, SKILL_CAMP, hs.camp_skill.code);
+  g->hero.camp_skill.lvl = hs.camp_skill.lvl;
+
+  g->hero.weapon = weapon_from_code(g, hs.weapon.code);
+  g->hero.body_armor = armor_from_code(g->body_armors, g->body_armor_count, hs.body_armor.code);
+  g->hero.head_armor = armor_from_code(g->head_armors, g->head_armor_count, hs.head_armor.code);
+  g->hero.arms_armor = armor_from_code(g->arms_armors, g->arms_armor_count, hs.arms_armor.code);
+  g->hero.shield = shield_from_code(g, hs.shield.code);
+  if (hs.weapon.enhance_code[0]) {
+    OccultRecipe *r = occult_recipe_by_code(&g->occult, hs.weapon.enhance_code);
+    if (r) recipe_apply_weapon(r, &g->hero.weapon);
   }
-  node_free(root);
+  if (hs.body_armor.enhance_code[0]) {
+    OccultRecipe *r = occult_recipe_by_code(&g->occult, hs.body_armor.enhance_code);
+    if (r) recipe_apply_armor(r, &g->hero.body_armor, &r->body_armor);
+  }
+  if (hs.head_armor.enhance_code[0]) {
+    OccultRecipe *r = occult_recipe_by_code(&g->occult, hs.head_armor.enhance_code);
+    if (r) recipe_apply_armor(r, &g->hero.head_armor, &r->head_armor);
+  }
+  if (hs.arms_armor.enhance_code[0]) {
+    OccultRecipe *r = occult_recipe_by_code(&g->occult, hs.arms_armor.enhance_code);
+    if (r) recipe_apply_armor(r, &g->hero.arms_armor, &r->arms_armor);
+  }
+  if (hs.shield.enhance_code[0]) {
+    OccultRecipe *r = occult_recipe_by_code(&g->occult, hs.shield.enhance_code);
+    if (r) recipe_apply_shield(r, &g->hero.shield);
+  }
+  character_touch(&g->hero);
+
+  snprintf(g->hero.dungeon_name, sizeof(g->hero.dungeon_name), "%s", hs.dungeon_name);
+  g->hero.dungeon_part_number = hs.dungeon_part_number;
+  g->hero.leveling = hs.leveling;
+  g->hero.pzdc_monolith_points = hs.pzdc_monolith_points;
+  g->hero.coins = hs.coins;
+
+  value_map_free(&g->hero.ingredients);
+  g->hero.ingredients = hs.ingredients;
+  memset(&hs.ingredients, 0, sizeof(hs.ingredients));
+
+  g->wg_taken = hs.wg_taken;
+  snprintf(g->wg_enemy, sizeof(g->wg_enemy), "%s", hs.wg_enemy);
+  g->wg_count = hs.wg_count;
+  g->wg_level = hs.wg_level;
+
+  // Older saves have no rng section, or only a draw count per stream; a section that
+  // cannot be restored keeps the streams of this session.
+  uint64_t seed = 0;
+  if (hs.has_rng && parse_u64(hs.seed, &seed)) {
+    Rng saved[RNG_STREAMS];
+    memset(saved, 0, sizeof(saved));
+    bool has_state[RNG_STREAMS] = {false};
+    bool ok = true;
+    for (int i = 0; ok && i < RNG_STREAMS; ++i) {
+      const RngStreamSave *st = &hs.streams[i];
+      ok = parse_u64(st->draws, &saved[i].draws);
+      if (ok && st->state_count == 4) {
+        has_state[i] = true;
+        for (int w = 0; w < 4; ++w) has_state[i] = has_state[i] && parse_u64(st->state[w], &saved[i].s[w]);
+        has_state[i] = has_state[i] && (saved[i].s[0] | saved[i].s[1] | saved[i].s[2] | saved[i].s[3]) != 0;
+      }
+    }
+    if (!ok || !game_seek(g, seed, saved, has_state)) {
+      fprintf(stderr, "[pzdc_dungeon_2_gl] load: rng section of %s is damaged, keeping this session's streams\n", path);
+    }
+  }
+
+  hero_save_free(&hs);
   return true;
 }
 
-static bool save_statistics_total(const StatisticsTotal *s) {
-  if (!s) return false;
-  char *saves_dir = resolve_saves_dir();
-  if (!saves_dir) return false;
-  char path[512];
-  snprintf(path, sizeof(path), "%s/statistics_total.yml", saves_dir);
-  free(saves_dir);
-  FILE *f = fopen(path, "w");
-  if (!f) return false;
-  fprintf(f, "bandits:\n");
-  fprintf(f, "  rabble: %d\n  rabid_dog: %d\n  poacher: %d\n  thug: %d\n  deserter: %d\n  bandit_leader: %d\n",
-          s->bandits[0], s->bandits[1], s->bandits[2], s->bandits[3], s->bandits[4], s->bandits[5]);
-  fprintf(f, "undeads:\n");
-  fprintf(f, "  zombie: %d\n  skeleton: %d\n  ghost: %d\n  fat_ghoul: %d\n  skeleton_soldier: %d\n  zombie_knight: %d\n",
-          s->undeads[0], s->undeads[1], s->undeads[2], s->undeads[3], s->undeads[4], s->undeads[5]);
-  fprintf(f, "swamp:\n");
-  fprintf(f, "  leech: %d\n  goblin: %d\n  sworm: %d\n  spider: %d\n  orc: %d\n  ancient_snail: %d\n",
-          s->swamp[0], s->swamp[1], s->swamp[2], s->swamp[3], s->swamp[4], s->swamp[5]);
-  fprintf(f, "pzdc:\n");
-  fprintf(f, "  stage_1_mimic: %d\n  stage_2_thing: %d\n  stage_3_dog: %d\n", s->pzdc[0], s->pzdc[1], s->pzdc[2]);
-  fclose(f);
+// xoshiro256** seeded through splitmix64. Every random draw goes through an explicit
+// Rng so independent runs can be replayed from a seed and played on separate threads.
+static uint64_t splitmix64(uint64_t *x) {
+  uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+static void rng_seed(Rng *rng, uint64_t seed) {
+  uint64_t x = seed;
+  for (int i = 0; i < 4; ++i) rng->s[i] = splitmix64(&x);
+  rng->draws = 0;
+}
+
+static uint64_t rng_rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t rng_next(Rng *rng) {
+  uint64_t *s = rng->s;
+  uint64_t result = rng_rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rng_rotl(s[3], 45);
+  rng->draws++;
+  return result;
+}
+
+static double rng_uniform(Rng *rng) {
+  return (double)(rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Lemire's multiply-shift on the top 32 bits: the high word of x * span is uniform once
+// the few low words below 2^32 mod span are rejected, so there is no modulo bias.
+static int rand_range(Rng *rng, int min, int max) {
+  if (max < min) return min;
+  uint64_t span = (uint64_t)((int64_t)max - min + 1);
+  uint64_t m = (rng_next(rng) >> 32) * span;
+  if ((uint32_t)m < span) {
+    uint32_t reject = (uint32_t)((0x100000000ull - span) % span);
+    while ((uint32_t)m < reject) m = (rng_next(rng) >> 32) * span;
+  }
+  return (int)((int64_t)min + (int64_t)(m >> 32));
+}
+
+// Every stream is seeded from one splitmix64 sequence over the game seed.
+static void game_seed(Game *g, uint64_t seed) {
+  g->seed = seed;
+  uint64_t x = seed;
+  for (int i = 0; i < RNG_STREAMS; ++i) rng_seed(&g->rng[i], splitmix64(&x));
+}
+
+// Seeking replays one draw at a time, so larger counts are only trusted alongside saved state words.
+#define RNG_SEEK_MAX (1ull << 24)
+
+// Restores the streams of a save. Saved state words win; the draw count is checked against a replay
+// from the seed when that is cheap. Saves with only a draw count are replayed up to RNG_SEEK_MAX.
+// Leaves g untouched and returns false when a stream cannot be restored.
+static bool game_seek(Game *g, uint64_t seed, const Rng *saved, const bool *has_state) {
+  Rng rng[RNG_STREAMS];
+  uint64_t x = seed;
+  for (int i = 0; i < RNG_STREAMS; ++i) rng_seed(&rng[i], splitmix64(&x));
+  for (int i = 0; i < RNG_STREAMS; ++i) {
+    if (saved[i].draws <= RNG_SEEK_MAX) {
+      while (rng[i].draws < saved[i].draws) rng_next(&rng[i]);
+      if (has_state[i] && memcmp(rng[i].s, saved[i].s, sizeof(rng[i].s)) != 0) {
+        fprintf(stderr, "[pzdc_dungeon_2_gl] load: %s stream state does not match seed %llu after %llu draws, using the saved state\n",
+                rng_stream_names[i], (unsigned long long)seed, (unsigned long long)saved[i].draws);
+      }
+    } else if (!has_state[i]) {
+      return false;
+    }
+    if (has_state[i]) rng[i] = saved[i];
+  }
+  g->seed = seed;
+  memcpy(g->rng, rng, sizeof(rng));
   return true;
 }
 
-static int stats_total_get(const StatisticsTotal *s, const char *dungeon, const char *enemy_code) {
-  if (!s || !dungeon || !enemy_code) return 0;
-  const char *bandits[] = {"rabble","rabid_dog","poacher","thug","deserter","bandit_leader"};
-  const char *undeads[] = {"zombie","skeleton","ghost","fat_ghoul","skeleton_soldier","zombie_knight"};
-  const char *swamp[] = {"leech","goblin","sworm","spider","orc","ancient_snail"};
-  const char *pzdc[] = {"stage_1_mimic","stage_2_thing","stage_3_dog"};
-  if (strcmp(dungeon, "bandits") == 0) {
-    for (int i = 0; i < 6; ++i) if (strcmp(bandits[i], enemy_code) == 0) return s->bandits[i];
-  } else if (strcmp(dungeon, "undeads") == 0) {
-    for (int i = 0; i < 6; ++i) if (strcmp(undeads[i], enemy_code) == 0) return s->undeads[i];
-  } else if (strcmp(dungeon, "swamp") == 0) {
-    for (int i = 0; i < 6; ++i) if (strcmp(swamp[i], enemy_code) == 0) return s->swamp[i];
-  } else if (strcmp(dungeon, "pzdc") == 0) {
-    for (int i = 0; i < 3; ++i) if (strcmp(pzdc[i], enemy_code) == 0) return s->pzdc[i];
+static const char *weapon_name_from_code(const Game *g, const char *code) {
+  if (!g || !code) return "---";
+  for (size_t i = 0; i < g->weapon_count; ++i) {
+    if (strcmp(g->weapons[i].code, code) == 0) return g->weapons[i].name;
+  }
+  if (strcmp(code, "without") == 0) return "without";
+  return code;
+}
+
+static const char *armor_name_from_code(const ArmorItem *items, size_t count, const char *code) {
+  if (!items || !code) return "---";
+  for (size_t i = 0; i < count; ++i) {
+    if (strcmp(items[i].code, code) == 0) return items[i].name;
+  }
+  if (strcmp(code, "without") == 0) return "without";
+  return code;
+}
+
+static const char *shield_name_from_code(const Game *g, const char *code) {
+  if (!g || !code) return "---";
+  for (size_t i = 0; i < g->shield_count; ++i) {
+    if (strcmp(g->shields[i].code, code) == 0) return g->shields[i].name;
   }
+  if (strcmp(code, "without") == 0) return "without";
+  return code;
+}
+
+static const char *ammo_name(Game *g, const char *type, const char *code) {
+  if (!g || !type || !code) return "---";
+  if (strcmp(type, "weapon") == 0) return weapon_name_from_code(g, code);
+  if (strcmp(type, "body_armor") == 0) return armor_name_from_code(g->body_armors, g->body_armor_count, code);
+  if (strcmp(type, "head_armor") == 0) return armor_name_from_code(g->head_armors, g->head_armor_count, code);
+  if (strcmp(type, "arms_armor") == 0) return armor_name_from_code(g->arms_armors, g->arms_armor_count, code);
+  if (strcmp(type, "shield") == 0) return shield_name_from_code(g, code);
+  return "---";
+}
+
+static int ammo_price(Game *g, const char *type, const char *code) {
+  if (!g || !type || !code) return 0;
+  if (strcmp(code, "without") == 0) return 0;
+  if (strcmp(type, "weapon") == 0) return weapon_from_code(g, code).price;
+  if (strcmp(type, "body_armor") == 0) return armor_from_code(g->body_armors, g->body_armor_count, code).price;
+  if (strcmp(type, "head_armor") == 0) return armor_from_code(g->head_armors, g->head_armor_count, code).price;
+  if (strcmp(type, "arms_armor") == 0) return armor_from_code(g->arms_armors, g->arms_armor_count, code).price;
+  if (strcmp(type, "shield") == 0) return shield_from_code(g, code).price;
   return 0;
 }
 
-static void stats_total_increment(StatisticsTotal *s, const char *dungeon, const char *enemy_code) {
-  if (!s || !dungeon || !enemy_code) return;
-  const char *bandits[] = {"rabble","rabid_dog","poacher","thug","deserter","bandit_leader"};
-  const char *undeads[] = {"zombie","skeleton","ghost","fat_ghoul","skeleton_soldier","zombie_knight"};
-  const char *swamp[] = {"leech","goblin","sworm","spider","orc","ancient_snail"};
-  const char *pzdc[] = {"stage_1_mimic","stage_2_thing","stage_3_dog"};
-  if (strcmp(dungeon, "bandits") == 0) {
-    for (int i = 0; i < 6; ++i) if (strcmp(bandits[i], enemy_code) == 0) { s->bandits[i] += 1; return; }
-  } else if (strcmp(dungeon, "undeads") == 0) {
-    for (int i = 0; i < 6; ++i) if (strcmp(undeads[i], enemy_code) == 0) { s->undeads[i] += 1; return; }
-  } else if (strcmp(dungeon, "swamp") == 0) {
-    for (int i = 0; i < 6; ++i) if (strcmp(swamp[i], enemy_code) == 0) { s->swamp[i] += 1; return; }
-  } else if (strcmp(dungeon, "pzdc") == 0) {
-    for (int i = 0; i < 3; ++i) if (strcmp(pzdc[i], enemy_code) == 0) { s->pzdc[i] += 1; return; }
+static void ammo_to_map(Game *g, const char *type, const char *code, ValueMap *map) {
+  value_map_clear(map);
+  if (!g || !type || !code) return;
+  if (strcmp(type, "weapon") == 0) {
+    WeaponItem it = weapon_from_code(g, code);
+    char name_buf[96];
+    ammo_display_name(it.name, it.enhanced, name_buf, sizeof(name_buf));
+    value_map_set(map, "name", name_buf);
+    value_map_set_int(map, "min_dmg", it.min_dmg);
+    value_map_set_int(map, "max_dmg", it.max_dmg);
+    value_map_set_int(map, "accuracy", it.accuracy);
+    value_map_set_int(map, "block_chance", it.block_chance);
+    value_map_set_int(map, "armor_penetration", it.armor_penetration);
+    value_map_set_int(map, "price", it.price);
+  } else if (strcmp(type, "shield") == 0) {
+    ShieldItem it = shield_from_code(g, code);
+    char name_buf[96];
+    ammo_display_name(it.name, it.enhanced, name_buf, sizeof(name_buf));
+    value_map_set(map, "name", name_buf);
+    value_map_set_int(map, "armor", it.armor);
+    value_map_set_int(map, "accuracy", it.accuracy);
+    value_map_set_int(map, "block_chance", it.block_chance);
+    value_map_set_int(map, "min_dmg", it.min_dmg);
+    value_map_set_int(map, "max_dmg", it.max_dmg);
+    value_map_set_int(map, "price", it.price);
+  } else {
+    ArmorItem it;
+    if (strcmp(type, "body_armor") == 0) it = armor_from_code(g->body_armors, g->body_armor_count, code);
+    else if (strcmp(type, "head_armor") == 0) it = armor_from_code(g->head_armors, g->head_armor_count, code);
+    else it = armor_from_code(g->arms_armors, g->arms_armor_count, code);
+    char name_buf[96];
+    ammo_display_name(it.name, it.enhanced, name_buf, sizeof(name_buf));
+    value_map_set(map, "name", name_buf);
+    value_map_set_int(map, "armor", it.armor);
+    value_map_set_int(map, "accuracy", it.accuracy);
+    value_map_set_int(map, "price", it.price);
+  }
+}
+
+static int anim_speed_ms_for(const Game *g) {
+  const int speeds[] = {100, 400, 700, 1000, 1500};
+  int idx = g ? g->anim_speed_index : 1;
+  if (idx < 0) idx = 0;
+  if (idx > 4) idx = 4;
+  return speeds[idx];
+}
+
+static const char *enemy_attack_art_from_type(int attack_type) {
+  if (attack_type == 2) return "attack_head";
+  if (attack_type == 3) return "attack_legs";
+  return "attack";
+}
+
+static void battle_anim_queue(Game *g, const char **seq, int count) {
+  if (!g || !seq || count <= 0) return;
+  if (count > 4) count = 4;
+  g->battle_anim_active = 1;
+  g->battle_anim_step = 0;
+  g->battle_anim_count = count;
+  for (int i = 0; i < count; ++i) {
+    snprintf(g->battle_anim_seq[i], sizeof(g->battle_anim_seq[i]), "%s", seq[i]);
+  }
+  snprintf(g->battle_art_name, sizeof(g->battle_art_name), "%s", seq[0]);
+  g->battle_anim_deadline = SDL_GetTicks() + (uint32_t)anim_speed_ms_for(g);
+  g->force_instant_redraw = 1;
+}
+
+static bool battle_anim_tick(Game *g, uint32_t now) {
+  if (!g || !g->battle_anim_active) return false;
+  if (now < g->battle_anim_deadline) return false;
+  g->battle_anim_step += 1;
+  if (g->battle_anim_step < g->battle_anim_count) {
+    snprintf(g->battle_art_name, sizeof(g->battle_art_name), "%s", g->battle_anim_seq[g->battle_anim_step]);
+    g->battle_anim_deadline = now + (uint32_t)anim_speed_ms_for(g);
+    g->force_instant_redraw = 1;
+    return true;
   }
-}
-
-static void occult_library_free(OccultLibraryData *ol) {
-  if (!ol) return;
-  for (size_t i = 0; i < ol->recipe_count; ++i) {
-    free(ol->recipes[i].ingredients);
+  g->battle_anim_active = 0;
+  if (g->battle_exit_pending) {
+    g->battle_exit_pending = 0;
+    g->state = g->battle_exit_state;
+    g->force_instant_redraw = 1;
+    return true;
   }
-  free(ol->recipes);
-  ol->recipes = NULL;
-  ol->recipe_count = 0;
+  if (strcmp(g->battle_art_name, "normal") != 0) {
+    snprintf(g->battle_art_name, sizeof(g->battle_art_name), "normal");
+    g->force_instant_redraw = 1;
+    return true;
+  }
+  return false;
 }
 
-static void parse_recipe_effect(Node *node, RecipeEffect *out) {
-  if (!out) return;
-  memset(out, 0, sizeof(*out));
-  if (!node || node->type != NODE_MAP) return;
-  out->accuracy = node_map_int(node, "accuracy", 0);
-  out->min_dmg = node_map_int(node, "min_dmg", 0);
-  out->max_dmg = node_map_int(node, "max_dmg", 0);
-  out->block_chance = node_map_int(node, "block_chance", 0);
-  out->armor = node_map_int(node, "armor", 0);
-  out->armor_penetration = node_map_int(node, "armor_penetration", 0);
-}
+static void battle_round(Game *g, int attack_type, int *out_enemy_attack_type) {
+  Character *h = &g->hero;
+  Character *e = &g->enemy;
+  const CharacterStats *hs = character_stats(h);
+  const CharacterStats *es = character_stats(e);
+  if (out_enemy_attack_type) *out_enemy_attack_type = 0;
 
-static bool load_occult_library_data(OccultLibraryData *ol) {
-  if (!ol) return false;
-  occult_library_free(ol);
-  char *data_path = resolve_data_path("data/camp/occult_library.yml");
-  if (!data_path) return false;
-  Node *root = yaml_load_file(data_path);
-  free(data_path);
-  if (!root || root->type != NODE_MAP) {
-    node_free(root);
-    return false;
+  double h_damage = rand_range(&g->rng[RNG_COMBAT], hs->min_dmg, hs->max_dmg);
+  double h_acc = hs->accuracy;
+  const char *attack_label = "body";
+  bool used_active = false;
+  double enemy_damage_mod = 1.0;
+
+  if (attack_type == 2) {
+    h_damage *= 1.5;
+    h_acc *= 0.7;
+    attack_label = "head";
+  } else if (attack_type == 3) {
+    h_damage *= 0.7;
+    h_acc *= 1.5;
+    attack_label = "legs";
+  } else if (attack_type == 4) {
+    if (strcmp(h->active_skill.code, "none") == 0) {
+      logbuffer_push(&g->log, "You have no active skill");
+      return;
+    }
+    if (h->mp < h->active_skill.mp_cost) {
+      logbuffer_push(&g->log, "Not enough MP");
+      return;
+    }
+    h->mp -= h->active_skill.mp_cost;
+    h_damage *= skill_active_damage_mod(&h->active_skill, h);
+    h_acc *= skill_active_accuracy_mod(&h->active_skill, h);
+    attack_label = h->active_skill.name;
+    used_active = true;
   }
 
-  OccultRecipe *recipes = NULL;
-  size_t count = 0;
-  for (size_t i = 0; i < root->map.len; ++i) {
-    const char *code = root->map.keys[i];
-    Node *r = root->map.values[i];
-    if (!code || !r || r->type != NODE_MAP) continue;
-    OccultRecipe rec;
-    memset(&rec, 0, sizeof(rec));
-    snprintf(rec.code, sizeof(rec.code), "%s", code);
-    rec.view_code = node_map_int(r, "view_code", 0);
-    snprintf(rec.name, sizeof(rec.name), "%s", node_map_str(r, "name", code));
-    rec.price = node_map_int(r, "price", 0);
-
-    Node *recipe_map = node_map_get(r, "recipe");
-    if (recipe_map && recipe_map->type == NODE_MAP) {
-      rec.ingredients = (RecipeIngredient *)calloc(recipe_map->map.len, sizeof(RecipeIngredient));
-      if (rec.ingredients) {
-        rec.ingredient_count = recipe_map->map.len;
-        for (size_t j = 0; j < recipe_map->map.len; ++j) {
-          const char *k = recipe_map->map.keys[j];
-          int v = node_int(recipe_map->map.values[j], 0);
-          if (k) snprintf(rec.ingredients[j].name, sizeof(rec.ingredients[j].name), "%s", k);
-          rec.ingredients[j].count = v;
-        }
-      }
+  h_damage *= skill_berserk_coef(&h->passive_skill, h);
+
+  bool enemy_block = rand_range(&g->rng[RNG_COMBAT], 1, 100) <= es->block_chance;
+  bool h_hit = rand_range(&g->rng[RNG_COMBAT], 1, 100) <= (int)round(h_acc);
+  if (h_hit) {
+    if (enemy_block) {
+      double coeff = 1.0 + (double)e->hp / 200.0;
+      h_damage /= coeff;
     }
+    int armor_block = es->armor - hs->armor_penetration;
+    if (armor_block < 0) armor_block = 0;
+    h_damage -= armor_block;
+    if (h_damage < 0) h_damage = 0;
+    e->hp -= (int)round(h_damage);
+    if (e->hp < 0) e->hp = 0;
 
-    Node *effect = node_map_get(r, "effect");
-    if (effect && effect->type == NODE_MAP) {
-      parse_recipe_effect(node_map_get(effect, "weapon"), &rec.weapon);
-      parse_recipe_effect(node_map_get(effect, "head_armor"), &rec.head_armor);
-      parse_recipe_effect(node_map_get(effect, "body_armor"), &rec.body_armor);
-      parse_recipe_effect(node_map_get(effect, "arms_armor"), &rec.arms_armor);
-      parse_recipe_effect(node_map_get(effect, "shield"), &rec.shield);
+    char msg[160];
+    snprintf(msg, sizeof(msg), "You hit %s for %d (%s)", e->name, (int)round(h_damage), attack_label);
+    if (enemy_block) {
+      char block_msg[64];
+      snprintf(block_msg, sizeof(block_msg), " (blocked %d%%)", block_power_in_percents(e));
+      strncat(msg, block_msg, sizeof(msg) - strlen(msg) - 1);
     }
+    logbuffer_push(&g->log, msg);
 
-    OccultRecipe *arr = (OccultRecipe *)realloc(recipes, (count + 1) * sizeof(OccultRecipe));
-    if (!arr) {
-      free(rec.ingredients);
-      continue;
+    double bonus = skill_concentration_bonus(&h->passive_skill, h, &g->rng[RNG_COMBAT]);
+    if (bonus > 0) {
+      e->hp -= (int)round(bonus);
+      if (e->hp < 0) e->hp = 0;
+      char msg2[128];
+      snprintf(msg2, sizeof(msg2), "Concentration adds %d damage", (int)round(bonus));
+      logbuffer_push(&g->log, msg2);
     }
-    recipes = arr;
-    recipes[count++] = rec;
-  }
-  node_free(root);
-  ol->recipes = recipes;
-  ol->recipe_count = count;
 
-  char *saves_dir = resolve_saves_dir();
-  if (!saves_dir) return true;
-  char path[512];
-  snprintf(path, sizeof(path), "%s/occult_library.yml", saves_dir);
-  free(saves_dir);
-  if (!file_exists(path)) {
-    FILE *f = fopen(path, "w");
-    if (f) {
-      for (size_t i = 0; i < ol->recipe_count; ++i) {
-        fprintf(f, "%s: false\n", ol->recipes[i].code);
+    if (strcmp(h->passive_skill.code, "dazed") == 0) {
+      double hp_part_coef = skill_dazed_hp_part_coef(&h->passive_skill);
+      if (h_damage * hp_part_coef > e->hp / 2.0) {
+        enemy_damage_mod = skill_dazed_accuracy_reduce_coef(&h->passive_skill, &g->rng[RNG_COMBAT]);
+        char msg3[128];
+        snprintf(msg3, sizeof(msg3), "%s is dazed, accuracy reduced", e->name);
+        logbuffer_push(&g->log, msg3);
       }
-      fclose(f);
     }
-    return true;
-  }
-  Node *saved = yaml_load_file(path);
-  if (!saved || saved->type != NODE_MAP) {
-    node_free(saved);
-    return true;
-  }
-  for (size_t i = 0; i < ol->recipe_count; ++i) {
-    const char *val = node_map_str(saved, ol->recipes[i].code, "false");
-    ol->recipes[i].purchased = (strcmp(val, "true") == 0 || strcmp(val, "1") == 0);
-  }
-  node_free(saved);
-  return true;
-}
 
-static bool save_occult_library_data(const OccultLibraryData *ol) {
-  if (!ol) return false;
-  char *saves_dir = resolve_saves_dir();
-  if (!saves_dir) return false;
-  char path[512];
-  snprintf(path, sizeof(path), "%s/occult_library.yml", saves_dir);
-  free(saves_dir);
-  FILE *f = fopen(path, "w");
-  if (!f) return false;
-  for (size_t i = 0; i < ol->recipe_count; ++i) {
-    fprintf(f, "%s: %s\n", ol->recipes[i].code, ol->recipes[i].purchased ? "true" : "false");
+    if (used_active && strcmp(h->active_skill.code, "traumatic_strike") == 0) {
+      enemy_damage_mod = skill_traumatic_effect_coef(&h->active_skill);
+      char msg4[128];
+      snprintf(msg4, sizeof(msg4), "%s injured, damage reduced", e->name);
+      logbuffer_push(&g->log, msg4);
+    }
+  } else {
+    char msg[128];
+    snprintf(msg, sizeof(msg), "You miss (%s)", attack_label);
+    logbuffer_push(&g->log, msg);
   }
-  fclose(f);
-  return true;
-}
 
-static OccultRecipe *occult_recipe_by_view_code(OccultLibraryData *ol, int view_code) {
-  if (!ol || view_code <= 0) return NULL;
-  for (size_t i = 0; i < ol->recipe_count; ++i) {
-    if (ol->recipes[i].view_code == view_code) return &ol->recipes[i];
-  }
-  return NULL;
-}
+  if (e->hp <= 0) return;
 
-static OccultRecipe *occult_recipe_by_code(OccultLibraryData *ol, const char *code) {
-  if (!ol || !code) return NULL;
-  for (size_t i = 0; i < ol->recipe_count; ++i) {
-    if (strcmp(ol->recipes[i].code, code) == 0) return &ol->recipes[i];
+  int e_attack_type = rand_range(&g->rng[RNG_COMBAT], 1, 3);
+  if (out_enemy_attack_type) *out_enemy_attack_type = e_attack_type;
+  double e_damage = rand_range(&g->rng[RNG_COMBAT], es->min_dmg, es->max_dmg);
+  double e_acc = es->accuracy * enemy_damage_mod;
+  const char *e_label = "body";
+  if (e_attack_type == 2) {
+    e_damage *= 1.5;
+    e_acc *= 0.7;
+    e_label = "head";
+  } else if (e_attack_type == 3) {
+    e_damage *= 0.7;
+    e_acc *= 1.5;
+    e_label = "legs";
   }
-  return NULL;
-}
 
-static void titleize_token(const char *in, char *out, size_t out_sz) {
-  if (!out || out_sz == 0) return;
-  if (!in) { snprintf(out, out_sz, "---"); return; }
-  size_t n = strlen(in);
-  if (n + 1 > out_sz) n = out_sz - 1;
-  for (size_t i = 0; i < n; ++i) {
-    char ch = in[i];
-    if (ch == '_') ch = ' ';
-    out[i] = (i == 0) ? (char)toupper((unsigned char)ch) : ch;
+  bool hero_block = rand_range(&g->rng[RNG_COMBAT], 1, 100) <= hs->block_chance;
+  bool e_hit = rand_range(&g->rng[RNG_COMBAT], 1, 100) <= (int)round(e_acc);
+  if (e_hit) {
+    if (hero_block) {
+      double coeff = 1.0 + (double)h->hp / 200.0;
+      e_damage /= coeff;
+    }
+    int armor_block = hs->armor - es->armor_penetration;
+    if (armor_block < 0) armor_block = 0;
+    e_damage -= armor_block;
+    if (e_damage < 0) e_damage = 0;
+    h->hp -= (int)round(e_damage);
+    if (h->hp < 0) h->hp = 0;
+    char msg[160];
+    snprintf(msg, sizeof(msg), "%s hits you for %d (%s)", e->name, (int)round(e_damage), e_label);
+    if (hero_block) {
+      char block_msg[64];
+      snprintf(block_msg, sizeof(block_msg), " (blocked %d%%)", block_power_in_percents(h));
+      strncat(msg, block_msg, sizeof(msg) - strlen(msg) - 1);
+    }
+    logbuffer_push(&g->log, msg);
+  } else {
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%s misses (%s)", e->name, e_label);
+    logbuffer_push(&g->log, msg);
   }
-  out[n] = '\0';
-}
 
-static void append_kv(char *out, size_t out_sz, const char *name, int val, bool *first) {
-  if (!out || out_sz == 0 || !name) return;
-  char buf[128];
-  snprintf(buf, sizeof(buf), "%s: %d", name, val);
-  if (*first) {
-    snprintf(out, out_sz, "%s", buf);
-    *first = false;
-  } else {
-    size_t len = strlen(out);
-    snprintf(out + len, out_sz - len, ";   %s", buf);
+  if (h->regen_hp_base > 0 && h->hp < h->hp_max) {
+    int gain = h->regen_hp_base;
+    if (h->hp + gain > h->hp_max) gain = h->hp_max - h->hp;
+    h->hp += gain;
+    if (gain > 0) {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "You regenerate %d HP", gain);
+      logbuffer_push(&g->log, msg);
+    }
+  }
+  if (h->regen_mp_base > 0 && h->mp < h->mp_max) {
+    int gain = h->regen_mp_base;
+    if (h->mp + gain > h->mp_max) gain = h->mp_max - h->mp;
+    h->mp += gain;
+    if (gain > 0) {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "You regenerate %d MP", gain);
+      logbuffer_push(&g->log, msg);
+    }
+  }
+  if (e->regen_hp_base > 0 && e->hp < e->hp_max) {
+    int gain = e->regen_hp_base;
+    if (e->hp + gain > e->hp_max) gain = e->hp_max - e->hp;
+    e->hp += gain;
+    if (gain > 0) {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "%s regenerates %d HP", e->name, gain);
+      logbuffer_push(&g->log, msg);
+    }
   }
 }
 
-static void format_recipe_ingredients(const OccultRecipe *r, char *out, size_t out_sz) {
-  if (!out || out_sz == 0) return;
-  out[0] = '\0';
-  if (!r || r->ingredient_count == 0) return;
-  bool first = true;
-  for (size_t i = 0; i < r->ingredient_count; ++i) {
-    char name_buf[64];
-    titleize_token(r->ingredients[i].name, name_buf, sizeof(name_buf));
-    append_kv(out, out_sz, name_buf, r->ingredients[i].count, &first);
-  }
+#define SIM_MAX_ROUNDS 1000
+#define BATTLE_ODDS_CUTOFF 1e-9
+#define BATTLE_ODDS_CELL_CUTOFF 1e-13
+#define BATTLE_ODDS_BERSERK_TABLE (1 << 22)
+
+enum { ODDS_PLAIN, ODDS_DAZED, ODDS_TRAUMATIC, ODDS_CLASSES };
+
+// P(rand_range(1, 100) <= (int)round(x))
+static double battle_odds_hit(double x) {
+  int k = (int)round(x);
+  return k <= 0 ? 0.0 : k >= 100 ? 1.0 : k / 100.0;
 }
 
-static void format_effect(const RecipeEffect *e, char *out, size_t out_sz) {
-  if (!out || out_sz == 0) return;
-  out[0] = '\0';
-  if (!e) return;
-  bool first = true;
-  if (e->accuracy) append_kv(out, out_sz, "Accuracy", e->accuracy, &first);
-  if (e->min_dmg) append_kv(out, out_sz, "Min dmg", e->min_dmg, &first);
-  if (e->max_dmg) append_kv(out, out_sz, "Max dmg", e->max_dmg, &first);
-  if (e->block_chance) append_kv(out, out_sz, "Block chance", e->block_chance, &first);
-  if (e->armor) append_kv(out, out_sz, "Armor", e->armor, &first);
-  if (e->armor_penetration) append_kv(out, out_sz, "Armor penetration", e->armor_penetration, &first);
+static void battle_odds_key(const Character *h, const Character *e, int base_attack, BattleOddsKey *k) {
+  const CharacterStats *hs = character_stats(h);
+  const CharacterStats *es = character_stats(e);
+  memset(k, 0, sizeof(*k));
+  int hero[16] = {h->hp, h->hp_max, h->mp, h->mp_max, h->regen_hp_base, h->regen_mp_base, h->stat_points,
+                  h->active_skill.lvl, h->active_skill.mp_cost, h->passive_skill.lvl,
+                  hs->min_dmg, hs->max_dmg, hs->accuracy, hs->armor, hs->armor_penetration, hs->block_chance};
+  int enemy[9] = {e->hp, e->hp_max, e->regen_hp_base,
+                  es->min_dmg, es->max_dmg, es->accuracy, es->armor, es->armor_penetration, es->block_chance};
+  memcpy(k->hero, hero, sizeof(hero));
+  memcpy(k->enemy, enemy, sizeof(enemy));
+  k->base_attack = base_attack;
+  snprintf(k->active, sizeof(k->active), "%s", h->active_skill.code);
+  snprintf(k->passive, sizeof(k->passive), "%s", h->passive_skill.code);
 }
 
-static bool recipe_hero_has_ingredients(const OccultRecipe *r, const Character *hero) {
-  if (!r || !hero) return false;
-  for (size_t i = 0; i < r->ingredient_count; ++i) {
-    int have = value_map_get_int(&hero->ingredients, r->ingredients[i].name, 0);
-    if (have < r->ingredients[i].count) return false;
+// A landed hero strike of weight q that leaves the enemy at left HP before the
+// concentration bonus; spreads it into the class layers of row and returns the part
+// that ends the fight.
+static double battle_odds_land(double **row, int left, double d, double q, int conc, int cls, double dazed_part) {
+  if (left < 0) left = 0;
+  double won = 0.0;
+  for (int bonus = 0; bonus < conc; ++bonus) {
+    int after = left - bonus;
+    if (after <= 0) {
+      won += q;
+      continue;
+    }
+    int c = cls;
+    if (c == ODDS_PLAIN && d * dazed_part > after / 2.0) c = ODDS_DAZED;
+    row[c][after] += q;
   }
-  return true;
+  return won;
 }
 
-static void recipe_consume_ingredients(const OccultRecipe *r, Character *hero) {
-  if (!r || !hero) return;
-  for (size_t i = 0; i < r->ingredient_count; ++i) {
-    int have = value_map_get_int(&hero->ingredients, r->ingredients[i].name, 0);
-    int left = have - r->ingredients[i].count;
-    if (left < 0) left = 0;
-    value_map_set_int(&hero->ingredients, r->ingredients[i].name, left);
+// Exact distribution of battle_round outcomes, propagated round by round over
+// (hero HP, enemy HP). MP never depends on the dice under this policy, so it is
+// tracked as a single schedule. Within a round the enemy's strike depends on the
+// hero's only through enemy_damage_mod, which is one of three classes (none, dazed,
+// traumatic), so the hero's strike is spread into one layer per class and each layer
+// is pushed through a per-HP kernel of the enemy's strike. Cells lighter than
+// BATTLE_ODDS_CELL_CUTOFF are dropped, and the dropped mass plus whatever is left at
+// BATTLE_ODDS_CUTOFF or SIM_MAX_ROUNDS is reported as open.
+static bool battle_odds_compute(const Character *h, const Character *e, int base_attack, BattleOdds *out) {
+  memset(out, 0, sizeof(*out));
+  out->open = 1.0;
+  if (h->hp <= 0 || e->hp <= 0) {
+    out->open = 0.0;
+    if (e->hp <= 0) out->win = 1.0;
+    else out->loss = 1.0;
+    return true;
+  }
+  const CharacterStats *hs = character_stats(h);
+  const CharacterStats *es = character_stats(e);
+  const Skill *pas = &h->passive_skill;
+  int hn = (h->hp > h->hp_max ? h->hp : h->hp_max) + 1;
+  int en = (e->hp > e->hp_max ? e->hp : e->hp_max) + 1;
+  int h_lo = hs->min_dmg;
+  int h_rolls = hs->max_dmg < hs->min_dmg ? 1 : hs->max_dmg - hs->min_dmg + 1;
+  int e_lo = es->min_dmg;
+  int e_rolls = es->max_dmg < es->min_dmg ? 1 : es->max_dmg - es->min_dmg + 1;
+
+  size_t cells = (size_t)hn * (size_t)en;
+  double *cur = (double *)calloc(cells, sizeof(double));
+  double *next = (double *)calloc(cells, sizeof(double));
+  double *mid = (double *)calloc(cells * ODDS_CLASSES, sizeof(double));
+  double *kern = (double *)calloc((size_t)ODDS_CLASSES * hn * hn, sizeof(double));
+  double *roll_dmg = (double *)calloc((size_t)h_rolls * (2 + (size_t)en), sizeof(double));
+  int *ints = (int *)calloc((size_t)hn + en + (size_t)ODDS_CLASSES * hn + (size_t)h_rolls * (1 + (size_t)en), sizeof(int));
+  if (!cur || !next || !mid || !kern || !roll_dmg || !ints) {
+    free(cur);
+    free(next);
+    free(mid);
+    free(kern);
+    free(roll_dmg);
+    free(ints);
+    return false;
+  }
+  double *open_dmg = roll_dmg + h_rolls;      // unblocked damage per roll, after armor
+  double *block_dmg = open_dmg + h_rolls;     // [ehp * h_rolls + r] when blocked
+  int *h_regen = ints;                        // HP after regen
+  int *e_regen = h_regen + hn;
+  int *kern_lo = e_regen + en;                // lowest hp_after of each kernel row
+  int *open_hit = kern_lo + ODDS_CLASSES * hn;
+  int *block_hit = open_hit + h_rolls;
+  for (int hp = 0; hp < hn; ++hp) {
+    int r = hp;
+    if (h->regen_hp_base > 0 && r < h->hp_max) r = r + h->regen_hp_base > h->hp_max ? h->hp_max : r + h->regen_hp_base;
+    h_regen[hp] = r;
+  }
+  for (int hp = 0; hp < en; ++hp) {
+    int r = hp;
+    if (e->regen_hp_base > 0 && r < e->hp_max) r = r + e->regen_hp_base > e->hp_max ? e->hp_max : r + e->regen_hp_base;
+    e_regen[hp] = r;
+  }
+
+  bool dazed = strcmp(pas->code, "dazed") == 0;
+  bool traumatic = strcmp(h->active_skill.code, "traumatic_strike") == 0;
+  int classes[ODDS_CLASSES];
+  int class_count = 0;
+  classes[class_count++] = ODDS_PLAIN;
+  if (dazed) classes[class_count++] = ODDS_DAZED;
+  if (traumatic) classes[class_count++] = ODDS_TRAUMATIC;
+
+  // The enemy's strike: kern[(c * hn + hp) * hn + hp_after], before regen.
+  static const double type_dmg[3] = {1.0, 1.5, 0.7};
+  static const double type_acc[3] = {1.0, 0.7, 1.5};
+  int min_reduce = 10 + 3 * pas->lvl;
+  if (min_reduce > 90) min_reduce = 90;
+  double h_block = battle_odds_hit(hs->block_chance);
+  int h_armor_block = hs->armor - es->armor_penetration;
+  if (h_armor_block < 0) h_armor_block = 0;
+  for (int ci = 0; ci < class_count; ++ci) {
+    int c = classes[ci];
+    for (int hp = 1; hp < hn; ++hp) kern_lo[c * hn + hp] = hp;
+    for (int t = 0; t < 3; ++t) {
+      double p_hit = 0.0;
+      if (c == ODDS_DAZED) {
+        for (int reduce = min_reduce; reduce <= 90; ++reduce) {
+          p_hit += battle_odds_hit(es->accuracy * (0.01 * (100 - reduce)) * type_acc[t]);
+        }
+        p_hit /= 91 - min_reduce;
+      } else {
+        double mod = c == ODDS_TRAUMATIC ? skill_traumatic_effect_coef(&h->active_skill) : 1.0;
+        p_hit = battle_odds_hit(es->accuracy * mod * type_acc[t]);
+      }
+      for (int hp = 1; hp < hn; ++hp) {
+        double *row = kern + ((size_t)c * hn + hp) * hn;
+        row[hp] += (1.0 - p_hit) / 3.0;
+        double p = p_hit / 3.0 / e_rolls;
+        for (int r = 0; r < e_rolls; ++r) {
+          for (int blocked = 0; blocked < 2; ++blocked) {
+            double q = p * (blocked ? h_block : 1.0 - h_block);
+            if (q <= 0.0) continue;
+            double d = (double)(e_lo + r) * type_dmg[t];
+            if (blocked) d /= 1.0 + (double)hp / 200.0;
+            d -= h_armor_block;
+            if (d < 0) d = 0;
+            int after = hp - (int)round(d);
+            if (after < 0) after = 0;
+            row[after] += q;
+            if (after < kern_lo[c * hn + hp]) kern_lo[c * hn + hp] = after;
+          }
+        }
+      }
+    }
   }
-}
 
-static void recipe_apply_weapon(const OccultRecipe *r, WeaponItem *w) {
-  if (!r || !w || strcmp(w->code, "without") == 0) return;
-  w->enhanced = true;
-  snprintf(w->enhance_name, sizeof(w->enhance_name), "%s", r->code);
-  w->enhance_accuracy += r->weapon.accuracy;
-  w->enhance_min_dmg += r->weapon.min_dmg;
-  w->enhance_max_dmg += r->weapon.max_dmg;
-  w->enhance_block_chance += r->weapon.block_chance;
-  w->enhance_armor_penetration += r->weapon.armor_penetration;
+  bool has_active = strcmp(h->active_skill.code, "none") != 0;
+  int mp = h->mp;
+  double e_block = battle_odds_hit(es->block_chance);
+  int e_armor_block = es->armor - hs->armor_penetration;
+  if (e_armor_block < 0) e_armor_block = 0;
+  bool berserk = strcmp(pas->code, "berserk") == 0;
+  double coef = h->mp_max * (0.1 + 0.005 * pas->lvl) - 10.0;
+  int conc = strcmp(pas->code, "concentration") == 0 && coef > 0 ? (int)coef + 1 : 1;
+  double dazed_part = dazed ? skill_dazed_hp_part_coef(pas) : 0.0;
+  // With berserk a blocked strike depends on both HPs; rows per (attack, hero HP) are
+  // filled on first use and reused by later rounds.
+  int *berserk_hit = NULL;
+  unsigned char *berserk_ready = NULL;
+  if (berserk && e_block > 0.0 && (size_t)2 * hn * en * h_rolls <= BATTLE_ODDS_BERSERK_TABLE) {
+    berserk_hit = (int *)malloc((size_t)2 * hn * en * h_rolls * sizeof(int));
+    berserk_ready = (unsigned char *)calloc((size_t)2 * hn, 1);
+    if (!berserk_hit || !berserk_ready) {
+      free(berserk_hit);
+      free(berserk_ready);
+      berserk_hit = NULL;
+      berserk_ready = NULL;
+    }
+  }
+
+  double win = 0.0, loss = 0.0, rounds = 0.0, hp_lost = 0.0, alive = 1.0, dropped = 0.0;
+  int hp0 = h->hp;
+  int h0 = h->hp, h1 = h->hp, e0 = e->hp, e1 = e->hp; // bounding box of cur
+  cur[(size_t)h->hp * en + e->hp] = 1.0;
+  int round_no = 0;
+  for (; round_no < SIM_MAX_ROUNDS && alive > BATTLE_ODDS_CUTOFF; ++round_no) {
+    bool skill = has_active && mp >= h->active_skill.mp_cost;
+    int at = skill ? 4 : base_attack;
+    if (skill) mp -= h->active_skill.mp_cost;
+    double dmg_f = at == 2 ? 1.5 : at == 3 ? 0.7 : at == 4 ? skill_active_damage_mod(&h->active_skill, h) : 1.0;
+    double acc_f = at == 2 ? 0.7 : at == 3 ? 1.5 : at == 4 ? skill_active_accuracy_mod(&h->active_skill, h) : 1.0;
+    double p_hit = battle_odds_hit(hs->accuracy * acc_f);
+    int strike_class = at == 4 && traumatic ? ODDS_TRAUMATIC : ODDS_PLAIN;
+    double done = (double)(round_no + 1);
+    // Without berserk a blocked strike depends on the enemy's HP only.
+    bool block_table = e_block > 0.0 && !berserk;
+    for (int ehp = e0; block_table && ehp <= e1; ++ehp) {
+      for (int r = 0; r < h_rolls; ++r) {
+        double d = (double)(h_lo + r) * dmg_f / (1.0 + (double)ehp / 200.0) - e_armor_block;
+        if (d < 0) d = 0;
+        block_dmg[(size_t)ehp * h_rolls + r] = d;
+        block_hit[(size_t)ehp * h_rolls + r] = (int)round(d);
+      }
+    }
+
+    // The hero's strike, into mid by class.
+    int max_hit = 0;
+    for (int hp = h0; hp <= h1; ++hp) {
+      double hp_part = h->hp_max > 0 ? (double)hp / h->hp_max : 0.0;
+      double berserk_coef = berserk ? 1.0 + (1.0 - hp_part) * (0.5 + 0.05 * pas->lvl) : 1.0;
+      for (int r = 0; r < h_rolls; ++r) {
+        roll_dmg[r] = (double)(h_lo + r) * dmg_f * berserk_coef;
+        double d = roll_dmg[r] - e_armor_block;
+        open_dmg[r] = d < 0 ? 0 : d;
+        open_hit[r] = (int)round(open_dmg[r]);
+        if (open_hit[r] > max_hit) max_hit = open_hit[r];
+      }
+      double *row[ODDS_CLASSES];
+      for (int c = 0; c < ODDS_CLASSES; ++c) row[c] = mid + ((size_t)c * hn + hp) * en;
+      double row_win = 0.0;
+      double *src = cur + (size_t)hp * en;
+      if (conc == 1 && !dazed) {
+        // Every strike lands in one class, so each roll is a shift of the whole row.
+        double *dst = row[strike_class];
+        for (int ehp = e0; ehp <= e1; ++ehp) {
+          if (src[ehp] != 0.0 && src[ehp] < BATTLE_ODDS_CELL_CUTOFF) {
+            dropped += src[ehp];
+            src[ehp] = 0.0;
+          }
+          row[ODDS_PLAIN][ehp] += src[ehp] * (1.0 - p_hit);
+        }
+        double q_open = p_hit / h_rolls * (1.0 - e_block);
+        double q_block = p_hit / h_rolls * e_block;
+        const int *hits = block_table ? block_hit : NULL;
+        if (berserk_hit && q_block > 0.0) {
+          int slot = (at == 4) * hn + hp;
+          int *fill = berserk_hit + (size_t)slot * en * h_rolls;
+          if (!berserk_ready[slot]) {
+            for (int ehp = 0; ehp < en; ++ehp) {
+              for (int r = 0; r < h_rolls; ++r) {
+                double d = roll_dmg[r] / (1.0 + (double)ehp / 200.0) - e_armor_block;
+                fill[(size_t)ehp * h_rolls + r] = d < 0 ? 0 : (int)round(d);
+              }
+            }
+            berserk_ready[slot] = 1;
+          }
+          hits = fill;
+        }
+        for (int r = 0; r < h_rolls && q_open > 0.0; ++r) {
+          int hit = open_hit[r];
+          int ehp = e0;
+          for (; ehp <= e1 && ehp <= hit; ++ehp) row_win += src[ehp] * q_open;
+          for (; ehp <= e1; ++ehp) dst[ehp - hit] += src[ehp] * q_open;
+        }
+        for (int ehp = e0; ehp <= e1 && q_block > 0.0; ++ehp) {
+          double m = src[ehp] * q_block;
+          if (m == 0.0) continue;
+          for (int r = 0; r < h_rolls; ++r) {
+            int hit;
+            if (hits) {
+              hit = hits[(size_t)ehp * h_rolls + r];
+            } else {
+              double d = roll_dmg[r] / (1.0 + (double)ehp / 200.0) - e_armor_block;
+              hit = d < 0 ? 0 : (int)round(d);
+            }
+            if (ehp - hit <= 0) row_win += m;
+            else dst[ehp - hit] += m;
+          }
+        }
+        memset(src + e0, 0, (size_t)(e1 - e0 + 1) * sizeof(double));
+        win += row_win;
+        rounds += row_win * done;
+        hp_lost += row_win * (hp0 - hp);
+        continue;
+      }
+      for (int ehp = e0; ehp <= e1; ++ehp) {
+        double m = src[ehp];
+        if (m == 0.0) continue;
+        src[ehp] = 0.0;
+        if (m < BATTLE_ODDS_CELL_CUTOFF) {
+          dropped += m;
+          continue;
+        }
+        row[ODDS_PLAIN][ehp] += m * (1.0 - p_hit);
+        double q_open = m * p_hit / h_rolls / conc * (1.0 - e_block);
+        double q_block = m * p_hit / h_rolls / conc * e_block;
+        for (int r = 0; r < h_rolls && q_open > 0.0; ++r) {
+          row_win += battle_odds_land(row, ehp - open_hit[r], open_dmg[r], q_open, conc, strike_class, dazed_part);
+        }
+        for (int r = 0; r < h_rolls && q_block > 0.0; ++r) {
+          double d;
+          int hit;
+          if (block_table) {
+            d = block_dmg[(size_t)ehp * h_rolls + r];
+            hit = block_hit[(size_t)ehp * h_rolls + r];
+          } else {
+            d = roll_dmg[r] / (1.0 + (double)ehp / 200.0) - e_armor_block;
+            if (d < 0) d = 0;
+            hit = (int)round(d);
+          }
+          row_win += battle_odds_land(row, ehp - hit, d, q_block, conc, strike_class, dazed_part);
+        }
+      }
+      win += row_win;
+      rounds += row_win * done;
+      hp_lost += row_win * (hp0 - hp);
+    }
+
+    // The enemy's strike, into next. A blocked strike never does more damage than
+    // the same roll unblocked, so nothing in mid lies below first.
+    int first = e0 - max_hit - (conc - 1);
+    if (first < 1) first = 1;
+    int n0 = hn, n1 = -1, m0 = en, m1 = -1;
+    alive = 0.0;
+    for (int ci = 0; ci < class_count; ++ci) {
+      int c = classes[ci];
+      for (int hp = h0; hp <= h1; ++hp) {
+        double *layer = mid + ((size_t)c * hn + hp) * en;
+        int lo = first, hi = e1;
+        while (lo <= hi && layer[lo] == 0.0) lo++;
+        while (hi >= lo && layer[hi] == 0.0) hi--;
+        if (lo > hi) continue;
+        double sum = 0.0;
+        for (int ehp = lo; ehp <= hi; ++ehp) sum += layer[ehp];
+        const double *row = kern + ((size_t)c * hn + hp) * hn;
+        for (int after = kern_lo[c * hn + hp]; after <= hp; ++after) {
+          double k = row[after];
+          if (k == 0.0) continue;
+          int hr = h_regen[after];
+          if (hr <= 0) {
+            loss += sum * k;
+            rounds += sum * k * done;
+            hp_lost += sum * k * hp0;
+            continue;
+          }
+          double *dst = next + (size_t)hr * en;
+          for (int ehp = lo; ehp <= hi; ++ehp) dst[ehp] += layer[ehp] * k;
+          if (hr < n0) n0 = hr;
+          if (hr > n1) n1 = hr;
+          alive += sum * k;
+        }
+        if (lo < m0) m0 = lo;
+        if (hi > m1) m1 = hi;
+        memset(layer + lo, 0, (size_t)(hi - lo + 1) * sizeof(double));
+      }
+    }
+    // The enemy's regen does not depend on the hero, so it is one pass over next.
+    if (e->regen_hp_base > 0 && n1 >= 0) {
+      for (int hp = n0; hp <= n1; ++hp) {
+        double *dst = next + (size_t)hp * en;
+        for (int ehp = m1; ehp >= m0; --ehp) {
+          if (dst[ehp] == 0.0 || e_regen[ehp] == ehp) continue;
+          dst[e_regen[ehp]] += dst[ehp];
+          dst[ehp] = 0.0;
+        }
+      }
+      m0 = e_regen[m0];
+      m1 = e_regen[m1];
+    }
+    if (h->regen_mp_base > 0 && mp < h->mp_max) mp = mp + h->regen_mp_base > h->mp_max ? h->mp_max : mp + h->regen_mp_base;
+
+    double *tmp = cur;
+    cur = next;
+    next = tmp;
+    if (n1 < 0) break;
+    h0 = n0;
+    h1 = n1;
+    e0 = m0;
+    e1 = m1;
+  }
+
+  double finished = win + loss;
+  out->win = win;
+  out->loss = loss;
+  out->open = (alive > 0.0 ? alive : 0.0) + dropped;
+  out->hp_lost = finished > 0.0 ? hp_lost / finished : 0.0;
+  out->rounds = finished > 0.0 ? rounds / finished : 0.0;
+  free(cur);
+  free(next);
+  free(mid);
+  free(kern);
+  free(roll_dmg);
+  free(ints);
+  free(berserk_hit);
+  free(berserk_ready);
+  return true;
 }
 
-static void recipe_apply_armor(const OccultRecipe *r, ArmorItem *a, const RecipeEffect *e) {
-  if (!r || !a || !e || strcmp(a->code, "without") == 0) return;
-  a->enhanced = true;
-  snprintf(a->enhance_name, sizeof(a->enhance_name), "%s", r->code);
-  a->enhance_accuracy += e->accuracy;
-  a->enhance_armor += e->armor;
+// battle_odds_compute memoized on everything it reads, so redrawing the enemy choice
+// screen or asking again for the same matchup costs one key comparison per entry.
+static BattleOdds battle_odds(BattleOddsCache *cache, const Character *h, const Character *e, int base_attack) {
+  BattleOddsKey key;
+  battle_odds_key(h, e, base_attack, &key);
+  for (int i = 0; i < cache->count; ++i) {
+    if (memcmp(&cache->keys[i], &key, sizeof(key)) == 0) return cache->odds[i];
+  }
+  BattleOdds odds;
+  if (!battle_odds_compute(h, e, base_attack, &odds)) return odds;
+  int slot = cache->next;
+  cache->next = (cache->next + 1) % BATTLE_ODDS_CACHE;
+  if (cache->count < BATTLE_ODDS_CACHE) cache->count++;
+  cache->keys[slot] = key;
+  cache->odds[slot] = odds;
+  return odds;
 }
 
-static void recipe_apply_shield(const OccultRecipe *r, ShieldItem *s) {
-  if (!r || !s || strcmp(s->code, "without") == 0) return;
-  s->enhanced = true;
-  snprintf(s->enhance_name, sizeof(s->enhance_name), "%s", r->code);
-  s->enhance_accuracy += r->shield.accuracy;
-  s->enhance_armor += r->shield.armor;
-  s->enhance_block_chance += r->shield.block_chance;
-  s->enhance_min_dmg += r->shield.min_dmg;
-  s->enhance_max_dmg += r->shield.max_dmg;
+static int monolith_points_from_enemy(const Character *hero, const Character *enemy, Rng *rng) {
+  if (!hero || !enemy) return 0;
+  double stats_sum = 0.0;
+  const double hero_stats[] = {
+      (double)hero->hp_max, (double)hero->mp_max,
+      (double)character_min_dmg(hero), (double)character_max_dmg(hero),
+      (double)hero->regen_hp_base, (double)hero->regen_mp_base,
+      (double)character_armor(hero), (double)character_accuracy(hero)
+  };
+  const double enemy_stats[] = {
+      (double)enemy->hp_max, (double)enemy->mp_max,
+      (double)character_min_dmg(enemy), (double)character_max_dmg(enemy),
+      (double)enemy->regen_hp_base, (double)enemy->regen_mp_base,
+      (double)character_armor(enemy), (double)character_accuracy(enemy)
+  };
+  int count = (int)(sizeof(hero_stats) / sizeof(hero_stats[0]));
+  for (int i = 0; i < count; ++i) {
+    if (hero_stats[i] <= 1.0) stats_sum += enemy_stats[i];
+    else stats_sum += enemy_stats[i] / hero_stats[i];
+  }
+  double probability = stats_sum / count;
+  int points = (int)floor(probability);
+  double frac = probability - points;
+  if (rng_uniform(rng) < frac) points += 1;
+  if (points < 0) points = 0;
+  return points;
 }
 
-static int compare_recipe_code(const void *a, const void *b, void *ctx) {
-  const OccultLibraryData *ol = (const OccultLibraryData *)ctx;
-  size_t ia = *(const size_t *)a;
-  size_t ib = *(const size_t *)b;
-  if (!ol) return 0;
-  return strcmp(ol->recipes[ia].code, ol->recipes[ib].code);
+static void game_init(Game *g) {
+  memset(g, 0, sizeof(*g));
+  g->state = STATE_START;
+  g->next_state = STATE_START;
+  game_seed(g, (uint64_t)time(NULL));
+  logbuffer_init(&g->log);
+  g->message_art_name[0] = '\0';
+  g->message_art_path[0] = '\0';
+  g->hero_selected = 0;
+  g->name_len = 0;
+  g->name_input[0] = '\0';
+  g->name_error[0] = '\0';
+  g->stat_dice1 = 0;
+  g->stat_dice2 = 0;
+  g->stat_roll = 0;
+  g->skill_dice1 = 0;
+  g->skill_dice2 = 0;
+  g->skill_choice_count = 0;
+  g->return_state = STATE_START;
+  g->ammo_show_type[0] = '\0';
+  g->ammo_show_code[0] = '\0';
+  g->stats_dungeon_index = 0;
+  g->current_recipe_index = -1;
+  g->loot_count = 0;
+  g->loot_index = 0;
+  g->loot_show_coins = 0;
+  g->loot_show_ingredient = 0;
+  g->loot_message_mode = 0;
+  g->loot_coins = 0;
+  g->loot_ingredient[0] = '\0';
+  g->loot_message[0] = '\0';
+  g->event_choice_count = 0;
+  g->event_message[0] = '\0';
+  g->event_art_path[0] = '\0';
+  g->event_art_name[0] = '\0';
+  g->event_choose_message[0] = '\0';
+  g->event_code[0] = '\0';
+  g->event_step = 0;
+  for (int i = 0; i < 4; ++i) g->event_data[i] = 0;
+  g->event_input_mode = EVENT_INPUT_NONE;
+  g->event_text[0] = '\0';
+  g->event_text_len = 0;
+  g->event_pending_action = EVENT_PENDING_NONE;
+  g->wg_taken = 0;
+  g->wg_enemy[0] = '\0';
+  g->wg_count = 0;
+  g->wg_level = 0;
+  g->anim_speed_index = 1;
+  g->screen_replace_type = 1;
+  snprintf(g->battle_art_name, sizeof(g->battle_art_name), "normal");
+  g->battle_art_dungeon[0] = '\0';
+  g->battle_anim_active = 0;
+  g->battle_anim_step = 0;
+  g->battle_anim_count = 0;
+  g->battle_anim_deadline = 0;
+  g->battle_exit_pending = 0;
+  g->battle_exit_state = STATE_BATTLE;
+  g->force_instant_redraw = 0;
+  g->loot_return_state = STATE_CAMPFIRE;
+  g->loot_return_pending = 0;
+  g->loot_last_taken = -1;
+  for (int i = 0; i < 3; ++i) g->enemy_choice_is_boss[i] = 0;
+  g->enemy_is_boss = 0;
+  g->enemy_choose_message[0] = '\0';
+  for (int i = 0; i < 3; ++i) g->enemy_choice_is_boss[i] = 0;
+  shop_init_default(&g->shop);
+  warehouse_init_default(&g->warehouse);
+  monolith_init_default(&g->monolith);
+  statistics_total_init_default(&g->stats_total);
+  g->occult.recipes = NULL;
+  g->occult.recipe_count = 0;
+  snprintf(g->dungeons[0].name, sizeof(g->dungeons[0].name), "bandits");
+  snprintf(g->dungeons[1].name, sizeof(g->dungeons[1].name), "undeads");
+  snprintf(g->dungeons[2].name, sizeof(g->dungeons[2].name), "swamp");
 }
 
-static size_t *occult_accessible_indices(const OccultLibraryData *ol, size_t *out_count) {
-  if (out_count) *out_count = 0;
-  if (!ol) return NULL;
-  size_t *indices = (size_t *)calloc(ol->recipe_count, sizeof(size_t));
-  if (!indices) return NULL;
-  size_t count = 0;
-  for (size_t i = 0; i < ol->recipe_count; ++i) {
-    if (ol->recipes[i].purchased) indices[count++] = i;
+static void game_free(Game *g) {
+  if (!g) return;
+  if (g->heroes) {
+    for (size_t i = 0; i < g->hero_count; ++i) {
+      free_string_list(g->heroes[i].weapon_options, g->heroes[i].weapon_count);
+      free_string_list(g->heroes[i].body_armor_options, g->heroes[i].body_armor_count);
+      free_string_list(g->heroes[i].head_armor_options, g->heroes[i].head_armor_count);
+      free_string_list(g->heroes[i].arms_armor_options, g->heroes[i].arms_armor_count);
+      free_string_list(g->heroes[i].shield_options, g->heroes[i].shield_count);
+    }
+    free(g->heroes);
   }
-  if (count > 1) {
-    qsort_r(indices, count, sizeof(size_t), compare_recipe_code, (void *)ol);
+  for (int i = 0; i < 3; ++i) {
+    if (g->dungeons[i].enemies) {
+      for (size_t j = 0; j < g->dungeons[i].enemy_count; ++j) {
+        free_string_list(g->dungeons[i].enemies[j].weapon_options, g->dungeons[i].enemies[j].weapon_count);
+        free_string_list(g->dungeons[i].enemies[j].body_armor_options, g->dungeons[i].enemies[j].body_armor_count);
+        free_string_list(g->dungeons[i].enemies[j].head_armor_options, g->dungeons[i].enemies[j].head_armor_count);
+        free_string_list(g->dungeons[i].enemies[j].arms_armor_options, g->dungeons[i].enemies[j].arms_armor_count);
+        free_string_list(g->dungeons[i].enemies[j].shield_options, g->dungeons[i].enemies[j].shield_count);
+        free_string_list(g->dungeons[i].enemies[j].ingredient_options, g->dungeons[i].enemies[j].ingredient_count);
+      }
+      free(g->dungeons[i].enemies);
+    }
   }
-  if (out_count) *out_count = count;
-  return indices;
-}
-
-static bool save_hero_in_run(const Game *g) {
-  if (!g) return false;
-  char *saves_dir = resolve_saves_dir();
-  if (!saves_dir) return false;
-  char path[512];
-  snprintf(path, sizeof(path), "%s/hero_in_run.yml", saves_dir);
-  free(saves_dir);
-
-  FILE *f = fopen(path, "w");
-  if (!f) return false;
+  if (g->event_enemies) {
+    for (size_t j = 0; j < g->event_enemy_count; ++j) {
+      free_string_list(g->event_enemies[j].weapon_options, g->event_enemies[j].weapon_count);
+      free_string_list(g->event_enemies[j].body_armor_options, g->event_enemies[j].body_armor_count);
+      free_string_list(g->event_enemies[j].head_armor_options, g->event_enemies[j].head_armor_count);
+      free_string_list(g->event_enemies[j].arms_armor_options, g->event_enemies[j].arms_armor_count);
+      free_string_list(g->event_enemies[j].shield_options, g->event_enemies[j].shield_count);
+      free_string_list(g->event_enemies[j].ingredient_options, g->event_enemies[j].ingredient_count);
+    }
+    free(g->event_enemies);
+  }
+  free(g->weapons);
+  free(g->body_armors);
+  free(g->head_armors);
+  free(g->arms_armors);
+  free(g->shields);
+  occult_library_free(&g->occult);
+  value_map_free(&g->hero.ingredients);
+  logbuffer_free(&g->log);
+}
 
-  const Character *h = &g->hero;
-  fprintf(f, "hero_create:\n");
-  fprintf(f, "  name: ");
-  yaml_write_escaped(f, h->name);
-  fprintf(f, "\n");
-  fprintf(f, "  background: %s\n", h->background[0] ? h->background : h->code);
+static void game_prepare_hero_select(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  value_map_set(main_map, "main", "Select a background");
 
-  fprintf(f, "hero_stats:\n");
-  fprintf(f, "  hp: %d\n", h->hp);
-  fprintf(f, "  hp_max: %d\n", h->hp_max);
-  fprintf(f, "  regen_hp_base: %d\n", h->regen_hp_base);
-  fprintf(f, "  mp: %d\n", h->mp);
-  fprintf(f, "  mp_max: %d\n", h->mp_max);
-  fprintf(f, "  regen_mp_base: %d\n", h->regen_mp_base);
-  fprintf(f, "  min_dmg_base: %d\n", h->min_dmg_base);
-  fprintf(f, "  max_dmg_base: %d\n", h->max_dmg_base);
-  fprintf(f, "  accuracy_base: %d\n", h->accuracy_base);
-  fprintf(f, "  armor_base: %d\n", h->armor_base);
-  fprintf(f, "  block_chance_base: %d\n", h->block_chance_base);
-  fprintf(f, "  armor_penetration_base: %d\n", h->armor_penetration_base);
-  fprintf(f, "  exp: %d\n", h->exp);
-  fprintf(f, "  lvl: %d\n", h->lvl);
-  fprintf(f, "  stat_points: %d\n", h->stat_points);
-  fprintf(f, "  skill_points: %d\n", h->skill_points);
+  logbuffer_clear(&g->log);
+  logbuffer_push(&g->log, "Background:   HP:         MP:         Min dmg:    Max dmg:    Accuracy:   Armor:");
+  for (size_t i = 0; i < g->hero_count; ++i) {
+    char line[256];
+    const HeroTemplate *h = &g->heroes[i];
+    snprintf(line, sizeof(line), "[Enter %2zu]  %-10s  %-10d %-10d %-10d %-10d %-10d %-10d", i + 1, h->name, h->hp, h->mp, h->min_dmg, h->max_dmg, h->accuracy, h->armor);
+    logbuffer_push(&g->log, line);
+  }
+  logbuffer_apply_full(main_map, &g->log, 60);
+}
 
-  fprintf(f, "hero_skills:\n");
-  fprintf(f, "  active_skill:\n");
-  fprintf(f, "    code: %s\n", h->active_skill.code);
-  fprintf(f, "    lvl: %d\n", h->active_skill.lvl);
-  fprintf(f, "  passive_skill:\n");
-  fprintf(f, "    code: %s\n", h->passive_skill.code);
-  fprintf(f, "    lvl: %d\n", h->passive_skill.lvl);
-  fprintf(f, "  camp_skill:\n");
-  fprintf(f, "    code: %s\n", h->camp_skill.code);
-  fprintf(f, "    lvl: %d\n", h->camp_skill.lvl);
+static void game_prepare_name_input(Game *g, ValueMap *main_map, const char *error) {
+  value_map_clear(main_map);
+  char title[128];
+  snprintf(title, sizeof(title), "Enter character name: %s", g->name_input);
+  value_map_set(main_map, "main", title);
+  logbuffer_clear(&g->log);
+  const char *err = error;
+  if (!err || !err[0]) err = g->name_error;
+  if (err && err[0]) {
+    logbuffer_push(&g->log, err);
+  }
+  logbuffer_push(&g->log, "The character name must contain at least 1 letter and be no more than 20 characters");
+  logbuffer_apply_full(main_map, &g->log, 20);
+}
 
-  fprintf(f, "hero_ammunition:\n");
-  fprintf(f, "  weapon:\n");
-  fprintf(f, "    code: %s\n", h->weapon.code);
-  fprintf(f, "    enhance_code: ");
-  yaml_write_escaped(f, h->weapon.enhanced ? h->weapon.enhance_name : "");
-  fprintf(f, "\n");
-  fprintf(f, "  body_armor:\n");
-  fprintf(f, "    code: %s\n", h->body_armor.code);
-  fprintf(f, "    enhance_code: ");
-  yaml_write_escaped(f, h->body_armor.enhanced ? h->body_armor.enhance_name : "");
-  fprintf(f, "\n");
-  fprintf(f, "  head_armor:\n");
-  fprintf(f, "    code: %s\n", h->head_armor.code);
-  fprintf(f, "    enhance_code: ");
-  yaml_write_escaped(f, h->head_armor.enhanced ? h->head_armor.enhance_name : "");
-  fprintf(f, "\n");
-  fprintf(f, "  arms_armor:\n");
-  fprintf(f, "    code: %s\n", h->arms_armor.code);
-  fprintf(f, "    enhance_code: ");
-  yaml_write_escaped(f, h->arms_armor.enhanced ? h->arms_armor.enhance_name : "");
-  fprintf(f, "\n");
-  fprintf(f, "  shield:\n");
-  fprintf(f, "    code: %s\n", h->shield.code);
-  fprintf(f, "    enhance_code: ");
-  yaml_write_escaped(f, h->shield.enhanced ? h->shield.enhance_name : "");
-  fprintf(f, "\n");
+static void game_prepare_skill_select(Game *g, ValueMap *main_map, SkillType type) {
+  value_map_clear(main_map);
+  if (type == SKILL_ACTIVE) value_map_set(main_map, "main", "Select an active skill");
+  else if (type == SKILL_PASSIVE) value_map_set(main_map, "main", "Select a passive skill");
+  else value_map_set(main_map, "main", "Select a camp skill");
 
-  fprintf(f, "dungeon_name: %s\n", h->dungeon_name[0] ? h->dungeon_name : g->dungeons[g->dungeon_index].name);
-  fprintf(f, "dungeon_part_number: %d\n", h->dungeon_part_number);
-  fprintf(f, "leveling: %d\n", h->leveling);
+  logbuffer_clear(&g->log);
 
-  fprintf(f, "camp_loot:\n");
-  fprintf(f, "  pzdc_monolith_points: %d\n", h->pzdc_monolith_points);
-  fprintf(f, "  coins: %d\n", h->coins);
+  const char *skills_active[] = {"ascetic_strike", "precise_strike", "strong_strike", "traumatic_strike"};
+  const char *skills_passive[] = {"berserk", "concentration", "dazed", "shield_master"};
+  const char *skills_camp[] = {"bloody_ritual", "first_aid", "treasure_hunter"};
+  const char **list = skills_active;
+  size_t count = sizeof(skills_active) / sizeof(skills_active[0]);
+  if (type == SKILL_PASSIVE) { list = skills_passive; count = sizeof(skills_passive) / sizeof(skills_passive[0]); }
+  if (type == SKILL_CAMP) { list = skills_camp; count = sizeof(skills_camp) / sizeof(skills_camp[0]); }
 
-  fprintf(f, "ingredients:\n");
-  if (h->ingredients.count == 0) {
-    fprintf(f, "  {}\n");
-  } else {
-    for (size_t i = 0; i < h->ingredients.count; ++i) {
-      fprintf(f, "  %s: %s\n", h->ingredients.items[i].key, h->ingredients.items[i].value);
-    }
-  }
-  if (g->wg_taken) {
-    fprintf(f, "events_data:\n");
-    fprintf(f, "  wariors_grave:\n");
-    fprintf(f, "    taken: 1\n");
-    fprintf(f, "    enemy: %s\n", g->wg_enemy[0] ? g->wg_enemy : "poacher");
-    fprintf(f, "    count: %d\n", g->wg_count);
-    fprintf(f, "    level: %d\n", g->wg_level);
-  } else {
-    fprintf(f, "events_data: {}\n");
+  for (size_t i = 0; i < count; ++i) {
+    Skill s;
+    skill_assign(&s, type, list[i]);
+    char desc[160];
+    skill_description_short(&s, &g->hero, desc, sizeof(desc));
+    char line[240];
+    snprintf(line, sizeof(line), "   [Enter %zu]   %-20s %s", i + 1, s.name, desc);
+    logbuffer_push(&g->log, line);
   }
+  logbuffer_apply_full(main_map, &g->log, 60);
+}
 
-  fclose(f);
-  return true;
+static void game_prepare_start(Game *g, ValueMap *main_map, const char *version) {
+  value_map_clear(main_map);
+  value_map_set(main_map, "main", version ? version : "v");
+  logbuffer_clear(&g->log);
 }
 
-static bool load_hero_in_run(Game *g) {
-  if (!g) return false;
-  char *saves_dir = resolve_saves_dir();
-  if (!saves_dir) return false;
-  char path[512];
-  snprintf(path, sizeof(path), "%s/hero_in_run.yml", saves_dir);
-  free(saves_dir);
+static void game_prepare_load_menu(Game *g, ValueMap *main_map) {
+  (void)g;
+  value_map_clear(main_map);
+  value_map_set(main_map, "main", "");
+  logbuffer_clear(&g->log);
+}
 
-  Node *root = yaml_load_file(path);
-  if (!root || root->type != NODE_MAP) {
-    node_free(root);
-    return false;
-  }
+static void game_prepare_load_confirm(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  value_map_set(main_map, "main", "Load game [Enter 1]            Back to menu [Enter 0]");
+  char log0[64];
+  snprintf(log0, sizeof(log0), "%s", g->hero.dungeon_name);
+  if (log0[0]) log0[0] = (char)toupper((unsigned char)log0[0]);
+  value_map_set(main_map, "log_0", log0);
+  value_map_set_int(main_map, "log_1", g->hero.leveling + 1);
+}
 
-  Node *hero_create = node_map_get(root, "hero_create");
-  const char *name = node_map_str(hero_create, "name", "Hero");
-  const char *background = node_map_str(hero_create, "background", "passerby");
-  const HeroTemplate *tmpl = hero_template_by_code(g, background);
-  if (!tmpl) tmpl = (g->hero_count > 0) ? &g->heroes[0] : NULL;
-  if (!tmpl) {
-    node_free(root);
-    return false;
-  }
+static void game_prepare_choose_dungeon(Game *g, ValueMap *main_map) {
+  (void)g;
+  value_map_clear(main_map);
+  value_map_set(main_map, "main", "");
+  logbuffer_clear(&g->log);
+}
 
-  g->hero = character_from_hero(g, tmpl, name);
-  snprintf(g->hero.background, sizeof(g->hero.background), "%s", background);
-
-  Node *hero_stats = node_map_get(root, "hero_stats");
-  g->hero.hp = node_map_int(hero_stats, "hp", g->hero.hp);
-  g->hero.hp_max = node_map_int(hero_stats, "hp_max", g->hero.hp_max);
-  g->hero.regen_hp_base = node_map_int(hero_stats, "regen_hp_base", g->hero.regen_hp_base);
-  g->hero.mp = node_map_int(hero_stats, "mp", g->hero.mp);
-  g->hero.mp_max = node_map_int(hero_stats, "mp_max", g->hero.mp_max);
-  g->hero.regen_mp_base = node_map_int(hero_stats, "regen_mp_base", g->hero.regen_mp_base);
-  g->hero.min_dmg_base = node_map_int(hero_stats, "min_dmg_base", g->hero.min_dmg_base);
-  g->hero.max_dmg_base = node_map_int(hero_stats, "max_dmg_base", g->hero.max_dmg_base);
-  g->hero.accuracy_base = node_map_int(hero_stats, "accuracy_base", g->hero.accuracy_base);
-  g->hero.armor_base = node_map_int(hero_stats, "armor_base", g->hero.armor_base);
-  g->hero.block_chance_base = node_map_int(hero_stats, "block_chance_base", g->hero.block_chance_base);
-  g->hero.armor_penetration_base = node_map_int(hero_stats, "armor_penetration_base", g->hero.armor_penetration_base);
-  g->hero.exp = node_map_int(hero_stats, "exp", g->hero.exp);
-  g->hero.lvl = node_map_int(hero_stats, "lvl", g->hero.lvl);
-  g->hero.stat_points = node_map_int(hero_stats, "stat_points", g->hero.stat_points);
-  g->hero.skill_points = node_map_int(hero_stats, "skill_points", g->hero.skill_points);
-
-  Node *hero_skills = node_map_get(root, "hero_skills");
-  Node *active = node_map_get(hero_skills, "active_skill");
-  Node *passive = node_map_get(hero_skills, "passive_skill");
-  Node *camp = node_map_get(hero_skills, "camp_skill");
-  skill_assign(&g->hero.active_skill, SKILL_ACTIVE, node_map_str(active, "code", "none"));
-  g->hero.active_skill.lvl = node_map_int(active, "lvl", 0);
-  skill_assign(&g->hero.passive_skill, SKILL_PASSIVE, node_map_str(passive, "code", "none"));
-  g->hero.passive_skill.lvl = node_map_int(passive, "lvl", 0);
-  skill_assign(&g->hero.camp_skill, SKILL_CAMP, node_map_str(camp, "code", "none"));
-  g->hero.camp_skill.lvl = node_map_int(camp, "lvl", 0);
-
-  Node *hero_ammo = node_map_get(root, "hero_ammunition");
-  Node *w = node_map_get(hero_ammo, "weapon");
-  Node *b = node_map_get(hero_ammo, "body_armor");
-  Node *h = node_map_get(hero_ammo, "head_armor");
-  Node *a = node_map_get(hero_ammo, "arms_armor");
-  Node *s = node_map_get(hero_ammo, "shield");
-  g->hero.weapon = weapon_from_code(g, node_map_str(w, "code", "without"));
-  g->hero.body_armor = armor_from_code(g->body_armors, g->body_armor_count, node_map_str(b, "code", "without"));
-  g->hero.head_armor = armor_from_code(g->head_armors, g->head_armor_count, node_map_str(h, "code", "without"));
-  g->hero.arms_armor = armor_from_code(g->arms_armors, g->arms_armor_count, node_map_str(a, "code", "without"));
-  g->hero.shield = shield_from_code(g, node_map_str(s, "code", "without"));
-  const char *w_enh = node_map_str(w, "enhance_code", "");
-  const char *b_enh = node_map_str(b, "enhance_code", "");
-  const char *h_enh = node_map_str(h, "enhance_code", "");
-  const char *a_enh = node_map_str(a, "enhance_code", "");
-  const char *s_enh = node_map_str(s, "enhance_code", "");
-  if (w_enh && w_enh[0]) {
-    OccultRecipe *r = occult_recipe_by_code(&g->occult, w_enh);
-    if (r) recipe_apply_weapon(r, &g->hero.weapon);
-  }
-  if (b_enh && b_enh[0]) {
-    OccultRecipe *r = occult_recipe_by_code(&g->occult, b_enh);
-    if (r) recipe_apply_armor(r, &g->hero.body_armor, &r->body_armor);
-  }
-  if (h_enh && h_enh[0]) {
-    OccultRecipe *r = occult_recipe_by_code(&g->occult, h_enh);
-    if (r) recipe_apply_armor(r, &g->hero.head_armor, &r->head_armor);
-  }
-  if (a_enh && a_enh[0]) {
-    OccultRecipe *r = occult_recipe_by_code(&g->occult, a_enh);
-    if (r) recipe_apply_armor(r, &g->hero.arms_armor, &r->arms_armor);
+static void game_prepare_enemy_select(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  char line[256];
+  int len = snprintf(line, sizeof(line), "%s", g->enemy_choose_message[0] ? g->enemy_choose_message : "Choose your enemy");
+  for (int i = 0; i < g->enemy_choice_count && len > 0 && (size_t)len < sizeof(line); ++i) {
+    BattleOdds odds = battle_odds(&g->odds, &g->hero, &g->enemy_choices[i], 1);
+    len += snprintf(line + len, sizeof(line) - (size_t)len, "%s%.0f%%", i == 0 ? "   Win: " : " | ", 100.0 * odds.win);
   }
-  if (s_enh && s_enh[0]) {
-    OccultRecipe *r = occult_recipe_by_code(&g->occult, s_enh);
-    if (r) recipe_apply_shield(r, &g->hero.shield);
+  value_map_set(main_map, "main", line);
+  logbuffer_clear(&g->log);
+}
+
+static void game_prepare_battle(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  value_map_set(main_map, "main", "Battle");
+  char actions[160];
+  if (strcmp(g->hero.active_skill.code, "none") != 0) {
+    snprintf(actions, sizeof(actions), "Hit body [1]  Head [2]  Legs [3]  %s [4]", g->hero.active_skill.name);
+  } else {
+    snprintf(actions, sizeof(actions), "Hit body [1]  Head [2]  Legs [3]");
   }
+  value_map_set(main_map, "actions", actions);
+  logbuffer_apply_last(main_map, &g->log, 4);
+}
 
-  const char *dungeon_name = node_map_str(root, "dungeon_name", g->dungeons[g->dungeon_index].name);
-  snprintf(g->hero.dungeon_name, sizeof(g->hero.dungeon_name), "%s", dungeon_name);
-  g->hero.dungeon_part_number = node_map_int(root, "dungeon_part_number", 0);
-  g->hero.leveling = node_map_int(root, "leveling", 0);
+static void game_prepare_campfire(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  value_map_set_int(main_map, "additional_1", g->hero.stat_points);
+  value_map_set_int(main_map, "additional_2", g->hero.skill_points);
+  logbuffer_apply_full(main_map, &g->log, 3);
+}
 
-  Node *camp_loot = node_map_get(root, "camp_loot");
-  g->hero.pzdc_monolith_points = node_map_int(camp_loot, "pzdc_monolith_points", 0);
-  g->hero.coins = node_map_int(camp_loot, "coins", 0);
+static void game_prepare_camp(Game *g, ValueMap *main_map) {
+  (void)g;
+  value_map_clear(main_map);
+  value_map_set(main_map, "main", "");
+  logbuffer_clear(&g->log);
+}
 
-  value_map_clear(&g->hero.ingredients);
-  Node *ingredients = node_map_get(root, "ingredients");
-  if (ingredients && ingredients->type == NODE_MAP) {
-    for (size_t i = 0; i < ingredients->map.len; ++i) {
-      const char *k = ingredients->map.keys[i];
-      const char *v = node_scalar(ingredients->map.values[i]);
-      if (k && v) value_map_set(&g->hero.ingredients, k, v);
-    }
-  }
+static void game_prepare_shop(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  value_map_set_int(main_map, "coins", g->warehouse.coins);
 
-  g->wg_taken = 0;
-  g->wg_enemy[0] = '\0';
-  g->wg_count = 0;
-  g->wg_level = 0;
-  Node *events_data = node_map_get(root, "events_data");
-  if (events_data && events_data->type == NODE_MAP) {
-    Node *wg = node_map_get(events_data, "wariors_grave");
-    if (wg && wg->type == NODE_MAP) {
-      g->wg_taken = node_map_int(wg, "taken", 0);
-      const char *enemy = node_map_str(wg, "enemy", "");
-      if (enemy) snprintf(g->wg_enemy, sizeof(g->wg_enemy), "%s", enemy);
-      g->wg_count = node_map_int(wg, "count", 0);
-      g->wg_level = node_map_int(wg, "level", 0);
+  const char *types[] = {"weapon", "body_armor", "head_armor", "arms_armor", "shield"};
+  for (int t = 0; t < 5; ++t) {
+    char (*arr)[32] = NULL;
+    if (t == 0) arr = g->shop.weapon;
+    else if (t == 1) arr = g->shop.body_armor;
+    else if (t == 2) arr = g->shop.head_armor;
+    else if (t == 3) arr = g->shop.arms_armor;
+    else arr = g->shop.shield;
+    for (int i = 0; i < 3; ++i) {
+      char key[32];
+      snprintf(key, sizeof(key), "%s__%d", types[t], i);
+      value_map_set(main_map, key, ammo_name(g, types[t], arr[i]));
+      snprintf(key, sizeof(key), "%s__%d__price", types[t], i);
+      value_map_set_int(main_map, key, ammo_price(g, types[t], arr[i]));
     }
   }
 
-  node_free(root);
-  return true;
+  value_map_set(main_map, "weapon", ammo_name(g, "weapon", g->warehouse.weapon));
+  value_map_set(main_map, "body_armor", ammo_name(g, "body_armor", g->warehouse.body_armor));
+  value_map_set(main_map, "head_armor", ammo_name(g, "head_armor", g->warehouse.head_armor));
+  value_map_set(main_map, "arms_armor", ammo_name(g, "arms_armor", g->warehouse.arms_armor));
+  value_map_set(main_map, "shield", ammo_name(g, "shield", g->warehouse.shield));
 }
 
-static int rand_range(int min, int max) {
-  if (max < min) return min;
-  return min + rand() % (max - min + 1);
-}
+static void game_prepare_monolith(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  value_map_set_int(main_map, "points", g->monolith.points);
 
-static const char *weapon_name_from_code(const Game *g, const char *code) {
-  if (!g || !code) return "---";
-  for (size_t i = 0; i < g->weapon_count; ++i) {
-    if (strcmp(g->weapons[i].code, code) == 0) return g->weapons[i].name;
+  const char *stats[] = {"hp","mp","accuracy","damage","stat_points","skill_points","armor","regen_hp","regen_mp","armor_penetration","block_chance"};
+  for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); ++i) {
+    if (!stats[i]) continue;
+    value_map_set_int(main_map, stats[i], monolith_get_stat(&g->monolith, stats[i]));
+    char key[64];
+    snprintf(key, sizeof(key), "%s__p", stats[i]);
+    value_map_set_int(main_map, key, monolith_price_for(&g->monolith, stats[i]));
   }
-  if (strcmp(code, "without") == 0) return "without";
-  return code;
 }
 
-static const char *armor_name_from_code(const ArmorItem *items, size_t count, const char *code) {
-  if (!items || !code) return "---";
-  for (size_t i = 0; i < count; ++i) {
-    if (strcmp(items[i].code, code) == 0) return items[i].name;
+static void format_hero_ingredients(const Character *h, char *out, size_t out_sz) {
+  if (!out || out_sz == 0) return;
+  out[0] = '\0';
+  if (!h || h->ingredients.count == 0) {
+    snprintf(out, out_sz, "Your ingredients:     ---");
+    return;
   }
-  if (strcmp(code, "without") == 0) return "without";
-  return code;
+  char list[512] = {0};
+  bool first = true;
+  for (size_t i = 0; i < h->ingredients.count; ++i) {
+    char name_buf[64];
+    titleize_token(h->ingredients.items[i].key, name_buf, sizeof(name_buf));
+    char num[16];
+    const char *text = value_map_value_at(&h->ingredients, i, num, sizeof(num));
+    int val = atoi(text ? text : "0");
+    append_kv(list, sizeof(list), name_buf, val, &first);
+  }
+  snprintf(out, out_sz, "Your ingredients:     %s", list[0] ? list : "---");
 }
 
-static const char *shield_name_from_code(const Game *g, const char *code) {
-  if (!g || !code) return "---";
-  for (size_t i = 0; i < g->shield_count; ++i) {
-    if (strcmp(g->shields[i].code, code) == 0) return g->shields[i].name;
+static void game_prepare_occult_library(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  char buf[128];
+  value_map_set_int(main_map, "coins", g->warehouse.coins);
+
+  for (int i = 1; i <= 24; ++i) {
+    OccultRecipe *r = occult_recipe_by_view_code(&g->occult, i);
+    char key[32];
+    if (r) {
+      snprintf(key, sizeof(key), "show__%d", i);
+      snprintf(buf, sizeof(buf), "[Enter %c]", (char)('A' + (i - 1)));
+      value_map_set(main_map, key, buf);
+      snprintf(key, sizeof(key), "name__%d", i);
+      value_map_set(main_map, key, r->name);
+      snprintf(key, sizeof(key), "price__%d", i);
+      if (r->purchased) value_map_set(main_map, key, "SOLD");
+      else { value_map_set_int(main_map, key, r->price); }
+      snprintf(key, sizeof(key), "status__%d", i);
+      if (r->purchased) value_map_set(main_map, key, "IN YOUR WAREHOUSE");
+      else { snprintf(buf, sizeof(buf), "[Enter %d]", i); value_map_set(main_map, key, buf); }
+    } else {
+      snprintf(key, sizeof(key), "show__%d", i); value_map_set(main_map, key, "");
+      snprintf(key, sizeof(key), "name__%d", i); value_map_set(main_map, key, "");
+      snprintf(key, sizeof(key), "price__%d", i); value_map_set(main_map, key, "");
+      snprintf(key, sizeof(key), "status__%d", i); value_map_set(main_map, key, "");
+    }
   }
-  if (strcmp(code, "without") == 0) return "without";
-  return code;
 }
 
-static const char *ammo_name(Game *g, const char *type, const char *code) {
-  if (!g || !type || !code) return "---";
-  if (strcmp(type, "weapon") == 0) return weapon_name_from_code(g, code);
-  if (strcmp(type, "body_armor") == 0) return armor_name_from_code(g->body_armors, g->body_armor_count, code);
-  if (strcmp(type, "head_armor") == 0) return armor_name_from_code(g->head_armors, g->head_armor_count, code);
-  if (strcmp(type, "arms_armor") == 0) return armor_name_from_code(g->arms_armors, g->arms_armor_count, code);
-  if (strcmp(type, "shield") == 0) return shield_name_from_code(g, code);
-  return "---";
-}
+static void game_prepare_recipe_view(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  OccultRecipe *r = (g->current_recipe_index >= 0 && (size_t)g->current_recipe_index < g->occult.recipe_count)
+                      ? &g->occult.recipes[g->current_recipe_index] : NULL;
+  if (!r) return;
+  value_map_set(main_map, "name", r->name);
+  char buf[512];
+  format_recipe_ingredients(r, buf, sizeof(buf));
+  value_map_set(main_map, "recipe", buf);
+  format_hero_ingredients(&g->hero, buf, sizeof(buf));
+  value_map_set(main_map, "ingredients", buf);
 
-static int ammo_price(Game *g, const char *type, const char *code) {
-  if (!g || !type || !code) return 0;
-  if (strcmp(code, "without") == 0) return 0;
-  if (strcmp(type, "weapon") == 0) return weapon_from_code(g, code).price;
-  if (strcmp(type, "body_armor") == 0) return armor_from_code(g->body_armors, g->body_armor_count, code).price;
-  if (strcmp(type, "head_armor") == 0) return armor_from_code(g->head_armors, g->head_armor_count, code).price;
-  if (strcmp(type, "arms_armor") == 0) return armor_from_code(g->arms_armors, g->arms_armor_count, code).price;
-  if (strcmp(type, "shield") == 0) return shield_from_code(g, code).price;
-  return 0;
+  format_effect(&r->weapon, buf, sizeof(buf)); value_map_set(main_map, "weapon", buf);
+  format_effect(&r->head_armor, buf, sizeof(buf)); value_map_set(main_map, "head_armor", buf);
+  format_effect(&r->body_armor, buf, sizeof(buf)); value_map_set(main_map, "body_armor", buf);
+  format_effect(&r->arms_armor, buf, sizeof(buf)); value_map_set(main_map, "arms_armor", buf);
+  format_effect(&r->shield, buf, sizeof(buf)); value_map_set(main_map, "shield", buf);
 }
 
-static void ammo_to_map(Game *g, const char *type, const char *code, ValueMap *map) {
-  value_map_clear(map);
-  if (!g || !type || !code) return;
-  if (strcmp(type, "weapon") == 0) {
-    WeaponItem it = weapon_from_code(g, code);
-    char buf[32];
-    char name_buf[96];
-    ammo_display_name(it.name, it.enhanced, name_buf, sizeof(name_buf));
-    value_map_set(map, "name", name_buf);
-    snprintf(buf, sizeof(buf), "%d", it.min_dmg); value_map_set(map, "min_dmg", buf);
-    snprintf(buf, sizeof(buf), "%d", it.max_dmg); value_map_set(map, "max_dmg", buf);
-    snprintf(buf, sizeof(buf), "%d", it.accuracy); value_map_set(map, "accuracy", buf);
-    snprintf(buf, sizeof(buf), "%d", it.block_chance); value_map_set(map, "block_chance", buf);
-    snprintf(buf, sizeof(buf), "%d", it.armor_penetration); value_map_set(map, "armor_penetration", buf);
-    snprintf(buf, sizeof(buf), "%d", it.price); value_map_set(map, "price", buf);
-  } else if (strcmp(type, "shield") == 0) {
-    ShieldItem it = shield_from_code(g, code);
-    char buf[32];
-    char name_buf[96];
-    ammo_display_name(it.name, it.enhanced, name_buf, sizeof(name_buf));
-    value_map_set(map, "name", name_buf);
-    snprintf(buf, sizeof(buf), "%d", it.armor); value_map_set(map, "armor", buf);
-    snprintf(buf, sizeof(buf), "%d", it.accuracy); value_map_set(map, "accuracy", buf);
-    snprintf(buf, sizeof(buf), "%d", it.block_chance); value_map_set(map, "block_chance", buf);
-    snprintf(buf, sizeof(buf), "%d", it.min_dmg); value_map_set(map, "min_dmg", buf);
-    snprintf(buf, sizeof(buf), "%d", it.max_dmg); value_map_set(map, "max_dmg", buf);
-    snprintf(buf, sizeof(buf), "%d", it.price); value_map_set(map, "price", buf);
-  } else {
-    ArmorItem it;
-    if (strcmp(type, "body_armor") == 0) it = armor_from_code(g->body_armors, g->body_armor_count, code);
-    else if (strcmp(type, "head_armor") == 0) it = armor_from_code(g->head_armors, g->head_armor_count, code);
-    else it = armor_from_code(g->arms_armors, g->arms_armor_count, code);
-    char buf[32];
-    char name_buf[96];
-    ammo_display_name(it.name, it.enhanced, name_buf, sizeof(name_buf));
-    value_map_set(map, "name", name_buf);
-    snprintf(buf, sizeof(buf), "%d", it.armor); value_map_set(map, "armor", buf);
-    snprintf(buf, sizeof(buf), "%d", it.accuracy); value_map_set(map, "accuracy", buf);
-    snprintf(buf, sizeof(buf), "%d", it.price); value_map_set(map, "price", buf);
-  }
-}
+static void game_prepare_recipe_enhance(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  OccultRecipe *r = (g->current_recipe_index >= 0 && (size_t)g->current_recipe_index < g->occult.recipe_count)
+                      ? &g->occult.recipes[g->current_recipe_index] : NULL;
+  if (!r) return;
+  value_map_set(main_map, "name", r->name);
+  char buf[512];
+  format_recipe_ingredients(r, buf, sizeof(buf));
+  value_map_set(main_map, "recipe", buf);
+  format_hero_ingredients(&g->hero, buf, sizeof(buf));
+  value_map_set(main_map, "ingredients", buf);
 
-static int anim_speed_ms_for(const Game *g) {
-  const int speeds[] = {100, 400, 700, 1000, 1500};
-  int idx = g ? g->anim_speed_index : 1;
-  if (idx < 0) idx = 0;
-  if (idx > 4) idx = 4;
-  return speeds[idx];
-}
+  ammo_display_name(g->hero.weapon.name, g->hero.weapon.enhanced, buf, sizeof(buf));
+  value_map_set(main_map, "hero__weapon__name", buf);
+  ammo_display_name(g->hero.head_armor.name, g->hero.head_armor.enhanced, buf, sizeof(buf));
+  value_map_set(main_map, "hero__head_armor__name", buf);
+  ammo_display_name(g->hero.body_armor.name, g->hero.body_armor.enhanced, buf, sizeof(buf));
+  value_map_set(main_map, "hero__body_armor__name", buf);
+  ammo_display_name(g->hero.arms_armor.name, g->hero.arms_armor.enhanced, buf, sizeof(buf));
+  value_map_set(main_map, "hero__arms_armor__name", buf);
+  ammo_display_name(g->hero.shield.name, g->hero.shield.enhanced, buf, sizeof(buf));
+  value_map_set(main_map, "hero__shield__name", buf);
 
-static const char *enemy_attack_art_from_type(int attack_type) {
-  if (attack_type == 2) return "attack_head";
-  if (attack_type == 3) return "attack_legs";
-  return "attack";
+  format_effect(&r->weapon, buf, sizeof(buf)); value_map_set(main_map, "weapon", buf);
+  format_effect(&r->head_armor, buf, sizeof(buf)); value_map_set(main_map, "head_armor", buf);
+  format_effect(&r->body_armor, buf, sizeof(buf)); value_map_set(main_map, "body_armor", buf);
+  format_effect(&r->arms_armor, buf, sizeof(buf)); value_map_set(main_map, "arms_armor", buf);
+  format_effect(&r->shield, buf, sizeof(buf)); value_map_set(main_map, "shield", buf);
 }
 
-static void battle_anim_queue(Game *g, const char **seq, int count) {
-  if (!g || !seq || count <= 0) return;
-  if (count > 4) count = 4;
-  g->battle_anim_active = 1;
-  g->battle_anim_step = 0;
-  g->battle_anim_count = count;
-  for (int i = 0; i < count; ++i) {
-    snprintf(g->battle_anim_seq[i], sizeof(g->battle_anim_seq[i]), "%s", seq[i]);
+static void game_prepare_enhance_list(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  size_t count = 0;
+  size_t *indices = occult_accessible_indices(&g->occult, &count);
+  for (int i = 1; i <= 24; ++i) {
+    char key[32];
+    char buf[128];
+    if ((size_t)(i - 1) < count) {
+      OccultRecipe *r = &g->occult.recipes[indices[i - 1]];
+      snprintf(key, sizeof(key), "show__%d", i);
+      snprintf(buf, sizeof(buf), "[Enter %c]", (char)('A' + (i - 1)));
+      value_map_set(main_map, key, buf);
+      snprintf(key, sizeof(key), "name__%d", i);
+      value_map_set(main_map, key, r->name);
+      snprintf(key, sizeof(key), "has_ingredients__%d", i);
+      value_map_set(main_map, key, recipe_hero_has_ingredients(r, &g->hero) ? "YES" : "NO");
+    } else {
+      snprintf(key, sizeof(key), "show__%d", i); value_map_set(main_map, key, "");
+      snprintf(key, sizeof(key), "name__%d", i); value_map_set(main_map, key, "");
+      snprintf(key, sizeof(key), "has_ingredients__%d", i); value_map_set(main_map, key, "");
+    }
   }
-  snprintf(g->battle_art_name, sizeof(g->battle_art_name), "%s", seq[0]);
-  g->battle_anim_deadline = SDL_GetTicks() + (uint32_t)anim_speed_ms_for(g);
-  g->force_instant_redraw = 1;
+  free(indices);
 }
 
-static bool battle_anim_tick(Game *g, uint32_t now) {
-  if (!g || !g->battle_anim_active) return false;
-  if (now < g->battle_anim_deadline) return false;
-  g->battle_anim_step += 1;
-  if (g->battle_anim_step < g->battle_anim_count) {
-    snprintf(g->battle_art_name, sizeof(g->battle_art_name), "%s", g->battle_anim_seq[g->battle_anim_step]);
-    g->battle_anim_deadline = now + (uint32_t)anim_speed_ms_for(g);
-    g->force_instant_redraw = 1;
-    return true;
-  }
-  g->battle_anim_active = 0;
-  if (g->battle_exit_pending) {
-    g->battle_exit_pending = 0;
-    g->state = g->battle_exit_state;
-    g->force_instant_redraw = 1;
-    return true;
+static void game_prepare_stats_choose(Game *g, ValueMap *main_map) {
+  (void)g;
+  value_map_clear(main_map);
+  value_map_set(main_map, "main", "Select dungeon statistics");
+}
+
+static void game_prepare_stats_show(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  const char *dungeon = g->stats_dungeon_index == 0 ? "bandits" :
+                        g->stats_dungeon_index == 1 ? "undeads" : "swamp";
+  char name_buf[64];
+  titleize_token(dungeon, name_buf, sizeof(name_buf));
+  value_map_set(main_map, "name", name_buf);
+
+  const char *bandits[] = {"rabble","rabid_dog","poacher","thug","deserter","bandit_leader"};
+  const char *undeads[] = {"zombie","skeleton","ghost","fat_ghoul","skeleton_soldier","zombie_knight"};
+  const char *swamp[] = {"leech","goblin","sworm","spider","orc","ancient_snail"};
+  const char *rewards[] = {
+    "Permanent weapon \"Stick\"",
+    "+2 HP",
+    "+1 accuracy",
+    "+5 HP",
+    "+1 stat point",
+    "+1 skill point",
+    "Permanent \"Worn gloves\"",
+    "+3 MP",
+    "+1 accuracy",
+    "+7 HP",
+    "+3 block chance",
+    "+1 MP-regen",
+    "+3 MP",
+    "Permanent \"Holey wicker buckler\"",
+    "+3 HP",
+    "+1 accuracy",
+    "+1 max damage",
+    "+1 armor"
+  };
+  const char **list = g->stats_dungeon_index == 0 ? bandits :
+                      g->stats_dungeon_index == 1 ? undeads : swamp;
+  int counts[6];
+  for (int i = 0; i < 6; ++i) {
+    counts[i] = stats_total_get(&g->stats_total, dungeon, list[i]);
   }
-  if (strcmp(g->battle_art_name, "normal") != 0) {
-    snprintf(g->battle_art_name, sizeof(g->battle_art_name), "normal");
-    g->force_instant_redraw = 1;
-    return true;
+  for (int i = 0; i < 6; ++i) {
+    char key[32];
+    char enemy_name[64];
+    titleize_token(list[i], enemy_name, sizeof(enemy_name));
+    snprintf(key, sizeof(key), "enemy_name__%d", i);
+    value_map_set(main_map, key, enemy_name);
+    snprintf(key, sizeof(key), "enemy_count__%d", i);
+    value_map_set_int(main_map, key, counts[i]);
+    snprintf(key, sizeof(key), "enemy_done__%d", i);
+    int needed = (g->stats_dungeon_index == 0 && i == 5) || (g->stats_dungeon_index == 1 && i == 5) || (g->stats_dungeon_index == 2 && i == 5) ? 5 : 30;
+    value_map_set(main_map, key, counts[i] >= needed ? "DONE" : "");
+    snprintf(key, sizeof(key), "enemy_kill__%d", i);
+    value_map_set_int(main_map, key, needed);
+    snprintf(key, sizeof(key), "enemy_get__%d", i);
+    int reward_idx = g->stats_dungeon_index * 6 + i;
+    value_map_set(main_map, key, rewards[reward_idx]);
   }
-  return false;
 }
 
-static void battle_round(Game *g, int attack_type, int *out_enemy_attack_type) {
-  Character *h = &g->hero;
-  Character *e = &g->enemy;
-  if (out_enemy_attack_type) *out_enemy_attack_type = 0;
-
-  double h_damage = rand_range(character_min_dmg(h), character_max_dmg(h));
-  double h_acc = character_accuracy(h);
-  const char *attack_label = "body";
-  bool used_active = false;
-  double enemy_damage_mod = 1.0;
-
-  if (attack_type == 2) {
-    h_damage *= 1.5;
-    h_acc *= 0.7;
-    attack_label = "head";
-  } else if (attack_type == 3) {
-    h_damage *= 0.7;
-    h_acc *= 1.5;
-    attack_label = "legs";
-  } else if (attack_type == 4) {
-    if (strcmp(h->active_skill.code, "none") == 0) {
-      logbuffer_push(&g->log, "You have no active skill");
-      return;
-    }
-    if (h->mp < h->active_skill.mp_cost) {
-      logbuffer_push(&g->log, "Not enough MP");
-      return;
-    }
-    h->mp -= h->active_skill.mp_cost;
-    h_damage *= skill_active_damage_mod(&h->active_skill, h);
-    h_acc *= skill_active_accuracy_mod(&h->active_skill, h);
-    attack_label = h->active_skill.name;
-    used_active = true;
+static void game_prepare_event_result(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  const char *title = g->event_message[0] ? g->event_message : "Event";
+  value_map_set(main_map, "main", title);
+  logbuffer_apply_full(main_map, &g->log, 7);
+  if (g->event_input_mode == EVENT_INPUT_TEXT) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "> %s", g->event_text);
+    value_map_set(main_map, "log_6", buf);
   }
+}
 
-  h_damage *= skill_berserk_coef(&h->passive_skill, h);
-
-  bool enemy_block = rand_range(1, 100) <= character_block_chance(e);
-  bool h_hit = rand_range(1, 100) <= (int)round(h_acc);
-  if (h_hit) {
-    if (enemy_block) {
-      double coeff = 1.0 + (double)e->hp / 200.0;
-      h_damage /= coeff;
-    }
-    int armor_block = character_armor(e) - character_armor_penetration(h);
-    if (armor_block < 0) armor_block = 0;
-    h_damage -= armor_block;
-    if (h_damage < 0) h_damage = 0;
-    e->hp -= (int)round(h_damage);
-    if (e->hp < 0) e->hp = 0;
+static void game_prepare_options(Game *g, ValueMap *main_map) {
+  (void)g;
+  value_map_clear(main_map);
+  value_map_set(main_map, "main", "");
+}
 
-    char msg[160];
-    snprintf(msg, sizeof(msg), "You hit %s for %d (%s)", e->name, (int)round(h_damage), attack_label);
-    if (enemy_block) {
-      char block_msg[64];
-      snprintf(block_msg, sizeof(block_msg), " (blocked %d%%)", block_power_in_percents(e));
-      strncat(msg, block_msg, sizeof(msg) - strlen(msg) - 1);
+static void game_prepare_options_anim(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  for (int i = 0; i < 5; ++i) {
+    char key[64];
+    snprintf(key, sizeof(key), "enemy_actions_animation_speed__%d", i);
+    if (g->anim_speed_index == i) value_map_set(main_map, key, "SELECTED");
+    else {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "[Enter %d]", i + 1);
+      value_map_set(main_map, key, buf);
     }
-    logbuffer_push(&g->log, msg);
+  }
+}
 
-    double bonus = skill_concentration_bonus(&h->passive_skill, h);
-    if (bonus > 0) {
-      e->hp -= (int)round(bonus);
-      if (e->hp < 0) e->hp = 0;
-      char msg2[128];
-      snprintf(msg2, sizeof(msg2), "Concentration adds %d damage", (int)round(bonus));
-      logbuffer_push(&g->log, msg2);
+static void game_prepare_options_replace(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  for (int i = 0; i < 3; ++i) {
+    char key[64];
+    snprintf(key, sizeof(key), "screen_replacement_type__%d", i);
+    if (g->screen_replace_type == i) value_map_set(main_map, key, "SELECTED");
+    else {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "[Enter %d]", i + 1);
+      value_map_set(main_map, key, buf);
     }
+  }
+}
 
-    if (strcmp(h->passive_skill.code, "dazed") == 0) {
-      double hp_part_coef = skill_dazed_hp_part_coef(&h->passive_skill);
-      if (h_damage * hp_part_coef > e->hp / 2.0) {
-        enemy_damage_mod = skill_dazed_accuracy_reduce_coef(&h->passive_skill);
-        char msg3[128];
-        snprintf(msg3, sizeof(msg3), "%s is dazed, accuracy reduced", e->name);
-        logbuffer_push(&g->log, msg3);
-      }
-    }
+static void game_prepare_loot(Game *g, ValueMap *main_map, ValueMap *hero_item_map, ValueMap *enemy_item_map,
+                              ArtArg **out_arts, size_t *out_art_count) {
+  value_map_clear(main_map);
+  value_map_set(main_map, "main", g->loot_message[0] ? g->loot_message : "Loot found");
+  value_map_clear(hero_item_map);
+  value_map_clear(enemy_item_map);
 
-    if (used_active && strcmp(h->active_skill.code, "traumatic_strike") == 0) {
-      enemy_damage_mod = skill_traumatic_effect_coef(&h->active_skill);
-      char msg4[128];
-      snprintf(msg4, sizeof(msg4), "%s injured, damage reduced", e->name);
-      logbuffer_push(&g->log, msg4);
-    }
-  } else {
-    char msg[128];
-    snprintf(msg, sizeof(msg), "You miss (%s)", attack_label);
-    logbuffer_push(&g->log, msg);
-  }
+  if (g->loot_index >= g->loot_count) return;
+  const LootEntry *le = &g->loot_items[g->loot_index];
+  const char *type = le->type;
+  const char *enemy_code = le->code;
+  const char *hero_code = "without";
+  if (strcmp(type, "weapon") == 0) hero_code = g->hero.weapon.code;
+  else if (strcmp(type, "body_armor") == 0) hero_code = g->hero.body_armor.code;
+  else if (strcmp(type, "head_armor") == 0) hero_code = g->hero.head_armor.code;
+  else if (strcmp(type, "arms_armor") == 0) hero_code = g->hero.arms_armor.code;
+  else if (strcmp(type, "shield") == 0) hero_code = g->hero.shield.code;
 
-  if (e->hp <= 0) return;
+  ammo_to_map(g, type, hero_code, hero_item_map);
+  ammo_to_map(g, type, enemy_code, enemy_item_map);
 
-  int e_attack_type = rand_range(1, 3);
-  if (out_enemy_attack_type) *out_enemy_attack_type = e_attack_type;
-  double e_damage = rand_range(character_min_dmg(e), character_max_dmg(e));
-  double e_acc = character_accuracy(e) * enemy_damage_mod;
-  const char *e_label = "body";
-  if (e_attack_type == 2) {
-    e_damage *= 1.5;
-    e_acc *= 0.7;
-    e_label = "head";
-  } else if (e_attack_type == 3) {
-    e_damage *= 0.7;
-    e_acc *= 1.5;
-    e_label = "legs";
+  *out_art_count = 2;
+  *out_arts = (ArtArg *)calloc(*out_art_count, sizeof(ArtArg));
+  if (*out_arts) {
+    char path0[256];
+    char path1[256];
+    snprintf(path0, sizeof(path0), "ammunition/%s/_%s", type, hero_code);
+    snprintf(path1, sizeof(path1), "ammunition/%s/_%s", type, enemy_code);
+    (*out_arts)[0].name = strdup_safe("normal");
+    (*out_arts)[0].path = strdup_safe(path0);
+    (*out_arts)[1].name = strdup_safe("normal");
+    (*out_arts)[1].path = strdup_safe(path1);
   }
+}
 
-  bool hero_block = rand_range(1, 100) <= character_block_chance(h);
-  bool e_hit = rand_range(1, 100) <= (int)round(e_acc);
-  if (e_hit) {
-    if (hero_block) {
-      double coeff = 1.0 + (double)h->hp / 200.0;
-      e_damage /= coeff;
-    }
-    int armor_block = character_armor(h) - character_armor_penetration(e);
-    if (armor_block < 0) armor_block = 0;
-    e_damage -= armor_block;
-    if (e_damage < 0) e_damage = 0;
-    h->hp -= (int)round(e_damage);
-    if (h->hp < 0) h->hp = 0;
-    char msg[160];
-    snprintf(msg, sizeof(msg), "%s hits you for %d (%s)", e->name, (int)round(e_damage), e_label);
-    if (hero_block) {
-      char block_msg[64];
-      snprintf(block_msg, sizeof(block_msg), " (blocked %d%%)", block_power_in_percents(h));
-      strncat(msg, block_msg, sizeof(msg) - strlen(msg) - 1);
-    }
+static void game_prepare_loot_message(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  logbuffer_clear(&g->log);
+  if (g->loot_message_mode == 1) {
+    g->hero.coins += g->loot_coins;
+    char msg[192];
+    snprintf(msg, sizeof(msg),
+             "After searching the %s's body you found %d coins. Now you have %d coins",
+             g->enemy.name, g->loot_coins, g->hero.coins);
+    value_map_set(main_map, "main", "My precious... Press Enter to continue");
     logbuffer_push(&g->log, msg);
-  } else {
-    char msg[128];
-    snprintf(msg, sizeof(msg), "%s misses (%s)", e->name, e_label);
+    g->loot_show_coins = 0;
+  } else if (g->loot_message_mode == 2) {
+    int have = value_map_get_int(&g->hero.ingredients, g->loot_ingredient, 0);
+    value_map_set_int(&g->hero.ingredients, g->loot_ingredient, have + 1);
+    char ing[64];
+    titleize_token(g->loot_ingredient, ing, sizeof(ing));
+    char msg[192];
+    snprintf(msg, sizeof(msg), "After searching the %s's body you found %s", g->enemy.name, ing);
+    value_map_set(main_map, "main", "Press Enter to continue");
     logbuffer_push(&g->log, msg);
+    g->loot_show_ingredient = 0;
+  } else {
+    value_map_set(main_map, "main", "Press Enter to continue");
   }
-
-  if (h->regen_hp_base > 0 && h->hp < h->hp_max) {
-    int gain = h->regen_hp_base;
-    if (h->hp + gain > h->hp_max) gain = h->hp_max - h->hp;
-    h->hp += gain;
-    if (gain > 0) {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "You regenerate %d HP", gain);
-      logbuffer_push(&g->log, msg);
-    }
-  }
-  if (h->regen_mp_base > 0 && h->mp < h->mp_max) {
-    int gain = h->regen_mp_base;
-    if (h->mp + gain > h->mp_max) gain = h->mp_max - h->mp;
-    h->mp += gain;
-    if (gain > 0) {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "You regenerate %d MP", gain);
-      logbuffer_push(&g->log, msg);
-    }
-  }
-  if (e->regen_hp_base > 0 && e->hp < e->hp_max) {
-    int gain = e->regen_hp_base;
-    if (e->hp + gain > e->hp_max) gain = e->hp_max - e->hp;
-    e->hp += gain;
-    if (gain > 0) {
-      char msg[128];
-      snprintf(msg, sizeof(msg), "%s regenerates %d HP", e->name, gain);
-      logbuffer_push(&g->log, msg);
-    }
-  }
+  logbuffer_apply_full(main_map, &g->log, 6);
 }
 
-static int monolith_points_from_enemy(const Character *hero, const Character *enemy) {
-  if (!hero || !enemy) return 0;
-  double stats_sum = 0.0;
-  const double hero_stats[] = {
-      (double)hero->hp_max, (double)hero->mp_max,
-      (double)character_min_dmg(hero), (double)character_max_dmg(hero),
-      (double)hero->regen_hp_base, (double)hero->regen_mp_base,
-      (double)character_armor(hero), (double)character_accuracy(hero)
-  };
-  const double enemy_stats[] = {
-      (double)enemy->hp_max, (double)enemy->mp_max,
-      (double)character_min_dmg(enemy), (double)character_max_dmg(enemy),
-      (double)enemy->regen_hp_base, (double)enemy->regen_mp_base,
-      (double)character_armor(enemy), (double)character_accuracy(enemy)
-  };
-  int count = (int)(sizeof(hero_stats) / sizeof(hero_stats[0]));
-  for (int i = 0; i < count; ++i) {
-    if (hero_stats[i] <= 1.0) stats_sum += enemy_stats[i];
-    else stats_sum += enemy_stats[i] / hero_stats[i];
-  }
-  double probability = stats_sum / count;
-  int points = (int)floor(probability);
-  double frac = probability - points;
-  if (((double)rand() / (double)RAND_MAX) < frac) points += 1;
-  if (points < 0) points = 0;
-  return points;
+static void game_prepare_hero_info(Game *g, ValueMap *main_map) {
+  value_map_clear(main_map);
+  char log0[64];
+  const char *dn = g->hero.dungeon_name[0] ? g->hero.dungeon_name : g->dungeons[g->dungeon_index].name;
+  snprintf(log0, sizeof(log0), "%s", dn);
+  log0[0] = (char)toupper((unsigned char)log0[0]);
+  value_map_set(main_map, "log_0", log0);
+  value_map_set_int(main_map, "log_1", g->hero.lvl + 1);
+  value_map_set(main_map, "main", "BACK TO CAMP FIRE OPTIONS  [Enter 0]");
 }
 
-static void game_init(Game *g) {
-  memset(g, 0, sizeof(*g));
-  g->state = STATE_START;
-  g->next_state = STATE_START;
-  logbuffer_init(&g->log);
-  g->message_art_name[0] = '\0';
-  g->message_art_path[0] = '\0';
-  g->hero_selected = 0;
-  g->name_len = 0;
-  g->name_input[0] = '\0';
-  g->name_error[0] = '\0';
-  g->stat_dice1 = 0;
-  g->stat_dice2 = 0;
-  g->stat_roll = 0;
-  g->skill_dice1 = 0;
-  g->skill_dice2 = 0;
-  g->skill_choice_count = 0;
-  g->return_state = STATE_START;
-  g->ammo_show_type[0] = '\0';
-  g->ammo_show_code[0] = '\0';
-  g->stats_dungeon_index = 0;
-  g->current_recipe_index = -1;
-  g->loot_count = 0;
-  g->loot_index = 0;
-  g->loot_show_coins = 0;
-  g->loot_show_ingredient = 0;
-  g->loot_message_mode = 0;
-  g->loot_coins = 0;
-  g->loot_ingredient[0] = '\0';
-  g->loot_message[0] = '\0';
-  g->event_choice_count = 0;
-  g->event_message[0] = '\0';
-  g->event_art_path[0] = '\0';
-  g->event_art_name[0] = '\0';
-  g->event_choose_message[0] = '\0';
-  g->event_code[0] = '\0';
-  g->event_step = 0;
-  for (int i = 0; i < 4; ++i) g->event_data[i] = 0;
-  g->event_input_mode = EVENT_INPUT_NONE;
-  g->event_text[0] = '\0';
-  g->event_text_len = 0;
-  g->event_pending_action = EVENT_PENDING_NONE;
-  g->wg_taken = 0;
-  g->wg_enemy[0] = '\0';
-  g->wg_count = 0;
-  g->wg_level = 0;
-  g->anim_speed_index = 1;
-  g->screen_replace_type = 1;
-  snprintf(g->battle_art_name, sizeof(g->battle_art_name), "normal");
-  g->battle_art_dungeon[0] = '\0';
-  g->battle_anim_active = 0;
-  g->battle_anim_step = 0;
-  g->battle_anim_count = 0;
-  g->battle_anim_deadline = 0;
-  g->battle_exit_pending = 0;
-  g->battle_exit_state = STATE_BATTLE;
-  g->force_instant_redraw = 0;
-  g->loot_return_state = STATE_CAMPFIRE;
-  g->loot_return_pending = 0;
-  g->loot_last_taken = -1;
-  for (int i = 0; i < 3; ++i) g->enemy_choice_is_boss[i] = 0;
-  g->enemy_is_boss = 0;
-  g->enemy_choose_message[0] = '\0';
-  for (int i = 0; i < 3; ++i) g->enemy_choice_is_boss[i] = 0;
-  shop_init_default(&g->shop);
-  warehouse_init_default(&g->warehouse);
-  monolith_init_default(&g->monolith);
-  statistics_total_init_default(&g->stats_total);
-  g->occult.recipes = NULL;
-  g->occult.recipe_count = 0;
-  snprintf(g->dungeons[0].name, sizeof(g->dungeons[0].name), "bandits");
-  snprintf(g->dungeons[1].name, sizeof(g->dungeons[1].name), "undeads");
-  snprintf(g->dungeons[2].name, sizeof(g->dungeons[2].name), "swamp");
+static void stat_roll_dice(Game *g) {
+  if (g->stat_roll != 0) return;
+  g->stat_dice1 = rand_range(&g->rng[RNG_RUN], 1, 6);
+  g->stat_dice2 = rand_range(&g->rng[RNG_RUN], 1, 6);
+  g->stat_roll = g->stat_dice1 + g->stat_dice2;
 }
 
-static void game_free(Game *g) {
-  if (!g) return;
-  if (g->heroes) {
-    for (size_t i = 0; i < g->hero_count; ++i) {
-      free_string_list(g->heroes[i].weapon_options, g->heroes[i].weapon_count);
-      free_string_list(g->heroes[i].body_armor_options, g->heroes[i].body_armor_count);
-      free_string_list(g->heroes[i].head_armor_options, g->heroes[i].head_armor_count);
-      free_string_list(g->heroes[i].arms_armor_options, g->heroes[i].arms_armor_count);
-      free_string_list(g->heroes[i].shield_options, g->heroes[i].shield_count);
-    }
-    free(g->heroes);
-  }
+static void skill_roll_choices(Game *g) {
+  if (g->skill_choice_count != 0) return;
+  g->skill_dice1 = rand_range(&g->rng[RNG_RUN], 1, 6);
+  g->skill_dice2 = rand_range(&g->rng[RNG_RUN], 1, 6);
+  int roll = g->skill_dice1 + g->skill_dice2;
+  g->skill_choice_count = roll >= 10 ? 3 : roll >= 6 ? 2 : 1;
+
+  SkillType pool[3] = {SKILL_ACTIVE, SKILL_PASSIVE, SKILL_CAMP};
   for (int i = 0; i < 3; ++i) {
-    if (g->dungeons[i].enemies) {
-      for (size_t j = 0; j < g->dungeons[i].enemy_count; ++j) {
-        free_string_list(g->dungeons[i].enemies[j].weapon_options, g->dungeons[i].enemies[j].weapon_count);
-        free_string_list(g->dungeons[i].enemies[j].body_armor_options, g->dungeons[i].enemies[j].body_armor_count);
-        free_string_list(g->dungeons[i].enemies[j].head_armor_options, g->dungeons[i].enemies[j].head_armor_count);
-        free_string_list(g->dungeons[i].enemies[j].arms_armor_options, g->dungeons[i].enemies[j].arms_armor_count);
-        free_string_list(g->dungeons[i].enemies[j].shield_options, g->dungeons[i].enemies[j].shield_count);
-        free_string_list(g->dungeons[i].enemies[j].ingredient_options, g->dungeons[i].enemies[j].ingredient_count);
+    int j = rand_range(&g->rng[RNG_RUN], i, 2);
+    SkillType tmp = pool[i];
+    pool[i] = pool[j];
+    pool[j] = tmp;
+  }
+  for (int i = 0; i < g->skill_choice_count; ++i) {
+    g->skill_choices[i] = pool[i];
+  }
+  // sort by type
+  for (int i = 0; i < g->skill_choice_count - 1; ++i) {
+    for (int j = i + 1; j < g->skill_choice_count; ++j) {
+      if (g->skill_choices[j] < g->skill_choices[i]) {
+        SkillType tmp = g->skill_choices[i];
+        g->skill_choices[i] = g->skill_choices[j];
+        g->skill_choices[j] = tmp;
       }
-      free(g->dungeons[i].enemies);
     }
   }
-  if (g->event_enemies) {
-    for (size_t j = 0; j < g->event_enemy_count; ++j) {
-      free_string_list(g->event_enemies[j].weapon_options, g->event_enemies[j].weapon_count);
-      free_string_list(g->event_enemies[j].body_armor_options, g->event_enemies[j].body_armor_count);
-      free_string_list(g->event_enemies[j].head_armor_options, g->event_enemies[j].head_armor_count);
-      free_string_list(g->event_enemies[j].arms_armor_options, g->event_enemies[j].arms_armor_count);
-      free_string_list(g->event_enemies[j].shield_options, g->event_enemies[j].shield_count);
-      free_string_list(g->event_enemies[j].ingredient_options, g->event_enemies[j].ingredient_count);
+}
+
+static bool hero_spend_stat(Game *g, int option) {
+  Character *h = &g->hero;
+  if (h->stat_points <= 0) return false;
+  if (option == 1) {
+    h->hp_max += 5;
+    h->hp += 5;
+  } else if (option == 2) {
+    h->mp_max += 5;
+    h->mp += 5;
+  } else if (option == 3 && g->stat_roll >= 8) {
+    h->accuracy_base += 1;
+  } else if (option == 4 && g->stat_roll >= 11) {
+    if (h->min_dmg_base < h->max_dmg_base && rand_range(&g->rng[RNG_RUN], 0, 1) == 0) {
+      h->min_dmg_base += 1;
+    } else {
+      h->max_dmg_base += 1;
     }
-    free(g->event_enemies);
+  } else {
+    return false;
   }
-  free(g->weapons);
-  free(g->body_armors);
-  free(g->head_armors);
-  free(g->arms_armors);
-  free(g->shields);
-  occult_library_free(&g->occult);
-  value_map_clear(&g->hero.ingredients);
-  logbuffer_free(&g->log);
+  h->stat_points -= 1;
+  g->stat_roll = 0;
+  character_touch(h);
+  return true;
 }
 
-static void game_prepare_hero_select(Game *g, ValueMap *main_map) {
+static bool hero_spend_skill(Game *g, int choice) {
+  if (choice < 1 || choice > g->skill_choice_count) return false;
+  SkillType chosen = g->skill_choices[choice - 1];
+  if (chosen == SKILL_ACTIVE) g->hero.active_skill.lvl += 1;
+  else if (chosen == SKILL_PASSIVE) g->hero.passive_skill.lvl += 1;
+  else if (chosen == SKILL_CAMP) g->hero.camp_skill.lvl += 1;
+  character_touch(&g->hero);
+  g->hero.skill_points -= 1;
+  g->skill_choice_count = 0;
+  return true;
+}
+
+static void game_prepare_spend_stat(Game *g, ValueMap *main_map) {
   value_map_clear(main_map);
-  value_map_set(main_map, "main", "Select a background");
+  char title[128];
+  snprintf(title, sizeof(title), "Distribute stat points. You have %d points left", g->hero.stat_points);
+  value_map_set(main_map, "main", title);
+
+  stat_roll_dice(g);
 
   logbuffer_clear(&g->log);
-  logbuffer_push(&g->log, "Background:   HP:         MP:         Min dmg:    Max dmg:    Accuracy:   Armor:");
-  for (size_t i = 0; i < g->hero_count; ++i) {
-    char line[256];
-    const HeroTemplate *h = &g->heroes[i];
-    snprintf(line, sizeof(line), "[Enter %2zu]  %-10s  %-10d %-10d %-10d %-10d %-10d %-10d", i + 1, h->name, h->hp, h->mp, h->min_dmg, h->max_dmg, h->accuracy, h->armor);
-    logbuffer_push(&g->log, line);
-  }
-  logbuffer_apply_full(main_map, &g->log, 60);
+  char line[128];
+  snprintf(line, sizeof(line), "The dice showed: %d (%d + %d)", g->stat_roll, g->stat_dice1, g->stat_dice2);
+  logbuffer_push(&g->log, line);
+  logbuffer_push(&g->log, "");
+  logbuffer_push(&g->log, "+5 HP                     [1]");
+  logbuffer_push(&g->log, "+5 MP                     [2]");
+  if (g->stat_roll >= 8) logbuffer_push(&g->log, "+1 accuracy               [3]");
+  if (g->stat_roll >= 11) logbuffer_push(&g->log, "+1 min/max(random) damage [4]");
+  logbuffer_apply_full(main_map, &g->log, 7);
 }
 
-static void game_prepare_name_input(Game *g, ValueMap *main_map, const char *error) {
+static void game_prepare_spend_skill(Game *g, ValueMap *main_map) {
   value_map_clear(main_map);
   char title[128];
-  snprintf(title, sizeof(title), "Enter character name: %s", g->name_input);
+  snprintf(title, sizeof(title), "Distribute skill points. You have %d points left", g->hero.skill_points);
   value_map_set(main_map, "main", title);
+
+  skill_roll_choices(g);
+
   logbuffer_clear(&g->log);
-  const char *err = error;
-  if (!err || !err[0]) err = g->name_error;
-  if (err && err[0]) {
-    logbuffer_push(&g->log, err);
+  char line[128];
+  snprintf(line, sizeof(line), "The dice showed: %d (%d + %d)", g->skill_dice1 + g->skill_dice2, g->skill_dice1, g->skill_dice2);
+  logbuffer_push(&g->log, line);
+  logbuffer_push(&g->log, "");
+  for (int i = 0; i < g->skill_choice_count; ++i) {
+    const Skill *s = g->skill_choices[i] == SKILL_ACTIVE ? &g->hero.active_skill :
+                     g->skill_choices[i] == SKILL_PASSIVE ? &g->hero.passive_skill :
+                     &g->hero.camp_skill;
+    char line2[128];
+    snprintf(line2, sizeof(line2), "%-20s [%d]", s->name, i + 1);
+    logbuffer_push(&g->log, line2);
   }
-  logbuffer_push(&g->log, "The character name must contain at least 1 letter and be no more than 20 characters");
-  logbuffer_apply_full(main_map, &g->log, 20);
+  logbuffer_apply_full(main_map, &g->log, 7);
 }
 
-static void game_prepare_skill_select(Game *g, ValueMap *main_map, SkillType type) {
+static void game_prepare_message(Game *g, ValueMap *main_map) {
   value_map_clear(main_map);
-  if (type == SKILL_ACTIVE) value_map_set(main_map, "main", "Select an active skill");
-  else if (type == SKILL_PASSIVE) value_map_set(main_map, "main", "Select a passive skill");
-  else value_map_set(main_map, "main", "Select a camp skill");
+  value_map_set(main_map, "main", g->message_title);
+  logbuffer_apply_full(main_map, &g->log, 20);
+}
 
-  logbuffer_clear(&g->log);
+static int key_to_digit(SDL_Keycode key) {
+  if (key >= SDLK_0 && key <= SDLK_9) return (int)(key - SDLK_0);
+  if (key >= SDLK_KP_0 && key <= SDLK_KP_9) return (int)(key - SDLK_KP_0);
+  return -1;
+}
 
-  const char *skills_active[] = {"ascetic_strike", "precise_strike", "strong_strike", "traumatic_strike"};
-  const char *skills_passive[] = {"berserk", "concentration", "dazed", "shield_master"};
-  const char *skills_camp[] = {"bloody_ritual", "first_aid", "treasure_hunter"};
-  const char **list = skills_active;
-  size_t count = sizeof(skills_active) / sizeof(skills_active[0]);
-  if (type == SKILL_PASSIVE) { list = skills_passive; count = sizeof(skills_passive) / sizeof(skills_passive[0]); }
-  if (type == SKILL_CAMP) { list = skills_camp; count = sizeof(skills_camp) / sizeof(skills_camp[0]); }
+static char key_to_letter(SDL_Keycode key) {
+  if (key >= SDLK_a && key <= SDLK_z) return (char)('a' + (key - SDLK_a));
+  return '\0';
+}
 
-  for (size_t i = 0; i < count; ++i) {
-    Skill s;
-    skill_assign(&s, type, list[i]);
-    char desc[160];
-    skill_description_short(&s, &g->hero, desc, sizeof(desc));
-    char line[240];
-    snprintf(line, sizeof(line), "   [Enter %zu]   %-20s %s", i + 1, s.name, desc);
-    logbuffer_push(&g->log, line);
+static void pick_random_enemies(Game *g) {
+  DungeonData *d = &g->dungeons[g->dungeon_index];
+  g->enemy_choose_message[0] = '\0';
+  if (g->hero.leveling >= 25) {
+    const EnemyTemplate *boss = enemy_template_boss(d);
+    if (boss) {
+      g->enemy_choice_count = 1;
+      g->enemy_choices[0] = character_from_enemy(g, boss);
+      g->enemy_choice_is_boss[0] = 1;
+      snprintf(g->enemy_choose_message, sizeof(g->enemy_choose_message),
+               "You've reached the end of the dungeon, this is a boss fight!");
+      return;
+    }
+  }
+  int count = enemy_choices_count_for(&g->hero, &g->rng[RNG_RUN]);
+  if (count < 1) count = 1;
+  if (count > 3) count = 3;
+  g->enemy_choice_count = count;
+  for (int i = 0; i < g->enemy_choice_count; ++i) {
+    const EnemyTemplate *tmpl = enemy_template_random_standard(d, g->hero.leveling, &g->rng[RNG_RUN]);
+    if (!tmpl) tmpl = &d->enemies[0];
+    g->enemy_choices[i] = character_from_enemy(g, tmpl);
+    g->enemy_choice_is_boss[i] = tmpl->is_boss ? 1 : 0;
+  }
+  if (g->enemy_choice_count > 0) {
+    int random = rand_range(&g->rng[RNG_RUN], 1, 200);
+    int th = treasure_hunter_coeff(&g->hero.camp_skill);
+    if (th > 0) {
+      snprintf(g->enemy_choose_message, sizeof(g->enemy_choose_message),
+               "Random is %d + treasure hunter %d = you find %d ways. Which way will you go?",
+               random, th, g->enemy_choice_count);
+    } else {
+      snprintf(g->enemy_choose_message, sizeof(g->enemy_choose_message),
+               "Random is %d = you find %d ways. Which way will you go?",
+               random, g->enemy_choice_count);
+    }
   }
-  logbuffer_apply_full(main_map, &g->log, 60);
 }
 
-static void game_prepare_start(Game *g, ValueMap *main_map, const char *version) {
-  value_map_clear(main_map);
-  value_map_set(main_map, "main", version ? version : "v");
-  logbuffer_clear(&g->log);
+static int dungeon_index_by_name(Game *g, const char *name) {
+  if (!g || !name) return 0;
+  for (int i = 0; i < 3; ++i) {
+    if (strcmp(g->dungeons[i].name, name) == 0) return i;
+  }
+  return 0;
 }
 
-static void game_prepare_load_menu(Game *g, ValueMap *main_map) {
-  (void)g;
-  value_map_clear(main_map);
-  value_map_set(main_map, "main", "");
-  logbuffer_clear(&g->log);
+static const EnemyTemplate *enemy_template_by_code(const DungeonData *d, const char *code) {
+  if (!d || !code) return NULL;
+  for (size_t i = 0; i < d->enemy_count; ++i) {
+    if (strcmp(d->enemies[i].code, code) == 0) return &d->enemies[i];
+  }
+  return NULL;
 }
 
-static void game_prepare_load_confirm(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  value_map_set(main_map, "main", "Load game [Enter 1]            Back to menu [Enter 0]");
-  char log0[64];
-  snprintf(log0, sizeof(log0), "%s", g->hero.dungeon_name);
-  if (log0[0]) log0[0] = (char)toupper((unsigned char)log0[0]);
-  value_map_set(main_map, "log_0", log0);
-  char log1[32];
-  snprintf(log1, sizeof(log1), "%d", g->hero.leveling + 1);
-  value_map_set(main_map, "log_1", log1);
+static const EnemyTemplate *event_enemy_by_code(const Game *g, const char *code) {
+  if (!g || !code) return NULL;
+  for (size_t i = 0; i < g->event_enemy_count; ++i) {
+    if (strcmp(g->event_enemies[i].code, code) == 0) return &g->event_enemies[i];
+  }
+  return NULL;
 }
 
-static void game_prepare_choose_dungeon(Game *g, ValueMap *main_map) {
-  (void)g;
-  value_map_clear(main_map);
-  value_map_set(main_map, "main", "");
-  logbuffer_clear(&g->log);
+static const char *enemy_art_dungeon(const Game *g) {
+  if (!g) return "";
+  if (g->battle_art_dungeon[0]) return g->battle_art_dungeon;
+  return g->dungeons[g->dungeon_index].name;
 }
 
-static void game_prepare_enemy_select(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  if (g->enemy_choose_message[0]) value_map_set(main_map, "main", g->enemy_choose_message);
-  else value_map_set(main_map, "main", "Choose your enemy");
-  logbuffer_clear(&g->log);
+static const EnemyTemplate *enemy_template_boss(const DungeonData *d) {
+  if (!d) return NULL;
+  for (size_t i = 0; i < d->enemy_count; ++i) {
+    if (d->enemies[i].is_boss) return &d->enemies[i];
+  }
+  return NULL;
 }
 
-static void game_prepare_battle(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  value_map_set(main_map, "main", "Battle");
-  char actions[160];
-  if (strcmp(g->hero.active_skill.code, "none") != 0) {
-    snprintf(actions, sizeof(actions), "Hit body [1]  Head [2]  Legs [3]  %s [4]", g->hero.active_skill.name);
-  } else {
-    snprintf(actions, sizeof(actions), "Hit body [1]  Head [2]  Legs [3]");
+static const EnemyTemplate *enemy_template_random_standard(const DungeonData *d, int leveling, Rng *rng) {
+  if (!d || d->enemy_count == 0) return NULL;
+  int standard_count = 0;
+  for (size_t i = 0; i < d->enemy_count; ++i) {
+    if (d->enemies[i].code[0] == 'e') standard_count++;
   }
-  value_map_set(main_map, "actions", actions);
-  logbuffer_apply_last(main_map, &g->log, 4);
+  if (standard_count == 0) return &d->enemies[0];
+  int chance = rand_range(rng, 1, 9) + rand_range(rng, 0, leveling);
+  int target = standard_count;
+  for (int n = 1; n <= standard_count; ++n) {
+    if (chance <= n * 4) { target = n; break; }
+  }
+  char code[16];
+  snprintf(code, sizeof(code), "e%d", target);
+  const EnemyTemplate *tmpl = enemy_template_by_code(d, code);
+  if (tmpl) return tmpl;
+  return &d->enemies[0];
 }
 
-static void game_prepare_campfire(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  char buf[32];
-  snprintf(buf, sizeof(buf), "%d", g->hero.stat_points);
-  value_map_set(main_map, "additional_1", buf);
-  snprintf(buf, sizeof(buf), "%d", g->hero.skill_points);
-  value_map_set(main_map, "additional_2", buf);
-  logbuffer_apply_full(main_map, &g->log, 3);
+static int enemy_choices_count_for(const Character *hero, Rng *rng) {
+  int random = rand_range(rng, 1, 200);
+  int th = treasure_hunter_coeff(&hero->camp_skill);
+  int res = random + th;
+  int n = res > 120 ? 3 : res > 50 ? 2 : 1;
+  return n;
 }
 
-static void game_prepare_camp(Game *g, ValueMap *main_map) {
-  (void)g;
-  value_map_clear(main_map);
-  value_map_set(main_map, "main", "");
-  logbuffer_clear(&g->log);
-}
+static bool game_build_screen(Game *g, const char *version, Menu *menu, ValueMap *main_map,
+                              ValueMap *hero_map, ValueMap *enemy_maps[3],
+                              ArtArg **out_arts, size_t *out_art_count,
+                              char **out_menu_path) {
+  (void)menu;
+  char *menu_path = NULL;
+  ArtArg *arts = NULL;
+  size_t art_count = 0;
 
-static void game_prepare_shop(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  char buf[64];
-  snprintf(buf, sizeof(buf), "%d", g->warehouse.coins);
-  value_map_set(main_map, "coins", buf);
+  if (g->state == STATE_START) {
+    menu_path = resolve_menu_path("start_game_screen");
+    game_prepare_start(g, main_map, version);
+  } else if (g->state == STATE_LOAD_MENU) {
+    menu_path = resolve_menu_path("load_new_run_screen");
+    game_prepare_load_menu(g, main_map);
+    art_count = 1;
+    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
+    arts[0].name = strdup_safe("dungeon_cave");
+    arts[0].path = strdup_safe("_dungeon_enter");
+  } else if (g->state == STATE_LOAD_NO_HERO) {
+    menu_path = resolve_menu_path("load_no_hero_screen");
+    value_map_clear(main_map);
+  } else if (g->state == STATE_CHOOSE_DUNGEON) {
+    menu_path = resolve_menu_path("choose_dungeon_screen");
+    game_prepare_choose_dungeon(g, main_map);
+    art_count = 3;
+    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
+    arts[0].name = strdup_safe("normal"); arts[0].path = strdup_safe("dungeons/_bandits");
+    arts[1].name = strdup_safe("normal"); arts[1].path = strdup_safe("dungeons/_undeads");
+    arts[2].name = strdup_safe("normal"); arts[2].path = strdup_safe("dungeons/_swamp");
+  } else if (g->state == STATE_NAME_INPUT) {
+    menu_path = resolve_menu_path("messages_screen");
+    game_prepare_name_input(g, main_map, NULL);
+    art_count = 1;
+    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
+    arts[0].name = strdup_safe("scroll");
+    arts[0].path = strdup_safe("_choose_name");
+  } else if (g->state == STATE_HERO_SELECT) {
+    menu_path = resolve_menu_path("messages_full_screen");
+    game_prepare_hero_select(g, main_map);
+  } else if (g->state == STATE_LOAD_CONFIRM) {
+    menu_path = resolve_menu_path("hero_sl_screen");
+    game_prepare_load_confirm(g, main_map);
+    value_map_clear(hero_map);
+    character_to_map(&g->hero, hero_map);
+    art_count = 1;
+    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
+    char path[256];
+    snprintf(path, sizeof(path), "dungeons/_%s", g->hero.dungeon_name[0] ? g->hero.dungeon_name : g->dungeons[g->dungeon_index].name);
+    arts[0].name = strdup_safe("normal");
+    arts[0].path = strdup_safe(path);
+  } else if (g->state == STATE_SKILL_ACTIVE) {
+    menu_path = resolve_menu_path("messages_full_screen");
+    game_prepare_skill_select(g, main_map, SKILL_ACTIVE);
+  } else if (g->state == STATE_SKILL_PASSIVE) {
+    menu_path = resolve_menu_path("messages_full_screen");
+    game_prepare_skill_select(g, main_map, SKILL_PASSIVE);
+  } else if (g->state == STATE_SKILL_CAMP) {
+    menu_path = resolve_menu_path("messages_full_screen");
+    game_prepare_skill_select(g, main_map, SKILL_CAMP);
+  } else if (g->state == STATE_ENEMY_SELECT) {
+    if (g->enemy_choice_count >= 3) menu_path = resolve_menu_path("enemy_3_choose_screen");
+    else if (g->enemy_choice_count == 2) menu_path = resolve_menu_path("enemy_2_choose_screen");
+    else menu_path = resolve_menu_path("enemy_1_choose_screen");
+    game_prepare_enemy_select(g, main_map);
 
-  const char *types[] = {"weapon", "body_armor", "head_armor", "arms_armor", "shield"};
-  for (int t = 0; t < 5; ++t) {
-    char (*arr)[32] = NULL;
-    if (t == 0) arr = g->shop.weapon;
-    else if (t == 1) arr = g->shop.body_armor;
-    else if (t == 2) arr = g->shop.head_armor;
-    else if (t == 3) arr = g->shop.arms_armor;
-    else arr = g->shop.shield;
-    for (int i = 0; i < 3; ++i) {
-      char key[32];
-      snprintf(key, sizeof(key), "%s__%d", types[t], i);
-      value_map_set(main_map, key, ammo_name(g, types[t], arr[i]));
-      snprintf(key, sizeof(key), "%s__%d__price", types[t], i);
-      snprintf(buf, sizeof(buf), "%d", ammo_price(g, types[t], arr[i]));
-      value_map_set(main_map, key, buf);
+    for (int i = 0; i < g->enemy_choice_count; ++i) {
+      value_map_clear(enemy_maps[i]);
+      character_to_map(&g->enemy_choices[i], enemy_maps[i]);
+    }
+    art_count = (size_t)g->enemy_choice_count;
+    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
+    for (size_t i = 0; i < art_count; ++i) {
+      char path[256];
+      snprintf(path, sizeof(path), "enemyes/%s/_%s", g->dungeons[g->dungeon_index].name, g->enemy_choices[i].code);
+      arts[i].name = strdup_safe("normal");
+      arts[i].path = strdup_safe(path);
+    }
+  } else if (g->state == STATE_BATTLE) {
+    menu_path = resolve_menu_path("battle_screen");
+    game_prepare_battle(g, main_map);
+    value_map_clear(hero_map);
+    character_to_map(&g->hero, hero_map);
+    value_map_clear(enemy_maps[0]);
+    character_to_map(&g->enemy, enemy_maps[0]);
+    art_count = 1;
+    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
+    char path[256];
+    snprintf(path, sizeof(path), "enemyes/%s/_%s", enemy_art_dungeon(g), g->enemy.code);
+    const char *battle_art = g->battle_art_name[0] ? g->battle_art_name : "normal";
+    arts[0].name = strdup_safe(battle_art);
+    arts[0].path = strdup_safe(path);
+  } else if (g->state == STATE_CAMPFIRE) {
+    menu_path = resolve_menu_path("rest_menu_screen");
+    game_prepare_campfire(g, main_map);
+    art_count = 1;
+    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
+    arts[0].name = strdup_safe("camp_fire_big");
+    arts[0].path = strdup_safe("_rest");
+  } else if (g->state == STATE_CAMP) {
+    menu_path = resolve_menu_path("camp_screen");
+    game_prepare_camp(g, main_map);
+  } else if (g->state == STATE_MONOLITH) {
+    menu_path = resolve_menu_path("camp_monolith_screen");
+    game_prepare_monolith(g, main_map);
+  } else if (g->state == STATE_OCCULT_LIBRARY) {
+    menu_path = resolve_menu_path("camp_occult_library_screen");
+    game_prepare_occult_library(g, main_map);
+  } else if (g->state == STATE_OL_RECIPE) {
+    menu_path = resolve_menu_path("camp_ol_recipe_screen");
+    game_prepare_recipe_view(g, main_map);
+  } else if (g->state == STATE_OL_ENHANCE_LIST) {
+    menu_path = resolve_menu_path("enhance_by_recipe_screen");
+    game_prepare_enhance_list(g, main_map);
+  } else if (g->state == STATE_OL_ENHANCE) {
+    menu_path = resolve_menu_path("camp_ol_enhance_screen");
+    game_prepare_recipe_enhance(g, main_map);
+  } else if (g->state == STATE_STATS_CHOOSE) {
+    menu_path = resolve_menu_path("statistics_choose_screen");
+    game_prepare_stats_choose(g, main_map);
+  } else if (g->state == STATE_STATS_SHOW) {
+    menu_path = resolve_menu_path("statistics_enemyes_camp_screen");
+    game_prepare_stats_show(g, main_map);
+  } else if (g->state == STATE_EVENT_SELECT) {
+    if (g->event_choice_count >= 3) menu_path = resolve_menu_path("event_3_choose_screen");
+    else if (g->event_choice_count == 2) menu_path = resolve_menu_path("event_2_choose_screen");
+    else menu_path = resolve_menu_path("event_1_choose_screen");
+    value_map_clear(main_map);
+    value_map_set(main_map, "main", g->event_choose_message[0] ? g->event_choose_message : "Choose an event");
+    for (int i = 0; i < g->event_choice_count; ++i) {
+      value_map_clear(enemy_maps[i]);
+      event_to_map(&g->event_choices[i], enemy_maps[i]);
+    }
+    art_count = (size_t)g->event_choice_count;
+    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
+    for (size_t i = 0; i < art_count; ++i) {
+      arts[i].name = strdup_safe("mini");
+      arts[i].path = strdup_safe(g->event_choices[i].art_path);
+    }
+  } else if (g->state == STATE_EVENT_RESULT) {
+    menu_path = resolve_menu_path("messages_screen");
+    game_prepare_event_result(g, main_map);
+    if (g->event_art_path[0]) {
+      art_count = 1;
+      arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
+      const char *art_name = g->event_art_name[0] ? g->event_art_name : "normal";
+      arts[0].name = strdup_safe(art_name);
+      arts[0].path = strdup_safe(g->event_art_path);
+    }
+  } else if (g->state == STATE_OPTIONS) {
+    menu_path = resolve_menu_path("options_choose_screen");
+    game_prepare_options(g, main_map);
+  } else if (g->state == STATE_OPTIONS_ANIM) {
+    menu_path = resolve_menu_path("options_animation_speed_screen");
+    game_prepare_options_anim(g, main_map);
+  } else if (g->state == STATE_OPTIONS_REPLACE) {
+    menu_path = resolve_menu_path("options_screen_replacement_type_screen");
+    game_prepare_options_replace(g, main_map);
+  } else if (g->state == STATE_CREDITS) {
+    menu_path = resolve_menu_path("credits_screen");
+  } else if (g->state == STATE_LOOT) {
+    const char *type = (g->loot_index < g->loot_count) ? g->loot_items[g->loot_index].type : "weapon";
+    if (strcmp(type, "weapon") == 0) menu_path = resolve_menu_path("loot_enemy_weapon");
+    else if (strcmp(type, "body_armor") == 0) menu_path = resolve_menu_path("loot_enemy_body_armor");
+    else if (strcmp(type, "head_armor") == 0) menu_path = resolve_menu_path("loot_enemy_head_armor");
+    else if (strcmp(type, "arms_armor") == 0) menu_path = resolve_menu_path("loot_enemy_arms_armor");
+    else menu_path = resolve_menu_path("loot_enemy_shield");
+    game_prepare_loot(g, main_map, hero_map, enemy_maps[0], &arts, &art_count);
+  } else if (g->state == STATE_LOOT_MESSAGE) {
+    menu_path = resolve_menu_path("messages_screen");
+    game_prepare_loot_message(g, main_map);
+    if (g->loot_message_mode == 1) {
+      art_count = 1;
+      arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
+      arts[0].name = strdup_safe("loot_coins");
+      arts[0].path = strdup_safe("_loot_coins");
+    } else if (g->loot_message_mode == 2) {
+      art_count = 1;
+      arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
+      char path[256];
+      snprintf(path, sizeof(path), "enemyes/%s/_%s", enemy_art_dungeon(g), g->enemy.code);
+      arts[0].name = strdup_safe("normal");
+      arts[0].path = strdup_safe(path);
+    }
+  } else if (g->state == STATE_SHOP) {
+    menu_path = resolve_menu_path("camp_shop_screen");
+    game_prepare_shop(g, main_map);
+  } else if (g->state == STATE_AMMO_SHOW) {
+    if (strcmp(g->ammo_show_type, "weapon") == 0) menu_path = resolve_menu_path("ammunition_weapon_screen");
+    else if (strcmp(g->ammo_show_type, "body_armor") == 0) menu_path = resolve_menu_path("ammunition_body_armor_screen");
+    else if (strcmp(g->ammo_show_type, "head_armor") == 0) menu_path = resolve_menu_path("ammunition_head_armor_screen");
+    else if (strcmp(g->ammo_show_type, "arms_armor") == 0) menu_path = resolve_menu_path("ammunition_arms_armor_screen");
+    else menu_path = resolve_menu_path("ammunition_shield_screen");
+    ammo_to_map(g, g->ammo_show_type, g->ammo_show_code, main_map);
+    art_count = 1;
+    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
+    char path[256];
+    snprintf(path, sizeof(path), "ammunition/%s/_%s", g->ammo_show_type, g->ammo_show_code);
+    arts[0].name = strdup_safe("normal");
+    arts[0].path = strdup_safe(path);
+  } else if (g->state == STATE_HERO_INFO) {
+    menu_path = resolve_menu_path("hero_sl_screen");
+    game_prepare_hero_info(g, main_map);
+    value_map_clear(hero_map);
+    character_to_map(&g->hero, hero_map);
+    art_count = 1;
+    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
+    char path[256];
+    snprintf(path, sizeof(path), "dungeons/_%s", g->dungeons[g->dungeon_index].name);
+    arts[0].name = strdup_safe("normal");
+    arts[0].path = strdup_safe(path);
+  } else if (g->state == STATE_SPEND_STAT || g->state == STATE_SPEND_SKILL) {
+    menu_path = resolve_menu_path("hero_update_screen");
+    if (g->state == STATE_SPEND_STAT) {
+      game_prepare_spend_stat(g, main_map);
+    } else {
+      game_prepare_spend_skill(g, main_map);
+    }
+    value_map_clear(hero_map);
+    character_to_map(&g->hero, hero_map);
+  } else if (g->state == STATE_MESSAGE) {
+    menu_path = resolve_menu_path("messages_screen");
+    game_prepare_message(g, main_map);
+    if (g->message_art_path[0]) {
+      art_count = 1;
+      arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
+      arts[0].name = strdup_safe(g->message_art_name[0] ? g->message_art_name : "normal");
+      arts[0].path = strdup_safe(g->message_art_path);
     }
   }
 
-  value_map_set(main_map, "weapon", ammo_name(g, "weapon", g->warehouse.weapon));
-  value_map_set(main_map, "body_armor", ammo_name(g, "body_armor", g->warehouse.body_armor));
-  value_map_set(main_map, "head_armor", ammo_name(g, "head_armor", g->warehouse.head_armor));
-  value_map_set(main_map, "arms_armor", ammo_name(g, "arms_armor", g->warehouse.arms_armor));
-  value_map_set(main_map, "shield", ammo_name(g, "shield", g->warehouse.shield));
+  if (!menu_path) return false;
+  *out_menu_path = menu_path;
+  *out_arts = arts;
+  *out_art_count = art_count;
+  return true;
 }
 
-static void game_prepare_monolith(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  char buf[64];
-  snprintf(buf, sizeof(buf), "%d", g->monolith.points);
-  value_map_set(main_map, "points", buf);
-
-  const char *stats[] = {"hp","mp","accuracy","damage","stat_points","skill_points","armor","regen_hp","regen_mp","armor_penetration","block_chance"};
-  for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); ++i) {
-    if (!stats[i]) continue;
-    snprintf(buf, sizeof(buf), "%d", monolith_get_stat(&g->monolith, stats[i]));
-    value_map_set(main_map, stats[i], buf);
-    char key[64];
-    snprintf(key, sizeof(key), "%s__p", stats[i]);
-    snprintf(buf, sizeof(buf), "%d", monolith_price_for(&g->monolith, stats[i]));
-    value_map_set(main_map, key, buf);
+static void free_art_args(ArtArg *arts, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    free(arts[i].name);
+    free(arts[i].path);
   }
+  free(arts);
 }
 
-static void format_hero_ingredients(const Character *h, char *out, size_t out_sz) {
-  if (!out || out_sz == 0) return;
-  out[0] = '\0';
-  if (!h || h->ingredients.count == 0) {
-    snprintf(out, out_sz, "Your ingredients:     ---");
-    return;
+// Which partial views of the current screen get their own value map
+// (hero/enemy panels); the rest are composed against the main map.
+static size_t screen_partial_maps(const Game *g, ValueMap *hero_map, ValueMap *enemy_maps[3], ValueMap *partial_maps[3]) {
+  size_t partial_count = 0;
+  if (g->state == STATE_BATTLE) {
+    partial_maps[0] = hero_map;
+    partial_maps[1] = enemy_maps[0];
+    partial_count = 2;
+  } else if (g->state == STATE_ENEMY_SELECT) {
+    for (int i = 0; i < g->enemy_choice_count; ++i) partial_maps[i] = enemy_maps[i];
+    partial_count = (size_t)g->enemy_choice_count;
+  } else if (g->state == STATE_EVENT_SELECT) {
+    for (int i = 0; i < g->event_choice_count; ++i) partial_maps[i] = enemy_maps[i];
+    partial_count = (size_t)g->event_choice_count;
+  } else if (g->state == STATE_LOOT) {
+    partial_maps[0] = hero_map;
+    partial_maps[1] = enemy_maps[0];
+    partial_count = 2;
+  } else if (g->state == STATE_HERO_INFO || g->state == STATE_SPEND_STAT || g->state == STATE_SPEND_SKILL || g->state == STATE_LOAD_CONFIRM) {
+    partial_maps[0] = hero_map;
+    partial_maps[1] = hero_map;
+    partial_count = 2;
+  }
+  return partial_count;
+}
+
+// Fills the value maps for g->state and composes the screen. With a composer,
+// a screen that keeps its template is patched in place; otherwise (or with
+// comp == NULL) the menu is reloaded from the template and fully composed.
+static bool game_compose_screen(Game *g, const char *version, Menu *menu, ValueMap *main_map,
+                                ValueMap *hero_map, ValueMap *enemy_maps[3], Composer *comp) {
+  ArtArg *arts = NULL;
+  size_t art_count = 0;
+  char *menu_path = NULL;
+  prof_enter(PROF_SCREEN);
+  bool built = game_build_screen(g, version, menu, main_map, hero_map, enemy_maps, &arts, &art_count, &menu_path);
+  prof_leave();
+  if (built) {
+    ValueMap *partial_maps[3] = {0};
+    size_t partial_count = screen_partial_maps(g, hero_map, enemy_maps, partial_maps);
+    prof_enter(PROF_COMPOSE);
+    if (!compose_menu_patch(comp, menu, menu_path, main_map, partial_maps, partial_count, arts, art_count)) {
+      free_menu(menu);
+      menu_load_cached(menu_path, menu);
+      compose_menu_ex(menu, main_map, partial_maps, partial_count, arts, art_count, comp, menu_path);
+    }
+    prof_leave();
+  }
+  free(menu_path);
+  free_art_args(arts, art_count);
+  return built;
+}
+
+// Text typed while the state machine waits for a name or an event answer.
+static bool game_handle_text(Game *g, const char *text) {
+  if (g->state == STATE_NAME_INPUT) {
+    append_text(g->name_input, &g->name_len, NAME_MAX_LEN + 1, text);
+    g->name_error[0] = '\0';
+    return true;
   }
-  char list[512] = {0};
-  bool first = true;
-  for (size_t i = 0; i < h->ingredients.count; ++i) {
-    char name_buf[64];
-    titleize_token(h->ingredients.items[i].key, name_buf, sizeof(name_buf));
-    int val = atoi(h->ingredients.items[i].value ? h->ingredients.items[i].value : "0");
-    append_kv(list, sizeof(list), name_buf, val, &first);
+  if (g->state == STATE_EVENT_RESULT && g->event_input_mode == EVENT_INPUT_TEXT) {
+    append_text(g->event_text, &g->event_text_len, sizeof(g->event_text), text);
+    return true;
   }
-  snprintf(out, out_sz, "Your ingredients:     %s", list[0] ? list : "---");
+  return false;
 }
 
-static void game_prepare_occult_library(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  char buf[128];
-  snprintf(buf, sizeof(buf), "%d", g->warehouse.coins);
-  value_map_set(main_map, "coins", buf);
-
-  for (int i = 1; i <= 24; ++i) {
-    OccultRecipe *r = occult_recipe_by_view_code(&g->occult, i);
-    char key[32];
-    if (r) {
-      snprintf(key, sizeof(key), "show__%d", i);
-      snprintf(buf, sizeof(buf), "[Enter %c]", (char)('A' + (i - 1)));
-      value_map_set(main_map, key, buf);
-      snprintf(key, sizeof(key), "name__%d", i);
-      value_map_set(main_map, key, r->name);
-      snprintf(key, sizeof(key), "price__%d", i);
-      if (r->purchased) value_map_set(main_map, key, "SOLD");
-      else { snprintf(buf, sizeof(buf), "%d", r->price); value_map_set(main_map, key, buf); }
-      snprintf(key, sizeof(key), "status__%d", i);
-      if (r->purchased) value_map_set(main_map, key, "IN YOUR WAREHOUSE");
-      else { snprintf(buf, sizeof(buf), "[Enter %d]", i); value_map_set(main_map, key, buf); }
+// The state machine's answer to one key press, as the window loop delivers it. Returns
+// true when the screen has to be rebuilt; *quit is set when the key ends the session.
+static bool game_handle_key(Game *g, SDL_Keycode key, bool *quit) {
+  bool dirty = false;
+  int digit = key_to_digit(key);
+  if (g->state == STATE_START) {
+    if (digit == 1) {
+      g->state = STATE_LOAD_MENU;
+      dirty = true;
+    } else if (digit == 0) {
+      *quit = true;
+    } else if (digit == 2) {
+      g->state = STATE_CAMP;
+      dirty = true;
+    } else if (digit == 3) {
+      g->state = STATE_OPTIONS;
+      dirty = true;
+    } else if (digit == 4) {
+      g->state = STATE_CREDITS;
+      dirty = true;
+    }
+  } else if (g->state == STATE_LOAD_MENU) {
+    if (digit == 1) {
+      if (load_hero_in_run(g)) {
+        g->dungeon_index = dungeon_index_by_name(g, g->hero.dungeon_name);
+        g->state = STATE_LOAD_CONFIRM;
+      } else {
+        g->state = STATE_LOAD_NO_HERO;
+      }
+      dirty = true;
+    } else if (digit == 2) {
+      g->state = STATE_CHOOSE_DUNGEON;
+      dirty = true;
+    } else if (digit == 0) {
+      g->state = STATE_START;
+      dirty = true;
+    }
+  } else if (g->state == STATE_LOAD_NO_HERO) {
+    if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
+      g->state = STATE_LOAD_MENU;
+      dirty = true;
+    }
+  } else if (g->state == STATE_CHOOSE_DUNGEON) {
+    if (digit >= 1 && digit <= 3) {
+      g->dungeon_index = digit - 1;
+      g->name_len = 0;
+      g->name_input[0] = '\0';
+      g->name_error[0] = '\0';
+      g->state = STATE_NAME_INPUT;
+      dirty = true;
+    } else if (digit == 0) {
+      g->state = STATE_LOAD_MENU;
+      dirty = true;
+    }
+  } else if (g->state == STATE_NAME_INPUT) {
+    if (key == SDLK_BACKSPACE) {
+      backspace_text(g->name_input, &g->name_len);
+      g->name_error[0] = '\0';
+      dirty = true;
+    } else if (key == SDLK_RETURN || key == SDLK_KP_ENTER) {
+      char tmp[32];
+      snprintf(tmp, sizeof(tmp), "%s", g->name_input);
+      trim_both_inplace(tmp);
+      if (tmp[0] == '\0') {
+        snprintf(g->name_error, sizeof(g->name_error), "The name must contain at least one letter");
+        dirty = true;
+      } else if (strlen(tmp) > NAME_MAX_LEN) {
+        snprintf(g->name_error, sizeof(g->name_error), "%s is an incorrect name. The name must be no more than 20 characters", tmp);
+        dirty = true;
+      } else if (!str_has_letter(tmp)) {
+        snprintf(g->name_error, sizeof(g->name_error), "%s is an incorrect name. The name must contain at least one letter", tmp);
+        dirty = true;
+      } else {
+        snprintf(g->name_input, sizeof(g->name_input), "%s", tmp);
+        g->name_len = strlen(g->name_input);
+        g->name_error[0] = '\0';
+        g->state = STATE_HERO_SELECT;
+        dirty = true;
+      }
+    } else if (digit == 0) {
+      g->state = STATE_CHOOSE_DUNGEON;
+      dirty = true;
+    }
+  } else if (g->state == STATE_HERO_SELECT) {
+    if (digit >= 1 && (size_t)digit <= g->hero_count) {
+      const char *hero_name = g->name_input[0] ? g->name_input : "Hero";
+      g->hero = character_from_hero(g, &g->heroes[digit - 1], hero_name);
+      snprintf(g->hero.dungeon_name, sizeof(g->hero.dungeon_name), "%s", g->dungeons[g->dungeon_index].name);
+      g->hero.dungeon_part_number = 1;
+      g->hero.leveling = 0;
+      apply_monolith_bonuses(&g->monolith, &g->hero, &g->rng[RNG_RUN]);
+      apply_statistics_bonuses(&g->stats_total, g, &g->hero);
+      apply_warehouse_bonuses(g, &g->hero);
+      if (strcmp(g->name_input, "BAMBUGA") == 0) {
+        g->hero.weapon = weapon_from_code(g, "bambuga");
+        character_touch(&g->hero);
+        snprintf(g->hero.name, sizeof(g->hero.name), "Cheater");
+      }
+      g->wg_taken = 0;
+      g->wg_enemy[0] = '\0';
+      g->wg_count = 0;
+      g->wg_level = 0;
+      g->hero_selected = 1;
+      g->state = STATE_SKILL_ACTIVE;
+      dirty = true;
+    } else if (digit == 0) {
+      g->state = STATE_NAME_INPUT;
+      dirty = true;
+    }
+  } else if (g->state == STATE_LOAD_CONFIRM) {
+    if (digit == 1) {
+      g->hero_selected = 1;
+      pick_random_enemies(g);
+      g->state = STATE_ENEMY_SELECT;
+      dirty = true;
+    } else if (digit == 0) {
+      g->state = STATE_LOAD_MENU;
+      dirty = true;
+    }
+  } else if (g->state == STATE_CAMP) {
+    if (digit == 1) {
+      g->state = STATE_MONOLITH;
+      dirty = true;
+    } else if (digit == 2) {
+      g->state = STATE_SHOP;
+      dirty = true;
+    } else if (digit == 3) {
+      g->state = STATE_OCCULT_LIBRARY;
+      dirty = true;
+    } else if (digit == 4) {
+      g->state = STATE_STATS_CHOOSE;
+      dirty = true;
+    } else if (digit == 0) {
+      g->state = STATE_START;
+      dirty = true;
+    }
+  } else if (g->state == STATE_MONOLITH) {
+    if (digit == 0) {
+      g->state = STATE_CAMP;
+      dirty = true;
+    } else if (digit >= 1 && digit <= 11) {
+      const char *stats[] = {"hp","mp","accuracy","damage","stat_points","skill_points","armor","regen_hp","regen_mp","armor_penetration","block_chance"};
+      const char *key = stats[digit - 1];
+      if (monolith_buy(&g->monolith, key)) {
+        save_monolith_data(&g->monolith);
+      } else {
+        snprintf(g->message_title, sizeof(g->message_title), "PZDC Monolith");
+        logbuffer_clear(&g->log);
+        logbuffer_push(&g->log, "Not enough points");
+        g->next_state = STATE_MONOLITH;
+        g->state = STATE_MESSAGE;
+      }
+      dirty = true;
+    }
+  } else if (g->state == STATE_OCCULT_LIBRARY) {
+    char letter = key_to_letter(key);
+    if (digit == 0) {
+      g->state = STATE_CAMP;
+      dirty = true;
+    } else if (digit >= 1 && digit <= 24) {
+      OccultRecipe *r = occult_recipe_by_view_code(&g->occult, digit);
+      if (!r) {
+        snprintf(g->message_title, sizeof(g->message_title), "Occult Library");
+        logbuffer_clear(&g->log);
+        logbuffer_push(&g->log, "No recipe on this line");
+        g->next_state = STATE_OCCULT_LIBRARY;
+        g->state = STATE_MESSAGE;
+        dirty = true;
+      } else if (r->purchased) {
+        snprintf(g->message_title, sizeof(g->message_title), "Occult Library");
+        logbuffer_clear(&g->log);
+        logbuffer_push(&g->log, "Already purchased");
+        g->next_state = STATE_OCCULT_LIBRARY;
+        g->state = STATE_MESSAGE;
+        dirty = true;
+      } else if (g->warehouse.coins < r->price) {
+        snprintf(g->message_title, sizeof(g->message_title), "Occult Library");
+        logbuffer_clear(&g->log);
+        logbuffer_push(&g->log, "Not enough coins");
+        g->next_state = STATE_OCCULT_LIBRARY;
+        g->state = STATE_MESSAGE;
+        dirty = true;
+      } else {
+        g->warehouse.coins -= r->price;
+        r->purchased = true;
+        save_occult_library_data(&g->occult);
+        save_warehouse_data(&g->warehouse);
+        snprintf(g->message_title, sizeof(g->message_title), "Occult Library");
+        logbuffer_clear(&g->log);
+        logbuffer_push(&g->log, "Recipe purchased");
+        g->next_state = STATE_OCCULT_LIBRARY;
+        g->state = STATE_MESSAGE;
+        dirty = true;
+      }
+    } else if (letter) {
+      int idx = (int)(letter - 'a') + 1;
+      OccultRecipe *r = occult_recipe_by_view_code(&g->occult, idx);
+      if (r) {
+        g->current_recipe_index = (int)(r - g->occult.recipes);
+        g->return_state = STATE_OCCULT_LIBRARY;
+        g->state = STATE_OL_RECIPE;
+        dirty = true;
+      }
+    }
+  } else if (g->state == STATE_OL_RECIPE) {
+    if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
+      GameState back = (g->return_state == STATE_OL_ENHANCE_LIST || g->return_state == STATE_OCCULT_LIBRARY)
+                         ? g->return_state : STATE_OCCULT_LIBRARY;
+      g->state = back;
+      dirty = true;
+    }
+  } else if (g->state == STATE_OL_ENHANCE_LIST) {
+    char letter = key_to_letter(key);
+    if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
+      g->state = STATE_CAMPFIRE;
+      dirty = true;
+    } else if (letter) {
+      size_t count = 0;
+      size_t *indices = occult_accessible_indices(&g->occult, &count);
+      int idx = (int)(letter - 'a');
+      if ((size_t)idx < count) {
+        g->current_recipe_index = (int)indices[idx];
+        OccultRecipe *r = &g->occult.recipes[indices[idx]];
+        if (recipe_hero_has_ingredients(r, &g->hero)) {
+          g->state = STATE_OL_ENHANCE;
+        } else {
+          g->return_state = STATE_OL_ENHANCE_LIST;
+          g->state = STATE_OL_RECIPE;
+        }
+        dirty = true;
+      }
+      free(indices);
+    }
+  } else if (g->state == STATE_OL_ENHANCE) {
+    char letter = key_to_letter(key);
+    if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
+      g->state = STATE_OL_ENHANCE_LIST;
+      dirty = true;
+    } else if (letter) {
+      const char *type = NULL;
+      if (letter == 'a') type = "weapon";
+      else if (letter == 'b') type = "head_armor";
+      else if (letter == 'c') type = "body_armor";
+      else if (letter == 'd') type = "arms_armor";
+      else if (letter == 'e') type = "shield";
+      if (type) {
+        const char *code = "without";
+        if (strcmp(type, "weapon") == 0) code = g->hero.weapon.code;
+        else if (strcmp(type, "head_armor") == 0) code = g->hero.head_armor.code;
+        else if (strcmp(type, "body_armor") == 0) code = g->hero.body_armor.code;
+        else if (strcmp(type, "arms_armor") == 0) code = g->hero.arms_armor.code;
+        else if (strcmp(type, "shield") == 0) code = g->hero.shield.code;
+        if (strcmp(code, "without") != 0) {
+          snprintf(g->ammo_show_type, sizeof(g->ammo_show_type), "%s", type);
+          snprintf(g->ammo_show_code, sizeof(g->ammo_show_code), "%s", code);
+          g->return_state = STATE_OL_ENHANCE;
+          g->state = STATE_AMMO_SHOW;
+          dirty = true;
+        }
+      }
+    } else if (digit >= 1 && digit <= 5) {
+      OccultRecipe *r = (g->current_recipe_index >= 0 && (size_t)g->current_recipe_index < g->occult.recipe_count)
+                          ? &g->occult.recipes[g->current_recipe_index] : NULL;
+      if (!r) {
+        g->state = STATE_OL_ENHANCE_LIST;
+        dirty = true;
+      } else if (!recipe_hero_has_ingredients(r, &g->hero)) {
+        snprintf(g->message_title, sizeof(g->message_title), "Occult Library");
+        logbuffer_clear(&g->log);
+        logbuffer_push(&g->log, "Not enough ingredients");
+        g->next_state = STATE_OL_ENHANCE;
+        g->state = STATE_MESSAGE;
+        dirty = true;
+      } else {
+        if (digit == 1) recipe_apply_weapon(r, &g->hero.weapon);
+        else if (digit == 2) recipe_apply_armor(r, &g->hero.head_armor, &r->head_armor);
+        else if (digit == 3) recipe_apply_armor(r, &g->hero.body_armor, &r->body_armor);
+        else if (digit == 4) recipe_apply_armor(r, &g->hero.arms_armor, &r->arms_armor);
+        else if (digit == 5) recipe_apply_shield(r, &g->hero.shield);
+        character_touch(&g->hero);
+        recipe_consume_ingredients(r, &g->hero);
+        snprintf(g->message_title, sizeof(g->message_title), "Occult Library");
+        logbuffer_clear(&g->log);
+        logbuffer_push(&g->log, "Ammunition enhanced");
+        g->next_state = STATE_OL_ENHANCE;
+        g->state = STATE_MESSAGE;
+        dirty = true;
+      }
+    }
+  } else if (g->state == STATE_STATS_CHOOSE) {
+    if (digit == 0) {
+      g->state = STATE_CAMP;
+      dirty = true;
+    } else if (digit >= 1 && digit <= 3) {
+      g->stats_dungeon_index = digit - 1;
+      g->state = STATE_STATS_SHOW;
+      dirty = true;
+    }
+  } else if (g->state == STATE_STATS_SHOW) {
+    if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
+      g->state = STATE_STATS_CHOOSE;
+      dirty = true;
+    }
+  } else if (g->state == STATE_EVENT_SELECT) {
+    if (digit == 0) {
+      g->hero.dungeon_part_number += 1;
+      logbuffer_clear(&g->log);
+      hero_rest(&g->hero, &g->log);
+      g->state = STATE_CAMPFIRE;
+      dirty = true;
+    } else if (digit >= 1 && digit <= g->event_choice_count) {
+      g->current_event = g->event_choices[digit - 1];
+      event_begin(g, &g->current_event);
+      dirty = true;
+    }
+  } else if (g->state == STATE_EVENT_RESULT) {
+    if (g->event_input_mode == EVENT_INPUT_TEXT) {
+      if (key == SDLK_BACKSPACE) {
+        backspace_text(g->event_text, &g->event_text_len);
+        dirty = true;
+      } else if (key == SDLK_RETURN || key == SDLK_KP_ENTER) {
+        event_handle_text(g, g->event_text);
+        dirty = true;
+      }
+    } else if (g->event_input_mode == EVENT_INPUT_DIGIT) {
+      if (digit >= 0) {
+        event_handle_digit(g, digit);
+        dirty = true;
+      }
     } else {
-      snprintf(key, sizeof(key), "show__%d", i); value_map_set(main_map, key, "");
-      snprintf(key, sizeof(key), "name__%d", i); value_map_set(main_map, key, "");
-      snprintf(key, sizeof(key), "price__%d", i); value_map_set(main_map, key, "");
-      snprintf(key, sizeof(key), "status__%d", i); value_map_set(main_map, key, "");
+      if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
+        event_handle_digit(g, digit);
+        dirty = true;
+      }
+    }
+  } else if (g->state == STATE_OPTIONS) {
+    if (digit == 1) {
+      g->state = STATE_OPTIONS_ANIM;
+      dirty = true;
+    } else if (digit == 2) {
+      g->state = STATE_OPTIONS_REPLACE;
+      dirty = true;
+    } else if (digit == 0) {
+      g->state = STATE_START;
+      dirty = true;
+    }
+  } else if (g->state == STATE_OPTIONS_ANIM) {
+    if (digit >= 1 && digit <= 5) {
+      g->anim_speed_index = digit - 1;
+      dirty = true;
+    } else if (digit == 0) {
+      g->state = STATE_OPTIONS;
+      dirty = true;
+    }
+  } else if (g->state == STATE_OPTIONS_REPLACE) {
+    if (digit >= 1 && digit <= 3) {
+      g->screen_replace_type = digit - 1;
+      dirty = true;
+    } else if (digit == 0) {
+      g->state = STATE_OPTIONS;
+      dirty = true;
+    }
+  } else if (g->state == STATE_CREDITS) {
+    if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
+      g->state = STATE_START;
+      dirty = true;
+    }
+  } else if (g->state == STATE_LOOT) {
+    char letter = key_to_letter(key);
+    if (letter == 'y' || letter == 'n') {
+      g->loot_last_taken = (letter == 'y') ? 1 : 0;
+      const LootEntry *le = (g->loot_index < g->loot_count) ? &g->loot_items[g->loot_index] : NULL;
+      if (le && letter == 'y') {
+        if (strcmp(le->type, "weapon") == 0) g->hero.weapon = weapon_from_code(g, le->code);
+        else if (strcmp(le->type, "body_armor") == 0) g->hero.body_armor = armor_from_code(g->body_armors, g->body_armor_count, le->code);
+        else if (strcmp(le->type, "head_armor") == 0) g->hero.head_armor = armor_from_code(g->head_armors, g->head_armor_count, le->code);
+        else if (strcmp(le->type, "arms_armor") == 0) g->hero.arms_armor = armor_from_code(g->arms_armors, g->arms_armor_count, le->code);
+        else if (strcmp(le->type, "shield") == 0) g->hero.shield = shield_from_code(g, le->code);
+        character_touch(&g->hero);
+      }
+      g->loot_index += 1;
+      loot_advance(g);
+      dirty = true;
+    }
+  } else if (g->state == STATE_LOOT_MESSAGE) {
+    if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
+      g->loot_message_mode = 0;
+      loot_advance(g);
+      dirty = true;
+    }
+  } else if (g->state == STATE_SHOP) {
+    char letter = key_to_letter(key);
+    if (digit == 0) {
+      g->state = STATE_CAMP;
+      dirty = true;
+    } else if (digit >= 1 && digit <= 15) {
+      const char *type = NULL;
+      int idx = 0;
+      if (digit <= 3) { type = "weapon"; idx = digit - 1; }
+      else if (digit <= 6) { type = "body_armor"; idx = digit - 4; }
+      else if (digit <= 9) { type = "head_armor"; idx = digit - 7; }
+      else if (digit <= 12) { type = "arms_armor"; idx = digit - 10; }
+      else { type = "shield"; idx = digit - 13; }
+      char *arr = NULL;
+      if (strcmp(type, "weapon") == 0) arr = g->shop.weapon[idx];
+      else if (strcmp(type, "body_armor") == 0) arr = g->shop.body_armor[idx];
+      else if (strcmp(type, "head_armor") == 0) arr = g->shop.head_armor[idx];
+      else if (strcmp(type, "arms_armor") == 0) arr = g->shop.arms_armor[idx];
+      else arr = g->shop.shield[idx];
+      if (strcmp(arr, "without") == 0) {
+        snprintf(g->message_title, sizeof(g->message_title), "Shop");
+        logbuffer_clear(&g->log);
+        logbuffer_push(&g->log, "Empty slot");
+        g->next_state = STATE_SHOP;
+        g->state = STATE_MESSAGE;
+        dirty = true;
+      } else {
+        int price = ammo_price(g, type, arr);
+        if (g->warehouse.coins < price) {
+          snprintf(g->message_title, sizeof(g->message_title), "Shop");
+          logbuffer_clear(&g->log);
+          logbuffer_push(&g->log, "Not enough coins");
+          g->next_state = STATE_SHOP;
+          g->state = STATE_MESSAGE;
+          dirty = true;
+        } else {
+          g->warehouse.coins -= price;
+          if (strcmp(type, "weapon") == 0) snprintf(g->warehouse.weapon, sizeof(g->warehouse.weapon), "%s", arr);
+          else if (strcmp(type, "body_armor") == 0) snprintf(g->warehouse.body_armor, sizeof(g->warehouse.body_armor), "%s", arr);
+          else if (strcmp(type, "head_armor") == 0) snprintf(g->warehouse.head_armor, sizeof(g->warehouse.head_armor), "%s", arr);
+          else if (strcmp(type, "arms_armor") == 0) snprintf(g->warehouse.arms_armor, sizeof(g->warehouse.arms_armor), "%s", arr);
+          else snprintf(g->warehouse.shield, sizeof(g->warehouse.shield), "%s", arr);
+          snprintf(arr, 32, "without");
+          save_shop_data(&g->shop);
+          save_warehouse_data(&g->warehouse);
+          snprintf(g->message_title, sizeof(g->message_title), "Shop");
+          logbuffer_clear(&g->log);
+          logbuffer_push(&g->log, "Item purchased");
+          g->next_state = STATE_SHOP;
+          g->state = STATE_MESSAGE;
+          dirty = true;
+        }
+      }
+    } else if (letter) {
+      const char *type = NULL;
+      const char *code = NULL;
+      if (letter >= 'a' && letter <= 'o') {
+        int idx = letter - 'a';
+        if (idx <= 2) { type = "weapon"; code = g->shop.weapon[idx]; }
+        else if (idx <= 5) { type = "body_armor"; code = g->shop.body_armor[idx - 3]; }
+        else if (idx <= 8) { type = "head_armor"; code = g->shop.head_armor[idx - 6]; }
+        else if (idx <= 11) { type = "arms_armor"; code = g->shop.arms_armor[idx - 9]; }
+        else { type = "shield"; code = g->shop.shield[idx - 12]; }
+      } else if (letter == 'v') { type = "weapon"; code = g->warehouse.weapon; }
+      else if (letter == 'w') { type = "body_armor"; code = g->warehouse.body_armor; }
+      else if (letter == 'x') { type = "head_armor"; code = g->warehouse.head_armor; }
+      else if (letter == 'y') { type = "arms_armor"; code = g->warehouse.arms_armor; }
+      else if (letter == 'z') { type = "shield"; code = g->warehouse.shield; }
+      if (type && code && strcmp(code, "without") != 0) {
+        snprintf(g->ammo_show_type, sizeof(g->ammo_show_type), "%s", type);
+        snprintf(g->ammo_show_code, sizeof(g->ammo_show_code), "%s", code);
+        g->return_state = STATE_SHOP;
+        g->state = STATE_AMMO_SHOW;
+        dirty = true;
+      } else if (type && code && strcmp(code, "without") == 0) {
+        snprintf(g->message_title, sizeof(g->message_title), "Shop");
+        logbuffer_clear(&g->log);
+        logbuffer_push(&g->log, "Nothing to show");
+        g->next_state = STATE_SHOP;
+        g->state = STATE_MESSAGE;
+        dirty = true;
+      }
+    }
+  } else if (g->state == STATE_AMMO_SHOW) {
+    if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
+      g->state = g->return_state;
+      dirty = true;
+    }
+  } else if (g->state == STATE_SKILL_ACTIVE) {
+    const char *skills[] = {"ascetic_strike", "precise_strike", "strong_strike", "traumatic_strike"};
+    if (digit >= 1 && digit <= 4) {
+      skill_assign(&g->hero.active_skill, SKILL_ACTIVE, skills[digit - 1]);
+      g->state = STATE_SKILL_PASSIVE;
+      dirty = true;
+    }
+  } else if (g->state == STATE_SKILL_PASSIVE) {
+    const char *skills[] = {"berserk", "concentration", "dazed", "shield_master"};
+    if (digit >= 1 && digit <= 4) {
+      skill_assign(&g->hero.passive_skill, SKILL_PASSIVE, skills[digit - 1]);
+      character_touch(&g->hero);
+      g->state = STATE_SKILL_CAMP;
+      dirty = true;
+    }
+  } else if (g->state == STATE_SKILL_CAMP) {
+    const char *skills[] = {"bloody_ritual", "first_aid", "treasure_hunter"};
+    if (digit >= 1 && digit <= 3) {
+      skill_assign(&g->hero.camp_skill, SKILL_CAMP, skills[digit - 1]);
+      pick_random_enemies(g);
+      g->state = STATE_ENEMY_SELECT;
+      dirty = true;
+    }
+  } else if (g->state == STATE_ENEMY_SELECT) {
+    if (digit >= 1 && digit <= g->enemy_choice_count) {
+      g->enemy = g->enemy_choices[digit - 1];
+      g->enemy_is_boss = g->enemy_choice_is_boss[digit - 1];
+      logbuffer_clear(&g->log);
+      snprintf(g->battle_art_name, sizeof(g->battle_art_name), "normal");
+      g->battle_art_dungeon[0] = '\0';
+      g->battle_anim_active = 0;
+      g->battle_anim_step = 0;
+      g->battle_anim_count = 0;
+      g->battle_anim_deadline = 0;
+      g->battle_exit_pending = 0;
+      g->state = STATE_BATTLE;
+      dirty = true;
+    } else if (digit == 0) {
+      logbuffer_clear(&g->log);
+      hero_rest(&g->hero, &g->log);
+      g->state = STATE_CAMPFIRE;
+      dirty = true;
+    }
+  } else if (g->state == STATE_BATTLE) {
+    if (g->battle_anim_active || g->battle_exit_pending) {
+      // ignore input while battle animation plays
+    } else if (digit >= 1 && digit <= 4) {
+      int enemy_attack_type = 0;
+      battle_round(g, digit, &enemy_attack_type);
+      const bool enemy_dead = (g->enemy.hp <= 0);
+      const bool hero_dead = (g->hero.hp <= 0);
+
+      if (enemy_dead) {
+        snprintf(g->message_title, sizeof(g->message_title), "Enemy defeated");
+        logbuffer_clear(&g->log);
+        hero_add_exp(&g->hero, g->enemy.exp_gived, &g->log);
+        stats_total_increment(&g->stats_total, g->dungeons[g->dungeon_index].name, g->enemy.code);
+        save_statistics_total(&g->stats_total);
+        int points = monolith_points_from_enemy(&g->hero, &g->enemy, &g->rng[RNG_LOOT]);
+        if (points > 0) {
+          g->hero.pzdc_monolith_points += points;
+          char msg[128];
+          snprintf(msg, sizeof(msg), "PZDC Monolith gained %d point(s)", points);
+          logbuffer_push(&g->log, msg);
+        }
+        if (g->enemy_is_boss) {
+          end_run_transfer(g, true);
+          snprintf(g->message_title, sizeof(g->message_title), "Dungeon completed");
+          snprintf(g->message_art_name, sizeof(g->message_art_name), "dungeon_completed");
+          snprintf(g->message_art_path, sizeof(g->message_art_path), "_game_over");
+          g->next_state = STATE_START;
+          g->battle_exit_state = STATE_MESSAGE;
+        } else {
+          loot_setup(g);
+          if (g->loot_count > 0 || g->loot_show_coins || g->loot_show_ingredient) {
+            loot_advance(g);
+            g->battle_exit_state = g->state;
+            g->state = STATE_BATTLE;
+          } else {
+            g->pending_levelup = 1;
+            g->next_state = STATE_CAMPFIRE;
+            g->battle_exit_state = STATE_MESSAGE;
+          }
+        }
+        g->battle_exit_pending = 1;
+      } else if (hero_dead) {
+        snprintf(g->message_title, sizeof(g->message_title), "You are dead");
+        logbuffer_clear(&g->log);
+        end_run_transfer(g, false);
+        logbuffer_push(&g->log, "Your run has ended. Camp loot saved.");
+        snprintf(g->message_art_name, sizeof(g->message_art_name), "game_over");
+        snprintf(g->message_art_path, sizeof(g->message_art_path), "_game_over");
+        g->next_state = STATE_START;
+        g->battle_exit_state = STATE_MESSAGE;
+        g->battle_exit_pending = 1;
+      }
+
+      const char *seq[3];
+      int seq_count = 0;
+      if (enemy_dead) {
+        seq[0] = "damaged";
+        seq[1] = "dead";
+        seq_count = 2;
+      } else {
+        seq[0] = "damaged";
+        seq[1] = "normal";
+        seq[2] = enemy_attack_art_from_type(enemy_attack_type);
+        seq_count = 3;
+      }
+      battle_anim_queue(g, seq, seq_count);
+      dirty = true;
+    }
+  } else if (g->state == STATE_CAMPFIRE) {
+    if (digit == 1) {
+      g->state = STATE_HERO_INFO;
+      dirty = true;
+    } else if (digit == 2) {
+      if (g->hero.stat_points > 0) {
+        g->stat_roll = 0;
+        g->state = STATE_SPEND_STAT;
+        dirty = true;
+      } else {
+        logbuffer_clear(&g->log);
+        logbuffer_push(&g->log, "No stat points to spend");
+        dirty = true;
+      }
+    } else if (digit == 3) {
+      if (g->hero.skill_points > 0) {
+        g->skill_choice_count = 0;
+        g->state = STATE_SPEND_SKILL;
+        dirty = true;
+      } else {
+        logbuffer_clear(&g->log);
+        logbuffer_push(&g->log, "No skill points to spend");
+        dirty = true;
+      }
+    } else if (digit == 4) {
+      game_use_camp_skill(g);
+      dirty = true;
+    } else if (digit == 5) {
+      g->state = STATE_OL_ENHANCE_LIST;
+      dirty = true;
+    } else if (digit == 6) {
+      save_hero_in_run(g);
+      snprintf(g->message_title, sizeof(g->message_title), "Game saved");
+      logbuffer_clear(&g->log);
+      logbuffer_push(&g->log, "You can resume from the main menu");
+      g->next_state = STATE_START;
+      g->state = STATE_MESSAGE;
+      dirty = true;
+    } else if (digit == 7) {
+      end_run_transfer(g, g->hero.hp > 0);
+      snprintf(g->message_title, sizeof(g->message_title), "Run ended");
+      logbuffer_clear(&g->log);
+      logbuffer_push(&g->log, "Camp loot and monolith points transferred");
+      g->next_state = STATE_START;
+      g->state = STATE_MESSAGE;
+      dirty = true;
+    } else if (digit == 0) {
+      if (g->hero.dungeon_part_number % 2 == 0) {
+        pick_random_events(g);
+        g->state = STATE_EVENT_SELECT;
+      } else {
+        pick_random_enemies(g);
+        g->state = STATE_ENEMY_SELECT;
+      }
+      dirty = true;
+    }
+  } else if (g->state == STATE_HERO_INFO) {
+    if (digit == 0) {
+      g->state = STATE_CAMPFIRE;
+      dirty = true;
+    }
+  } else if (g->state == STATE_SPEND_STAT) {
+    if (digit == 0) {
+      g->state = STATE_CAMPFIRE;
+      dirty = true;
+    } else if (hero_spend_stat(g, digit)) {
+      dirty = true;
+    }
+    if (g->state == STATE_SPEND_STAT && g->hero.stat_points <= 0) {
+      g->state = STATE_CAMPFIRE;
+      dirty = true;
+    }
+  } else if (g->state == STATE_SPEND_SKILL) {
+    if (digit == 0) {
+      g->state = STATE_CAMPFIRE;
+      dirty = true;
+    } else if (hero_spend_skill(g, digit)) {
+      dirty = true;
+      if (g->hero.skill_points <= 0) {
+        g->state = STATE_CAMPFIRE;
+      }
+    }
+  } else if (g->state == STATE_MESSAGE) {
+    g->state = g->next_state;
+    if (g->state == STATE_ENEMY_SELECT) pick_random_enemies(g);
+    if (g->state == STATE_CAMPFIRE) {
+      if (g->pending_levelup) {
+        g->hero.leveling += 1;
+        g->hero.dungeon_part_number += 1;
+        g->pending_levelup = 0;
+      }
+      logbuffer_clear(&g->log);
+      hero_rest(&g->hero, &g->log);
     }
+    g->message_art_name[0] = '\0';
+    g->message_art_path[0] = '\0';
+    dirty = true;
   }
+  return dirty;
 }
 
-static void game_prepare_recipe_view(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  OccultRecipe *r = (g->current_recipe_index >= 0 && (size_t)g->current_recipe_index < g->occult.recipe_count)
-                      ? &g->occult.recipes[g->current_recipe_index] : NULL;
-  if (!r) return;
-  value_map_set(main_map, "name", r->name);
-  char buf[512];
-  format_recipe_ingredients(r, buf, sizeof(buf));
-  value_map_set(main_map, "recipe", buf);
-  format_hero_ingredients(&g->hero, buf, sizeof(buf));
-  value_map_set(main_map, "ingredients", buf);
+// Startup data loading. The files are independent and each job writes its
+// own Game fields, so they are parsed on a few SDL threads while the main
+// thread brings up SDL and the font. Log lines are printed on join, in job
+// order, so the output does not depend on scheduling.
+typedef struct {
+  const char *what;
+  const char *path; // NULL for save-backed jobs, which resolve their own path and log nothing
+  size_t (*run)(Game *g, const char *path);
+} LoadJob;
 
-  format_effect(&r->weapon, buf, sizeof(buf)); value_map_set(main_map, "weapon", buf);
-  format_effect(&r->head_armor, buf, sizeof(buf)); value_map_set(main_map, "head_armor", buf);
-  format_effect(&r->body_armor, buf, sizeof(buf)); value_map_set(main_map, "body_armor", buf);
-  format_effect(&r->arms_armor, buf, sizeof(buf)); value_map_set(main_map, "arms_armor", buf);
-  format_effect(&r->shield, buf, sizeof(buf)); value_map_set(main_map, "shield", buf);
+static size_t load_job_heroes(Game *g, const char *path) {
+  load_heroes(path, &g->heroes, &g->hero_count);
+  return g->hero_count;
 }
 
-static void game_prepare_recipe_enhance(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  OccultRecipe *r = (g->current_recipe_index >= 0 && (size_t)g->current_recipe_index < g->occult.recipe_count)
-                      ? &g->occult.recipes[g->current_recipe_index] : NULL;
-  if (!r) return;
-  value_map_set(main_map, "name", r->name);
-  char buf[512];
-  format_recipe_ingredients(r, buf, sizeof(buf));
-  value_map_set(main_map, "recipe", buf);
-  format_hero_ingredients(&g->hero, buf, sizeof(buf));
-  value_map_set(main_map, "ingredients", buf);
-
-  ammo_display_name(g->hero.weapon.name, g->hero.weapon.enhanced, buf, sizeof(buf));
-  value_map_set(main_map, "hero__weapon__name", buf);
-  ammo_display_name(g->hero.head_armor.name, g->hero.head_armor.enhanced, buf, sizeof(buf));
-  value_map_set(main_map, "hero__head_armor__name", buf);
-  ammo_display_name(g->hero.body_armor.name, g->hero.body_armor.enhanced, buf, sizeof(buf));
-  value_map_set(main_map, "hero__body_armor__name", buf);
-  ammo_display_name(g->hero.arms_armor.name, g->hero.arms_armor.enhanced, buf, sizeof(buf));
-  value_map_set(main_map, "hero__arms_armor__name", buf);
-  ammo_display_name(g->hero.shield.name, g->hero.shield.enhanced, buf, sizeof(buf));
-  value_map_set(main_map, "hero__shield__name", buf);
+static size_t load_job_bandits(Game *g, const char *path) {
+  load_enemies(path, &g->dungeons[0].enemies, &g->dungeons[0].enemy_count);
+  return g->dungeons[0].enemy_count;
+}
 
-  format_effect(&r->weapon, buf, sizeof(buf)); value_map_set(main_map, "weapon", buf);
-  format_effect(&r->head_armor, buf, sizeof(buf)); value_map_set(main_map, "head_armor", buf);
-  format_effect(&r->body_armor, buf, sizeof(buf)); value_map_set(main_map, "body_armor", buf);
-  format_effect(&r->arms_armor, buf, sizeof(buf)); value_map_set(main_map, "arms_armor", buf);
-  format_effect(&r->shield, buf, sizeof(buf)); value_map_set(main_map, "shield", buf);
+static size_t load_job_undeads(Game *g, const char *path) {
+  load_enemies(path, &g->dungeons[1].enemies, &g->dungeons[1].enemy_count);
+  return g->dungeons[1].enemy_count;
 }
 
-static void game_prepare_enhance_list(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  size_t count = 0;
-  size_t *indices = occult_accessible_indices(&g->occult, &count);
-  for (int i = 1; i <= 24; ++i) {
-    char key[32];
-    char buf[128];
-    if ((size_t)(i - 1) < count) {
-      OccultRecipe *r = &g->occult.recipes[indices[i - 1]];
-      snprintf(key, sizeof(key), "show__%d", i);
-      snprintf(buf, sizeof(buf), "[Enter %c]", (char)('A' + (i - 1)));
-      value_map_set(main_map, key, buf);
-      snprintf(key, sizeof(key), "name__%d", i);
-      value_map_set(main_map, key, r->name);
-      snprintf(key, sizeof(key), "has_ingredients__%d", i);
-      value_map_set(main_map, key, recipe_hero_has_ingredients(r, &g->hero) ? "YES" : "NO");
-    } else {
-      snprintf(key, sizeof(key), "show__%d", i); value_map_set(main_map, key, "");
-      snprintf(key, sizeof(key), "name__%d", i); value_map_set(main_map, key, "");
-      snprintf(key, sizeof(key), "has_ingredients__%d", i); value_map_set(main_map, key, "");
-    }
-  }
-  free(indices);
+static size_t load_job_swamp(Game *g, const char *path) {
+  load_enemies(path, &g->dungeons[2].enemies, &g->dungeons[2].enemy_count);
+  return g->dungeons[2].enemy_count;
 }
 
-static void game_prepare_stats_choose(Game *g, ValueMap *main_map) {
-  (void)g;
-  value_map_clear(main_map);
-  value_map_set(main_map, "main", "Select dungeon statistics");
+static size_t load_job_events(Game *g, const char *path) {
+  load_enemies(path, &g->event_enemies, &g->event_enemy_count);
+  return g->event_enemy_count;
 }
 
-static void game_prepare_stats_show(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  const char *dungeon = g->stats_dungeon_index == 0 ? "bandits" :
-                        g->stats_dungeon_index == 1 ? "undeads" : "swamp";
-  char name_buf[64];
-  titleize_token(dungeon, name_buf, sizeof(name_buf));
-  value_map_set(main_map, "name", name_buf);
+static size_t load_job_weapons(Game *g, const char *path) {
+  load_weapons(path, &g->weapons, &g->weapon_count);
+  return g->weapon_count;
+}
 
-  const char *bandits[] = {"rabble","rabid_dog","poacher","thug","deserter","bandit_leader"};
-  const char *undeads[] = {"zombie","skeleton","ghost","fat_ghoul","skeleton_soldier","zombie_knight"};
-  const char *swamp[] = {"leech","goblin","sworm","spider","orc","ancient_snail"};
-  const char *rewards[] = {
-    "Permanent weapon \"Stick\"",
-    "+2 HP",
-    "+1 accuracy",
-    "+5 HP",
-    "+1 stat point",
-    "+1 skill point",
-    "Permanent \"Worn gloves\"",
-    "+3 MP",
-    "+1 accuracy",
-    "+7 HP",
-    "+3 block chance",
-    "+1 MP-regen",
-    "+3 MP",
-    "Permanent \"Holey wicker buckler\"",
-    "+3 HP",
-    "+1 accuracy",
-    "+1 max damage",
-    "+1 armor"
-  };
-  const char **list = g->stats_dungeon_index == 0 ? bandits :
-                      g->stats_dungeon_index == 1 ? undeads : swamp;
-  int counts[6];
-  for (int i = 0; i < 6; ++i) {
-    counts[i] = stats_total_get(&g->stats_total, dungeon, list[i]);
-  }
-  for (int i = 0; i < 6; ++i) {
-    char key[32];
-    char buf[128];
-    char enemy_name[64];
-    titleize_token(list[i], enemy_name, sizeof(enemy_name));
-    snprintf(key, sizeof(key), "enemy_name__%d", i);
-    value_map_set(main_map, key, enemy_name);
-    snprintf(key, sizeof(key), "enemy_count__%d", i);
-    snprintf(buf, sizeof(buf), "%d", counts[i]);
-    value_map_set(main_map, key, buf);
-    snprintf(key, sizeof(key), "enemy_done__%d", i);
-    int needed = (g->stats_dungeon_index == 0 && i == 5) || (g->stats_dungeon_index == 1 && i == 5) || (g->stats_dungeon_index == 2 && i == 5) ? 5 : 30;
-    value_map_set(main_map, key, counts[i] >= needed ? "DONE" : "");
-    snprintf(key, sizeof(key), "enemy_kill__%d", i);
-    snprintf(buf, sizeof(buf), "%d", needed);
-    value_map_set(main_map, key, buf);
-    snprintf(key, sizeof(key), "enemy_get__%d", i);
-    int reward_idx = g->stats_dungeon_index * 6 + i;
-    value_map_set(main_map, key, rewards[reward_idx]);
-  }
+static size_t load_job_body_armor(Game *g, const char *path) {
+  load_armors(path, &g->body_armors, &g->body_armor_count);
+  return g->body_armor_count;
 }
 
-static void game_prepare_event_result(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  const char *title = g->event_message[0] ? g->event_message : "Event";
-  value_map_set(main_map, "main", title);
-  logbuffer_apply_full(main_map, &g->log, 7);
-  if (g->event_input_mode == EVENT_INPUT_TEXT) {
-    char buf[128];
-    snprintf(buf, sizeof(buf), "> %s", g->event_text);
-    value_map_set(main_map, "log_6", buf);
-  }
+static size_t load_job_head_armor(Game *g, const char *path) {
+  load_armors(path, &g->head_armors, &g->head_armor_count);
+  return g->head_armor_count;
 }
 
-static void game_prepare_options(Game *g, ValueMap *main_map) {
-  (void)g;
-  value_map_clear(main_map);
-  value_map_set(main_map, "main", "");
+static size_t load_job_arms_armor(Game *g, const char *path) {
+  load_armors(path, &g->arms_armors, &g->arms_armor_count);
+  return g->arms_armor_count;
 }
 
-static void game_prepare_options_anim(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  for (int i = 0; i < 5; ++i) {
-    char key[64];
-    snprintf(key, sizeof(key), "enemy_actions_animation_speed__%d", i);
-    if (g->anim_speed_index == i) value_map_set(main_map, key, "SELECTED");
-    else {
-      char buf[32];
-      snprintf(buf, sizeof(buf), "[Enter %d]", i + 1);
-      value_map_set(main_map, key, buf);
-    }
-  }
+static size_t load_job_shields(Game *g, const char *path) {
+  load_shields(path, &g->shields, &g->shield_count);
+  return g->shield_count;
 }
 
-static void game_prepare_options_replace(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  for (int i = 0; i < 3; ++i) {
-    char key[64];
-    snprintf(key, sizeof(key), "screen_replacement_type__%d", i);
-    if (g->screen_replace_type == i) value_map_set(main_map, key, "SELECTED");
-    else {
-      char buf[32];
-      snprintf(buf, sizeof(buf), "[Enter %d]", i + 1);
-      value_map_set(main_map, key, buf);
-    }
-  }
+static size_t load_job_shop(Game *g, const char *path) {
+  (void)path;
+  return load_shop_data(&g->shop);
 }
 
-static void game_prepare_loot(Game *g, ValueMap *main_map, ValueMap *hero_item_map, ValueMap *enemy_item_map,
-                              ArtArg **out_arts, size_t *out_art_count) {
-  value_map_clear(main_map);
-  value_map_set(main_map, "main", g->loot_message[0] ? g->loot_message : "Loot found");
-  value_map_clear(hero_item_map);
-  value_map_clear(enemy_item_map);
+static size_t load_job_warehouse(Game *g, const char *path) {
+  (void)path;
+  return load_warehouse_data(&g->warehouse);
+}
 
-  if (g->loot_index >= g->loot_count) return;
-  const LootEntry *le = &g->loot_items[g->loot_index];
-  const char *type = le->type;
-  const char *enemy_code = le->code;
-  const char *hero_code = "without";
-  if (strcmp(type, "weapon") == 0) hero_code = g->hero.weapon.code;
-  else if (strcmp(type, "body_armor") == 0) hero_code = g->hero.body_armor.code;
-  else if (strcmp(type, "head_armor") == 0) hero_code = g->hero.head_armor.code;
-  else if (strcmp(type, "arms_armor") == 0) hero_code = g->hero.arms_armor.code;
-  else if (strcmp(type, "shield") == 0) hero_code = g->hero.shield.code;
+static size_t load_job_monolith(Game *g, const char *path) {
+  (void)path;
+  return load_monolith_data(&g->monolith);
+}
 
-  ammo_to_map(g, type, hero_code, hero_item_map);
-  ammo_to_map(g, type, enemy_code, enemy_item_map);
+static size_t load_job_statistics(Game *g, const char *path) {
+  (void)path;
+  return load_statistics_total(&g->stats_total);
+}
 
-  *out_art_count = 2;
-  *out_arts = (ArtArg *)calloc(*out_art_count, sizeof(ArtArg));
-  if (*out_arts) {
-    char path0[256];
-    char path1[256];
-    snprintf(path0, sizeof(path0), "ammunition/%s/_%s", type, hero_code);
-    snprintf(path1, sizeof(path1), "ammunition/%s/_%s", type, enemy_code);
-    (*out_arts)[0].name = strdup_safe("normal");
-    (*out_arts)[0].path = strdup_safe(path0);
-    (*out_arts)[1].name = strdup_safe("normal");
-    (*out_arts)[1].path = strdup_safe(path1);
-  }
+static size_t load_job_occult(Game *g, const char *path) {
+  (void)path;
+  return load_occult_library_data(&g->occult);
 }
 
-static void game_prepare_loot_message(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  logbuffer_clear(&g->log);
-  if (g->loot_message_mode == 1) {
-    g->hero.coins += g->loot_coins;
-    char msg[192];
-    snprintf(msg, sizeof(msg),
-             "After searching the %s's body you found %d coins. Now you have %d coins",
-             g->enemy.name, g->loot_coins, g->hero.coins);
-    value_map_set(main_map, "main", "My precious... Press Enter to continue");
-    logbuffer_push(&g->log, msg);
-    g->loot_show_coins = 0;
-  } else if (g->loot_message_mode == 2) {
-    int have = value_map_get_int(&g->hero.ingredients, g->loot_ingredient, 0);
-    value_map_set_int(&g->hero.ingredients, g->loot_ingredient, have + 1);
-    char ing[64];
-    titleize_token(g->loot_ingredient, ing, sizeof(ing));
-    char msg[192];
-    snprintf(msg, sizeof(msg), "After searching the %s's body you found %s", g->enemy.name, ing);
-    value_map_set(main_map, "main", "Press Enter to continue");
-    logbuffer_push(&g->log, msg);
-    g->loot_show_ingredient = 0;
+// Templates first: --simulate and --bench-compose only run that prefix.
+static const LoadJob load_jobs[] = {
+    {"heroes", "data/characters/heroes.yml", load_job_heroes},
+    {"bandits", "data/characters/enemyes/bandits.yml", load_job_bandits},
+    {"undeads", "data/characters/enemyes/undeads.yml", load_job_undeads},
+    {"swamp", "data/characters/enemyes/swamp.yml", load_job_swamp},
+    {"events enemyes", "data/characters/enemyes/events.yml", load_job_events},
+    {"weapons", "data/ammunition/weapon.yml", load_job_weapons},
+    {"body armor", "data/ammunition/body_armor.yml", load_job_body_armor},
+    {"head armor", "data/ammunition/head_armor.yml", load_job_head_armor},
+    {"arms armor", "data/ammunition/arms_armor.yml", load_job_arms_armor},
+    {"shields", "data/ammunition/shield.yml", load_job_shields},
+    {"shop", NULL, load_job_shop},
+    {"warehouse", NULL, load_job_warehouse},
+    {"monolith", NULL, load_job_monolith},
+    {"statistics", NULL, load_job_statistics},
+    {"occult library", NULL, load_job_occult},
+};
+
+#define LOAD_JOB_COUNT (sizeof(load_jobs) / sizeof(load_jobs[0]))
+#define LOAD_TEMPLATE_JOBS 10
+#define LOAD_MAX_THREADS 4
+
+typedef struct {
+  Game *g;
+  size_t job_count;
+  SDL_atomic_t next_job;
+  char *paths[LOAD_JOB_COUNT];
+  size_t counts[LOAD_JOB_COUNT];
+  SDL_Thread *threads[LOAD_MAX_THREADS];
+  int thread_count;
+} LoadStage;
+
+static int load_stage_worker(void *data) {
+  LoadStage *st = (LoadStage *)data;
+  for (;;) {
+    size_t i = (size_t)SDL_AtomicAdd(&st->next_job, 1);
+    if (i >= st->job_count) return 0;
+    const LoadJob *job = &load_jobs[i];
+    if (job->path) st->paths[i] = resolve_data_path(job->path);
+    st->counts[i] = job->run(st->g, st->paths[i]);
+  }
+}
+
+static void load_stage_start(LoadStage *st, Game *g, size_t job_count) {
+  memset(st, 0, sizeof(*st));
+  st->g = g;
+  st->job_count = job_count;
+  SDL_AtomicSet(&st->next_job, 0);
+  data_root();
+  int threads = SDL_GetCPUCount();
+  if (threads > LOAD_MAX_THREADS) threads = LOAD_MAX_THREADS;
+  if (threads > (int)job_count) threads = (int)job_count;
+  for (int t = 0; t < threads; ++t) {
+    SDL_Thread *th = SDL_CreateThread(load_stage_worker, "pzdc_load", st);
+    if (th) st->threads[st->thread_count++] = th;
+  }
+}
+
+static void load_stage_finish(LoadStage *st) {
+  // Picks up whatever is left, which is everything if no thread could be spawned.
+  load_stage_worker(st);
+  for (int t = 0; t < st->thread_count; ++t) SDL_WaitThread(st->threads[t], NULL);
+  st->thread_count = 0;
+
+  for (size_t i = 0; i < st->job_count; ++i) {
+    if (!load_jobs[i].path) continue;
+    fprintf(stderr, "[pzdc_dungeon_2_gl] load %s: %s\n", load_jobs[i].what, st->paths[i]);
+    fprintf(stderr, "[pzdc_dungeon_2_gl] %s loaded: %zu\n", load_jobs[i].what, st->counts[i]);
+  }
+  for (size_t i = 0; i < st->job_count; ++i) {
+    if (load_jobs[i].path && st->counts[i] == 0) {
+      fprintf(stderr, "[pzdc_dungeon_2_gl] WARN: failed to load %s from %s\n", load_jobs[i].what, st->paths[i]);
+    }
+    free(st->paths[i]);
+    st->paths[i] = NULL;
+  }
+}
+
+static void game_load_templates(Game *g) {
+  LoadStage st;
+  load_stage_start(&st, g, LOAD_TEMPLATE_JOBS);
+  load_stage_finish(&st);
+}
+
+// What a session does between loading its data and building the first screen.
+static void game_session_begin(Game *g) {
+  shop_fill(&g->shop, &g->rng[RNG_SHOP]);
+  save_shop_data(&g->shop);
+  save_warehouse_data(&g->warehouse);
+}
+
+// Deterministic game states for the screens that dominate play, used by
+// --bench-compose and --render. Any other GameState can be set up by its name
+// below; it then shows the fixture hero with no further context.
+// g must already have its templates loaded.
+static const char *game_fixture_names[] = {
+    "battle", "enemy1", "enemy2", "enemy3", "loot", "shop", "occult", "stats"};
+
+#define GAME_FIXTURE_COUNT (sizeof(game_fixture_names) / sizeof(game_fixture_names[0]))
+
+static const char *game_state_names[] = {
+    "start", "load_menu", "load_no_hero", "load_confirm", "choose_dungeon", "name_input", "hero_select",
+    "skill_active", "skill_passive", "skill_camp", "enemy_select", "battle", "campfire", "camp", "monolith",
+    "occult_library", "ol_recipe", "ol_enhance_list", "ol_enhance", "stats_choose", "stats_show", "loot",
+    "loot_message", "event_select", "event_result", "options", "options_anim", "options_replace", "credits",
+    "shop", "ammo_show", "hero_info", "spend_stat", "spend_skill", "message"};
+
+#define GAME_STATE_COUNT (sizeof(game_state_names) / sizeof(game_state_names[0]))
+
+static bool game_fixture_setup(Game *g, const char *name) {
+  if (!g || !name || g->hero_count == 0 || g->dungeons[0].enemy_count == 0) return false;
+  game_seed(g, 1);
+  logbuffer_clear(&g->log);
+  g->dungeon_index = 0;
+  g->hero = character_from_hero(g, &g->heroes[0], "Fixture");
+  snprintf(g->hero.dungeon_name, sizeof(g->hero.dungeon_name), "%s", g->dungeons[0].name);
+  skill_assign(&g->hero.active_skill, SKILL_ACTIVE, "ascetic_strike");
+  skill_assign(&g->hero.passive_skill, SKILL_PASSIVE, "berserk");
+  skill_assign(&g->hero.camp_skill, SKILL_CAMP, "first_aid");
+  character_touch(&g->hero);
+  g->hero_selected = 1;
+
+  const DungeonData *d = &g->dungeons[0];
+  for (int i = 0; i < 3; ++i) {
+    g->enemy_choices[i] = character_from_enemy(g, &d->enemies[(size_t)i % d->enemy_count]);
+    g->enemy_choice_is_boss[i] = 0;
+  }
+  g->enemy = g->enemy_choices[0];
+  g->enemy_is_boss = 0;
+  if (g->occult.recipe_count == 0) load_occult_recipes(&g->occult);
+
+  if (strcmp(name, "battle") == 0) {
+    battle_round(g, 1, NULL);
+    g->state = STATE_BATTLE;
+  } else if (strncmp(name, "enemy", 5) == 0 && name[5] >= '1' && name[5] <= '3' && !name[6]) {
+    g->enemy_choice_count = name[5] - '0';
+    snprintf(g->enemy_choose_message, sizeof(g->enemy_choose_message),
+             "Random is 100 = you find %d ways. Which way will you go?", g->enemy_choice_count);
+    g->state = STATE_ENEMY_SELECT;
+  } else if (strcmp(name, "loot") == 0) {
+    loot_reset(g);
+    loot_add(g, "weapon", strcmp(g->enemy.weapon.code, "without") != 0 ? g->enemy.weapon.code : g->weapons[0].code);
+    loot_advance(g);
+  } else if (strcmp(name, "shop") == 0) {
+    shop_init_default(&g->shop);
+    shop_fill(&g->shop, &g->rng[RNG_SHOP]);
+    g->state = STATE_SHOP;
+  } else if (strcmp(name, "occult") == 0) {
+    g->state = STATE_OCCULT_LIBRARY;
+  } else if (strcmp(name, "stats") == 0) {
+    g->stats_dungeon_index = 0;
+    g->state = STATE_STATS_SHOW;
   } else {
-    value_map_set(main_map, "main", "Press Enter to continue");
+    size_t s = 0;
+    while (s < GAME_STATE_COUNT && strcmp(name, game_state_names[s]) != 0) ++s;
+    if (s == GAME_STATE_COUNT) return false;
+    g->state = (GameState)s;
   }
-  logbuffer_apply_full(main_map, &g->log, 6);
+  return true;
 }
 
-static void game_prepare_hero_info(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  char log0[64];
-  const char *dn = g->hero.dungeon_name[0] ? g->hero.dungeon_name : g->dungeons[g->dungeon_index].name;
-  snprintf(log0, sizeof(log0), "%s", dn);
-  log0[0] = (char)toupper((unsigned char)log0[0]);
-  value_map_set(main_map, "log_0", log0);
-  char log1[32];
-  snprintf(log1, sizeof(log1), "%d", g->hero.lvl + 1);
-  value_map_set(main_map, "log_1", log1);
-  value_map_set(main_map, "main", "BACK TO CAMP FIRE OPTIONS  [Enter 0]");
+static int bench_cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
 }
 
-static void game_prepare_spend_stat(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  char title[128];
-  snprintf(title, sizeof(title), "Distribute stat points. You have %d points left", g->hero.stat_points);
-  value_map_set(main_map, "main", title);
-
-  if (g->stat_roll == 0) {
-    g->stat_dice1 = rand_range(1, 6);
-    g->stat_dice2 = rand_range(1, 6);
-    g->stat_roll = g->stat_dice1 + g->stat_dice2;
+// Replays game_compose_screen for every fixture without a window. The first
+// pass after dropping the asset cache is reported as "cold" (YAML or bundle
+// load plus view_build_cells); the rest measure the per-screen-change path.
+static int bench_compose_main(int iterations) {
+  if (iterations < 1) iterations = 1;
+  Game game;
+  game_init(&game);
+  game_load_templates(&game);
+  if (game.hero_count == 0 || game.dungeons[0].enemy_count == 0) {
+    fprintf(stderr, "bench: game data not found\n");
+    game_free(&game);
+    return 1;
+  }
+  Menu menu = {0};
+  ValueMap main_map = {0};
+  ValueMap hero_map = {0};
+  ValueMap enemy_map1 = {0};
+  ValueMap enemy_map2 = {0};
+  ValueMap enemy_map3 = {0};
+  ValueMap *enemy_maps[3] = {&enemy_map1, &enemy_map2, &enemy_map3};
+  double *samples = (double *)calloc((size_t)iterations, sizeof(double));
+  if (!samples) {
+    game_free(&game);
+    return 1;
+  }
+  uint64_t freq = SDL_GetPerformanceFrequency();
+  if (freq == 0) freq = 1;
+  int failures = 0;
+
+  Composer comp = {0};
+  printf("%-8s %7s %10s %10s %10s %10s %10s %10s\n", "screen", "iters", "cold_us", "mean_us", "p50_us", "p99_us",
+         "allocs/op", "patch_us");
+  for (size_t f = 0; f < GAME_FIXTURE_COUNT; ++f) {
+    if (!game_fixture_setup(&game, game_fixture_names[f])) {
+      fprintf(stderr, "bench: fixture %s could not be set up\n", game_fixture_names[f]);
+      failures++;
+      continue;
+    }
+    asset_cache_free();
+    uint64_t t0 = SDL_GetPerformanceCounter();
+    bool ok = game_compose_screen(&game, "bench", &menu, &main_map, &hero_map, enemy_maps, NULL);
+    double cold = (double)(SDL_GetPerformanceCounter() - t0) * 1e6 / (double)freq;
+    if (!ok || menu.view.line_count == 0) {
+      fprintf(stderr, "bench: screen %s failed to compose\n", game_fixture_names[f]);
+      failures++;
+      continue;
+    }
+#ifdef PZDC_BENCH_ALLOC
+    unsigned allocs_before = (unsigned)SDL_AtomicGet(&bench_alloc_count);
+#endif
+    double sum = 0.0;
+    for (int i = 0; i < iterations; ++i) {
+      t0 = SDL_GetPerformanceCounter();
+      game_compose_screen(&game, "bench", &menu, &main_map, &hero_map, enemy_maps, NULL);
+      samples[i] = (double)(SDL_GetPerformanceCounter() - t0) * 1e6 / (double)freq;
+      sum += samples[i];
+    }
+    qsort(samples, (size_t)iterations, sizeof(double), bench_cmp_double);
+    char allocs[32];
+#ifdef PZDC_BENCH_ALLOC
+    snprintf(allocs, sizeof(allocs), "%.1f", (double)((unsigned)SDL_AtomicGet(&bench_alloc_count) - allocs_before) / iterations);
+#else
+    snprintf(allocs, sizeof(allocs), "n/a");
+#endif
+    // Same screen again with a primed composer: the per-turn floor when no value changed.
+    game_compose_screen(&game, "bench", &menu, &main_map, &hero_map, enemy_maps, &comp);
+    t0 = SDL_GetPerformanceCounter();
+    for (int i = 0; i < iterations; ++i) {
+      game_compose_screen(&game, "bench", &menu, &main_map, &hero_map, enemy_maps, &comp);
+    }
+    double patch = (double)(SDL_GetPerformanceCounter() - t0) * 1e6 / (double)freq / iterations;
+    composer_reset(&comp);
+    printf("%-8s %7d %10.1f %10.2f %10.2f %10.2f %10s %10.2f\n", game_fixture_names[f], iterations, cold,
+           sum / iterations, samples[iterations / 2], samples[(size_t)((iterations - 1) * 0.99)], allocs, patch);
   }
 
-  logbuffer_clear(&g->log);
-  char line[128];
-  snprintf(line, sizeof(line), "The dice showed: %d (%d + %d)", g->stat_roll, g->stat_dice1, g->stat_dice2);
-  logbuffer_push(&g->log, line);
-  logbuffer_push(&g->log, "");
-  logbuffer_push(&g->log, "+5 HP                     [1]");
-  logbuffer_push(&g->log, "+5 MP                     [2]");
-  if (g->stat_roll >= 8) logbuffer_push(&g->log, "+1 accuracy               [3]");
-  if (g->stat_roll >= 11) logbuffer_push(&g->log, "+1 min/max(random) damage [4]");
-  logbuffer_apply_full(main_map, &g->log, 7);
+  free(samples);
+  free_menu(&menu);
+  value_map_free(&main_map);
+  value_map_free(&hero_map);
+  value_map_free(&enemy_map1);
+  value_map_free(&enemy_map2);
+  value_map_free(&enemy_map3);
+  game_free(&game);
+  partial_layers_free();
+  asset_cache_free();
+  asset_index_free();
+  return failures > 0 ? 1 : 0;
+}
+
+// --render: composes screens exactly as the game does and writes them without
+// a window, for screenshot regression tests. Glyph cells come from the same
+// glyph_render_cell the atlas uses, so neither a display nor a GL context is
+// needed. Output is an 8-bit grayscale PNG or the cell grid as UTF-8.
+typedef struct {
+  TTF_Font *font;
+  int cell_w;
+  int cell_h;
+  uint32_t *slots; // codepoint hash -> glyph index + 1
+  size_t slot_cap;
+  uint32_t *codepoints;
+  uint8_t *coverage; // cell_w * cell_h bytes per glyph
+  size_t count;
+  size_t cap;
+  uint8_t *pixels;
+  size_t pixels_cap;
+} SoftRaster;
+
+static void soft_raster_free(SoftRaster *sr) {
+  free(sr->slots);
+  free(sr->codepoints);
+  free(sr->coverage);
+  free(sr->pixels);
+  memset(sr, 0, sizeof(*sr));
+}
+
+static bool soft_raster_reserve(SoftRaster *sr) {
+  size_t cell = (size_t)sr->cell_w * (size_t)sr->cell_h;
+  if (sr->count + 1 > sr->cap) {
+    size_t new_cap = sr->cap == 0 ? 128 : sr->cap * 2;
+    uint32_t *codepoints = (uint32_t *)realloc(sr->codepoints, new_cap * sizeof(uint32_t));
+    if (!codepoints) return false;
+    sr->codepoints = codepoints;
+    uint8_t *coverage = (uint8_t *)realloc(sr->coverage, new_cap * cell);
+    if (!coverage) return false;
+    sr->coverage = coverage;
+    sr->cap = new_cap;
+  }
+  if ((sr->count + 1) * 2 > sr->slot_cap) {
+    size_t new_cap = sr->slot_cap == 0 ? 256 : sr->slot_cap * 2;
+    uint32_t *slots = (uint32_t *)calloc(new_cap, sizeof(uint32_t));
+    if (!slots) return false;
+    for (size_t k = 0; k < sr->count; ++k) glyph_slot_insert(slots, new_cap, sr->codepoints[k], (uint32_t)(k + 1));
+    free(sr->slots);
+    sr->slots = slots;
+    sr->slot_cap = new_cap;
+  }
+  return true;
 }
 
-static void game_prepare_spend_skill(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  char title[128];
-  snprintf(title, sizeof(title), "Distribute skill points. You have %d points left", g->hero.skill_points);
-  value_map_set(main_map, "main", title);
+// Coverage of cp's cell as it ends up on screen: the atlas texel is white
+// blended over transparent black, then blended again over the black clear,
+// so a pixel's intensity is R * A of the blitted cell.
+static const uint8_t *soft_glyph(SoftRaster *sr, uint32_t cp) {
+  size_t cell = (size_t)sr->cell_w * (size_t)sr->cell_h;
+  if (sr->slot_cap > 0) {
+    size_t mask = sr->slot_cap - 1;
+    for (size_t i = glyph_slot_hash(cp) & mask; sr->slots[i]; i = (i + 1) & mask) {
+      size_t k = sr->slots[i] - 1;
+      if (sr->codepoints[k] == cp) return sr->coverage + k * cell;
+    }
+  }
+  if (!soft_raster_reserve(sr)) return NULL;
+
+  size_t k = sr->count;
+  uint8_t *out = sr->coverage + k * cell;
+  memset(out, 0, cell);
+  SDL_Surface *surface = glyph_render_cell(sr->font, cp, sr->cell_w, sr->cell_h);
+  if (surface) {
+    for (int y = 0; y < sr->cell_h; ++y) {
+      const uint8_t *row = (const uint8_t *)surface->pixels + (size_t)y * (size_t)surface->pitch;
+      for (int x = 0; x < sr->cell_w; ++x) {
+        out[(size_t)y * (size_t)sr->cell_w + (size_t)x] = (uint8_t)((row[x * 4] * row[x * 4 + 3] + 127) / 255);
+      }
+    }
+    SDL_FreeSurface(surface);
+  }
 
-  if (g->skill_choice_count == 0) {
-    g->skill_dice1 = rand_range(1, 6);
-    g->skill_dice2 = rand_range(1, 6);
-    int roll = g->skill_dice1 + g->skill_dice2;
-    g->skill_choice_count = roll >= 10 ? 3 : roll >= 6 ? 2 : 1;
+  sr->codepoints[k] = cp;
+  sr->count++;
+  glyph_slot_insert(sr->slots, sr->slot_cap, cp, (uint32_t)sr->count);
+  return out;
+}
 
-    SkillType pool[3] = {SKILL_ACTIVE, SKILL_PASSIVE, SKILL_CAMP};
-    for (int i = 0; i < 3; ++i) {
-      int j = rand_range(i, 2);
-      SkillType tmp = pool[i];
-      pool[i] = pool[j];
-      pool[j] = tmp;
-    }
-    for (int i = 0; i < g->skill_choice_count; ++i) {
-      g->skill_choices[i] = pool[i];
-    }
-    // sort by type
-    for (int i = 0; i < g->skill_choice_count - 1; ++i) {
-      for (int j = i + 1; j < g->skill_choice_count; ++j) {
-        if (g->skill_choices[j] < g->skill_choices[i]) {
-          SkillType tmp = g->skill_choices[i];
-          g->skill_choices[i] = g->skill_choices[j];
-          g->skill_choices[j] = tmp;
-        }
+// Rasterizes menu at one pixel per texel (grid_w * cell_w by grid_h * cell_h).
+static const uint8_t *soft_raster_menu(SoftRaster *sr, const Menu *menu, int *out_w, int *out_h) {
+  int cols = (int)menu->view.max_cols;
+  int rows = (int)menu->view.line_count;
+  int w = cols * sr->cell_w;
+  int h = rows * sr->cell_h;
+  size_t size = (size_t)w * (size_t)h;
+  if (size == 0) return NULL;
+  if (size > sr->pixels_cap) {
+    uint8_t *pixels = (uint8_t *)realloc(sr->pixels, size);
+    if (!pixels) return NULL;
+    sr->pixels = pixels;
+    sr->pixels_cap = size;
+  }
+  memset(sr->pixels, 0, size);
+  for (int y = 0; y < rows; ++y) {
+    const Line *line = &menu->view.lines[y];
+    for (int x = 0; x < cols && x < (int)line->len_cells; ++x) {
+      uint32_t cp = line->cells[x];
+      if (cp == (uint32_t)' ') continue;
+      const uint8_t *glyph = soft_glyph(sr, cp);
+      if (!glyph) continue;
+      uint32_t shade = (uint32_t)(shade_intensity(cp) * 255.0f + 0.5f);
+      for (int py = 0; py < sr->cell_h; ++py) {
+        uint8_t *dst = sr->pixels + (size_t)(y * sr->cell_h + py) * (size_t)w + (size_t)x * (size_t)sr->cell_w;
+        const uint8_t *src = glyph + (size_t)py * (size_t)sr->cell_w;
+        for (int px = 0; px < sr->cell_w; ++px) dst[px] = (uint8_t)((src[px] * shade + 127) / 255);
       }
     }
   }
+  *out_w = w;
+  *out_h = h;
+  return sr->pixels;
+}
 
-  logbuffer_clear(&g->log);
-  char line[128];
-  snprintf(line, sizeof(line), "The dice showed: %d (%d + %d)", g->skill_dice1 + g->skill_dice2, g->skill_dice1, g->skill_dice2);
-  logbuffer_push(&g->log, line);
-  logbuffer_push(&g->log, "");
-  for (int i = 0; i < g->skill_choice_count; ++i) {
-    const Skill *s = g->skill_choices[i] == SKILL_ACTIVE ? &g->hero.active_skill :
-                     g->skill_choices[i] == SKILL_PASSIVE ? &g->hero.passive_skill :
-                     &g->hero.camp_skill;
-    char line2[128];
-    snprintf(line2, sizeof(line2), "%-20s [%d]", s->name, i + 1);
-    logbuffer_push(&g->log, line2);
+static uint32_t png_crc_table[256];
+
+static uint32_t png_crc(uint32_t crc, const uint8_t *data, size_t n) {
+  if (!png_crc_table[1]) {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      png_crc_table[i] = c;
+    }
   }
-  logbuffer_apply_full(main_map, &g->log, 7);
+  for (size_t i = 0; i < n; ++i) crc = png_crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return crc;
 }
 
-static void game_prepare_message(Game *g, ValueMap *main_map) {
-  value_map_clear(main_map);
-  value_map_set(main_map, "main", g->message_title);
-  logbuffer_apply_full(main_map, &g->log, 20);
+static uint32_t png_adler(const uint8_t *data, size_t n) {
+  uint32_t a = 1, b = 0;
+  while (n > 0) {
+    size_t run = n < 5552 ? n : 5552; // largest run before the sums can overflow
+    n -= run;
+    while (run--) {
+      a += *data++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
 }
 
-static int key_to_digit(SDL_Keycode key) {
-  if (key >= SDLK_0 && key <= SDLK_9) return (int)(key - SDLK_0);
-  if (key >= SDLK_KP_0 && key <= SDLK_KP_9) return (int)(key - SDLK_KP_0);
-  return -1;
+static void png_put_u32(uint8_t *out, uint32_t v) {
+  out[0] = (uint8_t)(v >> 24);
+  out[1] = (uint8_t)(v >> 16);
+  out[2] = (uint8_t)(v >> 8);
+  out[3] = (uint8_t)v;
 }
 
-static char key_to_letter(SDL_Keycode key) {
-  if (key >= SDLK_a && key <= SDLK_z) return (char)('a' + (key - SDLK_a));
-  return '\0';
+static bool png_write_chunk(FILE *f, const char *type, const uint8_t *data, size_t n) {
+  uint8_t head[8];
+  png_put_u32(head, (uint32_t)n);
+  memcpy(head + 4, type, 4);
+  uint32_t crc = png_crc(0xFFFFFFFFu, head + 4, 4);
+  if (n > 0) crc = png_crc(crc, data, n);
+  uint8_t tail[4];
+  png_put_u32(tail, crc ^ 0xFFFFFFFFu);
+  return fwrite(head, 1, 8, f) == 8 && (n == 0 || fwrite(data, 1, n, f) == n) && fwrite(tail, 1, 4, f) == 4;
 }
 
-static void pick_random_enemies(Game *g) {
-  DungeonData *d = &g->dungeons[g->dungeon_index];
-  g->enemy_choose_message[0] = '\0';
-  if (g->hero.leveling >= 25) {
-    const EnemyTemplate *boss = enemy_template_boss(d);
-    if (boss) {
-      g->enemy_choice_count = 1;
-      g->enemy_choices[0] = character_from_enemy(g, boss);
-      g->enemy_choice_is_boss[0] = 1;
-      snprintf(g->enemy_choose_message, sizeof(g->enemy_choose_message),
-               "You've reached the end of the dungeon, this is a boss fight!");
-      return;
+// 8-bit grayscale PNG whose image data is stored in uncompressed deflate
+// blocks: larger files, but writing one costs little more than a copy.
+static bool png_write_gray(const char *path, const uint8_t *pixels, int w, int h) {
+  size_t stride = (size_t)w + 1;
+  size_t raw_len = (size_t)h * stride;
+  size_t blocks = (raw_len + 65534) / 65535;
+  uint8_t *raw = (uint8_t *)malloc(raw_len);
+  uint8_t *z = (uint8_t *)malloc(2 + blocks * 5 + raw_len + 4);
+  if (!raw || !z) {
+    free(raw);
+    free(z);
+    return false;
+  }
+  for (int y = 0; y < h; ++y) {
+    raw[(size_t)y * stride] = 0; // filter type: none
+    memcpy(raw + (size_t)y * stride + 1, pixels + (size_t)y * (size_t)w, (size_t)w);
+  }
+  size_t zlen = 0;
+  z[zlen++] = 0x78;
+  z[zlen++] = 0x01;
+  for (size_t off = 0; off < raw_len; off += 65535) {
+    size_t n = raw_len - off < 65535 ? raw_len - off : 65535;
+    z[zlen++] = (uint8_t)(off + n == raw_len);
+    z[zlen++] = (uint8_t)n;
+    z[zlen++] = (uint8_t)(n >> 8);
+    z[zlen++] = (uint8_t)~n;
+    z[zlen++] = (uint8_t)(~n >> 8);
+    memcpy(z + zlen, raw + off, n);
+    zlen += n;
+  }
+  png_put_u32(z + zlen, png_adler(raw, raw_len));
+  zlen += 4;
+  free(raw);
+
+  static const uint8_t sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  uint8_t ihdr[13] = {0};
+  png_put_u32(ihdr, (uint32_t)w);
+  png_put_u32(ihdr + 4, (uint32_t)h);
+  ihdr[8] = 8; // bit depth; color type 0 (gray), no interlace
+  FILE *f = fopen(path, "wb");
+  bool ok = f && fwrite(sig, 1, 8, f) == 8 && png_write_chunk(f, "IHDR", ihdr, sizeof(ihdr)) &&
+            png_write_chunk(f, "IDAT", z, zlen) && png_write_chunk(f, "IEND", NULL, 0);
+  if (f && fclose(f) != 0) ok = false;
+  free(z);
+  return ok;
+}
+
+// One line per grid row, every cell encoded, so the file is an exact image of
+// the grid the renderer draws.
+static bool cells_write(const char *path, const Menu *menu) {
+  FILE *f = fopen(path, "wb");
+  if (!f) return false;
+  for (size_t y = 0; y < menu->view.line_count; ++y) {
+    const Line *line = &menu->view.lines[y];
+    char buf[4096];
+    size_t n = 0;
+    for (size_t x = 0; x < menu->view.max_cols; ++x) {
+      if (n + 5 > sizeof(buf)) {
+        fwrite(buf, 1, n, f);
+        n = 0;
+      }
+      n += utf8_encode(x < line->len_cells ? line->cells[x] : (uint32_t)' ', buf + n);
     }
+    buf[n++] = '\n';
+    fwrite(buf, 1, n, f);
   }
-  int count = enemy_choices_count_for(&g->hero);
-  if (count < 1) count = 1;
-  if (count > 3) count = 3;
-  g->enemy_choice_count = count;
-  for (int i = 0; i < g->enemy_choice_count; ++i) {
-    const EnemyTemplate *tmpl = enemy_template_random_standard(d, g->hero.leveling);
-    if (!tmpl) tmpl = &d->enemies[0];
-    g->enemy_choices[i] = character_from_enemy(g, tmpl);
-    g->enemy_choice_is_boss[i] = tmpl->is_boss ? 1 : 0;
+  bool ok = !ferror(f);
+  if (fclose(f) != 0) ok = false;
+  return ok;
+}
+
+static bool render_write(SoftRaster *sr, const Menu *menu, const char *out_dir, const char *name, bool png) {
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s.%s", out_dir, name, png ? "png" : "txt");
+  bool ok = false;
+  if (png) {
+    int w = 0, h = 0;
+    const uint8_t *pixels = soft_raster_menu(sr, menu, &w, &h);
+    ok = pixels && png_write_gray(path, pixels, w, h);
+  } else {
+    ok = menu->view.line_count > 0 && cells_write(path, menu);
+  }
+  if (!ok) fprintf(stderr, "render: cannot write %s\n", path);
+  return ok;
+}
+
+// target is a fixture or GameState name, a menu .yml composed with only the
+// version set (as --static does), or "all" for every fixture, every state and
+// every template under views/menues. Game screens use the templates alone, so
+// the output does not depend on local saves.
+static int render_main(const char *target, const char *out_dir, bool png, const char *font_path) {
+  const char *version = "render";
+  bool all = strcmp(target, "all") == 0;
+  bool is_menu = !all && strstr(target, ".yml") != NULL;
+  SoftRaster sr = {0};
+  if (png) {
+    if (!font_path) font_path = default_font_path();
+    if (!font_path || TTF_Init() != 0) {
+      fprintf(stderr, "render: no font; pass a monospace TTF via --font or use --format cells\n");
+      return 1;
+    }
+    sr.font = TTF_OpenFont(font_path, 20);
+    if (!sr.font) {
+      fprintf(stderr, "render: failed to load font %s: %s\n", font_path, TTF_GetError());
+      TTF_Quit();
+      return 1;
+    }
+    TTF_SizeUTF8(sr.font, "M", &sr.cell_w, &sr.cell_h);
+    sr.cell_h = TTF_FontHeight(sr.font);
+    if (sr.cell_w <= 0 || sr.cell_h <= 0) {
+      sr.cell_w = 12;
+      sr.cell_h = 20;
+    }
   }
-  if (g->enemy_choice_count > 0) {
-    int random = rand_range(1, 200);
-    int th = treasure_hunter_coeff(&g->hero.camp_skill);
-    if (th > 0) {
-      snprintf(g->enemy_choose_message, sizeof(g->enemy_choose_message),
-               "Random is %d + treasure hunter %d = you find %d ways. Which way will you go?",
-               random, th, g->enemy_choice_count);
-    } else {
-      snprintf(g->enemy_choose_message, sizeof(g->enemy_choose_message),
-               "Random is %d = you find %d ways. Which way will you go?",
-               random, g->enemy_choice_count);
+  if (mkdir(out_dir, 0755) != 0 && !dir_exists(out_dir)) {
+    fprintf(stderr, "render: cannot create %s\n", out_dir);
+    if (sr.font) {
+      TTF_CloseFont(sr.font);
+      TTF_Quit();
     }
+    return 1;
   }
-}
 
-static int dungeon_index_by_name(Game *g, const char *name) {
-  if (!g || !name) return 0;
-  for (int i = 0; i < 3; ++i) {
-    if (strcmp(g->dungeons[i].name, name) == 0) return i;
+  Game game;
+  game_init(&game);
+  Menu menu = {0};
+  ValueMap main_map = {0};
+  ValueMap hero_map = {0};
+  ValueMap enemy_map1 = {0};
+  ValueMap enemy_map2 = {0};
+  ValueMap enemy_map3 = {0};
+  ValueMap *enemy_maps[3] = {&enemy_map1, &enemy_map2, &enemy_map3};
+  uint64_t t0 = SDL_GetPerformanceCounter();
+  int rendered = 0;
+  int failures = 0;
+
+  // Fixtures first, then states whose name no fixture already took. Each screen
+  // gets a fresh Game, so it renders the same alone as it does inside "all".
+  for (size_t i = 0; !is_menu && i < GAME_FIXTURE_COUNT + GAME_STATE_COUNT; ++i) {
+    const char *name = i < GAME_FIXTURE_COUNT ? game_fixture_names[i] : game_state_names[i - GAME_FIXTURE_COUNT];
+    if (!all && strcmp(name, target) != 0) continue;
+    bool taken = false;
+    if (i >= GAME_FIXTURE_COUNT) {
+      for (size_t k = 0; k < GAME_FIXTURE_COUNT && !taken; ++k) taken = strcmp(game_fixture_names[k], name) == 0;
+    }
+    if (taken) continue;
+    game_free(&game);
+    game_init(&game);
+    game_load_templates(&game);
+    if (!game_fixture_setup(&game, name) ||
+        !game_compose_screen(&game, version, &menu, &main_map, &hero_map, enemy_maps, NULL) ||
+        menu.view.line_count == 0) {
+      fprintf(stderr, "render: screen %s failed to compose\n", name);
+      failures++;
+      continue;
+    }
+    if (render_write(&sr, &menu, out_dir, name, png)) rendered++;
+    else failures++;
+  }
+
+  SourceList menus = {0};
+  if (all) {
+    const char *root = view_bundle_root();
+    if (root) source_list_scan(&menus, root, "views/menues");
+    if (menus.count > 1) qsort(menus.paths, menus.count, sizeof(char *), cmp_cstr_ptr);
+  } else if (is_menu) {
+    menus.paths = (char **)calloc(1, sizeof(char *));
+    if (menus.paths) menus.paths[menus.count++] = strdup_safe(target);
+  }
+  for (size_t i = 0; i < menus.count; ++i) {
+    char *path = resolve_menu_path(menus.paths[i]);
+    const char *base = strrchr(menus.paths[i], '/');
+    base = base ? base + 1 : menus.paths[i];
+    char name[256];
+    snprintf(name, sizeof(name), "menu_%.*s", (int)(strlen(base) > 4 ? strlen(base) - 4 : strlen(base)), base);
+    free_menu(&menu);
+    if (!path || !menu_load_cached(path, &menu)) {
+      fprintf(stderr, "render: menu %s failed to load\n", menus.paths[i]);
+      failures++;
+      free(path);
+      continue;
+    }
+    value_map_clear(&main_map);
+    value_map_set(&main_map, "main", version);
+    compose_menu(&menu, &main_map, NULL, 0, NULL, 0);
+    if (render_write(&sr, &menu, out_dir, name, png)) rendered++;
+    else failures++;
+    free(path);
   }
-  return 0;
-}
+  source_list_free(&menus);
 
-static const EnemyTemplate *enemy_template_by_code(const DungeonData *d, const char *code) {
-  if (!d || !code) return NULL;
-  for (size_t i = 0; i < d->enemy_count; ++i) {
-    if (strcmp(d->enemies[i].code, code) == 0) return &d->enemies[i];
+  if (rendered == 0 && failures == 0) {
+    fprintf(stderr, "render: unknown target %s\n", target);
+    failures++;
   }
-  return NULL;
-}
+  uint64_t freq = SDL_GetPerformanceFrequency();
+  double ms = (double)(SDL_GetPerformanceCounter() - t0) * 1000.0 / (double)(freq ? freq : 1);
+  fprintf(stderr, "render: %d screens to %s in %.1f ms\n", rendered, out_dir, ms);
 
-static const EnemyTemplate *event_enemy_by_code(const Game *g, const char *code) {
-  if (!g || !code) return NULL;
-  for (size_t i = 0; i < g->event_enemy_count; ++i) {
-    if (strcmp(g->event_enemies[i].code, code) == 0) return &g->event_enemies[i];
+  free_menu(&menu);
+  value_map_free(&main_map);
+  value_map_free(&hero_map);
+  value_map_free(&enemy_map1);
+  value_map_free(&enemy_map2);
+  value_map_free(&enemy_map3);
+  game_free(&game);
+  partial_layers_free();
+  asset_cache_free();
+  asset_index_free();
+  if (sr.font) {
+    TTF_CloseFont(sr.font);
+    TTF_Quit();
   }
-  return NULL;
+  soft_raster_free(&sr);
+  return failures > 0 ? 1 : 0;
 }
 
-static const char *enemy_art_dungeon(const Game *g) {
-  if (!g) return "";
-  if (g->battle_art_dungeon[0]) return g->battle_art_dungeon;
-  return g->dungeons[g->dungeon_index].name;
-}
+// Session recordings (--record, --replay): the seed, a snapshot of saves/ taken before
+// startup touches it, then every input the state machine saw with its frame number and
+// the state it arrived in. Battle animation steps are recorded as well, because input
+// is ignored while one plays.
+#define REPLAY_MAGIC "PZDCRP01"
+#define REPLAY_VERSION 1u
 
-static const EnemyTemplate *enemy_template_boss(const DungeonData *d) {
-  if (!d) return NULL;
-  for (size_t i = 0; i < d->enemy_count; ++i) {
-    if (d->enemies[i].is_boss) return &d->enemies[i];
+typedef enum {
+  REPLAY_KEY = 1,
+  REPLAY_TEXT,
+  REPLAY_TICK
+} ReplayEventType;
+
+typedef struct {
+  int screens;
+  double total_ms;
+  double max_ms;
+} ReplayStat;
+
+static uint8_t *read_whole_file(const char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (!f) return NULL;
+  uint8_t *data = NULL;
+  size_t n = 0;
+  if (fseek(f, 0, SEEK_END) == 0) {
+    long size = ftell(f);
+    if (size >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+      data = (uint8_t *)malloc((size_t)size + 1);
+      if (data) n = fread(data, 1, (size_t)size, f);
+      if (data && n != (size_t)size) {
+        free(data);
+        data = NULL;
+      }
+    }
   }
-  return NULL;
+  fclose(f);
+  if (data) *len = n;
+  return data;
 }
 
-static const EnemyTemplate *enemy_template_random_standard(const DungeonData *d, int leveling) {
-  if (!d || d->enemy_count == 0) return NULL;
-  int standard_count = 0;
-  for (size_t i = 0; i < d->enemy_count; ++i) {
-    if (d->enemies[i].code[0] == 'e') standard_count++;
+static FILE *replay_record_open(const char *path, uint64_t seed) {
+  ByteBuf b = {0};
+  bb_put(&b, REPLAY_MAGIC, 8);
+  bb_put_u32(&b, REPLAY_VERSION);
+  bb_put(&b, &seed, sizeof(seed));
+  SourceList saves = {0};
+  char *saves_dir = resolve_saves_dir();
+  if (saves_dir) source_list_scan(&saves, "", saves_dir);
+  free(saves_dir);
+  ByteBuf files = {0};
+  uint32_t file_count = 0;
+  for (size_t i = 0; i < saves.count; ++i) {
+    size_t n = 0;
+    uint8_t *data = read_whole_file(saves.paths[i], &n);
+    if (!data) continue;
+    const char *base = strrchr(saves.paths[i], '/');
+    bb_put_str(&files, base ? base + 1 : saves.paths[i]);
+    bb_put_u32(&files, (uint32_t)n);
+    bb_put(&files, data, n);
+    free(data);
+    file_count++;
+  }
+  source_list_free(&saves);
+  bb_put_u32(&b, file_count);
+  if (files.len > 0) bb_put(&b, files.data, files.len);
+  if (files.failed) b.failed = true;
+  free(files.data);
+  if (b.failed) {
+    fprintf(stderr, "record: out of memory building header for %s\n", path);
+    free(b.data);
+    return NULL;
   }
-  if (standard_count == 0) return &d->enemies[0];
-  int chance = rand_range(1, 9) + rand_range(0, leveling);
-  int target = standard_count;
-  for (int n = 1; n <= standard_count; ++n) {
-    if (chance <= n * 4) { target = n; break; }
+
+  FILE *f = fopen(path, "wb");
+  bool ok = f && fwrite(b.data, 1, b.len, f) == b.len && fflush(f) == 0;
+  free(b.data);
+  if (!ok) {
+    fprintf(stderr, "record: cannot write %s\n", path);
+    if (f) fclose(f);
+    return NULL;
   }
-  char code[16];
-  snprintf(code, sizeof(code), "e%d", target);
-  const EnemyTemplate *tmpl = enemy_template_by_code(d, code);
-  if (tmpl) return tmpl;
-  return &d->enemies[0];
-}
+  fprintf(stderr, "[pzdc_dungeon_2_gl] recording to %s (seed %llu, %u save files)\n", path,
+          (unsigned long long)seed, file_count);
+  return f;
+}
+
+// Flushed per event, so a recording survives a crash up to the input that caused it. On any failure the
+// recording is closed and *fp cleared rather than leaving a truncated event in the middle of the stream.
+static void replay_record(FILE **fp, uint32_t frame, GameState state, ReplayEventType type, int key, const char *text) {
+  if (!*fp) return;
+  ByteBuf b = {0};
+  bb_put_u32(&b, frame);
+  bb_put_u32(&b, (uint32_t)type | ((uint32_t)state << 8));
+  if (type == REPLAY_KEY) bb_put_u32(&b, (uint32_t)key);
+  else if (type == REPLAY_TEXT) bb_put_str(&b, text);
+  bool ok = !b.failed && fwrite(b.data, 1, b.len, *fp) == b.len && fflush(*fp) == 0;
+  free(b.data);
+  if (!ok) {
+    fprintf(stderr, "record: write failed at frame %u, recording stopped\n", frame);
+    fclose(*fp);
+    *fp = NULL;
+  }
+}
+
+static void replay_scratch_free(const char *dir) {
+  SourceList files = {0};
+  source_list_scan(&files, "", dir);
+  for (size_t i = 0; i < files.count; ++i) remove(files.paths[i]);
+  source_list_free(&files);
+  rmdir(dir);
+}
+
+// Plays a recording back without a window, as fast as the state machine goes. Frames
+// before from_frame are fast-forwarded: their screens are built (building one can
+// change game state) but not composed. From from_frame on, every screen change is
+// composed as in the window loop and timed per state. The recorded saves are unpacked
+// into a scratch directory, so the real saves are never read or written.
+static int replay_main(const char *path, uint32_t from_frame) {
+  size_t len = 0;
+  uint8_t *data = read_whole_file(path, &len);
+  if (!data) {
+    fprintf(stderr, "replay: cannot read %s\n", path);
+    return 1;
+  }
+  ByteReader r = {data, data + len, true};
+  const char *magic = (const char *)rd_bytes(&r, 8);
+  uint32_t version = rd_u32(&r);
+  const void *seed_bytes = rd_bytes(&r, sizeof(uint64_t));
+  if (!magic || memcmp(magic, REPLAY_MAGIC, 8) != 0 || version != REPLAY_VERSION || !seed_bytes) {
+    fprintf(stderr, "replay: %s is not a recording\n", path);
+    free(data);
+    return 1;
+  }
+  uint64_t seed;
+  memcpy(&seed, seed_bytes, sizeof(seed));
 
-static int enemy_choices_count_for(const Character *hero) {
-  int random = rand_range(1, 200);
-  int th = treasure_hunter_coeff(&hero->camp_skill);
-  int res = random + th;
-  int n = res > 120 ? 3 : res > 50 ? 2 : 1;
-  return n;
-}
+  const char *tmp = getenv("TMPDIR");
+  char scratch[512];
+  snprintf(scratch, sizeof(scratch), "%s/pzdc_replay_XXXXXX", tmp && tmp[0] ? tmp : "/tmp");
+  if (!mkdtemp(scratch)) {
+    fprintf(stderr, "replay: cannot create %s\n", scratch);
+    free(data);
+    return 1;
+  }
+  uint32_t file_count = rd_u32(&r);
+  for (uint32_t i = 0; i < file_count && r.ok; ++i) {
+    const char *name = rd_str(&r);
+    uint32_t n = rd_u32(&r);
+    const void *bytes = rd_bytes(&r, n);
+    if (!r.ok || !name[0] || strchr(name, '/')) break;
+    char file_path[1024];
+    snprintf(file_path, sizeof(file_path), "%s/%s", scratch, name);
+    FILE *f = fopen(file_path, "wb");
+    if (f) {
+      fwrite(bytes, 1, n, f);
+      fclose(f);
+    }
+  }
+  if (!r.ok) {
+    fprintf(stderr, "replay: %s is truncated\n", path);
+    replay_scratch_free(scratch);
+    free(data);
+    return 1;
+  }
+  snprintf(saves_dir_override, sizeof(saves_dir_override), "%s", scratch);
+
+  const char *version_str = "replay";
+  Game game;
+  game_init(&game);
+  game_seed(&game, seed);
+  LoadStage load_stage;
+  load_stage_start(&load_stage, &game, LOAD_JOB_COUNT);
+  load_stage_finish(&load_stage);
+  game_session_begin(&game);
+
+  Menu menu = {0};
+  Composer composer = {0};
+  ValueMap main_map = {0};
+  ValueMap hero_map = {0};
+  ValueMap enemy_map1 = {0};
+  ValueMap enemy_map2 = {0};
+  ValueMap enemy_map3 = {0};
+  ValueMap *enemy_maps[3] = {&enemy_map1, &enemy_map2, &enemy_map3};
+  ReplayStat stats[GAME_STATE_COUNT];
+  memset(stats, 0, sizeof(stats));
+  uint64_t freq = SDL_GetPerformanceFrequency();
+  if (freq == 0) freq = 1;
+  uint64_t started = SDL_GetPerformanceCounter();
+
+  bool fast = from_frame > 0;
+  bool dirty = true; // the first screen
+  bool quit = false;
+  bool diverged = false;
+  uint32_t frame = 0;
+  size_t events = 0;
+  for (;;) {
+    bool more = r.ok && r.p < r.end;
+    uint32_t ev_frame = 0, word = 0;
+    if (more) {
+      ByteReader peek = r;
+      ev_frame = rd_u32(&peek);
+      more = peek.ok;
+    }
+    // A frame ends when the next event belongs to a later one: build its screen once,
+    // as the window loop does after draining input and ticking the battle animation.
+    if (!more || ev_frame != frame) {
+      if (dirty) {
+        if (fast && frame < from_frame) {
+          ArtArg *arts = NULL;
+          size_t art_count = 0;
+          char *menu_path = NULL;
+          game_build_screen(&game, version_str, &menu, &main_map, &hero_map, enemy_maps, &arts, &art_count, &menu_path);
+          free(menu_path);
+          free_art_args(arts, art_count);
+        } else {
+          if (fast) {
+            composer_reset(&composer);
+            fast = false;
+          }
+          uint64_t t0 = SDL_GetPerformanceCounter();
+          game_compose_screen(&game, version_str, &menu, &main_map, &hero_map, enemy_maps, &composer);
+          double ms = (double)(SDL_GetPerformanceCounter() - t0) * 1000.0 / (double)freq;
+          ReplayStat *st = &stats[game.state];
+          st->screens++;
+          st->total_ms += ms;
+          if (ms > st->max_ms) st->max_ms = ms;
+        }
+        game.force_instant_redraw = 0;
+        dirty = false;
+      }
+      if (!more || quit) break;
+      frame = ev_frame;
+    }
+    rd_u32(&r);
+    word = rd_u32(&r);
+    ReplayEventType type = (ReplayEventType)(word & 0xFFu);
+    GameState state = (GameState)(word >> 8);
+    int key = 0;
+    const char *text = NULL;
+    if (type == REPLAY_KEY) key = (int)rd_u32(&r);
+    else if (type == REPLAY_TEXT) text = rd_str(&r);
+    if (!r.ok) break;
+    if (game.state != state) {
+      fprintf(stderr, "replay: diverged at frame %u: recorded in state %s, replayed in %s (other build or data files?)\n", frame,
+              (size_t)state < GAME_STATE_COUNT ? game_state_names[state] : "?", game_state_names[game.state]);
+      diverged = true;
+      break;
+    }
+    if (type == REPLAY_KEY) dirty |= game_handle_key(&game, (SDL_Keycode)key, &quit);
+    else if (type == REPLAY_TEXT) dirty |= game_handle_text(&game, text);
+    else if (type == REPLAY_TICK) dirty |= battle_anim_tick(&game, game.battle_anim_deadline);
+    events++;
+  }
+  double total_ms = (double)(SDL_GetPerformanceCounter() - started) * 1000.0 / (double)freq;
+
+  printf("# replay=%s seed=%llu events=%zu frames=%u from=%u\n", path, (unsigned long long)seed, events, frame, from_frame);
+  printf("%-18s %8s %9s %9s %9s\n", "state", "screens", "mean_ms", "max_ms", "total_ms");
+  for (size_t i = 0; i < GAME_STATE_COUNT; ++i) {
+    if (stats[i].screens == 0) continue;
+    printf("%-18s %8d %9.3f %9.3f %9.2f\n", game_state_names[i], stats[i].screens,
+           stats[i].total_ms / stats[i].screens, stats[i].max_ms, stats[i].total_ms);
+  }
+  fprintf(stderr, "replay: stopped at frame %u in state %s (hero %s lvl %d, hp %d) after %.1f ms\n", frame,
+          game_state_names[game.state], game.hero.name[0] ? game.hero.name : "-", game.hero.lvl, game.hero.hp, total_ms);
 
-static bool game_build_screen(Game *g, const char *version, Menu *menu, ValueMap *main_map,
-                              ValueMap *hero_map, ValueMap *enemy_maps[3],
-                              ArtArg **out_arts, size_t *out_art_count,
-                              char **out_menu_path) {
-  (void)menu;
-  char *menu_path = NULL;
-  ArtArg *arts = NULL;
-  size_t art_count = 0;
+  free_menu(&menu);
+  composer_reset(&composer);
+  value_map_free(&main_map);
+  value_map_free(&hero_map);
+  value_map_free(&enemy_map1);
+  value_map_free(&enemy_map2);
+  value_map_free(&enemy_map3);
+  game_free(&game);
+  asset_cache_free();
+  saves_dir_override[0] = '\0';
+  replay_scratch_free(scratch);
+  free(data);
+  return diverged ? 1 : 0;
+}
+
+#define SIM_MAX_BATTLES 200
 
-  if (g->state == STATE_START) {
-    menu_path = resolve_menu_path("start_game_screen");
-    game_prepare_start(g, main_map, version);
-  } else if (g->state == STATE_LOAD_MENU) {
-    menu_path = resolve_menu_path("load_new_run_screen");
-    game_prepare_load_menu(g, main_map);
-    art_count = 1;
-    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
-    arts[0].name = strdup_safe("dungeon_cave");
-    arts[0].path = strdup_safe("_dungeon_enter");
-  } else if (g->state == STATE_LOAD_NO_HERO) {
-    menu_path = resolve_menu_path("load_no_hero_screen");
-    value_map_clear(main_map);
-  } else if (g->state == STATE_CHOOSE_DUNGEON) {
-    menu_path = resolve_menu_path("choose_dungeon_screen");
-    game_prepare_choose_dungeon(g, main_map);
-    art_count = 3;
-    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
-    arts[0].name = strdup_safe("normal"); arts[0].path = strdup_safe("dungeons/_bandits");
-    arts[1].name = strdup_safe("normal"); arts[1].path = strdup_safe("dungeons/_undeads");
-    arts[2].name = strdup_safe("normal"); arts[2].path = strdup_safe("dungeons/_swamp");
-  } else if (g->state == STATE_NAME_INPUT) {
-    menu_path = resolve_menu_path("messages_screen");
-    game_prepare_name_input(g, main_map, NULL);
-    art_count = 1;
-    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
-    arts[0].name = strdup_safe("scroll");
-    arts[0].path = strdup_safe("_choose_name");
-  } else if (g->state == STATE_HERO_SELECT) {
-    menu_path = resolve_menu_path("messages_full_screen");
-    game_prepare_hero_select(g, main_map);
-  } else if (g->state == STATE_LOAD_CONFIRM) {
-    menu_path = resolve_menu_path("hero_sl_screen");
-    game_prepare_load_confirm(g, main_map);
-    value_map_clear(hero_map);
-    character_to_map(&g->hero, hero_map);
-    art_count = 1;
-    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
-    char path[256];
-    snprintf(path, sizeof(path), "dungeons/_%s", g->hero.dungeon_name[0] ? g->hero.dungeon_name : g->dungeons[g->dungeon_index].name);
-    arts[0].name = strdup_safe("normal");
-    arts[0].path = strdup_safe(path);
-  } else if (g->state == STATE_SKILL_ACTIVE) {
-    menu_path = resolve_menu_path("messages_full_screen");
-    game_prepare_skill_select(g, main_map, SKILL_ACTIVE);
-  } else if (g->state == STATE_SKILL_PASSIVE) {
-    menu_path = resolve_menu_path("messages_full_screen");
-    game_prepare_skill_select(g, main_map, SKILL_PASSIVE);
-  } else if (g->state == STATE_SKILL_CAMP) {
-    menu_path = resolve_menu_path("messages_full_screen");
-    game_prepare_skill_select(g, main_map, SKILL_CAMP);
-  } else if (g->state == STATE_ENEMY_SELECT) {
-    if (g->enemy_choice_count >= 3) menu_path = resolve_menu_path("enemy_3_choose_screen");
-    else if (g->enemy_choice_count == 2) menu_path = resolve_menu_path("enemy_2_choose_screen");
-    else menu_path = resolve_menu_path("enemy_1_choose_screen");
-    game_prepare_enemy_select(g, main_map);
+typedef struct {
+  int runs;
+  int threads;
+  unsigned int seed;
+  const char *hero_code;
+  const char *dungeon_name;
+  const char *skills[3];
+  bool pick_odds; // fight the choice with the best battle_odds instead of the lowest threat
+} SimConfig;
 
-    for (int i = 0; i < g->enemy_choice_count; ++i) {
-      value_map_clear(enemy_maps[i]);
-      character_to_map(&g->enemy_choices[i], enemy_maps[i]);
-    }
-    art_count = (size_t)g->enemy_choice_count;
-    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
-    for (size_t i = 0; i < art_count; ++i) {
-      char path[256];
-      snprintf(path, sizeof(path), "enemyes/%s/_%s", g->dungeons[g->dungeon_index].name, g->enemy_choices[i].code);
-      arts[i].name = strdup_safe("normal");
-      arts[i].path = strdup_safe(path);
+typedef struct {
+  int runs;
+  int wins;
+  int deaths;
+  int stalls;
+  long long battles;
+  long long rounds;
+  long long depth_sum;
+  int depth_max;
+  long long lvl_sum;
+  long long loot_dropped;
+  long long loot_taken;
+  long long coins;
+  long long ingredients;
+  long long monolith_points;
+} SimStats;
+
+static int sim_enemy_threat(const Character *e) {
+  return e->hp * (character_min_dmg(e) + character_max_dmg(e));
+}
+
+static void sim_take_loot(Game *g, SimStats *st) {
+  Character *h = &g->hero;
+  st->loot_dropped += g->loot_count;
+  for (int i = 0; i < g->loot_count; ++i) {
+    const LootEntry *le = &g->loot_items[i];
+    bool taken = false;
+    if (strcmp(le->type, "weapon") == 0) {
+      WeaponItem it = weapon_from_code(g, le->code);
+      if ((taken = it.price > h->weapon.price)) h->weapon = it;
+    } else if (strcmp(le->type, "body_armor") == 0) {
+      ArmorItem it = armor_from_code(g->body_armors, g->body_armor_count, le->code);
+      if ((taken = it.price > h->body_armor.price)) h->body_armor = it;
+    } else if (strcmp(le->type, "head_armor") == 0) {
+      ArmorItem it = armor_from_code(g->head_armors, g->head_armor_count, le->code);
+      if ((taken = it.price > h->head_armor.price)) h->head_armor = it;
+    } else if (strcmp(le->type, "arms_armor") == 0) {
+      ArmorItem it = armor_from_code(g->arms_armors, g->arms_armor_count, le->code);
+      if ((taken = it.price > h->arms_armor.price)) h->arms_armor = it;
+    } else if (strcmp(le->type, "shield") == 0) {
+      ShieldItem it = shield_from_code(g, le->code);
+      if ((taken = it.price > h->shield.price)) h->shield = it;
     }
-  } else if (g->state == STATE_BATTLE) {
-    menu_path = resolve_menu_path("battle_screen");
-    game_prepare_battle(g, main_map);
-    value_map_clear(hero_map);
-    character_to_map(&g->hero, hero_map);
-    value_map_clear(enemy_maps[0]);
-    character_to_map(&g->enemy, enemy_maps[0]);
-    art_count = 1;
-    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
-    char path[256];
-    snprintf(path, sizeof(path), "enemyes/%s/_%s", enemy_art_dungeon(g), g->enemy.code);
-    const char *battle_art = g->battle_art_name[0] ? g->battle_art_name : "normal";
-    arts[0].name = strdup_safe(battle_art);
-    arts[0].path = strdup_safe(path);
-  } else if (g->state == STATE_CAMPFIRE) {
-    menu_path = resolve_menu_path("rest_menu_screen");
-    game_prepare_campfire(g, main_map);
-    art_count = 1;
-    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
-    arts[0].name = strdup_safe("camp_fire_big");
-    arts[0].path = strdup_safe("_rest");
-  } else if (g->state == STATE_CAMP) {
-    menu_path = resolve_menu_path("camp_screen");
-    game_prepare_camp(g, main_map);
-  } else if (g->state == STATE_MONOLITH) {
-    menu_path = resolve_menu_path("camp_monolith_screen");
-    game_prepare_monolith(g, main_map);
-  } else if (g->state == STATE_OCCULT_LIBRARY) {
-    menu_path = resolve_menu_path("camp_occult_library_screen");
-    game_prepare_occult_library(g, main_map);
-  } else if (g->state == STATE_OL_RECIPE) {
-    menu_path = resolve_menu_path("camp_ol_recipe_screen");
-    game_prepare_recipe_view(g, main_map);
-  } else if (g->state == STATE_OL_ENHANCE_LIST) {
-    menu_path = resolve_menu_path("enhance_by_recipe_screen");
-    game_prepare_enhance_list(g, main_map);
-  } else if (g->state == STATE_OL_ENHANCE) {
-    menu_path = resolve_menu_path("camp_ol_enhance_screen");
-    game_prepare_recipe_enhance(g, main_map);
-  } else if (g->state == STATE_STATS_CHOOSE) {
-    menu_path = resolve_menu_path("statistics_choose_screen");
-    game_prepare_stats_choose(g, main_map);
-  } else if (g->state == STATE_STATS_SHOW) {
-    menu_path = resolve_menu_path("statistics_enemyes_camp_screen");
-    game_prepare_stats_show(g, main_map);
-  } else if (g->state == STATE_EVENT_SELECT) {
-    if (g->event_choice_count >= 3) menu_path = resolve_menu_path("event_3_choose_screen");
-    else if (g->event_choice_count == 2) menu_path = resolve_menu_path("event_2_choose_screen");
-    else menu_path = resolve_menu_path("event_1_choose_screen");
-    value_map_clear(main_map);
-    value_map_set(main_map, "main", g->event_choose_message[0] ? g->event_choose_message : "Choose an event");
-    for (int i = 0; i < g->event_choice_count; ++i) {
-      value_map_clear(enemy_maps[i]);
-      event_to_map(&g->event_choices[i], enemy_maps[i]);
+    if (taken) {
+      st->loot_taken += 1;
+      character_touch(h);
     }
-    art_count = (size_t)g->event_choice_count;
-    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
-    for (size_t i = 0; i < art_count; ++i) {
-      arts[i].name = strdup_safe("mini");
-      arts[i].path = strdup_safe(g->event_choices[i].art_path);
+  }
+  g->loot_index = g->loot_count;
+  if (g->loot_show_coins) {
+    h->coins += g->loot_coins;
+    st->coins += g->loot_coins;
+    g->loot_show_coins = 0;
+  }
+  if (g->loot_show_ingredient) {
+    st->ingredients += 1;
+    g->loot_show_ingredient = 0;
+  }
+}
+
+// Campfire policy: stats go to damage/accuracy when the dice allow, HP otherwise;
+// skill points prefer the active skill; the camp skill is used when it helps.
+static void sim_campfire(Game *g) {
+  Character *h = &g->hero;
+  while (h->stat_points > 0) {
+    stat_roll_dice(g);
+    int option = g->stat_roll >= 11 ? 4 : g->stat_roll >= 8 ? 3 : 1;
+    hero_spend_stat(g, option);
+  }
+  while (h->skill_points > 0) {
+    skill_roll_choices(g);
+    hero_spend_skill(g, 1);
+  }
+  if ((strcmp(h->camp_skill.code, "first_aid") == 0 && h->hp * 10 < h->hp_max * 6) ||
+      (strcmp(h->camp_skill.code, "bloody_ritual") == 0 && h->mp < h->active_skill.mp_cost &&
+       h->hp * 2 > h->hp_max)) {
+    game_use_camp_skill(g);
+  }
+  logbuffer_clear(&g->log);
+}
+
+static void sim_run(Game *g, const HeroTemplate *t, const SimConfig *cfg, SimStats *st) {
+  Character *h = &g->hero;
+  *h = character_from_hero(g, t, t->name);
+  snprintf(h->dungeon_name, sizeof(h->dungeon_name), "%s", g->dungeons[g->dungeon_index].name);
+  skill_assign(&h->active_skill, SKILL_ACTIVE, cfg->skills[0]);
+  skill_assign(&h->passive_skill, SKILL_PASSIVE, cfg->skills[1]);
+  skill_assign(&h->camp_skill, SKILL_CAMP, cfg->skills[2]);
+  character_touch(h);
+  g->stat_roll = 0;
+  g->skill_choice_count = 0;
+  st->runs += 1;
+
+  for (int battle = 0;; ++battle) {
+    if (battle >= SIM_MAX_BATTLES) {
+      st->stalls += 1;
+      break;
+    }
+    sim_campfire(g);
+    if (h->dungeon_part_number % 2 == 0) {
+      // events are not simulated; take the "skip" branch of the event choice
+      h->dungeon_part_number += 1;
+      hero_rest(h, NULL);
+      sim_campfire(g);
+    }
+
+    pick_random_enemies(g);
+    int pick = 0;
+    if (cfg->pick_odds) {
+      BattleOdds best = battle_odds(&g->odds, h, &g->enemy_choices[0], 1);
+      for (int i = 1; i < g->enemy_choice_count; ++i) {
+        BattleOdds odds = battle_odds(&g->odds, h, &g->enemy_choices[i], 1);
+        if (odds.win > best.win || (odds.win == best.win && odds.hp_lost < best.hp_lost)) {
+          best = odds;
+          pick = i;
+        }
+      }
+    } else {
+      for (int i = 1; i < g->enemy_choice_count; ++i) {
+        if (sim_enemy_threat(&g->enemy_choices[i]) < sim_enemy_threat(&g->enemy_choices[pick])) pick = i;
+      }
     }
-  } else if (g->state == STATE_EVENT_RESULT) {
-    menu_path = resolve_menu_path("messages_screen");
-    game_prepare_event_result(g, main_map);
-    if (g->event_art_path[0]) {
-      art_count = 1;
-      arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
-      const char *art_name = g->event_art_name[0] ? g->event_art_name : "normal";
-      arts[0].name = strdup_safe(art_name);
-      arts[0].path = strdup_safe(g->event_art_path);
+    g->enemy = g->enemy_choices[pick];
+    g->enemy_is_boss = g->enemy_choice_is_boss[pick];
+    st->battles += 1;
+
+    int rounds = 0;
+    while (g->enemy.hp > 0 && h->hp > 0 && rounds < SIM_MAX_ROUNDS) {
+      bool skill = strcmp(h->active_skill.code, "none") != 0 && h->mp >= h->active_skill.mp_cost;
+      battle_round(g, skill ? 4 : 1, NULL);
+      logbuffer_clear(&g->log);
+      rounds++;
     }
-  } else if (g->state == STATE_OPTIONS) {
-    menu_path = resolve_menu_path("options_choose_screen");
-    game_prepare_options(g, main_map);
-  } else if (g->state == STATE_OPTIONS_ANIM) {
-    menu_path = resolve_menu_path("options_animation_speed_screen");
-    game_prepare_options_anim(g, main_map);
-  } else if (g->state == STATE_OPTIONS_REPLACE) {
-    menu_path = resolve_menu_path("options_screen_replacement_type_screen");
-    game_prepare_options_replace(g, main_map);
-  } else if (g->state == STATE_CREDITS) {
-    menu_path = resolve_menu_path("credits_screen");
-  } else if (g->state == STATE_LOOT) {
-    const char *type = (g->loot_index < g->loot_count) ? g->loot_items[g->loot_index].type : "weapon";
-    if (strcmp(type, "weapon") == 0) menu_path = resolve_menu_path("loot_enemy_weapon");
-    else if (strcmp(type, "body_armor") == 0) menu_path = resolve_menu_path("loot_enemy_body_armor");
-    else if (strcmp(type, "head_armor") == 0) menu_path = resolve_menu_path("loot_enemy_head_armor");
-    else if (strcmp(type, "arms_armor") == 0) menu_path = resolve_menu_path("loot_enemy_arms_armor");
-    else menu_path = resolve_menu_path("loot_enemy_shield");
-    game_prepare_loot(g, main_map, hero_map, enemy_maps[0], &arts, &art_count);
-  } else if (g->state == STATE_LOOT_MESSAGE) {
-    menu_path = resolve_menu_path("messages_screen");
-    game_prepare_loot_message(g, main_map);
-    if (g->loot_message_mode == 1) {
-      art_count = 1;
-      arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
-      arts[0].name = strdup_safe("loot_coins");
-      arts[0].path = strdup_safe("_loot_coins");
-    } else if (g->loot_message_mode == 2) {
-      art_count = 1;
-      arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
-      char path[256];
-      snprintf(path, sizeof(path), "enemyes/%s/_%s", enemy_art_dungeon(g), g->enemy.code);
-      arts[0].name = strdup_safe("normal");
-      arts[0].path = strdup_safe(path);
+    st->rounds += rounds;
+
+    if (g->enemy.hp > 0) {
+      if (h->hp <= 0) st->deaths += 1;
+      else st->stalls += 1;
+      break;
     }
-  } else if (g->state == STATE_SHOP) {
-    menu_path = resolve_menu_path("camp_shop_screen");
-    game_prepare_shop(g, main_map);
-  } else if (g->state == STATE_AMMO_SHOW) {
-    if (strcmp(g->ammo_show_type, "weapon") == 0) menu_path = resolve_menu_path("ammunition_weapon_screen");
-    else if (strcmp(g->ammo_show_type, "body_armor") == 0) menu_path = resolve_menu_path("ammunition_body_armor_screen");
-    else if (strcmp(g->ammo_show_type, "head_armor") == 0) menu_path = resolve_menu_path("ammunition_head_armor_screen");
-    else if (strcmp(g->ammo_show_type, "arms_armor") == 0) menu_path = resolve_menu_path("ammunition_arms_armor_screen");
-    else menu_path = resolve_menu_path("ammunition_shield_screen");
-    ammo_to_map(g, g->ammo_show_type, g->ammo_show_code, main_map);
-    art_count = 1;
-    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
-    char path[256];
-    snprintf(path, sizeof(path), "ammunition/%s/_%s", g->ammo_show_type, g->ammo_show_code);
-    arts[0].name = strdup_safe("normal");
-    arts[0].path = strdup_safe(path);
-  } else if (g->state == STATE_HERO_INFO) {
-    menu_path = resolve_menu_path("hero_sl_screen");
-    game_prepare_hero_info(g, main_map);
-    value_map_clear(hero_map);
-    character_to_map(&g->hero, hero_map);
-    art_count = 1;
-    arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
-    char path[256];
-    snprintf(path, sizeof(path), "dungeons/_%s", g->dungeons[g->dungeon_index].name);
-    arts[0].name = strdup_safe("normal");
-    arts[0].path = strdup_safe(path);
-  } else if (g->state == STATE_SPEND_STAT || g->state == STATE_SPEND_SKILL) {
-    menu_path = resolve_menu_path("hero_update_screen");
-    if (g->state == STATE_SPEND_STAT) {
-      game_prepare_spend_stat(g, main_map);
-    } else {
-      game_prepare_spend_skill(g, main_map);
+    hero_add_exp(h, g->enemy.exp_gived, NULL);
+    int points = monolith_points_from_enemy(h, &g->enemy, &g->rng[RNG_LOOT]);
+    h->pzdc_monolith_points += points;
+    st->monolith_points += points;
+    if (g->enemy_is_boss) {
+      st->wins += 1;
+      break;
     }
-    value_map_clear(hero_map);
-    character_to_map(&g->hero, hero_map);
-  } else if (g->state == STATE_MESSAGE) {
-    menu_path = resolve_menu_path("messages_screen");
-    game_prepare_message(g, main_map);
-    if (g->message_art_path[0]) {
-      art_count = 1;
-      arts = (ArtArg *)calloc(art_count, sizeof(ArtArg));
-      arts[0].name = strdup_safe(g->message_art_name[0] ? g->message_art_name : "normal");
-      arts[0].path = strdup_safe(g->message_art_path);
+    loot_setup(g);
+    sim_take_loot(g, st);
+    loot_advance(g);
+  }
+
+  st->depth_sum += h->leveling;
+  if (h->leveling > st->depth_max) st->depth_max = h->leveling;
+  st->lvl_sum += h->lvl;
+  value_map_free(&h->ingredients);
+}
+
+static void sim_print_row(const char *hero, const char *dungeon, const SimStats *st) {
+  double runs = st->runs > 0 ? (double)st->runs : 1.0;
+  double battles = st->battles > 0 ? (double)st->battles : 1.0;
+  printf("%-12s %-8s %8d %6.2f %6.2f %6.2f %6.2f %4d %5.2f %7.2f %6.2f %5.2f %6.2f %7.2f %6.2f %6.2f\n",
+         hero, dungeon, st->runs,
+         100.0 * st->wins / runs, 100.0 * st->deaths / runs, 100.0 * st->stalls / runs,
+         st->depth_sum / runs, st->depth_max, st->lvl_sum / runs,
+         st->battles / runs, st->rounds / battles,
+         st->loot_dropped / runs, st->loot_taken / runs, st->coins / runs,
+         st->ingredients / runs, st->monolith_points / runs);
+}
+
+#define SIM_CHUNK_RUNS 256
+
+typedef struct {
+  int hero_index;
+  int dungeon_index;
+  int first_run;
+  int run_count;
+  SimStats stats;
+} SimUnit;
+
+typedef struct {
+  const Game *base;
+  const SimConfig *cfg;
+  SimUnit *units;
+  int unit_count;
+  SDL_atomic_t *next_unit;
+} SimWorker;
+
+// Each run gets its own stream derived from (seed, dungeon, hero, run), so results do not
+// depend on how runs are spread across threads.
+static uint64_t sim_run_seed(uint64_t seed, int dungeon, int hero, int run) {
+  uint64_t x = seed;
+  x = splitmix64(&x) ^ (uint64_t)dungeon;
+  x = splitmix64(&x) ^ (uint64_t)hero;
+  x = splitmix64(&x) ^ (uint64_t)run;
+  return splitmix64(&x);
+}
+
+static int sim_worker_main(void *data) {
+  SimWorker *w = (SimWorker *)data;
+  // Templates are shared read-only; everything a run mutates lives in this copy.
+  Game g = *w->base;
+  logbuffer_init(&g.log);
+  for (;;) {
+    int idx = SDL_AtomicAdd(w->next_unit, 1);
+    if (idx >= w->unit_count) break;
+    SimUnit *u = &w->units[idx];
+    const HeroTemplate *t = &g.heroes[u->hero_index];
+    g.dungeon_index = u->dungeon_index;
+    for (int r = u->first_run; r < u->first_run + u->run_count; ++r) {
+      game_seed(&g, sim_run_seed(w->cfg->seed, u->dungeon_index, u->hero_index, r));
+      sim_run(&g, t, w->cfg, &u->stats);
+    }
+  }
+  logbuffer_free(&g.log);
+  return 0;
+}
+
+static void sim_stats_merge(SimStats *dst, const SimStats *src) {
+  dst->runs += src->runs;
+  dst->wins += src->wins;
+  dst->deaths += src->deaths;
+  dst->stalls += src->stalls;
+  dst->battles += src->battles;
+  dst->rounds += src->rounds;
+  dst->depth_sum += src->depth_sum;
+  if (src->depth_max > dst->depth_max) dst->depth_max = src->depth_max;
+  dst->lvl_sum += src->lvl_sum;
+  dst->loot_dropped += src->loot_dropped;
+  dst->loot_taken += src->loot_taken;
+  dst->coins += src->coins;
+  dst->ingredients += src->ingredients;
+  dst->monolith_points += src->monolith_points;
+}
+
+// Headless balance sweep: plays cfg->runs full dungeon runs per hero/dungeon pair with a
+// scripted policy. Never touches SDL video, TTF or GL and never writes save files.
+// Runs are split into chunks that idle threads pull from a shared atomic counter;
+// chunk results are merged in chunk order, so the report is identical for any thread count.
+static int simulate_main(const SimConfig *cfg) {
+  Game game;
+  game_init(&game);
+  game_load_templates(&game);
+  if (game.hero_count == 0) {
+    fprintf(stderr, "simulate: no heroes loaded\n");
+    game_free(&game);
+    return 1;
+  }
+  if (cfg->hero_code && !hero_template_by_code(&game, cfg->hero_code)) {
+    fprintf(stderr, "simulate: unknown hero '%s'\n", cfg->hero_code);
+    game_free(&game);
+    return 1;
+  }
+  if (cfg->dungeon_name && strcmp(game.dungeons[dungeon_index_by_name(&game, cfg->dungeon_name)].name, cfg->dungeon_name) != 0) {
+    fprintf(stderr, "simulate: unknown dungeon '%s'\n", cfg->dungeon_name);
+    game_free(&game);
+    return 1;
+  }
+
+  int chunks_per_pair = cfg->runs > 0 ? (cfg->runs + SIM_CHUNK_RUNS - 1) / SIM_CHUNK_RUNS : 0;
+  int unit_count = 0;
+  SimUnit *units = (SimUnit *)calloc((size_t)3 * game.hero_count * (size_t)(chunks_per_pair > 0 ? chunks_per_pair : 1), sizeof(SimUnit));
+  if (!units) {
+    game_free(&game);
+    return 1;
+  }
+  for (int d = 0; d < 3; ++d) {
+    if (cfg->dungeon_name && strcmp(game.dungeons[d].name, cfg->dungeon_name) != 0) continue;
+    if (game.dungeons[d].enemy_count == 0) continue;
+    for (size_t i = 0; i < game.hero_count; ++i) {
+      if (cfg->hero_code && strcmp(game.heroes[i].code, cfg->hero_code) != 0) continue;
+      for (int c = 0; c < chunks_per_pair; ++c) {
+        SimUnit *u = &units[unit_count++];
+        u->hero_index = (int)i;
+        u->dungeon_index = d;
+        u->first_run = c * SIM_CHUNK_RUNS;
+        u->run_count = cfg->runs - u->first_run < SIM_CHUNK_RUNS ? cfg->runs - u->first_run : SIM_CHUNK_RUNS;
+      }
     }
   }
 
-  if (!menu_path) return false;
-  *out_menu_path = menu_path;
-  *out_arts = arts;
-  *out_art_count = art_count;
-  return true;
+  int threads = cfg->threads > 0 ? cfg->threads : SDL_GetCPUCount();
+  if (threads < 1) threads = 1;
+  if (threads > unit_count) threads = unit_count > 0 ? unit_count : 1;
+
+  SDL_atomic_t next_unit;
+  SDL_AtomicSet(&next_unit, 0);
+  SimWorker worker = {&game, cfg, units, unit_count, &next_unit};
+  SDL_Thread **pool = (SDL_Thread **)calloc((size_t)threads, sizeof(SDL_Thread *));
+  uint32_t started = SDL_GetTicks();
+  int spawned = 0;
+  for (int t = 1; pool && t < threads; ++t) {
+    pool[t] = SDL_CreateThread(sim_worker_main, "pzdc_sim", &worker);
+    if (pool[t]) spawned++;
+  }
+  sim_worker_main(&worker);
+  for (int t = 1; pool && t < threads; ++t) {
+    if (pool[t]) SDL_WaitThread(pool[t], NULL);
+  }
+  free(pool);
+  double secs = (SDL_GetTicks() - started) / 1000.0;
+
+  printf("# runs=%d seed=%u skills=%s,%s,%s%s\n", cfg->runs, cfg->seed, cfg->skills[0], cfg->skills[1], cfg->skills[2],
+         cfg->pick_odds ? " pick=odds" : "");
+  printf("%-12s %-8s %8s %6s %6s %6s %6s %4s %5s %7s %6s %5s %6s %7s %6s %6s\n",
+         "hero", "dungeon", "runs", "win%", "dead%", "stall%", "depth", "max", "lvl",
+         "battles", "rounds", "drops", "taken", "coins", "ingr", "mono");
+  long long total_battles = 0;
+  for (int i = 0; i < unit_count;) {
+    SimStats st;
+    memset(&st, 0, sizeof(st));
+    int j = i;
+    for (; j < unit_count && units[j].hero_index == units[i].hero_index && units[j].dungeon_index == units[i].dungeon_index; ++j) {
+      sim_stats_merge(&st, &units[j].stats);
+    }
+    sim_print_row(game.heroes[units[i].hero_index].code, game.dungeons[units[i].dungeon_index].name, &st);
+    total_battles += st.battles;
+    i = j;
+  }
+  fprintf(stderr, "[pzdc_dungeon_2_gl] simulated %lld battles on %d thread(s) in %.2fs (%.0f battles/s)\n",
+          total_battles, spawned + 1, secs, secs > 0.0 ? total_battles / secs : 0.0);
+  free(units);
+  game_free(&game);
+  return 0;
 }
 
-static void free_art_args(ArtArg *arts, size_t count) {
-  for (size_t i = 0; i < count; ++i) {
-    free(arts[i].name);
-    free(arts[i].path);
+// Batch duel kernel: DUEL_LANES independent hero-vs-enemy fights in structure-of-arrays
+// form, advanced one battle_round at a time. Every lane carries its own xoshiro stream
+// and each draw is committed only on lanes where battle_round would have made it, so
+// a lane reproduces the scalar fight bit for bit (see --duel-check). Skills are folded
+// into per-lane constants at load; the step itself is straight-line selects.
+#define DUEL_LANES 256
+
+enum { DUEL_PASSIVE_NONE, DUEL_PASSIVE_BERSERK, DUEL_PASSIVE_CONCENTRATION, DUEL_PASSIVE_DAZED };
+
+typedef struct {
+  int count;
+  uint64_t s0[DUEL_LANES], s1[DUEL_LANES], s2[DUEL_LANES], s3[DUEL_LANES];
+  int h_hp[DUEL_LANES], h_hp_max[DUEL_LANES], h_mp[DUEL_LANES], h_mp_max[DUEL_LANES];
+  int h_regen_hp[DUEL_LANES], h_regen_mp[DUEL_LANES];
+  int h_min_dmg[DUEL_LANES], h_max_dmg[DUEL_LANES], h_accuracy[DUEL_LANES];
+  int h_armor[DUEL_LANES], h_armor_pen[DUEL_LANES], h_block[DUEL_LANES];
+  int e_hp[DUEL_LANES], e_hp_max[DUEL_LANES], e_regen_hp[DUEL_LANES];
+  int e_min_dmg[DUEL_LANES], e_max_dmg[DUEL_LANES], e_accuracy[DUEL_LANES];
+  int e_armor[DUEL_LANES], e_armor_pen[DUEL_LANES], e_block[DUEL_LANES];
+  int active_cost[DUEL_LANES]; // -1 without an active skill
+  double active_dmg[DUEL_LANES], active_acc[DUEL_LANES];
+  uint8_t traumatic[DUEL_LANES];
+  double traumatic_coef[DUEL_LANES];
+  uint8_t passive[DUEL_LANES];
+  double berserk_mod[DUEL_LANES];
+  uint8_t concentration_on[DUEL_LANES];
+  int concentration_max[DUEL_LANES];
+  double dazed_part[DUEL_LANES];
+  int dazed_min[DUEL_LANES];
+  int attack[DUEL_LANES]; // battle_round attack_type, set before each step
+  int rounds[DUEL_LANES];
+  uint8_t live[DUEL_LANES];
+} DuelBatch;
+
+static void duel_batch_load(DuelBatch *b, int lane, const Character *h, const Character *e, const Rng *rng) {
+  const CharacterStats *hs = character_stats(h);
+  const CharacterStats *es = character_stats(e);
+  b->s0[lane] = rng->s[0];
+  b->s1[lane] = rng->s[1];
+  b->s2[lane] = rng->s[2];
+  b->s3[lane] = rng->s[3];
+  b->h_hp[lane] = h->hp;
+  b->h_hp_max[lane] = h->hp_max;
+  b->h_mp[lane] = h->mp;
+  b->h_mp_max[lane] = h->mp_max;
+  b->h_regen_hp[lane] = h->regen_hp_base;
+  b->h_regen_mp[lane] = h->regen_mp_base;
+  b->h_min_dmg[lane] = hs->min_dmg;
+  b->h_max_dmg[lane] = hs->max_dmg;
+  b->h_accuracy[lane] = hs->accuracy;
+  b->h_armor[lane] = hs->armor;
+  b->h_armor_pen[lane] = hs->armor_penetration;
+  b->h_block[lane] = hs->block_chance;
+  b->e_hp[lane] = e->hp;
+  b->e_hp_max[lane] = e->hp_max;
+  b->e_regen_hp[lane] = e->regen_hp_base;
+  b->e_min_dmg[lane] = es->min_dmg;
+  b->e_max_dmg[lane] = es->max_dmg;
+  b->e_accuracy[lane] = es->accuracy;
+  b->e_armor[lane] = es->armor;
+  b->e_armor_pen[lane] = es->armor_penetration;
+  b->e_block[lane] = es->block_chance;
+
+  // stat_points and skill levels do not change mid-fight, so the skill helpers are
+  // evaluated once here with the same expressions battle_round uses.
+  const Skill *act = &h->active_skill;
+  b->active_cost[lane] = strcmp(act->code, "none") == 0 ? -1 : act->mp_cost;
+  b->active_dmg[lane] = skill_active_damage_mod(act, h);
+  b->active_acc[lane] = skill_active_accuracy_mod(act, h);
+  b->traumatic[lane] = strcmp(act->code, "traumatic_strike") == 0;
+  b->traumatic_coef[lane] = skill_traumatic_effect_coef(act);
+
+  const Skill *pas = &h->passive_skill;
+  b->passive[lane] = DUEL_PASSIVE_NONE;
+  if (strcmp(pas->code, "berserk") == 0) b->passive[lane] = DUEL_PASSIVE_BERSERK;
+  else if (strcmp(pas->code, "concentration") == 0) b->passive[lane] = DUEL_PASSIVE_CONCENTRATION;
+  else if (strcmp(pas->code, "dazed") == 0) b->passive[lane] = DUEL_PASSIVE_DAZED;
+  b->berserk_mod[lane] = 0.5 + 0.05 * pas->lvl;
+  double coef = h->mp_max * (0.1 + 0.005 * pas->lvl) - 10.0;
+  b->concentration_on[lane] = coef > 0;
+  b->concentration_max[lane] = coef > 0 ? (int)coef : 0;
+  b->dazed_part[lane] = skill_dazed_hp_part_coef(pas);
+  int min_reduce = 10 + 3 * pas->lvl;
+  b->dazed_min[lane] = min_reduce > 90 ? 90 : min_reduce;
+
+  b->attack[lane] = 1;
+  b->rounds[lane] = 0;
+  b->live[lane] = h->hp > 0 && e->hp > 0;
+}
+
+// rand_range on every lane in mask, with bounds per lane. Lanes outside the mask, or
+// with hi < lo, keep their stream untouched and get lo. Lanes that hit a rejected
+// value draw again in another pass, exactly as rand_range loops.
+static void duel_rand_range(DuelBatch *b, const uint8_t *mask, const int *lo, const int *hi, int *out) {
+  uint8_t want[DUEL_LANES];
+  int pending = 0;
+  for (int i = 0; i < b->count; ++i) {
+    want[i] = mask[i] && hi[i] >= lo[i];
+    out[i] = lo[i];
+    pending += want[i];
+  }
+  while (pending > 0) {
+    pending = 0;
+    for (int i = 0; i < b->count; ++i) {
+      uint64_t s0 = b->s0[i], s1 = b->s1[i], s2 = b->s2[i], s3 = b->s3[i];
+      uint64_t result = rng_rotl(s1 * 5, 7) * 9;
+      uint64_t t = s1 << 17;
+      s2 ^= s0;
+      s3 ^= s1;
+      s1 ^= s2;
+      s0 ^= s3;
+      s2 ^= t;
+      s3 = rng_rotl(s3, 45);
+      bool take = want[i];
+      b->s0[i] = take ? s0 : b->s0[i];
+      b->s1[i] = take ? s1 : b->s1[i];
+      b->s2[i] = take ? s2 : b->s2[i];
+      b->s3[i] = take ? s3 : b->s3[i];
+      uint64_t span = take ? (uint64_t)((int64_t)hi[i] - lo[i] + 1) : 1;
+      uint64_t m = (result >> 32) * span;
+      bool reject = take && (uint32_t)m < (uint32_t)((0x100000000ull - span) % span);
+      out[i] = take && !reject ? (int)((int64_t)lo[i] + (int64_t)(m >> 32)) : out[i];
+      want[i] = reject;
+      pending += reject;
+    }
+  }
+}
+
+// Same policy as sim_run: the active skill whenever it is affordable, otherwise base.
+static void duel_batch_policy(DuelBatch *b, int base_attack) {
+  for (int i = 0; i < b->count; ++i) {
+    bool skill = b->active_cost[i] >= 0 && b->h_mp[i] >= b->active_cost[i];
+    b->attack[i] = skill ? 4 : base_attack;
+  }
+}
+
+// One battle_round on every live lane, followed by the sim_run loop bookkeeping.
+// Returns the number of lanes still fighting.
+static int duel_batch_step(DuelBatch *b) {
+  int n = b->count;
+  uint8_t go[DUEL_LANES], hit[DUEL_LANES], mask[DUEL_LANES];
+  int lo[DUEL_LANES], hi[DUEL_LANES], roll[DUEL_LANES], roll2[DUEL_LANES];
+  double dmg[DUEL_LANES], acc[DUEL_LANES], emod[DUEL_LANES];
+
+  // The damage roll comes first; attack 4 without a skill or the MP for it then ends
+  // the round, like the early returns in battle_round.
+  duel_rand_range(b, b->live, b->h_min_dmg, b->h_max_dmg, roll);
+  for (int i = 0; i < n; ++i) {
+    bool skill = b->attack[i] == 4;
+    bool ok = b->live[i] && (!skill || (b->active_cost[i] >= 0 && b->h_mp[i] >= b->active_cost[i]));
+    go[i] = ok;
+    b->h_mp[i] -= ok && skill ? b->active_cost[i] : 0;
+    int at = b->attack[i];
+    double dmg_f = at == 2 ? 1.5 : at == 3 ? 0.7 : at == 4 ? b->active_dmg[i] : 1.0;
+    double acc_f = at == 2 ? 0.7 : at == 3 ? 1.5 : at == 4 ? b->active_acc[i] : 1.0;
+    double hp_part = b->h_hp_max[i] > 0 ? (double)b->h_hp[i] / b->h_hp_max[i] : 0.0;
+    double berserk = b->passive[i] == DUEL_PASSIVE_BERSERK ? 1.0 + (1.0 - hp_part) * b->berserk_mod[i] : 1.0;
+    dmg[i] = (double)roll[i] * dmg_f * berserk;
+    acc[i] = (double)b->h_accuracy[i] * acc_f;
+    lo[i] = 1;
+    hi[i] = 100;
+  }
+
+  duel_rand_range(b, go, lo, hi, roll);
+  duel_rand_range(b, go, lo, hi, roll2);
+  for (int i = 0; i < n; ++i) {
+    bool block = roll[i] <= b->e_block[i];
+    bool landed = go[i] && roll2[i] <= (int)round(acc[i]);
+    double d = dmg[i] / (landed && block ? 1.0 + (double)b->e_hp[i] / 200.0 : 1.0);
+    int armor_block = b->e_armor[i] - b->h_armor_pen[i];
+    d -= armor_block < 0 ? 0 : armor_block;
+    d = d < 0 ? 0 : d;
+    int hp = b->e_hp[i] - (landed ? (int)round(d) : 0);
+    b->e_hp[i] = hp < 0 ? 0 : hp;
+    dmg[i] = d;
+    hit[i] = landed;
+    mask[i] = landed && b->passive[i] == DUEL_PASSIVE_CONCENTRATION && b->concentration_on[i];
+    lo[i] = 0;
+  }
+
+  duel_rand_range(b, mask, lo, b->concentration_max, roll);
+  for (int i = 0; i < n; ++i) {
+    int hp = b->e_hp[i] - (mask[i] ? roll[i] : 0);
+    b->e_hp[i] = hp < 0 ? 0 : hp;
+    mask[i] = hit[i] && b->passive[i] == DUEL_PASSIVE_DAZED && dmg[i] * b->dazed_part[i] > b->e_hp[i] / 2.0;
+    hi[i] = 90;
   }
-  free(arts);
+
+  duel_rand_range(b, mask, b->dazed_min, hi, roll);
+  for (int i = 0; i < n; ++i) {
+    double mod = mask[i] ? 0.01 * (100 - roll[i]) : 1.0;
+    emod[i] = hit[i] && b->attack[i] == 4 && b->traumatic[i] ? b->traumatic_coef[i] : mod;
+    go[i] = go[i] && b->e_hp[i] > 0;
+    lo[i] = 1;
+    hi[i] = 3;
+  }
+
+  duel_rand_range(b, go, lo, hi, roll);
+  duel_rand_range(b, go, b->e_min_dmg, b->e_max_dmg, roll2);
+  for (int i = 0; i < n; ++i) {
+    int at = roll[i];
+    double dmg_f = at == 2 ? 1.5 : at == 3 ? 0.7 : 1.0;
+    double acc_f = at == 2 ? 0.7 : at == 3 ? 1.5 : 1.0;
+    dmg[i] = (double)roll2[i] * dmg_f;
+    acc[i] = (double)b->e_accuracy[i] * emod[i] * acc_f;
+    hi[i] = 100;
+  }
+
+  duel_rand_range(b, go, lo, hi, roll);
+  duel_rand_range(b, go, lo, hi, roll2);
+  int live = 0;
+  for (int i = 0; i < n; ++i) {
+    bool block = roll[i] <= b->h_block[i];
+    bool landed = go[i] && roll2[i] <= (int)round(acc[i]);
+    double d = dmg[i] / (landed && block ? 1.0 + (double)b->h_hp[i] / 200.0 : 1.0);
+    int armor_block = b->h_armor[i] - b->e_armor_pen[i];
+    d -= armor_block < 0 ? 0 : armor_block;
+    d = d < 0 ? 0 : d;
+    int hp = b->h_hp[i] - (landed ? (int)round(d) : 0);
+    hp = hp < 0 ? 0 : hp;
+
+    int gain = b->h_hp_max[i] - hp < b->h_regen_hp[i] ? b->h_hp_max[i] - hp : b->h_regen_hp[i];
+    hp += go[i] && b->h_regen_hp[i] > 0 && hp < b->h_hp_max[i] ? gain : 0;
+    b->h_hp[i] = hp;
+    int mp = b->h_mp[i];
+    gain = b->h_mp_max[i] - mp < b->h_regen_mp[i] ? b->h_mp_max[i] - mp : b->h_regen_mp[i];
+    b->h_mp[i] = mp + (go[i] && b->h_regen_mp[i] > 0 && mp < b->h_mp_max[i] ? gain : 0);
+    int ehp = b->e_hp[i];
+    gain = b->e_hp_max[i] - ehp < b->e_regen_hp[i] ? b->e_hp_max[i] - ehp : b->e_regen_hp[i];
+    b->e_hp[i] = ehp + (go[i] && b->e_regen_hp[i] > 0 && ehp < b->e_hp_max[i] ? gain : 0);
+
+    b->rounds[i] += b->live[i];
+    b->live[i] = b->live[i] && b->e_hp[i] > 0 && b->h_hp[i] > 0 && b->rounds[i] < SIM_MAX_ROUNDS;
+    live += b->live[i];
+  }
+  return live;
+}
+
+typedef struct {
+  int duels;
+  int attack;
+  bool check;
+  bool odds;
+} DuelConfig;
+
+static uint64_t duel_seed(uint64_t seed, int dungeon, int hero, int enemy, int duel) {
+  uint64_t x = sim_run_seed(seed, dungeon, hero, duel) ^ ((uint64_t)enemy << 32);
+  return splitmix64(&x);
+}
+
+// Leaves the fresh hero and enemy in g->hero / g->enemy with the combat stream
+// positioned at the first roll of the fight.
+static void duel_setup(Game *g, const HeroTemplate *t, const EnemyTemplate *et, const SimConfig *cfg, uint64_t seed) {
+  game_seed(g, seed);
+  g->hero = character_from_hero(g, t, t->name);
+  skill_assign(&g->hero.active_skill, SKILL_ACTIVE, cfg->skills[0]);
+  skill_assign(&g->hero.passive_skill, SKILL_PASSIVE, cfg->skills[1]);
+  skill_assign(&g->hero.camp_skill, SKILL_CAMP, cfg->skills[2]);
+  character_touch(&g->hero);
+  g->enemy = character_from_enemy(g, et);
+}
+
+// The sim_run battle loop on the scalar path; returns the number of rounds played.
+static int duel_scalar(Game *g, int base_attack) {
+  Character *h = &g->hero;
+  int rounds = 0;
+  while (g->enemy.hp > 0 && h->hp > 0 && rounds < SIM_MAX_ROUNDS) {
+    bool skill = strcmp(h->active_skill.code, "none") != 0 && h->mp >= h->active_skill.mp_cost;
+    battle_round(g, skill ? 4 : base_attack, NULL);
+    logbuffer_clear(&g->log);
+    rounds++;
+  }
+  return rounds;
+}
+
+// Balance table of fresh heroes against every enemy of each dungeon, resolved by the
+// batch kernel. With check set every duel is replayed through battle_round and the
+// final HP, MP, round count and RNG state must match exactly.
+static int duels_main(const SimConfig *cfg, const DuelConfig *dc) {
+  Game game;
+  game_init(&game);
+  game_load_templates(&game);
+  if (game.hero_count == 0) {
+    fprintf(stderr, "duels: no heroes loaded\n");
+    game_free(&game);
+    return 1;
+  }
+  if (cfg->hero_code && !hero_template_by_code(&game, cfg->hero_code)) {
+    fprintf(stderr, "duels: unknown hero '%s'\n", cfg->hero_code);
+    game_free(&game);
+    return 1;
+  }
+  if (cfg->dungeon_name && strcmp(game.dungeons[dungeon_index_by_name(&game, cfg->dungeon_name)].name, cfg->dungeon_name) != 0) {
+    fprintf(stderr, "duels: unknown dungeon '%s'\n", cfg->dungeon_name);
+    game_free(&game);
+    return 1;
+  }
+  DuelBatch *b = (DuelBatch *)calloc(1, sizeof(DuelBatch));
+  if (!b) {
+    game_free(&game);
+    return 1;
+  }
+
+  static const char *attack_names[] = {"", "body", "head", "legs"};
+  printf("# duels=%d seed=%u skills=%s,%s,%s attack=%s\n", dc->duels, cfg->seed,
+         cfg->skills[0], cfg->skills[1], cfg->skills[2], attack_names[dc->attack]);
+  printf("%-12s %-8s %-20s %8s %6s %6s %6s %7s %7s%s\n",
+         "hero", "dungeon", "enemy", "duels", "win%", "loss%", "stall%", "rounds", "hp_left", dc->odds ? "   odds%" : "");
+
+  uint64_t freq = SDL_GetPerformanceFrequency();
+  uint64_t kernel_ticks = 0;
+  uint64_t scalar_ticks = 0;
+  long long total = 0;
+  long long mismatches = 0;
+  for (int d = 0; d < 3; ++d) {
+    const DungeonData *dd = &game.dungeons[d];
+    if (cfg->dungeon_name && strcmp(dd->name, cfg->dungeon_name) != 0) continue;
+    for (size_t i = 0; i < game.hero_count; ++i) {
+      const HeroTemplate *t = &game.heroes[i];
+      if (cfg->hero_code && strcmp(t->code, cfg->hero_code) != 0) continue;
+      for (size_t k = 0; k < dd->enemy_count; ++k) {
+        const EnemyTemplate *et = &dd->enemies[k];
+        long long wins = 0, losses = 0, rounds = 0, hp_left = 0;
+        double odds = 0.0;
+        for (int first = 0; first < dc->duels; first += DUEL_LANES) {
+          b->count = dc->duels - first < DUEL_LANES ? dc->duels - first : DUEL_LANES;
+          for (int lane = 0; lane < b->count; ++lane) {
+            duel_setup(&game, t, et, cfg, duel_seed(cfg->seed, d, (int)i, (int)k, first + lane));
+            duel_batch_load(b, lane, &game.hero, &game.enemy, &game.rng[RNG_COMBAT]);
+            if (dc->odds) odds += battle_odds(&game.odds, &game.hero, &game.enemy, dc->attack).win;
+            value_map_free(&game.hero.ingredients);
+          }
+          uint64_t t0 = SDL_GetPerformanceCounter();
+          int live = b->count;
+          while (live > 0) {
+            duel_batch_policy(b, dc->attack);
+            live = duel_batch_step(b);
+          }
+          kernel_ticks += SDL_GetPerformanceCounter() - t0;
+
+          for (int lane = 0; lane < b->count; ++lane) {
+            rounds += b->rounds[lane];
+            if (b->e_hp[lane] <= 0) {
+              wins++;
+              hp_left += b->h_hp[lane];
+            } else if (b->h_hp[lane] <= 0) {
+              losses++;
+            }
+            if (!dc->check) continue;
+            duel_setup(&game, t, et, cfg, duel_seed(cfg->seed, d, (int)i, (int)k, first + lane));
+            uint64_t t1 = SDL_GetPerformanceCounter();
+            int r = duel_scalar(&game, dc->attack);
+            scalar_ticks += SDL_GetPerformanceCounter() - t1;
+            const Rng *rng = &game.rng[RNG_COMBAT];
+            if (r != b->rounds[lane] || game.hero.hp != b->h_hp[lane] || game.hero.mp != b->h_mp[lane] ||
+                game.enemy.hp != b->e_hp[lane] || rng->s[0] != b->s0[lane] || rng->s[1] != b->s1[lane] ||
+                rng->s[2] != b->s2[lane] || rng->s[3] != b->s3[lane]) {
+              if (mismatches < 10) {
+                fprintf(stderr, "duel-check: %s vs %s duel %d: scalar hp %d/%d mp %d rounds %d, batch hp %d/%d mp %d rounds %d\n",
+                        t->code, et->code_name, first + lane, game.hero.hp, game.enemy.hp, game.hero.mp, r,
+                        b->h_hp[lane], b->e_hp[lane], b->h_mp[lane], b->rounds[lane]);
+              }
+              mismatches++;
+            }
+            value_map_free(&game.hero.ingredients);
+          }
+        }
+        int n = dc->duels > 0 ? dc->duels : 1;
+        printf("%-12s %-8s %-20s %8d %6.2f %6.2f %6.2f %7.2f %7.2f",
+               t->code, dd->name, et->code_name, dc->duels,
+               100.0 * wins / n, 100.0 * losses / n, 100.0 * (dc->duels - wins - losses) / n,
+               (double)rounds / n, wins > 0 ? (double)hp_left / wins : 0.0);
+        if (dc->odds) printf(" %7.2f", 100.0 * odds / n);
+        printf("\n");
+        total += dc->duels;
+      }
+    }
+  }
+
+  double kernel_secs = (double)kernel_ticks / (double)(freq ? freq : 1);
+  fprintf(stderr, "[pzdc_dungeon_2_gl] resolved %lld duels in %.3fs of kernel time (%.0f duels/s)\n",
+          total, kernel_secs, kernel_secs > 0.0 ? total / kernel_secs : 0.0);
+  if (dc->check) {
+    double scalar_secs = (double)scalar_ticks / (double)(freq ? freq : 1);
+    fprintf(stderr, "duel-check: %lld duels, %lld mismatches; battle_round took %.3fs (%.0f duels/s)\n",
+            total, mismatches, scalar_secs, scalar_secs > 0.0 ? total / scalar_secs : 0.0);
+  }
+  free(b);
+  game_free(&game);
+  return mismatches > 0 ? 1 : 0;
 }
 
 int main(int argc, char **argv) {
   bool static_mode = false;
+  bool build_bundle = false;
+  bool simulate = false;
+  bool bench_compose = false;
+  int bench_iterations = 2000;
+  const char *render_target = NULL;
+  const char *render_out = "screens";
+  bool render_png = true;
+  SimConfig sim = {1000, 0, 1, NULL, NULL, {"ascetic_strike", "berserk", "first_aid"}, false};
+  DuelConfig duel = {0, 1, false, false};
   const char *static_menu_path_arg = NULL;
   const char *font_path = NULL;
+  const char *profile_path = NULL;
+  bool seed_set = false;
+  const char *record_path = NULL;
+  const char *replay_path = NULL;
+  uint32_t replay_frame = 0;
   ValueMap static_map = {0};
   ArtArg *static_arts = NULL;
   size_t static_art_count = 0;
@@ -6517,6 +11818,99 @@ int main(int argc, char **argv) {
       static_mode = true;
       continue;
     }
+    if (strcmp(argv[i], "--build-bundle") == 0) {
+      build_bundle = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--simulate") == 0) {
+      simulate = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--bench-compose") == 0) {
+      bench_compose = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--render") == 0 && i + 1 < argc) {
+      render_target = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      render_out = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      render_png = strcmp(argv[++i], "cells") != 0;
+      continue;
+    }
+    if (strcmp(argv[i], "--duels") == 0 && i + 1 < argc) {
+      duel.duels = atoi(argv[++i]);
+      continue;
+    }
+    if (strcmp(argv[i], "--pick") == 0 && i + 1 < argc) {
+      sim.pick_odds = strcmp(argv[++i], "odds") == 0;
+      continue;
+    }
+    if (strcmp(argv[i], "--odds") == 0) {
+      duel.odds = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--duel-check") == 0) {
+      duel.check = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--attack") == 0 && i + 1 < argc) {
+      const char *a = argv[++i];
+      duel.attack = strcmp(a, "head") == 0 ? 2 : strcmp(a, "legs") == 0 ? 3 : 1;
+      continue;
+    }
+    if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      record_path = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      replay_path = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "--frame") == 0 && i + 1 < argc) {
+      replay_frame = (uint32_t)strtoul(argv[++i], NULL, 10);
+      continue;
+    }
+    if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      bench_iterations = atoi(argv[++i]);
+      continue;
+    }
+    if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      sim.runs = atoi(argv[++i]);
+      continue;
+    }
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      sim.threads = atoi(argv[++i]);
+      continue;
+    }
+    if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      sim.seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+      seed_set = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--hero") == 0 && i + 1 < argc) {
+      sim.hero_code = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "--dungeon") == 0 && i + 1 < argc) {
+      sim.dungeon_name = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "--skills") == 0 && i + 1 < argc) {
+      // active,passive,camp
+      char *list = argv[++i];
+      for (int k = 0; k < 3 && list; ++k) {
+        char *comma = strchr(list, ',');
+        if (comma) *comma = '\0';
+        sim.skills[k] = list;
+        list = comma ? comma + 1 : NULL;
+      }
+      continue;
+    }
     if (strcmp(argv[i], "--set") == 0 && i + 1 < argc) {
       char *pair = argv[++i];
       char *eq = strchr(pair, '=');
@@ -6543,6 +11937,10 @@ int main(int argc, char **argv) {
       }
       continue;
     }
+    if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      profile_path = argv[++i];
+      continue;
+    }
     if (strcmp(argv[i], "--font") == 0 && i + 1 < argc) {
       font_path = argv[++i];
       continue;
@@ -6553,7 +11951,52 @@ int main(int argc, char **argv) {
     }
   }
 
-  srand((unsigned int)time(NULL));
+  if (build_bundle) {
+    value_map_free(&static_map);
+    free_art_args(static_arts, static_art_count);
+    return view_bundle_build() ? 0 : 1;
+  }
+  if (simulate) {
+    value_map_free(&static_map);
+    free_art_args(static_arts, static_art_count);
+    return simulate_main(&sim);
+  }
+  if (duel.duels > 0 || duel.check) {
+    value_map_free(&static_map);
+    free_art_args(static_arts, static_art_count);
+    if (duel.duels <= 0) duel.duels = 1000;
+    return duels_main(&sim, &duel);
+  }
+  if (bench_compose) {
+    value_map_free(&static_map);
+    free_art_args(static_arts, static_art_count);
+    view_bundle_open();
+    asset_index_build();
+    int rc = bench_compose_main(bench_iterations);
+    view_bundle_close();
+    return rc;
+  }
+  if (render_target) {
+    value_map_free(&static_map);
+    free_art_args(static_arts, static_art_count);
+    view_bundle_open();
+    asset_index_build();
+    int rc = render_main(render_target, render_out, render_png, font_path);
+    view_bundle_close();
+    return rc;
+  }
+  if (replay_path) {
+    value_map_free(&static_map);
+    free_art_args(static_arts, static_art_count);
+    view_bundle_open();
+    asset_index_build();
+    int rc = replay_main(replay_path, replay_frame);
+    view_bundle_close();
+    return rc;
+  }
+
+  view_bundle_open();
+  asset_index_build();
 
   fprintf(stderr, "[pzdc_dungeon_2_gl] argv parsed (static_mode=%d)\n", static_mode ? 1 : 0);
 
@@ -6577,13 +12020,41 @@ int main(int argc, char **argv) {
 
   fprintf(stderr, "[pzdc_dungeon_2_gl] font: %s\n", font_path);
 
+  // Data files load in the background while SDL, TTF and the font come up;
+  // load_stage_finish joins before the first screen is built.
+  Game game;
+  LoadStage load_stage;
+  FILE *record = NULL;
+  if (!static_mode) {
+    fprintf(stderr, "[pzdc_dungeon_2_gl] interactive mode\n");
+    game_init(&game);
+    if (seed_set) game_seed(&game, sim.seed);
+    fprintf(stderr, "[pzdc_dungeon_2_gl] game_init OK (seed %llu)\n", (unsigned long long)game.seed);
+    if (record_path) record = replay_record_open(record_path, game.seed);
+    {
+      char cwd_buf[512];
+      if (getcwd(cwd_buf, sizeof(cwd_buf))) {
+        fprintf(stderr, "[pzdc_dungeon_2_gl] cwd: %s\n", cwd_buf);
+      }
+    }
+    load_stage_start(&load_stage, &game, LOAD_JOB_COUNT);
+  }
+
   if (SDL_Init(SDL_INIT_VIDEO) != 0) {
     fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
+    if (!static_mode) {
+      load_stage_finish(&load_stage);
+      game_free(&game);
+    }
     return 1;
   }
   fprintf(stderr, "[pzdc_dungeon_2_gl] SDL_Init OK\n");
   if (TTF_Init() != 0) {
     fprintf(stderr, "TTF_Init failed: %s\n", TTF_GetError());
+    if (!static_mode) {
+      load_stage_finish(&load_stage);
+      game_free(&game);
+    }
     SDL_Quit();
     return 1;
   }
@@ -6592,6 +12063,10 @@ int main(int argc, char **argv) {
   TTF_Font *font = TTF_OpenFont(font_path, 20);
   if (!font) {
     fprintf(stderr, "Failed to load font: %s\n", TTF_GetError());
+    if (!static_mode) {
+      load_stage_finish(&load_stage);
+      game_free(&game);
+    }
     TTF_Quit();
     SDL_Quit();
     return 1;
@@ -6607,6 +12082,7 @@ int main(int argc, char **argv) {
   }
 
   Menu menu = {0};
+  Composer composer = {0};
   RenderState rs = {0};
 
   if (static_mode) {
@@ -6624,11 +12100,11 @@ int main(int argc, char **argv) {
     char *resolved_menu = resolve_menu_path(menu_path);
     if (!resolved_menu) resolved_menu = strdup_safe(menu_path);
 
-    if (!menu_load(resolved_menu, &menu)) {
+    if (!menu_load_cached(resolved_menu, &menu)) {
       fprintf(stderr, "Failed to load menu from %s\n", resolved_menu);
       free(resolved_menu);
       free(version);
-      value_map_clear(&static_map);
+      value_map_free(&static_map);
       free_art_args(static_arts, static_art_count);
       TTF_CloseFont(font);
       TTF_Quit();
@@ -6641,7 +12117,6 @@ int main(int argc, char **argv) {
     free(resolved_menu);
   }
 
-  Game game;
   ValueMap main_map = {0};
   ValueMap hero_map = {0};
   ValueMap enemy_map1 = {0};
@@ -6650,96 +12125,9 @@ int main(int argc, char **argv) {
   ValueMap *enemy_maps[3] = {&enemy_map1, &enemy_map2, &enemy_map3};
 
   if (!static_mode) {
-    fprintf(stderr, "[pzdc_dungeon_2_gl] interactive mode\n");
-    game_init(&game);
-    fprintf(stderr, "[pzdc_dungeon_2_gl] game_init OK\n");
-    {
-      char cwd_buf[512];
-      if (getcwd(cwd_buf, sizeof(cwd_buf))) {
-        fprintf(stderr, "[pzdc_dungeon_2_gl] cwd: %s\n", cwd_buf);
-      }
-    }
-    char *heroes_path = resolve_data_path("data/characters/heroes.yml");
-    char *bandits_path = resolve_data_path("data/characters/enemyes/bandits.yml");
-    char *undeads_path = resolve_data_path("data/characters/enemyes/undeads.yml");
-    char *swamp_path = resolve_data_path("data/characters/enemyes/swamp.yml");
-    char *events_path = resolve_data_path("data/characters/enemyes/events.yml");
-    char *weapons_path = resolve_data_path("data/ammunition/weapon.yml");
-    char *body_path = resolve_data_path("data/ammunition/body_armor.yml");
-    char *head_path = resolve_data_path("data/ammunition/head_armor.yml");
-    char *arms_path = resolve_data_path("data/ammunition/arms_armor.yml");
-    char *shield_path = resolve_data_path("data/ammunition/shield.yml");
-
-    fprintf(stderr, "[pzdc_dungeon_2_gl] load heroes: %s\n", heroes_path);
-    load_heroes(heroes_path, &game.heroes, &game.hero_count);
-    fprintf(stderr, "[pzdc_dungeon_2_gl] heroes loaded: %zu\n", game.hero_count);
-
-    fprintf(stderr, "[pzdc_dungeon_2_gl] load bandits: %s\n", bandits_path);
-    load_enemies(bandits_path, &game.dungeons[0].enemies, &game.dungeons[0].enemy_count);
-    fprintf(stderr, "[pzdc_dungeon_2_gl] bandits loaded: %zu\n", game.dungeons[0].enemy_count);
-
-    fprintf(stderr, "[pzdc_dungeon_2_gl] load undeads: %s\n", undeads_path);
-    load_enemies(undeads_path, &game.dungeons[1].enemies, &game.dungeons[1].enemy_count);
-    fprintf(stderr, "[pzdc_dungeon_2_gl] undeads loaded: %zu\n", game.dungeons[1].enemy_count);
-
-    fprintf(stderr, "[pzdc_dungeon_2_gl] load swamp: %s\n", swamp_path);
-    load_enemies(swamp_path, &game.dungeons[2].enemies, &game.dungeons[2].enemy_count);
-    fprintf(stderr, "[pzdc_dungeon_2_gl] swamp loaded: %zu\n", game.dungeons[2].enemy_count);
-
-    fprintf(stderr, "[pzdc_dungeon_2_gl] load events enemyes: %s\n", events_path);
-    load_enemies(events_path, &game.event_enemies, &game.event_enemy_count);
-    fprintf(stderr, "[pzdc_dungeon_2_gl] events enemyes loaded: %zu\n", game.event_enemy_count);
-
-    fprintf(stderr, "[pzdc_dungeon_2_gl] load weapons: %s\n", weapons_path);
-    load_weapons(weapons_path, &game.weapons, &game.weapon_count);
-    fprintf(stderr, "[pzdc_dungeon_2_gl] weapons loaded: %zu\n", game.weapon_count);
-
-    fprintf(stderr, "[pzdc_dungeon_2_gl] load body armor: %s\n", body_path);
-    load_armors(body_path, &game.body_armors, &game.body_armor_count);
-    fprintf(stderr, "[pzdc_dungeon_2_gl] body armor loaded: %zu\n", game.body_armor_count);
-
-    fprintf(stderr, "[pzdc_dungeon_2_gl] load head armor: %s\n", head_path);
-    load_armors(head_path, &game.head_armors, &game.head_armor_count);
-    fprintf(stderr, "[pzdc_dungeon_2_gl] head armor loaded: %zu\n", game.head_armor_count);
-
-    fprintf(stderr, "[pzdc_dungeon_2_gl] load arms armor: %s\n", arms_path);
-    load_armors(arms_path, &game.arms_armors, &game.arms_armor_count);
-    fprintf(stderr, "[pzdc_dungeon_2_gl] arms armor loaded: %zu\n", game.arms_armor_count);
-
-    fprintf(stderr, "[pzdc_dungeon_2_gl] load shields: %s\n", shield_path);
-    load_shields(shield_path, &game.shields, &game.shield_count);
-    fprintf(stderr, "[pzdc_dungeon_2_gl] shields loaded: %zu\n", game.shield_count);
-
-    load_shop_data(&game.shop);
-    load_warehouse_data(&game.warehouse);
-    shop_fill(&game.shop);
-    save_shop_data(&game.shop);
-    save_warehouse_data(&game.warehouse);
-    load_monolith_data(&game.monolith);
-    load_statistics_total(&game.stats_total);
-    load_occult_library_data(&game.occult);
-
-    if (game.hero_count == 0) fprintf(stderr, "[pzdc_dungeon_2_gl] WARN: failed to load heroes from %s\n", heroes_path);
-    if (game.dungeons[0].enemy_count == 0) fprintf(stderr, "[pzdc_dungeon_2_gl] WARN: failed to load bandits from %s\n", bandits_path);
-    if (game.dungeons[1].enemy_count == 0) fprintf(stderr, "[pzdc_dungeon_2_gl] WARN: failed to load undeads from %s\n", undeads_path);
-    if (game.dungeons[2].enemy_count == 0) fprintf(stderr, "[pzdc_dungeon_2_gl] WARN: failed to load swamp from %s\n", swamp_path);
-    if (game.event_enemy_count == 0) fprintf(stderr, "[pzdc_dungeon_2_gl] WARN: failed to load events enemyes from %s\n", events_path);
-    if (game.weapon_count == 0) fprintf(stderr, "[pzdc_dungeon_2_gl] WARN: failed to load weapons from %s\n", weapons_path);
-    if (game.body_armor_count == 0) fprintf(stderr, "[pzdc_dungeon_2_gl] WARN: failed to load body armor from %s\n", body_path);
-    if (game.head_armor_count == 0) fprintf(stderr, "[pzdc_dungeon_2_gl] WARN: failed to load head armor from %s\n", head_path);
-    if (game.arms_armor_count == 0) fprintf(stderr, "[pzdc_dungeon_2_gl] WARN: failed to load arms armor from %s\n", arms_path);
-    if (game.shield_count == 0) fprintf(stderr, "[pzdc_dungeon_2_gl] WARN: failed to load shields from %s\n", shield_path);
-
-    free(heroes_path);
-    free(bandits_path);
-    free(undeads_path);
-    free(swamp_path);
-    free(events_path);
-    free(weapons_path);
-    free(body_path);
-    free(head_path);
-    free(arms_path);
-    free(shield_path);
+    load_stage_finish(&load_stage);
+    game_session_begin(&game);
+
     fprintf(stderr, "[pzdc_dungeon_2_gl] data loaded (heroes=%zu, enemies=%zu/%zu/%zu)\n",
             game.hero_count, game.dungeons[0].enemy_count, game.dungeons[1].enemy_count, game.dungeons[2].enemy_count);
 
@@ -6756,7 +12144,7 @@ int main(int argc, char **argv) {
       return 1;
     }
 
-    if (!menu_load(menu_path, &menu)) {
+    if (!menu_load_cached(menu_path, &menu)) {
       fprintf(stderr, "Failed to load menu from %s\n", menu_path);
       free(menu_path);
       free_art_args(arts, art_count);
@@ -6787,12 +12175,12 @@ int main(int argc, char **argv) {
     fprintf(stderr, "SDL_CreateWindow failed: %s\n", SDL_GetError());
     free_menu(&menu);
     render_state_free(&rs);
-    value_map_clear(&static_map);
-    value_map_clear(&main_map);
-    value_map_clear(&hero_map);
-    value_map_clear(&enemy_map1);
-    value_map_clear(&enemy_map2);
-    value_map_clear(&enemy_map3);
+    value_map_free(&static_map);
+    value_map_free(&main_map);
+    value_map_free(&hero_map);
+    value_map_free(&enemy_map1);
+    value_map_free(&enemy_map2);
+    value_map_free(&enemy_map3);
     if (!static_mode) game_free(&game);
     free(version);
     free_art_args(static_arts, static_art_count);
@@ -6809,12 +12197,12 @@ int main(int argc, char **argv) {
     SDL_DestroyWindow(window);
     free_menu(&menu);
     render_state_free(&rs);
-    value_map_clear(&static_map);
-    value_map_clear(&main_map);
-    value_map_clear(&hero_map);
-    value_map_clear(&enemy_map1);
-    value_map_clear(&enemy_map2);
-    value_map_clear(&enemy_map3);
+    value_map_free(&static_map);
+    value_map_free(&main_map);
+    value_map_free(&hero_map);
+    value_map_free(&enemy_map1);
+    value_map_free(&enemy_map2);
+    value_map_free(&enemy_map3);
     if (!static_mode) game_free(&game);
     free(version);
     free_art_args(static_arts, static_art_count);
@@ -6835,7 +12223,9 @@ int main(int argc, char **argv) {
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-  build_atlas(&menu, font, cell_w, cell_h, &rs);
+  atlas_init(&rs, font, cell_w, cell_h);
+  render_set_menu(&rs, &menu);
+  prof_init();
 
   bool running = true;
   bool dirty = false;
@@ -6847,736 +12237,52 @@ int main(int argc, char **argv) {
   int fade_duration_ms = 200;
   int typewriter_duration_ms = 700;
   uint32_t last_tick = SDL_GetTicks();
+  uint32_t last_frame = last_tick;
+  const uint32_t frame_ms = 16;
+  bool needs_redraw = true;
+  uint32_t frame = 0;
 
   while (running) {
+    ++frame;
+    // Block until the next input or the next thing due on screen: an
+    // animation frame while fading/typing, or the battle animation deadline.
+    int timeout = -1;
+    uint32_t wait_now = SDL_GetTicks();
+    if (transition_active || typewriter_active) {
+      uint32_t next_frame = last_frame + frame_ms;
+      timeout = next_frame > wait_now ? (int)(next_frame - wait_now) : 0;
+    }
+    if (!static_mode && game.battle_anim_active) {
+      int until = game.battle_anim_deadline > wait_now ? (int)(game.battle_anim_deadline - wait_now) : 0;
+      if (timeout < 0 || until < timeout) timeout = until;
+    }
+    if (dirty || needs_redraw) timeout = 0;
+
     SDL_Event e;
-    while (SDL_PollEvent(&e)) {
+    prof_enter(PROF_IDLE);
+    bool have_event = SDL_WaitEventTimeout(&e, timeout) != 0;
+    prof_leave();
+    prof_enter(PROF_INPUT);
+    for (; have_event; have_event = SDL_PollEvent(&e) != 0) {
       if (e.type == SDL_QUIT) running = false;
-      if (e.type == SDL_TEXTINPUT) {
-        if (!static_mode && game.state == STATE_NAME_INPUT) {
-          append_text(game.name_input, &game.name_len, NAME_MAX_LEN + 1, e.text.text);
-          game.name_error[0] = '\0';
-          dirty = true;
-        } else if (!static_mode && game.state == STATE_EVENT_RESULT && game.event_input_mode == EVENT_INPUT_TEXT) {
-          append_text(game.event_text, &game.event_text_len, sizeof(game.event_text), e.text.text);
-          dirty = true;
-        }
+      if (e.type == SDL_WINDOWEVENT) needs_redraw = true;
+      if (e.type == SDL_TEXTINPUT && !static_mode) {
+        replay_record(&record, frame, game.state, REPLAY_TEXT, 0, e.text.text);
+        if (game_handle_text(&game, e.text.text)) dirty = true;
       }
       if (e.type == SDL_KEYDOWN) {
         SDL_Keycode key = e.key.keysym.sym;
         if (key == SDLK_ESCAPE) running = false;
-        if (static_mode) continue;
-
-        int digit = key_to_digit(key);
-        if (game.state == STATE_START) {
-          if (digit == 1) {
-            game.state = STATE_LOAD_MENU;
-            dirty = true;
-          } else if (digit == 0) {
-            running = false;
-          } else if (digit == 2) {
-            game.state = STATE_CAMP;
-            dirty = true;
-          } else if (digit == 3) {
-            game.state = STATE_OPTIONS;
-            dirty = true;
-          } else if (digit == 4) {
-            game.state = STATE_CREDITS;
-            dirty = true;
-          }
-        } else if (game.state == STATE_LOAD_MENU) {
-          if (digit == 1) {
-            if (load_hero_in_run(&game)) {
-              game.dungeon_index = dungeon_index_by_name(&game, game.hero.dungeon_name);
-              game.state = STATE_LOAD_CONFIRM;
-            } else {
-              game.state = STATE_LOAD_NO_HERO;
-            }
-            dirty = true;
-          } else if (digit == 2) {
-            game.state = STATE_CHOOSE_DUNGEON;
-            dirty = true;
-          } else if (digit == 0) {
-            game.state = STATE_START;
-            dirty = true;
-          }
-        } else if (game.state == STATE_LOAD_NO_HERO) {
-          if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
-            game.state = STATE_LOAD_MENU;
-            dirty = true;
-          }
-        } else if (game.state == STATE_CHOOSE_DUNGEON) {
-          if (digit >= 1 && digit <= 3) {
-            game.dungeon_index = digit - 1;
-            game.name_len = 0;
-            game.name_input[0] = '\0';
-            game.name_error[0] = '\0';
-            game.state = STATE_NAME_INPUT;
-            dirty = true;
-          } else if (digit == 0) {
-            game.state = STATE_LOAD_MENU;
-            dirty = true;
-          }
-        } else if (game.state == STATE_NAME_INPUT) {
-          if (key == SDLK_BACKSPACE) {
-            backspace_text(game.name_input, &game.name_len);
-            game.name_error[0] = '\0';
-            dirty = true;
-          } else if (key == SDLK_RETURN || key == SDLK_KP_ENTER) {
-            char tmp[32];
-            snprintf(tmp, sizeof(tmp), "%s", game.name_input);
-            trim_both_inplace(tmp);
-            if (tmp[0] == '\0') {
-              snprintf(game.name_error, sizeof(game.name_error), "The name must contain at least one letter");
-              dirty = true;
-            } else if (strlen(tmp) > NAME_MAX_LEN) {
-              snprintf(game.name_error, sizeof(game.name_error), "%s is an incorrect name. The name must be no more than 20 characters", tmp);
-              dirty = true;
-            } else if (!str_has_letter(tmp)) {
-              snprintf(game.name_error, sizeof(game.name_error), "%s is an incorrect name. The name must contain at least one letter", tmp);
-              dirty = true;
-            } else {
-              snprintf(game.name_input, sizeof(game.name_input), "%s", tmp);
-              game.name_len = strlen(game.name_input);
-              game.name_error[0] = '\0';
-              game.state = STATE_HERO_SELECT;
-              dirty = true;
-            }
-          } else if (digit == 0) {
-            game.state = STATE_CHOOSE_DUNGEON;
-            dirty = true;
-          }
-        } else if (game.state == STATE_HERO_SELECT) {
-          if (digit >= 1 && (size_t)digit <= game.hero_count) {
-            const char *hero_name = game.name_input[0] ? game.name_input : "Hero";
-            game.hero = character_from_hero(&game, &game.heroes[digit - 1], hero_name);
-            snprintf(game.hero.dungeon_name, sizeof(game.hero.dungeon_name), "%s", game.dungeons[game.dungeon_index].name);
-            game.hero.dungeon_part_number = 1;
-            game.hero.leveling = 0;
-            apply_monolith_bonuses(&game.monolith, &game.hero);
-            apply_statistics_bonuses(&game.stats_total, &game, &game.hero);
-            apply_warehouse_bonuses(&game, &game.hero);
-            if (strcmp(game.name_input, "BAMBUGA") == 0) {
-              game.hero.weapon = weapon_from_code(&game, "bambuga");
-              snprintf(game.hero.name, sizeof(game.hero.name), "Cheater");
-            }
-            game.wg_taken = 0;
-            game.wg_enemy[0] = '\0';
-            game.wg_count = 0;
-            game.wg_level = 0;
-            game.hero_selected = 1;
-            game.state = STATE_SKILL_ACTIVE;
-            dirty = true;
-          } else if (digit == 0) {
-            game.state = STATE_NAME_INPUT;
-            dirty = true;
-          }
-        } else if (game.state == STATE_LOAD_CONFIRM) {
-          if (digit == 1) {
-            game.hero_selected = 1;
-            pick_random_enemies(&game);
-            game.state = STATE_ENEMY_SELECT;
-            dirty = true;
-          } else if (digit == 0) {
-            game.state = STATE_LOAD_MENU;
-            dirty = true;
-          }
-        } else if (game.state == STATE_CAMP) {
-          if (digit == 1) {
-            game.state = STATE_MONOLITH;
-            dirty = true;
-          } else if (digit == 2) {
-            game.state = STATE_SHOP;
-            dirty = true;
-          } else if (digit == 3) {
-            game.state = STATE_OCCULT_LIBRARY;
-            dirty = true;
-          } else if (digit == 4) {
-            game.state = STATE_STATS_CHOOSE;
-            dirty = true;
-          } else if (digit == 0) {
-            game.state = STATE_START;
-            dirty = true;
-          }
-        } else if (game.state == STATE_MONOLITH) {
-          if (digit == 0) {
-            game.state = STATE_CAMP;
-            dirty = true;
-          } else if (digit >= 1 && digit <= 11) {
-            const char *stats[] = {"hp","mp","accuracy","damage","stat_points","skill_points","armor","regen_hp","regen_mp","armor_penetration","block_chance"};
-            const char *key = stats[digit - 1];
-            if (monolith_buy(&game.monolith, key)) {
-              save_monolith_data(&game.monolith);
-            } else {
-              snprintf(game.message_title, sizeof(game.message_title), "PZDC Monolith");
-              logbuffer_clear(&game.log);
-              logbuffer_push(&game.log, "Not enough points");
-              game.next_state = STATE_MONOLITH;
-              game.state = STATE_MESSAGE;
-            }
-            dirty = true;
-          }
-        } else if (game.state == STATE_OCCULT_LIBRARY) {
-          char letter = key_to_letter(key);
-          if (digit == 0) {
-            game.state = STATE_CAMP;
-            dirty = true;
-          } else if (digit >= 1 && digit <= 24) {
-            OccultRecipe *r = occult_recipe_by_view_code(&game.occult, digit);
-            if (!r) {
-              snprintf(game.message_title, sizeof(game.message_title), "Occult Library");
-              logbuffer_clear(&game.log);
-              logbuffer_push(&game.log, "No recipe on this line");
-              game.next_state = STATE_OCCULT_LIBRARY;
-              game.state = STATE_MESSAGE;
-              dirty = true;
-            } else if (r->purchased) {
-              snprintf(game.message_title, sizeof(game.message_title), "Occult Library");
-              logbuffer_clear(&game.log);
-              logbuffer_push(&game.log, "Already purchased");
-              game.next_state = STATE_OCCULT_LIBRARY;
-              game.state = STATE_MESSAGE;
-              dirty = true;
-            } else if (game.warehouse.coins < r->price) {
-              snprintf(game.message_title, sizeof(game.message_title), "Occult Library");
-              logbuffer_clear(&game.log);
-              logbuffer_push(&game.log, "Not enough coins");
-              game.next_state = STATE_OCCULT_LIBRARY;
-              game.state = STATE_MESSAGE;
-              dirty = true;
-            } else {
-              game.warehouse.coins -= r->price;
-              r->purchased = true;
-              save_occult_library_data(&game.occult);
-              save_warehouse_data(&game.warehouse);
-              snprintf(game.message_title, sizeof(game.message_title), "Occult Library");
-              logbuffer_clear(&game.log);
-              logbuffer_push(&game.log, "Recipe purchased");
-              game.next_state = STATE_OCCULT_LIBRARY;
-              game.state = STATE_MESSAGE;
-              dirty = true;
-            }
-          } else if (letter) {
-            int idx = (int)(letter - 'a') + 1;
-            OccultRecipe *r = occult_recipe_by_view_code(&game.occult, idx);
-            if (r) {
-              game.current_recipe_index = (int)(r - game.occult.recipes);
-              game.return_state = STATE_OCCULT_LIBRARY;
-              game.state = STATE_OL_RECIPE;
-              dirty = true;
-            }
-          }
-        } else if (game.state == STATE_OL_RECIPE) {
-          if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
-            GameState back = (game.return_state == STATE_OL_ENHANCE_LIST || game.return_state == STATE_OCCULT_LIBRARY)
-                               ? game.return_state : STATE_OCCULT_LIBRARY;
-            game.state = back;
-            dirty = true;
-          }
-        } else if (game.state == STATE_OL_ENHANCE_LIST) {
-          char letter = key_to_letter(key);
-          if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
-            game.state = STATE_CAMPFIRE;
-            dirty = true;
-          } else if (letter) {
-            size_t count = 0;
-            size_t *indices = occult_accessible_indices(&game.occult, &count);
-            int idx = (int)(letter - 'a');
-            if ((size_t)idx < count) {
-              game.current_recipe_index = (int)indices[idx];
-              OccultRecipe *r = &game.occult.recipes[indices[idx]];
-              if (recipe_hero_has_ingredients(r, &game.hero)) {
-                game.state = STATE_OL_ENHANCE;
-              } else {
-                game.return_state = STATE_OL_ENHANCE_LIST;
-                game.state = STATE_OL_RECIPE;
-              }
-              dirty = true;
-            }
-            free(indices);
-          }
-        } else if (game.state == STATE_OL_ENHANCE) {
-          char letter = key_to_letter(key);
-          if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
-            game.state = STATE_OL_ENHANCE_LIST;
-            dirty = true;
-          } else if (letter) {
-            const char *type = NULL;
-            if (letter == 'a') type = "weapon";
-            else if (letter == 'b') type = "head_armor";
-            else if (letter == 'c') type = "body_armor";
-            else if (letter == 'd') type = "arms_armor";
-            else if (letter == 'e') type = "shield";
-            if (type) {
-              const char *code = "without";
-              if (strcmp(type, "weapon") == 0) code = game.hero.weapon.code;
-              else if (strcmp(type, "head_armor") == 0) code = game.hero.head_armor.code;
-              else if (strcmp(type, "body_armor") == 0) code = game.hero.body_armor.code;
-              else if (strcmp(type, "arms_armor") == 0) code = game.hero.arms_armor.code;
-              else if (strcmp(type, "shield") == 0) code = game.hero.shield.code;
-              if (strcmp(code, "without") != 0) {
-                snprintf(game.ammo_show_type, sizeof(game.ammo_show_type), "%s", type);
-                snprintf(game.ammo_show_code, sizeof(game.ammo_show_code), "%s", code);
-                game.return_state = STATE_OL_ENHANCE;
-                game.state = STATE_AMMO_SHOW;
-                dirty = true;
-              }
-            }
-          } else if (digit >= 1 && digit <= 5) {
-            OccultRecipe *r = (game.current_recipe_index >= 0 && (size_t)game.current_recipe_index < game.occult.recipe_count)
-                                ? &game.occult.recipes[game.current_recipe_index] : NULL;
-            if (!r) {
-              game.state = STATE_OL_ENHANCE_LIST;
-              dirty = true;
-            } else if (!recipe_hero_has_ingredients(r, &game.hero)) {
-              snprintf(game.message_title, sizeof(game.message_title), "Occult Library");
-              logbuffer_clear(&game.log);
-              logbuffer_push(&game.log, "Not enough ingredients");
-              game.next_state = STATE_OL_ENHANCE;
-              game.state = STATE_MESSAGE;
-              dirty = true;
-            } else {
-              if (digit == 1) recipe_apply_weapon(r, &game.hero.weapon);
-              else if (digit == 2) recipe_apply_armor(r, &game.hero.head_armor, &r->head_armor);
-              else if (digit == 3) recipe_apply_armor(r, &game.hero.body_armor, &r->body_armor);
-              else if (digit == 4) recipe_apply_armor(r, &game.hero.arms_armor, &r->arms_armor);
-              else if (digit == 5) recipe_apply_shield(r, &game.hero.shield);
-              recipe_consume_ingredients(r, &game.hero);
-              snprintf(game.message_title, sizeof(game.message_title), "Occult Library");
-              logbuffer_clear(&game.log);
-              logbuffer_push(&game.log, "Ammunition enhanced");
-              game.next_state = STATE_OL_ENHANCE;
-              game.state = STATE_MESSAGE;
-              dirty = true;
-            }
-          }
-        } else if (game.state == STATE_STATS_CHOOSE) {
-          if (digit == 0) {
-            game.state = STATE_CAMP;
-            dirty = true;
-          } else if (digit >= 1 && digit <= 3) {
-            game.stats_dungeon_index = digit - 1;
-            game.state = STATE_STATS_SHOW;
-            dirty = true;
-          }
-        } else if (game.state == STATE_STATS_SHOW) {
-          if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
-            game.state = STATE_STATS_CHOOSE;
-            dirty = true;
-          }
-        } else if (game.state == STATE_EVENT_SELECT) {
-          if (digit == 0) {
-            game.hero.dungeon_part_number += 1;
-            logbuffer_clear(&game.log);
-            hero_rest(&game.hero, &game.log);
-            game.state = STATE_CAMPFIRE;
-            dirty = true;
-          } else if (digit >= 1 && digit <= game.event_choice_count) {
-            game.current_event = game.event_choices[digit - 1];
-            event_begin(&game, &game.current_event);
-            dirty = true;
-          }
-        } else if (game.state == STATE_EVENT_RESULT) {
-          if (game.event_input_mode == EVENT_INPUT_TEXT) {
-            if (key == SDLK_BACKSPACE) {
-              backspace_text(game.event_text, &game.event_text_len);
-              dirty = true;
-            } else if (key == SDLK_RETURN || key == SDLK_KP_ENTER) {
-              event_handle_text(&game, game.event_text);
-              dirty = true;
-            }
-          } else if (game.event_input_mode == EVENT_INPUT_DIGIT) {
-            if (digit >= 0) {
-              event_handle_digit(&game, digit);
-              dirty = true;
-            }
-          } else {
-            if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
-              event_handle_digit(&game, digit);
-              dirty = true;
-            }
-          }
-        } else if (game.state == STATE_OPTIONS) {
-          if (digit == 1) {
-            game.state = STATE_OPTIONS_ANIM;
-            dirty = true;
-          } else if (digit == 2) {
-            game.state = STATE_OPTIONS_REPLACE;
-            dirty = true;
-          } else if (digit == 0) {
-            game.state = STATE_START;
-            dirty = true;
-          }
-        } else if (game.state == STATE_OPTIONS_ANIM) {
-          if (digit >= 1 && digit <= 5) {
-            game.anim_speed_index = digit - 1;
-            dirty = true;
-          } else if (digit == 0) {
-            game.state = STATE_OPTIONS;
-            dirty = true;
-          }
-        } else if (game.state == STATE_OPTIONS_REPLACE) {
-          if (digit >= 1 && digit <= 3) {
-            game.screen_replace_type = digit - 1;
-            dirty = true;
-          } else if (digit == 0) {
-            game.state = STATE_OPTIONS;
-            dirty = true;
-          }
-        } else if (game.state == STATE_CREDITS) {
-          if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
-            game.state = STATE_START;
-            dirty = true;
-          }
-        } else if (game.state == STATE_LOOT) {
-          char letter = key_to_letter(key);
-          if (letter == 'y' || letter == 'n') {
-            game.loot_last_taken = (letter == 'y') ? 1 : 0;
-            const LootEntry *le = (game.loot_index < game.loot_count) ? &game.loot_items[game.loot_index] : NULL;
-            if (le && letter == 'y') {
-              if (strcmp(le->type, "weapon") == 0) game.hero.weapon = weapon_from_code(&game, le->code);
-              else if (strcmp(le->type, "body_armor") == 0) game.hero.body_armor = armor_from_code(game.body_armors, game.body_armor_count, le->code);
-              else if (strcmp(le->type, "head_armor") == 0) game.hero.head_armor = armor_from_code(game.head_armors, game.head_armor_count, le->code);
-              else if (strcmp(le->type, "arms_armor") == 0) game.hero.arms_armor = armor_from_code(game.arms_armors, game.arms_armor_count, le->code);
-              else if (strcmp(le->type, "shield") == 0) game.hero.shield = shield_from_code(&game, le->code);
-            }
-            game.loot_index += 1;
-            loot_advance(&game);
-            dirty = true;
-          }
-        } else if (game.state == STATE_LOOT_MESSAGE) {
-          if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
-            game.loot_message_mode = 0;
-            loot_advance(&game);
-            dirty = true;
-          }
-        } else if (game.state == STATE_SHOP) {
-          char letter = key_to_letter(key);
-          if (digit == 0) {
-            game.state = STATE_CAMP;
-            dirty = true;
-          } else if (digit >= 1 && digit <= 15) {
-            const char *type = NULL;
-            int idx = 0;
-            if (digit <= 3) { type = "weapon"; idx = digit - 1; }
-            else if (digit <= 6) { type = "body_armor"; idx = digit - 4; }
-            else if (digit <= 9) { type = "head_armor"; idx = digit - 7; }
-            else if (digit <= 12) { type = "arms_armor"; idx = digit - 10; }
-            else { type = "shield"; idx = digit - 13; }
-            char *arr = NULL;
-            if (strcmp(type, "weapon") == 0) arr = game.shop.weapon[idx];
-            else if (strcmp(type, "body_armor") == 0) arr = game.shop.body_armor[idx];
-            else if (strcmp(type, "head_armor") == 0) arr = game.shop.head_armor[idx];
-            else if (strcmp(type, "arms_armor") == 0) arr = game.shop.arms_armor[idx];
-            else arr = game.shop.shield[idx];
-            if (strcmp(arr, "without") == 0) {
-              snprintf(game.message_title, sizeof(game.message_title), "Shop");
-              logbuffer_clear(&game.log);
-              logbuffer_push(&game.log, "Empty slot");
-              game.next_state = STATE_SHOP;
-              game.state = STATE_MESSAGE;
-              dirty = true;
-            } else {
-              int price = ammo_price(&game, type, arr);
-              if (game.warehouse.coins < price) {
-                snprintf(game.message_title, sizeof(game.message_title), "Shop");
-                logbuffer_clear(&game.log);
-                logbuffer_push(&game.log, "Not enough coins");
-                game.next_state = STATE_SHOP;
-                game.state = STATE_MESSAGE;
-                dirty = true;
-              } else {
-                game.warehouse.coins -= price;
-                if (strcmp(type, "weapon") == 0) snprintf(game.warehouse.weapon, sizeof(game.warehouse.weapon), "%s", arr);
-                else if (strcmp(type, "body_armor") == 0) snprintf(game.warehouse.body_armor, sizeof(game.warehouse.body_armor), "%s", arr);
-                else if (strcmp(type, "head_armor") == 0) snprintf(game.warehouse.head_armor, sizeof(game.warehouse.head_armor), "%s", arr);
-                else if (strcmp(type, "arms_armor") == 0) snprintf(game.warehouse.arms_armor, sizeof(game.warehouse.arms_armor), "%s", arr);
-                else snprintf(game.warehouse.shield, sizeof(game.warehouse.shield), "%s", arr);
-                snprintf(arr, 32, "without");
-                save_shop_data(&game.shop);
-                save_warehouse_data(&game.warehouse);
-                snprintf(game.message_title, sizeof(game.message_title), "Shop");
-                logbuffer_clear(&game.log);
-                logbuffer_push(&game.log, "Item purchased");
-                game.next_state = STATE_SHOP;
-                game.state = STATE_MESSAGE;
-                dirty = true;
-              }
-            }
-          } else if (letter) {
-            const char *type = NULL;
-            const char *code = NULL;
-            if (letter >= 'a' && letter <= 'o') {
-              int idx = letter - 'a';
-              if (idx <= 2) { type = "weapon"; code = game.shop.weapon[idx]; }
-              else if (idx <= 5) { type = "body_armor"; code = game.shop.body_armor[idx - 3]; }
-              else if (idx <= 8) { type = "head_armor"; code = game.shop.head_armor[idx - 6]; }
-              else if (idx <= 11) { type = "arms_armor"; code = game.shop.arms_armor[idx - 9]; }
-              else { type = "shield"; code = game.shop.shield[idx - 12]; }
-            } else if (letter == 'v') { type = "weapon"; code = game.warehouse.weapon; }
-            else if (letter == 'w') { type = "body_armor"; code = game.warehouse.body_armor; }
-            else if (letter == 'x') { type = "head_armor"; code = game.warehouse.head_armor; }
-            else if (letter == 'y') { type = "arms_armor"; code = game.warehouse.arms_armor; }
-            else if (letter == 'z') { type = "shield"; code = game.warehouse.shield; }
-            if (type && code && strcmp(code, "without") != 0) {
-              snprintf(game.ammo_show_type, sizeof(game.ammo_show_type), "%s", type);
-              snprintf(game.ammo_show_code, sizeof(game.ammo_show_code), "%s", code);
-              game.return_state = STATE_SHOP;
-              game.state = STATE_AMMO_SHOW;
-              dirty = true;
-            } else if (type && code && strcmp(code, "without") == 0) {
-              snprintf(game.message_title, sizeof(game.message_title), "Shop");
-              logbuffer_clear(&game.log);
-              logbuffer_push(&game.log, "Nothing to show");
-              game.next_state = STATE_SHOP;
-              game.state = STATE_MESSAGE;
-              dirty = true;
-            }
-          }
-        } else if (game.state == STATE_AMMO_SHOW) {
-          if (digit == 0 || key == SDLK_RETURN || key == SDLK_KP_ENTER) {
-            game.state = game.return_state;
-            dirty = true;
-          }
-        } else if (game.state == STATE_SKILL_ACTIVE) {
-          const char *skills[] = {"ascetic_strike", "precise_strike", "strong_strike", "traumatic_strike"};
-          if (digit >= 1 && digit <= 4) {
-            skill_assign(&game.hero.active_skill, SKILL_ACTIVE, skills[digit - 1]);
-            game.state = STATE_SKILL_PASSIVE;
-            dirty = true;
-          }
-        } else if (game.state == STATE_SKILL_PASSIVE) {
-          const char *skills[] = {"berserk", "concentration", "dazed", "shield_master"};
-          if (digit >= 1 && digit <= 4) {
-            skill_assign(&game.hero.passive_skill, SKILL_PASSIVE, skills[digit - 1]);
-            game.state = STATE_SKILL_CAMP;
-            dirty = true;
-          }
-        } else if (game.state == STATE_SKILL_CAMP) {
-          const char *skills[] = {"bloody_ritual", "first_aid", "treasure_hunter"};
-          if (digit >= 1 && digit <= 3) {
-            skill_assign(&game.hero.camp_skill, SKILL_CAMP, skills[digit - 1]);
-            pick_random_enemies(&game);
-            game.state = STATE_ENEMY_SELECT;
-            dirty = true;
-          }
-        } else if (game.state == STATE_ENEMY_SELECT) {
-          if (digit >= 1 && digit <= game.enemy_choice_count) {
-            game.enemy = game.enemy_choices[digit - 1];
-            game.enemy_is_boss = game.enemy_choice_is_boss[digit - 1];
-            logbuffer_clear(&game.log);
-            snprintf(game.battle_art_name, sizeof(game.battle_art_name), "normal");
-            game.battle_art_dungeon[0] = '\0';
-            game.battle_anim_active = 0;
-            game.battle_anim_step = 0;
-            game.battle_anim_count = 0;
-            game.battle_anim_deadline = 0;
-            game.battle_exit_pending = 0;
-            game.state = STATE_BATTLE;
-            dirty = true;
-          } else if (digit == 0) {
-            logbuffer_clear(&game.log);
-            hero_rest(&game.hero, &game.log);
-            game.state = STATE_CAMPFIRE;
-            dirty = true;
-          }
-        } else if (game.state == STATE_BATTLE) {
-          if (game.battle_anim_active || game.battle_exit_pending) {
-            // ignore input while battle animation plays
-          } else if (digit >= 1 && digit <= 4) {
-            int enemy_attack_type = 0;
-            battle_round(&game, digit, &enemy_attack_type);
-            const bool enemy_dead = (game.enemy.hp <= 0);
-            const bool hero_dead = (game.hero.hp <= 0);
-
-            if (enemy_dead) {
-              snprintf(game.message_title, sizeof(game.message_title), "Enemy defeated");
-              logbuffer_clear(&game.log);
-              hero_add_exp(&game.hero, game.enemy.exp_gived, &game.log);
-              stats_total_increment(&game.stats_total, game.dungeons[game.dungeon_index].name, game.enemy.code);
-              save_statistics_total(&game.stats_total);
-              int points = monolith_points_from_enemy(&game.hero, &game.enemy);
-              if (points > 0) {
-                game.hero.pzdc_monolith_points += points;
-                char msg[128];
-                snprintf(msg, sizeof(msg), "PZDC Monolith gained %d point(s)", points);
-                logbuffer_push(&game.log, msg);
-              }
-              if (game.enemy_is_boss) {
-                end_run_transfer(&game, true);
-                snprintf(game.message_title, sizeof(game.message_title), "Dungeon completed");
-                snprintf(game.message_art_name, sizeof(game.message_art_name), "dungeon_completed");
-                snprintf(game.message_art_path, sizeof(game.message_art_path), "_game_over");
-                game.next_state = STATE_START;
-                game.battle_exit_state = STATE_MESSAGE;
-              } else {
-                loot_setup(&game);
-                if (game.loot_count > 0 || game.loot_show_coins || game.loot_show_ingredient) {
-                  loot_advance(&game);
-                  game.battle_exit_state = game.state;
-                  game.state = STATE_BATTLE;
-                } else {
-                  game.pending_levelup = 1;
-                  game.next_state = STATE_CAMPFIRE;
-                  game.battle_exit_state = STATE_MESSAGE;
-                }
-              }
-              game.battle_exit_pending = 1;
-            } else if (hero_dead) {
-              snprintf(game.message_title, sizeof(game.message_title), "You are dead");
-              logbuffer_clear(&game.log);
-              end_run_transfer(&game, false);
-              logbuffer_push(&game.log, "Your run has ended. Camp loot saved.");
-              snprintf(game.message_art_name, sizeof(game.message_art_name), "game_over");
-              snprintf(game.message_art_path, sizeof(game.message_art_path), "_game_over");
-              game.next_state = STATE_START;
-              game.battle_exit_state = STATE_MESSAGE;
-              game.battle_exit_pending = 1;
-            }
-
-            const char *seq[3];
-            int seq_count = 0;
-            if (enemy_dead) {
-              seq[0] = "damaged";
-              seq[1] = "dead";
-              seq_count = 2;
-            } else {
-              seq[0] = "damaged";
-              seq[1] = "normal";
-              seq[2] = enemy_attack_art_from_type(enemy_attack_type);
-              seq_count = 3;
-            }
-            battle_anim_queue(&game, seq, seq_count);
-            dirty = true;
-          }
-        } else if (game.state == STATE_CAMPFIRE) {
-          if (digit == 1) {
-            game.state = STATE_HERO_INFO;
-            dirty = true;
-          } else if (digit == 2) {
-            if (game.hero.stat_points > 0) {
-              game.stat_roll = 0;
-              game.state = STATE_SPEND_STAT;
-              dirty = true;
-            } else {
-              logbuffer_clear(&game.log);
-              logbuffer_push(&game.log, "No stat points to spend");
-              dirty = true;
-            }
-          } else if (digit == 3) {
-            if (game.hero.skill_points > 0) {
-              game.skill_choice_count = 0;
-              game.state = STATE_SPEND_SKILL;
-              dirty = true;
-            } else {
-              logbuffer_clear(&game.log);
-              logbuffer_push(&game.log, "No skill points to spend");
-              dirty = true;
-            }
-          } else if (digit == 4) {
-            game_use_camp_skill(&game);
-            dirty = true;
-          } else if (digit == 5) {
-            game.state = STATE_OL_ENHANCE_LIST;
-            dirty = true;
-          } else if (digit == 6) {
-            save_hero_in_run(&game);
-            snprintf(game.message_title, sizeof(game.message_title), "Game saved");
-            logbuffer_clear(&game.log);
-            logbuffer_push(&game.log, "You can resume from the main menu");
-            game.next_state = STATE_START;
-            game.state = STATE_MESSAGE;
-            dirty = true;
-          } else if (digit == 7) {
-            end_run_transfer(&game, game.hero.hp > 0);
-            snprintf(game.message_title, sizeof(game.message_title), "Run ended");
-            logbuffer_clear(&game.log);
-            logbuffer_push(&game.log, "Camp loot and monolith points transferred");
-            game.next_state = STATE_START;
-            game.state = STATE_MESSAGE;
-            dirty = true;
-          } else if (digit == 0) {
-            if (game.hero.dungeon_part_number % 2 == 0) {
-              pick_random_events(&game);
-              game.state = STATE_EVENT_SELECT;
-            } else {
-              pick_random_enemies(&game);
-              game.state = STATE_ENEMY_SELECT;
-            }
-            dirty = true;
-          }
-        } else if (game.state == STATE_HERO_INFO) {
-          if (digit == 0) {
-            game.state = STATE_CAMPFIRE;
-            dirty = true;
-          }
-        } else if (game.state == STATE_SPEND_STAT) {
-          if (digit == 0) {
-            game.state = STATE_CAMPFIRE;
-            dirty = true;
-          } else if (digit == 1) {
-            game.hero.hp_max += 5;
-            game.hero.hp += 5;
-            game.hero.stat_points -= 1;
-            game.stat_roll = 0;
-            dirty = true;
-          } else if (digit == 2) {
-            game.hero.mp_max += 5;
-            game.hero.mp += 5;
-            game.hero.stat_points -= 1;
-            game.stat_roll = 0;
-            dirty = true;
-          } else if (digit == 3 && game.stat_roll >= 8) {
-            game.hero.accuracy_base += 1;
-            game.hero.stat_points -= 1;
-            game.stat_roll = 0;
-            dirty = true;
-          } else if (digit == 4 && game.stat_roll >= 11) {
-            if (game.hero.min_dmg_base < game.hero.max_dmg_base && rand_range(0, 1) == 0) {
-              game.hero.min_dmg_base += 1;
-            } else {
-              game.hero.max_dmg_base += 1;
-            }
-            game.hero.stat_points -= 1;
-            game.stat_roll = 0;
-            dirty = true;
-          }
-          if (game.state == STATE_SPEND_STAT && game.hero.stat_points <= 0) {
-            game.state = STATE_CAMPFIRE;
-            dirty = true;
-          }
-        } else if (game.state == STATE_SPEND_SKILL) {
-          if (digit == 0) {
-            game.state = STATE_CAMPFIRE;
-            dirty = true;
-          } else if (digit >= 1 && digit <= game.skill_choice_count) {
-            SkillType chosen = game.skill_choices[digit - 1];
-            if (chosen == SKILL_ACTIVE) game.hero.active_skill.lvl += 1;
-            else if (chosen == SKILL_PASSIVE) game.hero.passive_skill.lvl += 1;
-            else if (chosen == SKILL_CAMP) game.hero.camp_skill.lvl += 1;
-            game.hero.skill_points -= 1;
-            game.skill_choice_count = 0;
-            dirty = true;
-            if (game.hero.skill_points <= 0) {
-              game.state = STATE_CAMPFIRE;
-            }
-          }
-        } else if (game.state == STATE_MESSAGE) {
-          game.state = game.next_state;
-          if (game.state == STATE_ENEMY_SELECT) pick_random_enemies(&game);
-          if (game.state == STATE_CAMPFIRE) {
-            if (game.pending_levelup) {
-              game.hero.leveling += 1;
-              game.hero.dungeon_part_number += 1;
-              game.pending_levelup = 0;
-            }
-            logbuffer_clear(&game.log);
-            hero_rest(&game.hero, &game.log);
-          }
-          game.message_art_name[0] = '\0';
-          game.message_art_path[0] = '\0';
-          dirty = true;
+        if (key == SDLK_F3) {
+          prof.overlay = !prof.overlay;
+          needs_redraw = true;
+          continue;
         }
+        if (static_mode) continue;
+        replay_record(&record, frame, game.state, REPLAY_KEY, (int)key, NULL);
+        bool quit = false;
+        if (game_handle_key(&game, key, &quit)) dirty = true;
+        if (quit) running = false;
       }
       if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
         win_w = e.window.data1;
@@ -7589,6 +12295,7 @@ int main(int argc, char **argv) {
         glLoadIdentity();
       }
     }
+    prof_leave();
 
     if (!static_mode) {
       bool want_text = (game.state == STATE_NAME_INPUT) ||
@@ -7604,43 +12311,18 @@ int main(int argc, char **argv) {
 
     if (!static_mode) {
       uint32_t now_anim = SDL_GetTicks();
+      GameState before = game.state;
       if (battle_anim_tick(&game, now_anim)) {
+        replay_record(&record, frame, before, REPLAY_TICK, 0, NULL);
         dirty = true;
       }
     }
 
     if (!static_mode && dirty) {
-      ArtArg *arts = NULL;
-      size_t art_count = 0;
-      char *menu_path = NULL;
-      if (game_build_screen(&game, version, &menu, &main_map, &hero_map, enemy_maps, &arts, &art_count, &menu_path)) {
-        free_menu(&menu);
-        menu_load(menu_path, &menu);
-        ValueMap *partial_maps[3] = {0};
-        size_t partial_count = 0;
-
-        if (game.state == STATE_BATTLE) {
-          partial_maps[0] = &hero_map;
-          partial_maps[1] = &enemy_map1;
-          partial_count = 2;
-        } else if (game.state == STATE_ENEMY_SELECT) {
-          for (int i = 0; i < game.enemy_choice_count; ++i) partial_maps[i] = enemy_maps[i];
-          partial_count = (size_t)game.enemy_choice_count;
-        } else if (game.state == STATE_EVENT_SELECT) {
-          for (int i = 0; i < game.event_choice_count; ++i) partial_maps[i] = enemy_maps[i];
-          partial_count = (size_t)game.event_choice_count;
-        } else if (game.state == STATE_LOOT) {
-          partial_maps[0] = &hero_map;
-          partial_maps[1] = &enemy_map1;
-          partial_count = 2;
-        } else if (game.state == STATE_HERO_INFO || game.state == STATE_SPEND_STAT || game.state == STATE_SPEND_SKILL || game.state == STATE_LOAD_CONFIRM) {
-          partial_maps[0] = &hero_map;
-          partial_maps[1] = &hero_map;
-          partial_count = 2;
-        }
-
-        compose_menu(&menu, &main_map, partial_maps, partial_count, arts, art_count);
-        build_atlas(&menu, font, cell_w, cell_h, &rs);
+      if (game_compose_screen(&game, version, &menu, &main_map, &hero_map, enemy_maps, &composer)) {
+        prof_enter(PROF_QUADS);
+        render_update_menu(&rs, &menu, &composer);
+        prof_leave();
         {
           const int speeds[] = {100, 400, 700, 1000, 1500};
           int idx = game.anim_speed_index;
@@ -7668,15 +12350,16 @@ int main(int argc, char **argv) {
           typewriter_pos = 0;
         }
         game.force_instant_redraw = 0;
+        last_tick = SDL_GetTicks();
+        needs_redraw = true;
       }
-      free(menu_path);
-      free_art_args(arts, art_count);
       dirty = false;
     }
 
     uint32_t now = SDL_GetTicks();
     uint32_t dt = now - last_tick;
     last_tick = now;
+    if (transition_active || typewriter_active) needs_redraw = true;
     if (transition_active) {
       transition_alpha += (float)dt / (float)(fade_duration_ms > 0 ? fade_duration_ms : 200);
       if (transition_alpha >= 1.0f) {
@@ -7699,20 +12382,40 @@ int main(int argc, char **argv) {
         typewriter_active = false;
       }
     }
+    if (!needs_redraw) continue;
     int max_chars = typewriter_active ? typewriter_pos : -1;
-    draw_menu(&menu, &rs, win_w, win_h, cell_w, cell_h, transition_alpha, max_chars);
+    prof_enter(PROF_DRAW);
+    draw_menu(&rs, win_w, win_h, cell_w, cell_h, transition_alpha, max_chars);
+    if (prof.overlay) {
+      char overlay[PROF_ZONE_COUNT + 2][64];
+      int overlay_lines = prof_overlay_lines(overlay, PROF_ZONE_COUNT + 2);
+      draw_overlay_text(&rs, win_w, win_h, overlay, overlay_lines);
+    }
+    prof_leave();
+    prof_enter(PROF_SWAP);
     SDL_GL_SwapWindow(window);
-    SDL_Delay(16);
+    prof_leave();
+    prof_frame_end(static_mode ? -1 : (int)game.state);
+    last_frame = now;
+    needs_redraw = false;
   }
 
+  if (record) fclose(record);
+  if (profile_path) prof_write_csv(profile_path);
+  prof_free();
   render_state_free(&rs);
+  composer_reset(&composer);
   free_menu(&menu);
-  value_map_clear(&static_map);
-  value_map_clear(&main_map);
-  value_map_clear(&hero_map);
-  value_map_clear(&enemy_map1);
-  value_map_clear(&enemy_map2);
-  value_map_clear(&enemy_map3);
+  partial_layers_free();
+  asset_cache_free();
+  asset_index_free();
+  view_bundle_close();
+  value_map_free(&static_map);
+  value_map_free(&main_map);
+  value_map_free(&hero_map);
+  value_map_free(&enemy_map1);
+  value_map_free(&enemy_map2);
+  value_map_free(&enemy_map3);
   if (!static_mode) game_free(&game);
   free(version);
   free_art_args(static_arts, static_art_count);